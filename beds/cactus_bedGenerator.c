@@ -17,6 +17,8 @@
 #include "commonC.h"
 #include "hashTableC.h"
 #include "sonLibSortedSet.h"
+#include "cactusUtils.h"
+#include "cactusSnapshot.h"
 
 /*
  *Jul 4 2011: rewrite for better efficiency
@@ -29,7 +31,7 @@
  *Sep 08 2010: nknguyen@soe.ucsc.edu
  *Print to outputFile bed record of each chain of the interested/inputed species.
  */
-char *getCoor(char *header, int *start);
+char *getCoor(const char *header, int *start);
 int segmentCmp(const void *s1,const void *s2);
 //int segmentCmp(Segment *s1,Segment *s2);
 
@@ -42,17 +44,22 @@ struct Thread{
     stSortedSet *segments;
 };
 
-struct Thread *constructThread( char *header, char *chainName ){
+struct Thread *constructThread2( const char *header, char *chainName, int (*cmpFn)(const void *, const void *),
+        void (*destructElementFn)(void *) ){
     struct Thread *thread = st_malloc( sizeof(struct Thread) );
     thread->header = stString_copy( header );
     int i;
     thread->chr = stString_copy(getCoor(header, &i));
     thread->start = i;
     thread->chainName = stString_copy( chainName );
-    thread->segments = stSortedSet_construct3(segmentCmp, NULL);
+    thread->segments = stSortedSet_construct3(cmpFn, destructElementFn);
     return thread;
 }
 
+struct Thread *constructThread( const char *header, char *chainName ){
+    return constructThread2( header, chainName, segmentCmp, NULL );
+}
+
 void destructThread( struct Thread *thread ){
     stSortedSet_destruct(thread->segments);
     free( thread->header );
@@ -95,34 +102,7 @@ bool isLinked(End *end1, End *end2){
     return false;
 }
 
-char *formatSequenceHeader(Sequence *sequence) {
-    const char *sequenceHeader = sequence_getHeader(sequence);
-    if (strlen(sequenceHeader) > 0) {
-        char *cA = st_malloc(sizeof(char) * (1 + strlen(sequenceHeader)));
-        sscanf(sequenceHeader, "%s", cA);
-        return cA;
-    } else {
-        return cactusMisc_nameToString(sequence_getName(sequence));
-    }
-}
-
-Sequence *getSequenceMatchesHeader(Flower *flower, char *header){
-    //Returns the first Sequence whose name matches 'header'
-    Flower_SequenceIterator *it = flower_getSequenceIterator(flower);
-    Sequence *sequence = NULL;
-    while((sequence = flower_getNextSequence(it)) != NULL){
-        char *sequenceHeader = formatSequenceHeader(sequence);
-        if(strstr(sequenceHeader, header) != NULL){
-            free(sequenceHeader);
-            break;
-        }
-        free(sequenceHeader);
-    }
-    flower_destructSequenceIterator(it);
-    return sequence;
-}
-
-char *getCoor(char *header, int *start){
+char *getCoor(const char *header, int *start){
     char *chr;
     char *tok;
     *start = 0;
@@ -150,7 +130,7 @@ void block_getBED(Block *block, FILE *fileHandle, char *species, int level) {
     while((segment = block_getNext(instanceIterator)) != NULL) {
         Sequence *sequence = segment_getSequence(segment);
         if(sequence != NULL) {
-            char *sequenceHeader = formatSequenceHeader(sequence);
+            const char *sequenceHeader = getInternedSequenceHeader(sequence);
             Event *event = sequence_getEvent( sequence );
             char *eventHeader = stString_copy( event_getHeader( event ) );
             if(strcmp(eventHeader, species) == 0){
@@ -167,21 +147,27 @@ void block_getBED(Block *block, FILE *fileHandle, char *species, int level) {
                 int e = cap_getCoordinate(cap3) + start + 1 - 1;
                 fprintf(fileHandle, "%s %d %d %s.%d %d %s %d %d %d %d %d %d\n", chr, s, e, "NA", level, 0, ".", s, e, 0, 1, e-s,0);
             }
-            free(sequenceHeader);
         }
     }
     block_destructInstanceIterator(instanceIterator);
 }
 
-void removeSubSortedSet( stSortedSet *segments, Segment *segment){
+void removeSubSortedSet2( stSortedSet *segments, void *segment, void (*destructElementFn)(void *) ){
     st_logInfo("RemoveSubSortedSet...\n");
-    Segment *sm;
+    void *sm;
     while( ( sm = stSortedSet_searchLessThan(segments, segment) ) != NULL ){
         stSortedSet_remove(segments, sm);
+        if( destructElementFn != NULL ){
+            destructElementFn(sm);
+        }
     }
     return;
 }
 
+void removeSubSortedSet( stSortedSet *segments, Segment *segment){
+    removeSubSortedSet2( segments, segment, NULL );
+}
+
 void printThread( struct Thread *thread, FILE *fileHandle, int64_t level ){
     struct IntList *blockStarts = constructEmptyIntList(0);
     struct IntList *blockSizes = constructEmptyIntList(0);
@@ -254,7 +240,7 @@ void addSegments( struct List *threads, Block *block, char *header, char *chainN
     while( (segment = block_getNext(it)) != NULL ){
         Sequence *seq = segment_getSequence( segment );
         if(seq != NULL){
-            char *seqHeader = formatSequenceHeader( seq );
+            const char *seqHeader = getInternedSequenceHeader( seq );
             char *eventHeader = stString_copy( event_getHeader( sequence_getEvent(seq) ) );
             if( strcmp(eventHeader, header) == 0 ){
                 //st_logInfo("\t\tFound %s\n", seqHeader);
@@ -273,7 +259,6 @@ void addSegments( struct List *threads, Block *block, char *header, char *chainN
                 addSegmentToThread( thread, segment );
                 //st_logInfo("addSegmentToThread in %" PRIi64 " seconds/\n", time(NULL) - startTime);
             }
-            free(seqHeader);
             free(eventHeader);
         }
     }
@@ -347,7 +332,7 @@ void getBEDs(Flower *flower, FILE *fileHandle, char *species, int level){
     level ++;
     //if (level > 5){ return; } // ONLY PRINT OUT THE FIRST 5 LEVEL BEDs
     while( (group = flower_getNextGroup(groupIt) ) != NULL ){
-        Flower *nestedFlower = group_getNestedFlower( group );
+        Flower *nestedFlower = getNestedFlower( group );
         if( nestedFlower != NULL ){
             getBEDs(nestedFlower, fileHandle, species, level);
         }
@@ -356,6 +341,189 @@ void getBEDs(Flower *flower, FILE *fileHandle, char *species, int level){
 
 }
 
+/*
+ * The same BEDs, read from a snapshot written by cactus_snapshotExport rather than the database. Segments
+ * are indices of the snapshot's segments, and the threads hold them as (start, segment) stIntTuples.
+ */
+
+int64_t snapshotSegment_getPositiveStart(CactusSnapshot *snapshot, int64_t segment){
+    //The start of the segment on the + strand, where segment_getStart of a - strand segment is its highest coordinate
+    SnapshotSegment *record = &(snapshot->segments[segment]);
+    return record->strand ? record->start : record->start - snapshot->blocks[record->block].length + 1;
+}
+
+int64_t snapshotSegment_getPositiveEnd(CactusSnapshot *snapshot, int64_t segment, bool side5){
+    //The end of the 5' (or 3') cap of the segment on the + strand
+    SnapshotSegment *record = &(snapshot->segments[segment]);
+    return snapshot->caps[ record->strand == side5 ? record->cap5 : record->cap3 ].end;
+}
+
+int segmentFromSnapshotCmp(const void *sm1, const void *sm2){
+    //As segmentCmp, by the start only
+    int64_t start1 = stIntTuple_get((stIntTuple *) sm1, 0);
+    int64_t start2 = stIntTuple_get((stIntTuple *) sm2, 0);
+    if(start1 == start2) {
+        return 0;
+    }else if( start1 < start2){
+        return -1;
+    }else{
+        return 1;
+    }
+}
+
+bool isLinkedFromSnapshot(CactusSnapshot *snapshot, int64_t end1, int64_t end2){
+    //As isLinked: block ends are linked if they are the two ends of a link group
+    int64_t group = snapshot->ends[end1].group;
+    return end1 != end2 && group == snapshot->ends[end2].group && snapshot->groups[group].isLink;
+}
+
+void block_getBEDFromSnapshot(CactusSnapshot *snapshot, int64_t block, FILE *fileHandle, Name species, int level) {
+    stList *segments = cactusSnapshot_getBlockInstances(snapshot, block);
+    for(int64_t i = 0; i < stList_length(segments); i++){
+        int64_t segment = stIntTuple_get(stList_get(segments, i), 0);
+        int64_t sequence = snapshot->segments[segment].sequence;
+        if(sequence != -1 && snapshot->sequences[sequence].event == species){
+            int start;
+            char *chr = getCoor( cactusSnapshot_getSequenceHeader(snapshot, sequence), &start );
+            int64_t positiveStart = snapshotSegment_getPositiveStart(snapshot, segment);
+            int s = positiveStart + start - 1;
+            int e = positiveStart + snapshot->blocks[block].length - 1 + start + 1 - 1;
+            fprintf(fileHandle, "%s %d %d %s.%d %d %s %d %d %d %d %d %d\n", chr, s, e, "NA", level, 0, ".", s, e, 0, 1, e-s,0);
+        }
+    }
+    stList_destruct(segments);
+}
+
+void printThreadFromSnapshot( CactusSnapshot *snapshot, struct Thread *thread, FILE *fileHandle, int64_t level ){
+    struct IntList *blockStarts = constructEmptyIntList(0);
+    struct IntList *blockSizes = constructEmptyIntList(0);
+
+    int64_t prevOtherEnd = -1;
+
+    stSortedSetIterator *it = stSortedSet_getIterator(thread->segments);
+    stIntTuple *sm;
+
+    while( (sm = stSortedSet_getNext(it)) != NULL ){
+        int64_t segment = stIntTuple_get(sm, 1);
+        if( prevOtherEnd == -1 || isLinkedFromSnapshot( snapshot, prevOtherEnd, snapshotSegment_getPositiveEnd(snapshot, segment, 1) ) ){
+            intListAppend(blockStarts, stIntTuple_get(sm, 0));
+            intListAppend(blockSizes, snapshot->blocks[snapshot->segments[segment].block].length);
+        }else{
+            break;
+        }
+        prevOtherEnd = snapshotSegment_getPositiveEnd(snapshot, segment, 0);
+    }
+    stSortedSet_destructIterator(it);
+
+    if (sm != NULL){
+        //Start new bed record. Remove all the previous Segments first:
+        removeSubSortedSet2(thread->segments, sm, (void (*)(void *)) stIntTuple_destruct);
+        fprintf(fileHandle, "SPLIT TO A NEW BED RECORD!\n");
+        printThreadFromSnapshot( snapshot, thread, fileHandle, level );
+    }
+
+    int64_t blockCount = blockStarts->length;
+    if( blockCount == 0 ){
+        return;
+    }
+
+    int64_t chromStart = blockStarts->list[0] + thread->start -1;
+    int64_t chromEnd = blockStarts->list[blockCount -1] + blockSizes->list[blockCount -1] + thread->start -1;
+
+    fprintf(fileHandle, "%s %" PRIi64 " %" PRIi64 " %s.%" PRIi64 " %" PRIi64 " %s %" PRIi64 " %" PRIi64 " %s %" PRIi64 " ", thread->chr, chromStart, chromEnd,
+                         thread->chainName, level, (int64_t)0, ".", chromStart, chromEnd, "0", blockCount);
+
+    //Print blockSizes
+    int64_t i;
+    for(i=0; i< blockCount; i++){
+        fprintf(fileHandle, "%" PRIi64 ",", blockSizes->list[i] );
+    }
+    destructIntList(blockSizes);
+    fprintf(fileHandle, " ");
+    for(i=0; i< blockCount; i++){
+        fprintf(fileHandle, "%" PRIi64 ",", blockStarts->list[i] - blockStarts->list[0] );
+    }
+    destructIntList(blockStarts);
+    fprintf(fileHandle, "\n");
+    return;
+}
+
+void addSegmentsFromSnapshot( CactusSnapshot *snapshot, struct List *threads, int64_t block, Name species, char *chainName ){
+    struct Thread *thread = NULL;
+    stList *segments = cactusSnapshot_getBlockInstances(snapshot, block);
+    for(int64_t j = 0; j < stList_length(segments); j++){
+        int64_t segment = stIntTuple_get(stList_get(segments, j), 0);
+        int64_t sequence = snapshot->segments[segment].sequence;
+        if(sequence != -1 && snapshot->sequences[sequence].event == species){
+            const char *seqHeader = cactusSnapshot_getSequenceHeader(snapshot, sequence);
+            int64_t i;
+            for(i = 0; i < threads->length; i++){
+                thread = threads->list[i];
+                if( strcmp(thread->header, seqHeader) == 0 ){
+                    break;
+                }
+            }
+            if( i == threads->length ){
+                thread = constructThread2( seqHeader, chainName, segmentFromSnapshotCmp, (void (*)(void *)) stIntTuple_destruct );
+                listAppend(threads, thread);
+            }
+            stSortedSet_insert(thread->segments, stIntTuple_construct2(snapshotSegment_getPositiveStart(snapshot, segment), segment));
+        }
+    }
+    stList_destruct(segments);
+}
+
+void chain_getBEDsFromSnapshot(CactusSnapshot *snapshot, int64_t chain, FILE *fileHandle, Name species, int level) {
+    SnapshotChain *record = &(snapshot->chains[chain]);
+    char *chainName = cactusMisc_nameToString(record->name);
+
+    //Get all the threads with event 'species'
+    struct List * threads = constructEmptyList(0, free);
+    for( int64_t i = 0; i< record->blockNumber; i++ ){
+        addSegmentsFromSnapshot( snapshot, threads, snapshot->chainBlocks[record->firstBlock + i], species, chainName );
+    }
+
+    //Print the beds:
+    for( int64_t i = 0; i< threads->length; i++ ){
+        struct Thread *thread = threads->list[i];
+        printThreadFromSnapshot( snapshot, thread, fileHandle, level );
+        destructThread(thread);
+    }
+
+    free(threads->list);
+    free(threads);
+    free(chainName);
+}
+
+void getBEDsFromSnapshot(CactusSnapshot *snapshot, int64_t flower, FILE *fileHandle, Name species, int level){
+    SnapshotFlower *record = &(snapshot->flowers[flower]);
+
+    //Get beds for chains at current level
+    bool *isChainBlock = st_calloc(record->blockNumber + 1, sizeof(bool));
+    for( int64_t i = record->firstChain; i < record->firstChain + record->chainNumber; i++ ){
+        chain_getBEDsFromSnapshot(snapshot, i, fileHandle, species, level);
+        for( int64_t j = 0; j < snapshot->chains[i].blockNumber; j++ ){
+            isChainBlock[ snapshot->chainBlocks[snapshot->chains[i].firstBlock + j] - record->firstBlock ] = 1;
+        }
+    }
+
+    //Get beds for non-trivial chains:
+    for( int64_t i = 0; i < record->blockNumber; i++ ){
+        if( !isChainBlock[i] ){
+            block_getBEDFromSnapshot(snapshot, record->firstBlock + i, fileHandle, species, level);
+        }
+    }
+    free(isChainBlock);
+
+    //Call child flowers recursively
+    level ++;
+    for( int64_t i = record->firstGroup; i < record->firstGroup + record->groupNumber; i++ ){
+        if( snapshot->groups[i].nestedFlower != -1 ){
+            getBEDsFromSnapshot(snapshot, snapshot->groups[i].nestedFlower, fileHandle, species, level);
+        }
+    }
+}
+
 void usage() {
     fprintf(stderr, "cactus_bedGenerator, version 0.2\n");
     fprintf(stderr, "Prints to output file all segments of the target sequence that are in blocks that contain both query & target\n");
@@ -365,6 +533,8 @@ void usage() {
     fprintf(stderr, "-d --flowerName : The name of the flower (the key in the database)\n");
     fprintf(stderr, "-e --outputFile : The file to write the BEDs in.\n");
     fprintf(stderr, "-h --help : Print this help screen\n");
+    fprintf(stderr, "-p --prefetch : Load the whole flower subtree from the disk in batches up front\n");
+    fprintf(stderr, "-s --snapshot : Read the flowers from a snapshot written by cactus_snapshotExport, rather than the database.\n");
 }
 
 int main(int argc, char *argv[]) {
@@ -379,6 +549,8 @@ int main(int argc, char *argv[]) {
     char * flowerName = NULL;
     char * outputFile = NULL;
     char * species = NULL;
+    bool prefetch = 0;
+    char * snapshotFile = NULL;
 
     ///////////////////////////////////////////////////////////////////////////
     // (0) Parse the inputs handed by genomeCactus.py / setup stuff.
@@ -392,12 +564,14 @@ int main(int argc, char *argv[]) {
             { "flowerName", required_argument, 0, 'd' },
             { "outputFile", required_argument, 0, 'e' },
             { "help", no_argument, 0, 'h' },
+            { "prefetch", no_argument, 0, 'p' },
+            { "snapshot", required_argument, 0, 's' },
             { 0, 0, 0, 0 }
         };
 
         int option_index = 0;
 
-        int key = getopt_long(argc, argv, "a:b:c:d:e:h", long_options, &option_index);
+        int key = getopt_long(argc, argv, "a:b:c:d:e:hps:", long_options, &option_index);
 
         if(key == -1) {
             break;
@@ -422,6 +596,12 @@ int main(int argc, char *argv[]) {
             case 'h':
                 usage();
                 return 0;
+            case 'p':
+                prefetch = 1;
+                break;
+            case 's':
+                snapshotFile = stString_copy(optarg);
+                break;
             default:
                 usage();
                 return 1;
@@ -432,8 +612,8 @@ int main(int argc, char *argv[]) {
     // (0) Check the inputs.
     ///////////////////////////////////////////////////////////////////////////
 
-    assert(cactusDiskDatabaseString != NULL);
-    assert(flowerName != NULL);
+    assert(cactusDiskDatabaseString != NULL || snapshotFile != NULL);
+    assert(flowerName != NULL || snapshotFile != NULL);
     assert(outputFile != NULL);
     assert(species != NULL);
 
@@ -451,6 +631,30 @@ int main(int argc, char *argv[]) {
     st_logInfo("Output BED file : %s\n", outputFile);
     st_logInfo("Species: %s\n", species);
 
+    //////////////////////////////////////////////
+    //Read the flowers from a snapshot, without the database
+    //////////////////////////////////////////////
+
+    if(snapshotFile != NULL){
+        st_logInfo("Snapshot file : %s\n", snapshotFile);
+        int64_t startTime = time(NULL);
+        CactusSnapshot *snapshot = cactusSnapshot_open(snapshotFile);
+        FILE *fileHandle = fopen(outputFile, "w");
+        if(strstr(species, "reference") != NULL){
+            stList *referenceSequences = cactusSnapshot_getSequencesMatchingHeader(snapshot, "reference", 0);
+            if(stList_length(referenceSequences) == 0){
+                fprintf(stderr, "No reference sequence found in the snapshot\n");
+                exit(EXIT_FAILURE);
+            }
+            stList_destruct(referenceSequences);
+        }
+        getBEDsFromSnapshot(snapshot, 0, fileHandle, cactusSnapshot_getEventByHeader(snapshot, species), 0);
+        fclose(fileHandle);
+        cactusSnapshot_close(snapshot);
+        st_logInfo("Got the beds from the snapshot in %" PRIi64 " seconds/\n", time(NULL) - startTime);
+        return 0;
+    }
+
     //////////////////////////////////////////////
     //Load the database
     //////////////////////////////////////////////
@@ -463,8 +667,11 @@ int main(int argc, char *argv[]) {
     // Parse the basic reconstruction problem
     ///////////////////////////////////////////////////////////////////////////
 
-    flower = cactusDisk_getFlower(cactusDisk, cactusMisc_stringToName(flowerName));
+    flower = getFlower(cactusDisk, cactusMisc_stringToName(flowerName));
     st_logInfo("Parsed the top level flower of the cactus tree to check\n");
+    if(prefetch){
+        prefetchFlowerSubtree(flower, PREFETCH_BATCH_SIZE);
+    }
 
     ///////////////////////////////////////////////////////////////////////////
     // Recursive check the flowers.
@@ -481,6 +688,7 @@ int main(int argc, char *argv[]) {
     getBEDs(flower, fileHandle, species, 0);
     fclose(fileHandle);
     st_logInfo("Got the beds in %" PRIi64 " seconds/\n", time(NULL) - startTime);
+    logLoadedFlowerNumber();
 
     ///////////////////////////////////////////////////////////////////////////
     // Clean up.
@@ -11,6 +11,7 @@
 #include "commonC.h"
 #include "hashTableC.h"
 #include "sonLibSortedSet.h"
+#include "cactusUtils.h"
 //#include "cactus_addReferenceSeq.h"
 
 /*
@@ -21,7 +22,7 @@
  *
  */
 
-char *getCoor(char *header, int64_t  *start, int64_t *chrsize);
+char *getCoor(const char *header, int64_t  *start, int64_t *chrsize);
 int segmentCmp(const void *s1,const void *s2);
 //int segmentCmp(Segment *s1,Segment *s2);
 
@@ -32,7 +33,7 @@ struct Thread{
     stSortedSet *segments;
 };
 
-struct Thread *constructThread( char *header ){
+struct Thread *constructThread( const char *header ){
     struct Thread *thread = st_malloc( sizeof(struct Thread) );
     thread->header = stString_copy( header );
     int64_t chrsize = 0;
@@ -67,18 +68,6 @@ int segmentCmp(const void *sm1, const void *sm2){
     }
 }
 
-char *formatSequenceHeader(Sequence *sequence) {
-    const char *sequenceHeader = sequence_getHeader(sequence);
-    if(strlen(sequenceHeader) > 0) {
-        char *cA = st_malloc(sizeof(char) *(1 + strlen(sequenceHeader)));
-        sscanf(sequenceHeader, "%s", cA);
-        return cA;
-    }
-    else {
-        return cactusMisc_nameToString(sequence_getName(sequence));
-    }
-}
-
 bool isLinked(End *end1, End *end2){
     //Return true if there is a link between end1 and end2, otherwise return false
     Link *link = group_getLink(end_getGroup(end1));
@@ -100,7 +89,7 @@ Cap *end_getCapBySeqName(End *end, char *name){
     while( (cap = end_getNext(it)) != NULL ){
         Sequence *sequence = cap_getSequence(cap);
         if(sequence == NULL){continue;}
-        char *sequenceHeader = formatSequenceHeader(sequence);
+        const char *sequenceHeader = getInternedSequenceHeader(sequence);
         st_logInfo("%s\t%" PRIi64 "\n", sequenceHeader, cap_getCoordinate(cap));
         if(strstr(sequenceHeader, name) != NULL){//cap matched with name
             break;
@@ -155,7 +144,7 @@ char *cap_getChr(Cap *cap){
     char *chr;
     Sequence *sequence = cap_getSequence(cap);
     if(sequence == NULL){return NULL;}
-    char *seqname = formatSequenceHeader(sequence);
+    const char *seqname = getInternedSequenceHeader(sequence);
     char sep[] = ".";
     
     strtok(stString_copy(seqname), sep); //query e.g "panTro2"
@@ -172,7 +161,7 @@ int64_t convertCoor(int64_t coor, int64_t chrsize, int64_t offset, int64_t fragm
     return coor;
 }
 
-char *getCoor(char *header, int64_t  *start, int64_t *chrsize){
+char *getCoor(const char *header, int64_t  *start, int64_t *chrsize){
     char *chr;
     char *tok;
     *start = 0;
@@ -201,7 +190,7 @@ int block_getCHAIN(Block *block, FILE *fileHandle, char *query, char *target, in
     while((segment = block_getNext(instanceIterator)) != NULL) {
         Sequence *sequence = segment_getSequence(segment);
         if(sequence != NULL) {
-            char *sequenceHeader = formatSequenceHeader(sequence);
+            const char *sequenceHeader = getInternedSequenceHeader(sequence);
             Event *event = sequence_getEvent( sequence );
             char *eventHeader = stString_copy( event_getHeader( event ) ); 
             if(strcmp(eventHeader, query) == 0){
@@ -240,7 +229,6 @@ int block_getCHAIN(Block *block, FILE *fileHandle, char *query, char *target, in
                 chainid ++;
                 fprintf(fileHandle, "%" PRIi64 "\n\n", segment_getLength(segment));
             }
-            free(sequenceHeader);
         }
     }
     block_destructInstanceIterator(instanceIterator);
@@ -395,7 +383,7 @@ void addSegments(struct List *threads, Block *block, char *query, char *target){
     while( (segment = block_getNext(it)) != NULL ){
         Sequence *seq = segment_getSequence( segment );
         if(seq != NULL){
-            char *seqHeader = formatSequenceHeader( seq );
+            const char *seqHeader = getInternedSequenceHeader( seq );
             char *eventHeader = stString_copy( event_getHeader( sequence_getEvent(seq) ) );
             if( strcmp(eventHeader, query) == 0 ){
                 int64_t i;
@@ -411,7 +399,6 @@ void addSegments(struct List *threads, Block *block, char *query, char *target){
                 }
                 addSegmentToThread( thread, segment );
             }
-            free(seqHeader);
             free(eventHeader);
         }
     }
@@ -440,20 +427,6 @@ int64_t chain_getCHAINs(Chain *chain, FILE *fileHandle, char *query, char *targe
     return chainid;
 }
 
-int64_t getSeqLength(Flower *flower, char *header){
-    Flower_SequenceIterator *it = flower_getSequenceIterator(flower);
-    Sequence *sequence;
-    while((sequence = flower_getNextSequence(it)) != NULL){
-        char *sequenceHeader = formatSequenceHeader(sequence);
-        if(strcmp(sequenceHeader, header) == 0){
-            flower_destructSequenceIterator(it);
-            return sequence_getLength(sequence);
-        }
-    }
-    flower_destructSequenceIterator(it);
-    return 0;
-}
-
 int getCHAINs(Flower *flower, FILE *fileHandle, char *query, char *target, int64_t chainid){
     Chain *chain;
     int64_t startTime;
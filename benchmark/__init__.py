@@ -0,0 +1,5 @@
+#!/usr/bin/env python
+
+#Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+#
+#Released under the MIT license, see LICENSE.txt
@@ -0,0 +1,130 @@
+#!/usr/bin/env python
+
+#Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+#
+#Released under the MIT license, see LICENSE.txt
+"""Times the cactus tools on a synthetic cactus disk, reporting for each tool the run time,
+bases per second, peak resident set size and the number of flowers it loaded, as logged by the
+tool. The number of flowers in the whole cactus tree, as exported by cactus_snapshotExport, is
+given in the report header.
+
+The peak resident set size is that of the largest single process of a tool, as given by wait4,
+so with more than one worker the workers' memory is not summed.
+"""
+
+import os
+import re
+import sys
+import time
+import random
+import subprocess
+from optparse import OptionParser
+
+from sonLib.bioio import logger
+from sonLib.bioio import system
+from sonLib.bioio import getTempDirectory
+from sonLib.bioio import setLogLevel
+
+import cactus.shared.test
+
+from cactusTools.benchmark.cactus_benchmarkInputs import makeBenchmarkInputs
+from cactusTools.benchmark.cactus_benchmarkInputs import addBenchmarkInputOptions
+
+def getToolCommands(cactusDiskDatabaseString, outputDir, geneFile, workerNumber, prefetch):
+    """The command line of each tool benchmarked, in the order they are run.
+    """
+    extraOptions = "--workerNumber %i" % workerNumber
+    if prefetch:
+        extraOptions += " --prefetch"
+    return [ ("cactus_MAFGenerator", "cactus_MAFGenerator --cactusDisk '%s' --flowerName 0 --outputFile %s --logLevel INFO %s" % \
+                  (cactusDiskDatabaseString, os.path.join(outputDir, "benchmark.maf"), extraOptions)),
+             ("cactus_treeStats", "cactus_treeStats --cactusDisk '%s' --flowerName 0 --outputFile %s --logLevel INFO %s" % \
+                  (cactusDiskDatabaseString, os.path.join(outputDir, "benchmark.xml"), extraOptions)),
+             ("cactus_bedGenerator", "cactus_bedGenerator --cactusDisk '%s' --flowerName 0 --species genome0 --outputFile %s --logLevel INFO" % \
+                  (cactusDiskDatabaseString, os.path.join(outputDir, "benchmark.bed"))),
+             ("cactus_pslGenerator", "cactus_pslGenerator --cactusDisk '%s' --query genome0.chr0 --target genome1.chr0 --outputFile %s --logLevel INFO" % \
+                  (cactusDiskDatabaseString, os.path.join(outputDir, "benchmark.psl"))),
+             ("cactus_genemapHomolog", "cactus_genemapHomolog --cactusDisk '%s' --species genome0 --genePslFile %s --outputFile %s --st_logLevel INFO" % \
+                  (cactusDiskDatabaseString, geneFile, os.path.join(outputDir, "benchmarkGenemap.xml"))) ]
+
+def runTimed(command, logFile):
+    """Runs the command, returning its wall clock time in seconds, the peak resident set size in kilobytes
+    of its largest process, which for a tool forking workers is not their total, and the number of flowers
+    it logged loading, or None if it logged none. The log is written to logFile rather than piped, so a
+    long log can not block the tool while it is timed.
+    """
+    logFileHandle = open(logFile, "w")
+    startTime = time.time()
+    process = subprocess.Popen(command, shell=True, stderr=logFileHandle)
+    pid, status, resourceUsage = os.wait4(process.pid, 0)
+    seconds = time.time() - startTime
+    logFileHandle.close()
+    if status != 0:
+        raise RuntimeError("The command %s exited with status %i" % (command, status))
+    match = re.search("Loaded ([0-9]+) flowers", open(logFile).read())
+    return seconds, resourceUsage.ru_maxrss, int(match.group(1)) if match != None else None
+
+def getFlowerNumber(cactusDiskDatabaseString, outputDir):
+    """Gets the number of flowers in the cactus tree, from the log of exporting it to a snapshot.
+    """
+    snapshotFile = os.path.join(outputDir, "benchmark.snapshot")
+    process = subprocess.Popen("cactus_snapshotExport --cactusDisk '%s' --flowerName 0 --outputFile %s --logLevel INFO" % \
+                               (cactusDiskDatabaseString, snapshotFile), shell=True, stderr=subprocess.PIPE)
+    log = process.communicate()[1]
+    os.remove(snapshotFile)
+    match = re.search("Wrote a snapshot of ([0-9]+) flowers", log)
+    if match == None:
+        return None
+    return int(match.group(1))
+
+def benchmark(options, outputFileHandle):
+    tempDir = getTempDirectory(".")
+    sequenceFiles, newickTreeString, geneFile, baseNumber = makeBenchmarkInputs(tempDir, options.genomeNumber,
+                        options.chromosomeNumber, options.chromosomeLength, options.nestingDepth,
+                        options.duplicationRate, geneNumber=options.geneNumber)
+    outputDir = getTempDirectory(tempDir)
+    experiment = cactus.shared.test.runWorkflow_TestScript(sequenceFiles, newickTreeString,
+                           outputDir=outputDir, batchSystem=options.batchSystem,
+                           buildAvgs=True, buildReference=True)
+    cactusDiskDatabaseString = experiment.getDatabaseString()
+    flowerNumber = getFlowerNumber(cactusDiskDatabaseString, outputDir)
+
+    outputFileHandle.write("#genomes=%i chromosomes=%i chromosomeLength=%i nestingDepth=%i duplicationRate=%s bases=%i flowers=%s workerNumber=%i\n" % \
+                           (options.genomeNumber, options.chromosomeNumber, options.chromosomeLength, options.nestingDepth,
+                            options.duplicationRate, baseNumber, flowerNumber, options.workerNumber))
+    outputFileHandle.write("#peakRssKb is that of the largest process of a tool, not summed over its workers\n")
+    outputFileHandle.write("#tool\tseconds\tbasesPerSecond\tpeakRssKb\tflowersLoaded\n")
+    for toolName, command in getToolCommands(cactusDiskDatabaseString, outputDir, geneFile,
+                                             options.workerNumber, options.prefetch):
+        if options.tools != None and toolName not in options.tools.split(","):
+            continue
+        seconds, peakRss, flowersLoaded = runTimed(command, os.path.join(outputDir, "%s.log" % toolName))
+        outputFileHandle.write("%s\t%.3f\t%.1f\t%i\t%s\n" % (toolName, seconds, baseNumber / max(seconds, 0.001), peakRss, flowersLoaded))
+        outputFileHandle.flush()
+        logger.info("Benchmarked %s in %.3f seconds" % (toolName, seconds))
+
+    experiment.cleanupDatabase()
+    system("rm -rf %s" % tempDir)
+
+def main():
+    usg = "Usage: %prog [options]\n"
+    parser = OptionParser(usage=usg)
+    addBenchmarkInputOptions(parser)
+    parser.add_option("--tools", dest="tools", help="Comma separated list of the tools to run. Default: all", default=None)
+    parser.add_option("--workerNumber", dest="workerNumber", type="int", help="Worker number for the MAF and stats tools. Default: 1", default=1)
+    parser.add_option("--prefetch", dest="prefetch", action="store_true", help="Prefetch the cactus tree in the MAF and stats tools", default=False)
+    parser.add_option("--batchSystem", dest="batchSystem", help="Batch system to build the cactus disk with. Default: single_machine", default="single_machine")
+    parser.add_option("--outputFile", dest="outputFile", help="File to write the report to. Default: stdout", default=None)
+    parser.add_option("--logLevel", dest="logLevel", help="Log level. Default: CRITICAL", default="CRITICAL")
+    (options, args) = parser.parse_args()
+    setLogLevel(options.logLevel)
+    random.seed(options.seed)
+    outputFileHandle = sys.stdout
+    if options.outputFile != None:
+        outputFileHandle = open(options.outputFile, "w")
+    benchmark(options, outputFileHandle)
+    if options.outputFile != None:
+        outputFileHandle.close()
+
+if __name__ == "__main__":
+    main()
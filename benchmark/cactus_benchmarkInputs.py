@@ -0,0 +1,128 @@
+#!/usr/bin/env python
+
+#Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+#
+#Released under the MIT license, see LICENSE.txt
+"""Makes synthetic genomes of a configurable size for benchmarking the cactus tools.
+
+An ancestral set of chromosomes is mutated into each genome. Duplications copy random
+stretches of a chromosome into random positions, at the given rate per base. Nesting depth
+is approximated by nested inversions, each falling inside the previous one, as every level
+of rearrangement nests the flowers of the resulting cactus tree one level deeper.
+"""
+
+import os
+import random
+from optparse import OptionParser
+
+from sonLib.bioio import logger
+from sonLib.bioio import getRandomSequence
+from sonLib.bioio import mutateSequence
+from sonLib.bioio import reverseComplement
+from sonLib.bioio import fastaWrite
+
+def duplicate(sequence, duplicationRate, maxLength=1000):
+    """Copies random stretches of the sequence to random positions, until about
+    duplicationRate * len(sequence) bases have been duplicated.
+    """
+    duplicatedBases = int(duplicationRate * len(sequence))
+    while duplicatedBases > 0 and len(sequence) > 1:
+        length = min(random.randint(1, maxLength), duplicatedBases, len(sequence) - 1)
+        start = random.randint(0, len(sequence) - length)
+        insertion = random.randint(0, len(sequence))
+        sequence = sequence[:insertion] + sequence[start:start+length] + sequence[insertion:]
+        duplicatedBases -= length
+    return sequence
+
+def invertNested(sequence, nestingDepth):
+    """Inverts nestingDepth nested intervals of the sequence, each inside the last.
+    """
+    start, end = 0, len(sequence)
+    for i in xrange(nestingDepth):
+        if end - start < 4:
+            break
+        start = random.randint(start, start + (end - start)/4)
+        end = random.randint(end - (end - start)/4, end)
+        sequence = sequence[:start] + reverseComplement(sequence[start:end]) + sequence[end:]
+    return sequence
+
+def makeNewickTree(genomeNames, branchLength):
+    """A caterpillar tree of the genomes.
+    """
+    tree = "%s:%s" % (genomeNames[0], branchLength)
+    for genomeName in genomeNames[1:]:
+        tree = "(%s,%s:%s):%s" % (tree, genomeName, branchLength, branchLength)
+    return tree + ";"
+
+def makeGeneBeds(chromosomes, genomeName, geneNumber, exonNumber=3, exonLength=100, intronLength=200):
+    """Makes BED12 gene models on the first genome's chromosomes, for cactus_genemapHomolog.
+    """
+    genes = []
+    geneLength = exonNumber * exonLength + (exonNumber - 1) * intronLength
+    for i in xrange(geneNumber):
+        chromosomeIndex = random.randint(0, len(chromosomes) - 1)
+        chromosomeLength = len(chromosomes[chromosomeIndex])
+        if chromosomeLength <= geneLength:
+            continue
+        start = random.randint(0, chromosomeLength - geneLength)
+        blockSizes = ",".join([ str(exonLength) ] * exonNumber)
+        blockStarts = ",".join([ str(j * (exonLength + intronLength)) for j in xrange(exonNumber) ])
+        genes.append("%s.chr%i\t%i\t%i\tgene%i\t0\t+\t%i\t%i\t0\t%i\t%s,\t%s,\n" % \
+                     (genomeName, chromosomeIndex, start, start + geneLength, i, start, start + geneLength,
+                      exonNumber, blockSizes, blockStarts))
+    return genes
+
+def makeBenchmarkInputs(outputDir, genomeNumber=4, chromosomeNumber=2, chromosomeLength=10000,
+                        nestingDepth=2, duplicationRate=0.01, branchLength=0.05, geneNumber=10):
+    """Writes a fasta file per genome, and a gene BED file for the first genome, to outputDir.
+    Returns the fasta files, the newick tree of the genomes, the gene file and the total number of bases.
+    """
+    ancestralChromosomes = [ getRandomSequence(chromosomeLength)[1] for i in xrange(chromosomeNumber) ]
+    genomeNames = [ "genome%i" % i for i in xrange(genomeNumber) ]
+    sequenceFiles = []
+    baseNumber = 0
+    firstChromosomes = None
+    for genomeName in genomeNames:
+        chromosomes = [ invertNested(duplicate(mutateSequence(chromosome, branchLength), duplicationRate), nestingDepth) \
+                        for chromosome in ancestralChromosomes ]
+        if firstChromosomes == None:
+            firstChromosomes = chromosomes
+        sequenceFile = os.path.join(outputDir, "%s.fa" % genomeName)
+        fileHandle = open(sequenceFile, "w")
+        for i in xrange(len(chromosomes)):
+            fastaWrite(fileHandle, "%s.chr%i" % (genomeName, i), chromosomes[i])
+            baseNumber += len(chromosomes[i])
+        fileHandle.close()
+        sequenceFiles.append(sequenceFile)
+    geneFile = os.path.join(outputDir, "genes.bed")
+    fileHandle = open(geneFile, "w")
+    fileHandle.writelines(makeGeneBeds(firstChromosomes, genomeNames[0], geneNumber))
+    fileHandle.close()
+    logger.info("Made %i genomes of %i bases in total in %s" % (genomeNumber, baseNumber, outputDir))
+    return sequenceFiles, makeNewickTree(genomeNames, branchLength), geneFile, baseNumber
+
+def addBenchmarkInputOptions(parser):
+    parser.add_option("--genomeNumber", dest="genomeNumber", type="int", help="Number of genomes. Default: 4", default=4)
+    parser.add_option("--chromosomeNumber", dest="chromosomeNumber", type="int", help="Number of chromosomes per genome. Default: 2", default=2)
+    parser.add_option("--chromosomeLength", dest="chromosomeLength", type="int", help="Length of the ancestral chromosomes. Default: 10000", default=10000)
+    parser.add_option("--nestingDepth", dest="nestingDepth", type="int", help="Number of nested inversions per chromosome. Default: 2", default=2)
+    parser.add_option("--duplicationRate", dest="duplicationRate", type="float", help="Fraction of each chromosome duplicated. Default: 0.01", default=0.01)
+    parser.add_option("--geneNumber", dest="geneNumber", type="int", help="Number of gene models on the first genome. Default: 10", default=10)
+    parser.add_option("--seed", dest="seed", type="int", help="Random seed, so runs can be repeated. Default: 0", default=0)
+
+def main():
+    usg = "Usage: %prog [options] outputDir\n"
+    parser = OptionParser(usage=usg)
+    addBenchmarkInputOptions(parser)
+    (options, args) = parser.parse_args()
+    assert len(args) == 1
+    random.seed(options.seed)
+    sequenceFiles, newickTreeString, geneFile, baseNumber = makeBenchmarkInputs(args[0], options.genomeNumber,
+                        options.chromosomeNumber, options.chromosomeLength, options.nestingDepth,
+                        options.duplicationRate, geneNumber=options.geneNumber)
+    fileHandle = open(os.path.join(args[0], "tree.newick"), "w")
+    fileHandle.write(newickTreeString + "\n")
+    fileHandle.close()
+
+if __name__ == "__main__":
+    main()
@@ -15,12 +15,35 @@
 #include "avl.h"
 #include "commonC.h"
 #include "hashTableC.h"
+#include "cactusUtils.h"
 
 ///////////////////////////////////////////////////////
 ///Common functions used by cactus utilities-scripts///
 ///////////////////////////////////////////////////////
 
-char *formatSequenceHeader(Sequence *sequence) {
+//Sequence Name -> InternedSequenceHeader, shared by all the flowers of the disk.
+static stHash *internedSequenceHeaders = NULL;
+
+typedef struct _internedSequenceHeader {
+    Name sequenceName; //The key, first so the entry can be hashed through its address
+    char *header;
+} InternedSequenceHeader;
+
+static uint64_t internedSequenceHeader_hashKey(const void *key) {
+    Name name = *((const Name *)key);
+    return (uint64_t)(name ^ (name >> 32));
+}
+
+static int internedSequenceHeader_equalKey(const void *key1, const void *key2) {
+    return *((const Name *)key1) == *((const Name *)key2);
+}
+
+static void internedSequenceHeader_destruct(InternedSequenceHeader *internedHeader) {
+    free(internedHeader->header);
+    free(internedHeader);
+}
+
+static char *formatSequenceHeaderP(Sequence *sequence) {
     const char *sequenceHeader = sequence_getHeader(sequence);
     if (strlen(sequenceHeader) > 0) {
         char *cA = st_malloc(sizeof(char) * (1 + strlen(sequenceHeader)));
@@ -31,21 +54,232 @@ char *formatSequenceHeader(Sequence *sequence) {
     }
 }
 
+const char *getInternedSequenceHeader(Sequence *sequence) {
+    if (internedSequenceHeaders == NULL) {
+        internedSequenceHeaders = stHash_construct3(internedSequenceHeader_hashKey,
+                internedSequenceHeader_equalKey, NULL, (void (*)(void *))internedSequenceHeader_destruct);
+    }
+    Name sequenceName = sequence_getName(sequence);
+    InternedSequenceHeader *internedHeader = stHash_search(internedSequenceHeaders, &sequenceName);
+    if (internedHeader == NULL) {
+        internedHeader = st_malloc(sizeof(InternedSequenceHeader));
+        internedHeader->sequenceName = sequenceName;
+        internedHeader->header = formatSequenceHeaderP(sequence);
+        stHash_insert(internedSequenceHeaders, &(internedHeader->sequenceName), internedHeader);
+    }
+    return internedHeader->header;
+}
+
+const char *cap_getInternedSequenceName(Cap *cap) {
+    Sequence *sequence = cap_getSequence(cap);
+    return sequence == NULL ? NULL : getInternedSequenceHeader(sequence);
+}
+
+void destructInternedSequenceHeaders(void) {
+    if (internedSequenceHeaders != NULL) {
+        stHash_destruct(internedSequenceHeaders);
+        internedSequenceHeaders = NULL;
+    }
+}
+
+char *formatSequenceHeader(Sequence *sequence) {
+    return stString_copy(getInternedSequenceHeader(sequence));
+}
+
+
+//Flower -> SequenceHeaderIndex, for the flowers whose header index has been built.
+static stHash *sequenceHeaderIndexes = NULL;
+
+typedef struct _sequenceHeaderIndexEntry {
+    const char *header; //Interned, see getInternedSequenceHeader
+    Name sequenceName;
+    int64_t length;
+} SequenceHeaderIndexEntry;
+
+typedef struct _sequenceHeaderSuffix {
+    const char *suffix; //Points into the interned header of the entry
+    int64_t entry;
+} SequenceHeaderSuffix;
+
+struct _sequenceHeaderIndex {
+    Flower *flower;
+    SequenceHeaderIndexEntry *entries; //In the order of the flower's sequence iterator
+    int64_t entryNumber;
+    stHash *headersToEntries;
+    SequenceHeaderSuffix *suffixes; //Suffix array of all the headers, for substring queries
+    int64_t suffixNumber;
+    SequenceHeaderSuffix *sortedHeaders; //The headers in sorted order, for prefix queries
+};
+
+static int sequenceHeaderSuffix_cmp(const void *a, const void *b){
+    const SequenceHeaderSuffix *suffix1 = a;
+    const SequenceHeaderSuffix *suffix2 = b;
+    int i = strcmp(suffix1->suffix, suffix2->suffix);
+    if(i != 0){
+        return i;
+    }
+    return suffix1->entry < suffix2->entry ? -1 : (suffix1->entry > suffix2->entry ? 1 : 0);
+}
+
+static int int64_cmp(const void *a, const void *b){
+    int64_t i = *((const int64_t *)a);
+    int64_t j = *((const int64_t *)b);
+    return i < j ? -1 : (i > j ? 1 : 0);
+}
+
+static void sequenceHeaderIndex_buildSuffixes(SequenceHeaderIndex *index){
+    /*
+     *The suffixes point straight into the interned headers, whose terminating null stops
+     *each comparison at the end of its header, so no concatenated text is needed.
+     */
+    index->suffixNumber = 0;
+    for(int64_t i=0; i < index->entryNumber; i++){
+        index->suffixNumber += strlen(index->entries[i].header);
+    }
+    index->suffixes = st_malloc(sizeof(SequenceHeaderSuffix) * (index->suffixNumber + 1));
+    index->sortedHeaders = st_malloc(sizeof(SequenceHeaderSuffix) * (index->entryNumber + 1));
+    int64_t j = 0;
+    for(int64_t i=0; i < index->entryNumber; i++){
+        const char *header = index->entries[i].header;
+        for(const char *cA = header; *cA != '\0'; cA++){
+            index->suffixes[j].suffix = cA;
+            index->suffixes[j++].entry = i;
+        }
+        index->sortedHeaders[i].suffix = header;
+        index->sortedHeaders[i].entry = i;
+    }
+    assert(j == index->suffixNumber);
+    qsort(index->suffixes, index->suffixNumber, sizeof(SequenceHeaderSuffix), sequenceHeaderSuffix_cmp);
+    qsort(index->sortedHeaders, index->entryNumber, sizeof(SequenceHeaderSuffix), sequenceHeaderSuffix_cmp);
+}
+
+static int64_t sequenceHeaderSuffixes_lowerBound(SequenceHeaderSuffix *suffixes, int64_t suffixNumber,
+        const char *pattern, int64_t patternLength, bool strictlyGreater){
+    /*
+     *Returns the first suffix whose first patternLength characters compare greater than
+     *(or equal to, if !strictlyGreater) the pattern.
+     */
+    int64_t min = 0, max = suffixNumber;
+    while(min < max){
+        int64_t mid = min + (max - min) / 2;
+        int i = strncmp(suffixes[mid].suffix, pattern, patternLength);
+        if(i < 0 || (strictlyGreater && i == 0)){
+            min = mid + 1;
+        }else{
+            max = mid;
+        }
+    }
+    return min;
+}
+
+static int64_t *sequenceHeaderIndex_getMatches(SequenceHeaderIndex *index, const char *pattern, bool prefixOnly,
+        int64_t *matchNumber){
+    /*
+     *Returns the indexes of the entries whose header contains (or starts with, if prefixOnly)
+     *the pattern, in increasing order and without duplicates.
+     */
+    SequenceHeaderSuffix *suffixes = prefixOnly ? index->sortedHeaders : index->suffixes;
+    int64_t suffixNumber = prefixOnly ? index->entryNumber : index->suffixNumber;
+    int64_t patternLength = strlen(pattern);
+    int64_t start = sequenceHeaderSuffixes_lowerBound(suffixes, suffixNumber, pattern, patternLength, 0);
+    int64_t end = sequenceHeaderSuffixes_lowerBound(suffixes, suffixNumber, pattern, patternLength, 1);
+    int64_t *matches = st_malloc(sizeof(int64_t) * (end - start + 1));
+    *matchNumber = 0;
+    for(int64_t i=start; i < end; i++){
+        matches[(*matchNumber)++] = suffixes[i].entry;
+    }
+    qsort(matches, *matchNumber, sizeof(int64_t), int64_cmp);
+    int64_t j = 0;
+    for(int64_t i=0; i < *matchNumber; i++){ //A header can contain the pattern more than once
+        if(j == 0 || matches[j-1] != matches[i]){
+            matches[j++] = matches[i];
+        }
+    }
+    *matchNumber = j;
+    return matches;
+}
+
+SequenceHeaderIndex *flower_buildSequenceHeaderIndex(Flower *flower){
+    /*
+     *Builds the header -> sequence index of 'flower', formatting each header once.
+     */
+    SequenceHeaderIndex *index;
+    if(sequenceHeaderIndexes == NULL){
+        sequenceHeaderIndexes = stHash_construct();
+    }else if((index = stHash_search(sequenceHeaderIndexes, flower)) != NULL){
+        return index;
+    }
+    index = st_malloc(sizeof(SequenceHeaderIndex));
+    index->flower = flower;
+    index->entries = st_malloc(sizeof(SequenceHeaderIndexEntry) * (flower_getSequenceNumber(flower) + 1));
+    index->entryNumber = 0;
+    index->headersToEntries = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, NULL, NULL);
+    Flower_SequenceIterator *it = flower_getSequenceIterator(flower);
+    Sequence *sequence;
+    while((sequence = flower_getNextSequence(it)) != NULL){
+        SequenceHeaderIndexEntry *entry = &(index->entries[index->entryNumber++]);
+        entry->header = getInternedSequenceHeader(sequence);
+        entry->sequenceName = sequence_getName(sequence);
+        entry->length = sequence_getLength(sequence);
+        if(stHash_search(index->headersToEntries, (char *)entry->header) == NULL){ //The first sequence with a header wins, as in a scan
+            stHash_insert(index->headersToEntries, (char *)entry->header, entry);
+        }
+    }
+    flower_destructSequenceIterator(it);
+    sequenceHeaderIndex_buildSuffixes(index);
+    stHash_insert(sequenceHeaderIndexes, flower, index);
+    st_logInfo("Built the sequence header index of flower %s, %" PRIi64 " sequences, %" PRIi64 " suffixes\n",
+            cactusMisc_nameToStringStatic(flower_getName(flower)), index->entryNumber, index->suffixNumber);
+    return index;
+}
+
+SequenceHeaderIndex *flower_getSequenceHeaderIndex(Flower *flower){
+    /*
+     *The sequences of a nested flower are a subset of those of its parent, so the
+     *index of the closest indexed ancestor can answer for it.
+     */
+    if(sequenceHeaderIndexes == NULL){
+        return NULL;
+    }
+    while(flower != NULL){
+        SequenceHeaderIndex *index = stHash_search(sequenceHeaderIndexes, flower);
+        if(index != NULL){
+            return index;
+        }
+        Group *parentGroup = flower_getParentGroup(flower);
+        flower = parentGroup == NULL ? NULL : group_getFlower(parentGroup);
+    }
+    return NULL;
+}
+
+void flower_destructSequenceHeaderIndex(Flower *flower){
+    SequenceHeaderIndex *index;
+    if(sequenceHeaderIndexes == NULL || (index = stHash_remove(sequenceHeaderIndexes, flower)) == NULL){
+        return;
+    }
+    free(index->entries);
+    stHash_destruct(index->headersToEntries);
+    free(index->suffixes);
+    free(index->sortedHeaders);
+    free(index);
+}
 
 Sequence *getSequenceByHeader(Flower *flower, char *header){
     /*
      *Iterates through the Sequences in 'flower' and return 
      *the first Sequence whose name is 'header'
      */
+    SequenceHeaderIndex *index = flower_getSequenceHeaderIndex(flower);
+    if(index != NULL){
+        SequenceHeaderIndexEntry *entry = stHash_search(index->headersToEntries, header);
+        return entry == NULL ? NULL : flower_getSequence(flower, entry->sequenceName);
+    }
     Flower_SequenceIterator *it = flower_getSequenceIterator(flower);
     Sequence *sequence = NULL;
     while((sequence = flower_getNextSequence(it)) != NULL){
-        char *sequenceHeader = formatSequenceHeader(sequence);
-        if(strcmp(sequenceHeader, header) == 0){
-            free(sequenceHeader);
+        if(strcmp(getInternedSequenceHeader(sequence), header) == 0){
             break;
         }
-        free(sequenceHeader);
     }
     flower_destructSequenceIterator(it);
     return sequence;
@@ -53,39 +287,73 @@ Sequence *getSequenceByHeader(Flower *flower, char *header){
 
 Sequence *getSequenceMatchesHeader(Flower *flower, char *header){
     //Returns the first Sequence whose name matches 'header'
+    SequenceHeaderIndex *index = flower_getSequenceHeaderIndex(flower);
+    if(index != NULL){
+        int64_t matchNumber;
+        int64_t *matches = sequenceHeaderIndex_getMatches(index, header, 0, &matchNumber);
+        Sequence *sequence = NULL;
+        for(int64_t i=0; i < matchNumber && sequence == NULL; i++){
+            sequence = flower_getSequence(flower, index->entries[matches[i]].sequenceName);
+        }
+        free(matches);
+        return sequence;
+    }
     Flower_SequenceIterator *it = flower_getSequenceIterator(flower);
     Sequence *sequence = NULL;
     while((sequence = flower_getNextSequence(it)) != NULL){
-        char *sequenceHeader = formatSequenceHeader(sequence);
-        if(strstr(sequenceHeader, header) != NULL){
-            free(sequenceHeader);
+        if(strstr(getInternedSequenceHeader(sequence), header) != NULL){
             break;
         }
-        free(sequenceHeader);
     }
     flower_destructSequenceIterator(it);
     return sequence;
 }
 
-struct List *getSequences(Flower *flower, char *name){
-   //get names of all the sequences in 'flower' that have their names start with 'name'
-   Sequence *sequence;
-   //st_logInfo("getSequences for %s\n", name);
+static struct List *flower_getSequencesMatchingHeaderP(Flower *flower, const char *pattern, bool prefixOnly){
+    struct List *sequences = constructEmptyList(0, NULL);
+    SequenceHeaderIndex *index = flower_getSequenceHeaderIndex(flower);
+    if(index != NULL){
+        int64_t matchNumber;
+        int64_t *matches = sequenceHeaderIndex_getMatches(index, pattern, prefixOnly, &matchNumber);
+        for(int64_t i=0; i < matchNumber; i++){
+            //The index may belong to an ancestor, which has sequences this flower does not
+            Sequence *sequence = flower_getSequence(flower, index->entries[matches[i]].sequenceName);
+            if(sequence != NULL){
+                listAppend(sequences, sequence);
+            }
+        }
+        free(matches);
+        return sequences;
+    }
+    Flower_SequenceIterator *it = flower_getSequenceIterator(flower);
+    Sequence *sequence;
+    while((sequence = flower_getNextSequence(it)) != NULL){
+        const char *sequenceHeader = getInternedSequenceHeader(sequence);
+        const char *match = strstr(sequenceHeader, pattern);
+        if(match != NULL && (!prefixOnly || match == sequenceHeader)){
+            listAppend(sequences, sequence);
+        }
+    }
+    flower_destructSequenceIterator(it);
+    return sequences;
+}
+
+struct List *flower_getSequencesMatchingHeader(Flower *flower, const char *pattern){
+    return flower_getSequencesMatchingHeaderP(flower, pattern, 0);
+}
 
+struct List *flower_getSequencesWithHeaderPrefix(Flower *flower, const char *prefix){
+    return flower_getSequencesMatchingHeaderP(flower, prefix, 1);
+}
+
+struct List *getSequences(Flower *flower, char *name){
+   //get names of all the sequences in 'flower' that have 'name' in their names
+   struct List *sequences = flower_getSequencesMatchingHeader(flower, name);
    struct List *seqs = constructEmptyList(0, free);
-   Flower_SequenceIterator * seqIterator = flower_getSequenceIterator(flower);
-   while((sequence = flower_getNextSequence(seqIterator)) != NULL){
-      char *sequenceHeader = formatSequenceHeader(sequence);
-      //st_logInfo("\tcurrseq: %s\n", sequenceHeader);
-
-      //if(strstr(sequenceHeader, name) == sequenceHeader){
-      if(strstr(sequenceHeader, name) != NULL){
-         listAppend(seqs, sequenceHeader);
-         //st_logInfo("\t\tmatch!\n");
-      }
-      //free(sequenceHeader);
+   for(int64_t i = 0; i < sequences->length; i++){
+      listAppend(seqs, stString_copy(getInternedSequenceHeader(sequences->list[i])));
    }
-   flower_destructSequenceIterator(seqIterator);
+   destructList(sequences);
    return seqs;
 }
 
@@ -101,12 +369,7 @@ bool isStubCap(Cap *cap){
 }
 
 char *cap_getSequenceName(Cap *cap){
-    Sequence *sequence = cap_getSequence(cap);
-    char *name = NULL;
-    if(sequence != NULL){
-        name = formatSequenceHeader(sequence);
-    }
-    return name;
+    return (char *)cap_getInternedSequenceName(cap);
 }
 
 char *appendIntToName(char *name, int num){
@@ -120,16 +383,19 @@ char *appendIntToName(char *name, int num){
 }
 
 int64_t getSeqLength(Flower *flower, char *header){
+    SequenceHeaderIndex *index = flower_getSequenceHeaderIndex(flower);
+    if(index != NULL){
+        SequenceHeaderIndexEntry *entry = stHash_search(index->headersToEntries, header);
+        //The index may belong to an ancestor, which has sequences this flower does not
+        return entry == NULL || flower_getSequence(flower, entry->sequenceName) == NULL ? 0 : entry->length;
+    }
     Flower_SequenceIterator *it = flower_getSequenceIterator(flower);
     Sequence *sequence;
     while((sequence = flower_getNextSequence(it)) != NULL){
-        char *sequenceHeader = formatSequenceHeader(sequence);
-        if(strcmp(sequenceHeader, header) == 0){
+        if(strcmp(getInternedSequenceHeader(sequence), header) == 0){
             flower_destructSequenceIterator(it);
-            free(sequenceHeader);
             return sequence_getLength(sequence);
         }
-        free(sequenceHeader);
     }
     flower_destructSequenceIterator(it);
     return 0;
@@ -148,33 +414,298 @@ void moveCapToNextBlock(Cap **cap){
     st_logInfo("moved-cap %s, %d\n", cactusMisc_nameToString(cap_getName(*cap)), cap_getCoordinate(*cap));
 }
 
+stHash *flower_getSequenceSetMatchingHeader(Flower *flower, const char *pattern){
+    struct List *sequences = flower_getSequencesMatchingHeader(flower, pattern);
+    stHash *sequenceSet = stHash_construct();
+    for(int64_t i = 0; i < sequences->length; i++){
+        stHash_insert(sequenceSet, sequences->list[i], sequences->list[i]);
+    }
+    destructList(sequences);
+    return sequenceSet;
+}
+
+//Flower -> ThreadStartTable, for the flowers whose thread start table has been built or loaded.
+static stHash *threadStartTables = NULL;
+
+struct _threadStartTable {
+    Flower *flower;
+    Cap **threadStarts; //The 3' stub caps of the forward strands, in the order of the flower's cap iterator
+    int64_t threadStartNumber;
+    stHash *sequencesToThreadStarts; //Sequence -> IntList of indexes into threadStarts
+};
+
+static ThreadStartTable *threadStartTable_construct(Flower *flower){
+    ThreadStartTable *table = st_malloc(sizeof(ThreadStartTable));
+    table->flower = flower;
+    table->threadStarts = NULL;
+    table->threadStartNumber = 0;
+    table->sequencesToThreadStarts = stHash_construct2(NULL, (void (*)(void *))destructIntList);
+    return table;
+}
+
+static void threadStartTable_destruct(ThreadStartTable *table){
+    free(table->threadStarts);
+    stHash_destruct(table->sequencesToThreadStarts);
+    free(table);
+}
+
+static bool threadStartTable_add(ThreadStartTable *table, Cap *cap){
+    /*
+     *Adds cap if it is the 3' stub of the forward strand of a sequence, returns true if added.
+     */
+    if(!isStubCap(cap)){
+        return 0;
+    }
+    Sequence *sequence = cap_getSequence(cap);
+    if(sequence == NULL){
+        return 0;
+    }
+    if(!cap_getStrand(cap)){//if cap is on negative strand - reverse it
+        cap = cap_getReverse(cap);
+    }
+    if(cap_getSide(cap)){//if cap is the 5' end, ignore
+        return 0;
+    }
+    table->threadStarts = needMoreMem(table->threadStarts, table->threadStartNumber * sizeof(Cap *),
+            (table->threadStartNumber + 1) * sizeof(Cap *));
+    struct IntList *threadStarts = stHash_search(table->sequencesToThreadStarts, sequence);
+    if(threadStarts == NULL){
+        threadStarts = constructEmptyIntList(0);
+        stHash_insert(table->sequencesToThreadStarts, sequence, threadStarts);
+    }
+    intListAppend(threadStarts, table->threadStartNumber);
+    table->threadStarts[table->threadStartNumber++] = cap;
+    return 1;
+}
+
+static void threadStartTable_register(ThreadStartTable *table){
+    if(threadStartTables == NULL){
+        threadStartTables = stHash_construct();
+    }
+    stHash_insert(threadStartTables, table->flower, table);
+}
+
+ThreadStartTable *flower_buildThreadStartTable(Flower *flower){
+    /*
+     *Scans the caps of 'flower' once, keeping the thread starts of every sequence.
+     */
+    ThreadStartTable *table;
+    if(threadStartTables != NULL && (table = stHash_search(threadStartTables, flower)) != NULL){
+        return table;
+    }
+    table = threadStartTable_construct(flower);
+    Cap *cap;
+    Flower_CapIterator *capIterator = flower_getCapIterator(flower);
+    while((cap = flower_getNextCap(capIterator)) != NULL){
+        threadStartTable_add(table, cap);
+    }
+    flower_destructCapIterator(capIterator);
+    threadStartTable_register(table);
+    st_logInfo("Built the thread start table of flower %s, %" PRIi64 " thread starts\n",
+            cactusMisc_nameToStringStatic(flower_getName(flower)), table->threadStartNumber);
+    return table;
+}
+
+ThreadStartTable *flower_getThreadStartTable(Flower *flower){
+    return threadStartTables == NULL ? NULL : stHash_search(threadStartTables, flower);
+}
+
+void flower_destructThreadStartTable(Flower *flower){
+    ThreadStartTable *table;
+    if(threadStartTables != NULL && (table = stHash_remove(threadStartTables, flower)) != NULL){
+        threadStartTable_destruct(table);
+    }
+}
+
+int flower_writeThreadStartTable(Flower *flower, const char *fileName){
+    /*
+     *Writes the table as a header line "flowerName capNumber threadStartNumber", then one
+     *line "sequenceName capName" per thread start, in table order.
+     */
+    ThreadStartTable *table = flower_buildThreadStartTable(flower);
+    FILE *fileHandle = fopen(fileName, "w");
+    if(fileHandle == NULL){
+        st_logInfo("Could not write the thread start table to %s\n", fileName);
+        return 1;
+    }
+    fprintf(fileHandle, "%s\t%" PRIi64 "\t%" PRIi64 "\n", cactusMisc_nameToStringStatic(flower_getName(flower)),
+            flower_getCapNumber(flower), table->threadStartNumber);
+    for(int64_t i=0; i < table->threadStartNumber; i++){
+        Cap *cap = table->threadStarts[i];
+        fprintf(fileHandle, "%s\t", cactusMisc_nameToStringStatic(sequence_getName(cap_getSequence(cap))));
+        fprintf(fileHandle, "%s\n", cactusMisc_nameToStringStatic(cap_getName(cap)));
+    }
+    fclose(fileHandle);
+    return 0;
+}
+
+ThreadStartTable *flower_loadThreadStartTable(Flower *flower, const char *fileName){
+    /*
+     *Any mismatch with the flower (a different flower or cap number, an unknown cap or a cap of
+     *another sequence) means the file is stale, in which case nothing is loaded.
+     */
+    ThreadStartTable *table = flower_getThreadStartTable(flower);
+    if(table != NULL){
+        return table;
+    }
+    FILE *fileHandle = fopen(fileName, "r");
+    if(fileHandle == NULL){
+        return NULL;
+    }
+    char flowerName[64], sequenceName[64], capName[64]; //Names are integers
+    int64_t capNumber, threadStartNumber;
+    bool stale = fscanf(fileHandle, "%63s %" SCNi64 " %" SCNi64, flowerName, &capNumber, &threadStartNumber) != 3
+            || cactusMisc_stringToName(flowerName) != flower_getName(flower)
+            || capNumber != flower_getCapNumber(flower);
+    table = threadStartTable_construct(flower);
+    for(int64_t i=0; !stale && i < threadStartNumber; i++){
+        Cap *cap;
+        stale = fscanf(fileHandle, "%63s %63s", sequenceName, capName) != 2
+                || (cap = flower_getCap(flower, cactusMisc_stringToName(capName))) == NULL
+                || cap_getSequence(cap) == NULL
+                || sequence_getName(cap_getSequence(cap)) != cactusMisc_stringToName(sequenceName)
+                || !threadStartTable_add(table, cap);
+    }
+    fclose(fileHandle);
+    if(stale){
+        st_logInfo("The thread start table in %s does not match flower %s, ignoring it\n", fileName,
+                cactusMisc_nameToStringStatic(flower_getName(flower)));
+        threadStartTable_destruct(table);
+        return NULL;
+    }
+    threadStartTable_register(table);
+    st_logInfo("Loaded the thread start table of flower %s from %s, %" PRIi64 " thread starts\n",
+            cactusMisc_nameToStringStatic(flower_getName(flower)), fileName, table->threadStartNumber);
+    return table;
+}
+
 struct List *flower_getThreadStarts(Flower *flower, char *name){
     /*
      *Get 3' end Stubs of the forward strand of sequences by its name
      *I.e (Each of these stubs is the first cap at the 5' end of each thread with 
      *name including 'name')
+     *The caps come from the flower's thread start table, built on the first call
+     *for a top level flower, so later calls do not iterate over all the caps again.
      */
-    Cap *cap;
     struct List *startCaps = constructEmptyList(0, free);
-    Flower_CapIterator *capIterator = flower_getCapIterator(flower);
-    while((cap= flower_getNextCap(capIterator)) != NULL){
-        if(isStubCap(cap)){//dead end or inherited end
-            char *sequenceHeader = cap_getSequenceName(cap);
-            if(sequenceHeader == NULL){continue;}
-            if(strstr(sequenceHeader, name) != NULL){//cap matched with name
-                if(!cap_getStrand(cap)){//if cap is on negative strand - reverse it
-                    cap = cap_getReverse(cap);
+    ThreadStartTable *table = flower_getThreadStartTable(flower);
+    if(table == NULL){
+        if(flower_getParentGroup(flower) == NULL){
+            table = flower_buildThreadStartTable(flower);
+        }else{ //Nested flowers are not cached
+            Cap *cap;
+            stHash *sequences = flower_getSequenceSetMatchingHeader(flower, name);
+            Flower_CapIterator *capIterator = flower_getCapIterator(flower);
+            while(stHash_size(sequences) > 0 && (cap = flower_getNextCap(capIterator)) != NULL){
+                if(isStubCap(cap) && cap_getSequence(cap) != NULL && stHash_search(sequences, cap_getSequence(cap)) != NULL){
+                    if(!cap_getStrand(cap)){//if cap is on negative strand - reverse it
+                        cap = cap_getReverse(cap);
+                    }
+                    if(cap_getSide(cap)){ continue; }//if cap is the 5' end, ignore
+                    listAppend(startCaps, cap);
                 }
-                if(cap_getSide(cap)){ continue; }//if cap is the 5' end, ignore
-                listAppend(startCaps, cap);
             }
-            free(sequenceHeader);
+            flower_destructCapIterator(capIterator);
+            stHash_destruct(sequences);
+            return startCaps;
         }
     }
-    flower_destructCapIterator(capIterator);
+    struct List *sequences = flower_getSequencesMatchingHeader(flower, name);
+    struct IntList *indexes = constructEmptyIntList(0);
+    for(int64_t i = 0; i < sequences->length; i++){
+        struct IntList *threadStarts = stHash_search(table->sequencesToThreadStarts, sequences->list[i]);
+        for(int64_t j = 0; threadStarts != NULL && j < threadStarts->length; j++){
+            intListAppend(indexes, threadStarts->list[j]);
+        }
+    }
+    qsort(indexes->list, indexes->length, sizeof(int64_t), int64_cmp); //Back into cap iterator order
+    for(int64_t i = 0; i < indexes->length; i++){
+        listAppend(startCaps, table->threadStarts[indexes->list[i]]);
+    }
+    destructIntList(indexes);
+    destructList(sequences);
     return startCaps;
 }
 
+//The distinct flowers returned by getFlower, getNestedFlower and prefetchFlowerSubtree.
+static stHash *loadedFlowers = NULL;
+
+static Flower *countLoadedFlower(Flower *flower){
+    if(flower != NULL){
+        if(loadedFlowers == NULL){
+            loadedFlowers = stHash_construct();
+        }
+        if(stHash_search(loadedFlowers, flower) == NULL){
+            stHash_insert(loadedFlowers, flower, flower);
+        }
+    }
+    return flower;
+}
+
+Flower *getFlower(CactusDisk *cactusDisk, Name flowerName){
+    return countLoadedFlower(cactusDisk_getFlower(cactusDisk, flowerName));
+}
+
+Flower *getNestedFlower(Group *group){
+    return countLoadedFlower(group_getNestedFlower(group));
+}
+
+int64_t getLoadedFlowerNumber(void){
+    return loadedFlowers == NULL ? 0 : stHash_size(loadedFlowers);
+}
+
+void logLoadedFlowerNumber(void){
+    st_logInfo("Loaded %" PRIi64 " flowers\n", getLoadedFlowerNumber());
+}
+
+void prefetchFlowerSubtree(Flower *flower, int64_t batchSize){
+    /*
+     *Walks the subtree a level at a time, so the names of a whole level are known before
+     *any of its flowers is fetched.
+     */
+    assert(batchSize > 0);
+    CactusDisk *cactusDisk = flower_getCactusDisk(flower);
+    stList *flowers = stList_construct();
+    stList_append(flowers, flower);
+    int64_t flowerNumber = 0, batchNumber = 0, level = 0;
+    while(stList_length(flowers) > 0){
+        stList *flowerNames = stList_construct3(0, (void (*)(void *))stIntTuple_destruct);
+        for(int64_t i=0; i < stList_length(flowers); i++){
+            Flower_GroupIterator *groupIt = flower_getGroupIterator(stList_get(flowers, i));
+            Group *group;
+            while((group = flower_getNextGroup(groupIt)) != NULL){
+                if(!group_isLeaf(group)){ //The nested flower has the name of its group
+                    stList_append(flowerNames, stIntTuple_construct1(group_getName(group)));
+                }
+            }
+            flower_destructGroupIterator(groupIt);
+        }
+        stList_destruct(flowers);
+        flowers = stList_construct();
+        stList *batchNames = stList_construct();
+        for(int64_t i=0; i < stList_length(flowerNames); i += batchSize){
+            for(int64_t j=i; j < i + batchSize && j < stList_length(flowerNames); j++){
+                stList_append(batchNames, stList_get(flowerNames, j));
+            }
+            stList *batch = cactusDisk_getFlowers(cactusDisk, batchNames);
+            for(int64_t j=0; j < stList_length(batch); j++){
+                stList_append(flowers, countLoadedFlower(stList_get(batch, j)));
+            }
+            stList_destruct(batch);
+            while(stList_length(batchNames) > 0){
+                stList_pop(batchNames);
+            }
+            batchNumber++;
+        }
+        stList_destruct(batchNames);
+        stList_destruct(flowerNames);
+        flowerNumber += stList_length(flowers);
+        level++;
+    }
+    stList_destruct(flowers);
+    st_logInfo("Prefetched %" PRIi64 " flowers below flower %s in %" PRIi64 " batches over %" PRIi64 " levels\n",
+            flowerNumber, cactusMisc_nameToStringStatic(flower_getName(flower)), batchNumber, level - 1);
+}
 
 struct List *splitString(char *str, char *delim){
     struct List *list = constructEmptyList(0, free);
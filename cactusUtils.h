@@ -1,3 +1,6 @@
+#ifndef CACTUS_UTILS_H_
+#define CACTUS_UTILS_H_
+
 #include <assert.h>
 #include <limits.h>
 #include <stdio.h>
@@ -17,9 +20,49 @@
 
 /*
  *Return the fasta header of the sequence if any. Otherwise return the sequence's internal name.
+ *The returned string is a fresh copy that the caller must free.
  */
 char *formatSequenceHeader(Sequence *sequence);
 
+/*
+ *Return the formatted header of the sequence (as formatSequenceHeader) from a table of headers
+ *interned by sequence Name and shared by all callers. The string is formatted once per sequence,
+ *stays valid until destructInternedSequenceHeaders is called and must not be freed or modified.
+ */
+const char *getInternedSequenceHeader(Sequence *sequence);
+
+/*
+ *Return the interned header of the sequence of cap, or NULL if the cap has no sequence.
+ */
+const char *cap_getInternedSequenceName(Cap *cap);
+
+/*
+ *Free the interned header table, invalidating all the strings it returned.
+ */
+void destructInternedSequenceHeaders(void);
+
+
+/*
+ *Index of the sequences of a flower by their formatted header. While an index is built
+ *for a flower, getSequenceByHeader, getSequenceMatchesHeader and getSeqLength use it
+ *for that flower and its nested flowers, instead of formatting every header on each call.
+ */
+typedef struct _sequenceHeaderIndex SequenceHeaderIndex;
+
+/*
+ *Build (once) and register the header index of flower. Returns the existing index if there is one.
+ */
+SequenceHeaderIndex *flower_buildSequenceHeaderIndex(Flower *flower);
+
+/*
+ *Return the header index of flower or of its closest indexed ancestor, or NULL if there is none.
+ */
+SequenceHeaderIndex *flower_getSequenceHeaderIndex(Flower *flower);
+
+/*
+ *Unregister and free the header index of flower, if any.
+ */
+void flower_destructSequenceHeaderIndex(Flower *flower);
 
 /*
  *Return the first sequence in flower whose name is 'header'
@@ -32,17 +75,35 @@ Sequence *getSequenceByHeader(Flower *flower, char *header);
 Sequence *getSequenceMatchesHeader(Flower *flower, char *header);
 
 /*
- *Return the list of Sequences in flower whose names mathces 'name'.
+ *Return the list of the headers (copies) of the Sequences in flower whose names mathces 'name'.
  */
 struct List *getSequences(Flower *flower, char *name);
 
+/*
+ *Return the Sequences of flower whose header contains 'pattern', all at once and in the order of the
+ *flower's sequence iterator. When the flower is indexed the header index's suffix array answers the query
+ *in O(log(total header length)) plus the number of matches. The list does not own the Sequences.
+ */
+struct List *flower_getSequencesMatchingHeader(Flower *flower, const char *pattern);
+
+/*
+ *As flower_getSequencesMatchingHeader, for the Sequences whose header starts with 'prefix' (e.g. "hg19.").
+ */
+struct List *flower_getSequencesWithHeaderPrefix(Flower *flower, const char *prefix);
+
+/*
+ *Return the Sequences of flower_getSequencesMatchingHeader as a set (Sequence -> Sequence), for filtering caps.
+ */
+stHash *flower_getSequenceSetMatchingHeader(Flower *flower, const char *pattern);
+
 /*
  *Return true if cap is a stubEnd, otherwise return False
  */
 bool isStubCap(Cap *cap);
 
 /*
- *Return the sequence header (or it's internal name if header is not available) of the input cap
+ *Return the sequence header (or it's internal name if header is not available) of the input cap.
+ *The string is interned (see getInternedSequenceHeader), so must not be freed.
  */
 char *cap_getSequenceName(Cap *cap);
 
@@ -61,12 +122,80 @@ int64_t getSeqLength(Flower *flower, char *header);
  */
 void moveCapToNextBlock(Cap **cap);
 
+/*
+ *Table of the thread starts of a flower, i.e. the 3'-end stubs (caps) of the forward strand of its
+ *sequences, grouped by sequence. flower_getThreadStarts answers from the flower's table instead of
+ *iterating over all its caps.
+ */
+typedef struct _threadStartTable ThreadStartTable;
+
+/*
+ *Build (once) and register the thread start table of flower. Returns the existing table if there is one.
+ */
+ThreadStartTable *flower_buildThreadStartTable(Flower *flower);
+
+/*
+ *Return the thread start table of flower, or NULL if none has been built or loaded.
+ */
+ThreadStartTable *flower_getThreadStartTable(Flower *flower);
+
+/*
+ *Unregister and free the thread start table of flower, if any.
+ */
+void flower_destructThreadStartTable(Flower *flower);
+
+/*
+ *Write the thread start table of flower (building it if needed) to fileName, so later runs on the
+ *same disk can load it. Returns 0 on success.
+ */
+int flower_writeThreadStartTable(Flower *flower, const char *fileName);
+
+/*
+ *Load and register the thread start table of flower from fileName. Returns NULL if the file
+ *does not exist or does not match the flower.
+ */
+ThreadStartTable *flower_loadThreadStartTable(Flower *flower, const char *fileName);
+
 /*
  *Get 3'-end stubs (caps) of the forward strand of sequences by its name
  *(i.e each of these stubs is the first cap at the 5' end of each thread whose name matches 'name'
+ *The thread start table of a top level flower is built on the first call.
  */
 struct List *flower_getThreadStarts(Flower *flower, char *name);
 
+/*
+ *Default number of flowers fetched from the disk per request by prefetchFlowerSubtree.
+ */
+#define PREFETCH_BATCH_SIZE 1000
+
+/*
+ *Load all the flowers nested in flower, breadth first, fetching each level from the disk in
+ *batches of batchSize flowers rather than one request per flower as the traversals reach them.
+ *The batches are issued one after another, as the database connection is not thread safe.
+ *Workers forked afterwards share the loaded flowers, but not the connection (see parallelOrderedMap).
+ */
+void prefetchFlowerSubtree(Flower *flower, int64_t batchSize);
+
+/*
+ *As cactusDisk_getFlower and group_getNestedFlower, counting the distinct flowers returned. The cactus
+ *disk loads each flower the first time it is reached and keeps it, so a tool reaching its flowers only
+ *through these and prefetchFlowerSubtree counts the flowers it loads. Flowers reached by forked workers
+ *are not counted, but workers only reach flowers loaded before they were forked.
+ */
+Flower *getFlower(CactusDisk *cactusDisk, Name flowerName);
+
+Flower *getNestedFlower(Group *group);
+
+/*
+ *Return the number of flowers counted by getFlower, getNestedFlower and prefetchFlowerSubtree.
+ */
+int64_t getLoadedFlowerNumber(void);
+
+/*
+ *Log the number of flowers loaded (see getLoadedFlowerNumber) at the info level, as "Loaded N flowers".
+ */
+void logLoadedFlowerNumber(void);
+
 /*
  *Split a string using 'delim'. Return the list of token strings
  */
@@ -76,4 +205,4 @@ struct IntList *splitIntString(char *str, char *delim);
 
 char *str_joinList(struct List *strList, char *sep);
 
-
+#endif /* CACTUS_UTILS_H_ */
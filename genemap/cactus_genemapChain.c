@@ -418,6 +418,8 @@ int main(int argc, char *argv[]) {
    ///////////////////////////////////////////////////////////////////////////
    flower = cactusDisk_getFlower(cactusDisk, cactusMisc_stringToName(flowerName));
    st_logInfo("Parsed the top level flower of the cactus tree to check\n");
+   flower_buildSequenceHeaderIndex(flower); //flower_getThreadStarts is called once per gene
+   flower_buildThreadStartTable(flower);
 
    ///////////////////////////////////////////////////////////////////////////
    // Recursive check the flowers.
@@ -434,6 +436,8 @@ int main(int argc, char *argv[]) {
    // Clean up.
    ///////////////////////////////////////////////////////////////////////////
 
+   flower_destructThreadStartTable(flower);
+   flower_destructSequenceHeaderIndex(flower);
    cactusDisk_destruct(cactusDisk);
 
    return 0;
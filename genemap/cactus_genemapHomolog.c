@@ -428,28 +428,12 @@ struct CapList *flower_getThreadStart(Flower *flower, char *name){// from Flower
      *Get 3' end Stub (the start) of the sequence by its name
      */
     struct CapList *caplist = constructCapList();
-    Cap *cap;
-    Flower_CapIterator *capIterator = flower_getCapIterator(flower);
-    while((cap= flower_getNextCap(capIterator)) != NULL){
-        if(isStubCap(cap)){//dead end or inherited end
-            if( !cap_getStrand(cap) ){//convert cap to + strand
-                cap = cap_getReverse(cap);
-            }
-            if( !cap_getSide(cap) ){//3' 
-                Sequence *sequence = cap_getSequence(cap);
-                if(sequence == NULL){continue;}
-                char *sequenceHeader = formatSequenceHeader(sequence);
-                if(strstr(sequenceHeader, name) != NULL){
-                    caplist = insertCapList(caplist, cap);
-                    /*char *strand = cap_getStrand(cap) ? "+" : "-";
-                    char *side = cap_getSide(cap) ? "5" : "3";
-                    st_logInfo("Found a thread start: %d, %s, %s\n", mapCapCoor(cap), strand, side);*/
-                }
-                free(sequenceHeader);
-            }
-        }
+    struct List *startCaps = flower_getThreadStarts(flower, name); //From the flower's thread start table
+    for(int64_t i = 0; i < startCaps->length; i++){
+        caplist = insertCapList(caplist, startCaps->list[i]);
     }
-    flower_destructCapIterator(capIterator);
+    startCaps->destructElement = NULL; //The caps belong to the flower
+    destructList(startCaps);
     return caplist;
 }
 
@@ -464,8 +448,7 @@ int block_checkDuplication(Block *block){
     while((segment = block_getNext(it)) != NULL){
         Sequence *sequence = segment_getSequence(segment);
         //if(sequence == NULL){continue;}
-        char *seqHeader = formatSequenceHeader(sequence);
-        struct List *headerList = splitString(seqHeader, ".");
+        struct List *headerList = splitString((char *)getInternedSequenceHeader(sequence), ".");
         assert(headerList->length > 0);
         if(!visitedString(spcList, headerList->list[0])){//has not visited this species yet
             listAppend(spcList, headerList->list[0]);
@@ -475,7 +458,6 @@ int block_checkDuplication(Block *block){
             hasDup = 1;
         }
         //destructList(headerList);
-        free(seqHeader);
         if(hasDup == 1){break;}
     }
     //destructList(spcList);
@@ -534,7 +516,7 @@ Cap *walkDown(Cap *cap, int64_t start){//cap is either stub or the 'otherSegment
     }else{//currcoor < start < adjCoor
         Group *group = end_getGroup(cap_getEnd(cap));
         assert(!group_isLeaf(group));//there must be lower level for currcoor < start < adjCoor
-        Cap *lowerCap = flower_getCap(group_getNestedFlower(group), cap_getName(cap));
+        Cap *lowerCap = flower_getCap(getNestedFlower(group), cap_getName(cap));
         if(cap_getStrand(cap) != cap_getStrand(lowerCap)){
             lowerCap = cap_getReverse(lowerCap);
         }
@@ -1668,7 +1650,7 @@ Cap *overlap_walkDown(Cap *cap, int64_t start, int64_t end, struct Exon *exon, i
     if(group_isLeaf(group)){
         cap = overlap_walkUp(adjCap, start, end, exon, hasDup);
     }else{
-        Cap *lowerCap = flower_getCap(group_getNestedFlower(group), cap_getName(cap));
+        Cap *lowerCap = flower_getCap(getNestedFlower(group), cap_getName(cap));
         if(cap_getStrand(cap) != cap_getStrand(lowerCap)){
             lowerCap = cap_getReverse(lowerCap);
         }
@@ -1729,8 +1711,7 @@ struct List *flower_getSpecies(Flower *flower){
     Flower_SequenceIterator *it = flower_getSequenceIterator(flower);
     Sequence *seq;
     while((seq = flower_getNextSequence(it)) != NULL){
-        char *seqHeader = formatSequenceHeader(seq);
-        struct List *headerList = splitString(seqHeader, ".");
+        struct List *headerList = splitString((char *)getInternedSequenceHeader(seq), ".");
         assert(headerList->length > 0);
         if (!visitedString(list, headerList->list[0])){
             listAppend(list, headerList->list[0]);
@@ -1941,8 +1922,10 @@ int main(int argc, char *argv[]) {
    ///////////////////////////////////////////////////////////////////////////
    // Parse the basic reconstruction problem
    ///////////////////////////////////////////////////////////////////////////
-   flower = cactusDisk_getFlower(cactusDisk, cactusMisc_stringToName(flowerName));
+   flower = getFlower(cactusDisk, cactusMisc_stringToName(flowerName));
    st_logInfo("Parsed the top level flower of the cactus tree to check\n");
+   flower_buildSequenceHeaderIndex(flower); //getSeqLength is called for every cap inserted into a thread
+   flower_buildThreadStartTable(flower);
 
    ///////////////////////////////////////////////////////////////////////////
    // Recursive check the flowers.
@@ -1954,11 +1937,14 @@ int main(int argc, char *argv[]) {
    mapGenes(flower, fileHandle, gene, species);
    fclose(fileHandle);
    st_logInfo("Map genes in %" PRIi64 " seconds/\n", time(NULL) - startTime);
+   logLoadedFlowerNumber();
 
    ///////////////////////////////////////////////////////////////////////////
    // Clean up.
    ///////////////////////////////////////////////////////////////////////////
 
+   flower_destructThreadStartTable(flower);
+   flower_destructSequenceHeaderIndex(flower);
    cactusDisk_destruct(cactusDisk);
 
    return 0;
@@ -0,0 +1,399 @@
+/*
+ * bgzfFile.c
+ *
+ *  Created on: 17 Oct 2026
+ */
+
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#define _GNU_SOURCE //For fopencookie under -std=c99
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <zlib.h>
+#include "cactus.h"
+#include "sonLib.h"
+#include "bgzfFile.h"
+
+#define BGZF_MAX_BLOCK_SIZE 0x10000 //Compressed, including the header and footer
+#define BGZF_HEADER_SIZE 18
+#define BGZF_FOOTER_SIZE 8
+
+static const uint8_t bgzfEndOfFile[28] = { 0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06,
+        0x00, 0x42, 0x43, 0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+#define BGZF_BLOCK_EMPTY 0 //Being filled, or free to be
+#define BGZF_BLOCK_PENDING 1 //Full, waiting for or being compressed
+#define BGZF_BLOCK_DONE 2 //Compressed, waiting to be written
+
+typedef struct _bgzfBlock {
+    uint8_t input[BGZF_BLOCK_SIZE];
+    int64_t inputLength;
+    uint8_t output[BGZF_MAX_BLOCK_SIZE];
+    int64_t outputLength;
+    int64_t state;
+} BgzfBlock;
+
+/*
+ * Blocks are numbered in the order they are filled, and block i lives in the ring at i % blockNumber.
+ * The caller fills blocks, the threads compress them in number order, and the caller writes them
+ * out in number order, waiting when the ring is full of blocks not yet written.
+ */
+typedef struct _bgzfFile {
+    FILE *fileHandle;
+    BgzfBlock *blocks;
+    int64_t blockNumber;
+    int64_t nextToFill;
+    int64_t nextToCompress;
+    int64_t nextToWrite;
+    bool finished;
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+    pthread_t *threads;
+    int64_t threadNumber;
+    int64_t uncompressedLength; //Bytes written to the stream so far
+    int64_t compressedLength; //Bytes written to the file so far
+    char *gziFileName;
+    int64_t *blockOffsets; //The offset in the file of each block written, if writing a gzi index
+    int64_t blockOffsetNumber;
+    int64_t maxBlockOffsetNumber;
+} BgzfFile;
+
+static void packInt(uint8_t *bytes, uint32_t i, int64_t byteNumber) { //Little endian
+    for (int64_t j = 0; j < byteNumber; j++) {
+        bytes[j] = (i >> (8 * j)) & 0xff;
+    }
+}
+
+static void bgzfBlock_compress(BgzfBlock *block) {
+    int64_t compressedLength = -1;
+    for (int level = Z_DEFAULT_COMPRESSION; compressedLength == -1; level = Z_NO_COMPRESSION) {
+        z_stream zStream;
+        memset(&zStream, 0, sizeof(z_stream));
+        if (deflateInit2(&zStream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) { //Raw deflate
+            st_errAbort("Could not initialise zlib for BGZF compression\n");
+        }
+        zStream.next_in = block->input;
+        zStream.avail_in = block->inputLength;
+        zStream.next_out = block->output + BGZF_HEADER_SIZE;
+        zStream.avail_out = BGZF_MAX_BLOCK_SIZE - BGZF_HEADER_SIZE - BGZF_FOOTER_SIZE;
+        if (deflate(&zStream, Z_FINISH) == Z_STREAM_END) {
+            compressedLength = zStream.total_out;
+        } else if (level == Z_NO_COMPRESSION) { //Stored blocks always fit, so this can not happen
+            st_errAbort("A BGZF block did not fit uncompressed\n");
+        } //else the data did not compress, so store it
+        deflateEnd(&zStream);
+    }
+    block->outputLength = BGZF_HEADER_SIZE + compressedLength + BGZF_FOOTER_SIZE;
+    uint8_t *header = block->output;
+    header[0] = 31; //gzip magic
+    header[1] = 139;
+    header[2] = 8; //deflate
+    header[3] = 4; //FEXTRA
+    packInt(header + 4, 0, 4); //MTIME
+    header[8] = 0; //XFL
+    header[9] = 255; //OS unknown
+    packInt(header + 10, 6, 2); //XLEN
+    header[12] = 'B';
+    header[13] = 'C';
+    packInt(header + 14, 2, 2); //SLEN
+    packInt(header + 16, block->outputLength - 1, 2); //BSIZE
+    uint8_t *footer = block->output + BGZF_HEADER_SIZE + compressedLength;
+    packInt(footer, crc32(crc32(0L, Z_NULL, 0), block->input, block->inputLength), 4);
+    packInt(footer + 4, block->inputLength, 4);
+}
+
+static void *bgzfFile_compressBlocks(void *argument) {
+    BgzfFile *bgzfFile = argument;
+    pthread_mutex_lock(&bgzfFile->mutex);
+    while (1) {
+        while (!bgzfFile->finished && bgzfFile->nextToCompress == bgzfFile->nextToFill) {
+            pthread_cond_wait(&bgzfFile->condition, &bgzfFile->mutex);
+        }
+        if (bgzfFile->nextToCompress == bgzfFile->nextToFill) { //Finished, and nothing left to compress
+            break;
+        }
+        BgzfBlock *block = &(bgzfFile->blocks[bgzfFile->nextToCompress++ % bgzfFile->blockNumber]);
+        pthread_mutex_unlock(&bgzfFile->mutex);
+        bgzfBlock_compress(block);
+        pthread_mutex_lock(&bgzfFile->mutex);
+        block->state = BGZF_BLOCK_DONE;
+        pthread_cond_broadcast(&bgzfFile->condition);
+    }
+    pthread_mutex_unlock(&bgzfFile->mutex);
+    return NULL;
+}
+
+static void bgzfFile_writeBlocks(BgzfFile *bgzfFile, int64_t blockNumber) {
+    /*
+     * Writes out compressed blocks in order until fewer than blockNumber blocks are filled but not
+     * written, then writes any others that are already compressed. Call holding the mutex.
+     */
+    while (bgzfFile->nextToWrite < bgzfFile->nextToFill) {
+        BgzfBlock *block = &(bgzfFile->blocks[bgzfFile->nextToWrite % bgzfFile->blockNumber]);
+        if (block->state != BGZF_BLOCK_DONE) {
+            if (bgzfFile->nextToFill - bgzfFile->nextToWrite < blockNumber) {
+                return;
+            }
+            pthread_cond_wait(&bgzfFile->condition, &bgzfFile->mutex);
+            continue;
+        }
+        pthread_mutex_unlock(&bgzfFile->mutex); //The threads leave done blocks alone
+        if (fwrite(block->output, sizeof(uint8_t), block->outputLength, bgzfFile->fileHandle) != block->outputLength) {
+            st_errAbort("Could not write a BGZF block\n");
+        }
+        if (bgzfFile->gziFileName != NULL) {
+            if (bgzfFile->blockOffsetNumber == bgzfFile->maxBlockOffsetNumber) {
+                bgzfFile->maxBlockOffsetNumber = 2 * bgzfFile->maxBlockOffsetNumber + 1;
+                bgzfFile->blockOffsets = realloc(bgzfFile->blockOffsets, sizeof(int64_t) * bgzfFile->maxBlockOffsetNumber);
+                if (bgzfFile->blockOffsets == NULL) {
+                    st_errAbort("Ran out of memory indexing a BGZF file\n");
+                }
+            }
+            bgzfFile->blockOffsets[bgzfFile->blockOffsetNumber++] = bgzfFile->compressedLength;
+        }
+        bgzfFile->compressedLength += block->outputLength;
+        pthread_mutex_lock(&bgzfFile->mutex);
+        block->state = BGZF_BLOCK_EMPTY;
+        block->inputLength = 0;
+        bgzfFile->nextToWrite++;
+    }
+}
+
+static void bgzfFile_submitBlock(BgzfFile *bgzfFile, int64_t blockNumber) {
+    /*
+     * Hands the block being filled to the threads, then makes sure the next block is free to fill.
+     */
+    pthread_mutex_lock(&bgzfFile->mutex);
+    bgzfFile->blocks[bgzfFile->nextToFill % bgzfFile->blockNumber].state = BGZF_BLOCK_PENDING;
+    bgzfFile->nextToFill++;
+    pthread_cond_broadcast(&bgzfFile->condition);
+    bgzfFile_writeBlocks(bgzfFile, blockNumber);
+    pthread_mutex_unlock(&bgzfFile->mutex);
+}
+
+static ssize_t bgzfFile_write(void *cookie, const char *data, size_t length) {
+    BgzfFile *bgzfFile = cookie;
+    size_t written = 0;
+    while (written < length) {
+        BgzfBlock *block = &(bgzfFile->blocks[bgzfFile->nextToFill % bgzfFile->blockNumber]);
+        int64_t i = BGZF_BLOCK_SIZE - block->inputLength;
+        if (i > length - written) {
+            i = length - written;
+        }
+        memcpy(block->input + block->inputLength, data + written, i);
+        block->inputLength += i;
+        written += i;
+        bgzfFile->uncompressedLength += i;
+        if (block->inputLength == BGZF_BLOCK_SIZE) {
+            bgzfFile_submitBlock(bgzfFile, bgzfFile->blockNumber);
+        }
+    }
+    return written;
+}
+
+static int bgzfFile_seek(void *cookie, off64_t *position, int whence) {
+    /*
+     * Only supports asking for the current position, so that ftell gives the uncompressed offset.
+     */
+    BgzfFile *bgzfFile = cookie;
+    if (whence != SEEK_CUR || *position != 0) {
+        return -1;
+    }
+    *position = bgzfFile->uncompressedLength;
+    return 0;
+}
+
+static void writeUint64(FILE *fileHandle, uint64_t i) { //Little endian
+    uint8_t bytes[8];
+    packInt(bytes, i & 0xffffffff, 4);
+    packInt(bytes + 4, i >> 32, 4);
+    fwrite(bytes, sizeof(uint8_t), 8, fileHandle);
+}
+
+static void bgzfFile_writeGzi(BgzfFile *bgzfFile) {
+    /*
+     * Writes the offsets of the blocks in the bgzip .gzi format: the number of entries, then the
+     * compressed and uncompressed offset of every block but the first.
+     */
+    FILE *fileHandle = fopen(bgzfFile->gziFileName, "wb");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open the BGZF index %s for writing\n", bgzfFile->gziFileName);
+    }
+    writeUint64(fileHandle, bgzfFile->blockOffsetNumber > 0 ? bgzfFile->blockOffsetNumber - 1 : 0);
+    for (int64_t i = 1; i < bgzfFile->blockOffsetNumber; i++) {
+        writeUint64(fileHandle, bgzfFile->blockOffsets[i]);
+        writeUint64(fileHandle, i * BGZF_BLOCK_SIZE); //All blocks but the last are full
+    }
+    fclose(fileHandle);
+}
+
+static int bgzfFile_close(void *cookie) {
+    BgzfFile *bgzfFile = cookie;
+    if (bgzfFile->blocks[bgzfFile->nextToFill % bgzfFile->blockNumber].inputLength > 0) {
+        bgzfFile_submitBlock(bgzfFile, bgzfFile->blockNumber);
+    }
+    pthread_mutex_lock(&bgzfFile->mutex);
+    bgzfFile->finished = 1;
+    pthread_cond_broadcast(&bgzfFile->condition);
+    bgzfFile_writeBlocks(bgzfFile, 1);
+    pthread_mutex_unlock(&bgzfFile->mutex);
+    for (int64_t i = 0; i < bgzfFile->threadNumber; i++) {
+        pthread_join(bgzfFile->threads[i], NULL);
+    }
+    fwrite(bgzfEndOfFile, sizeof(uint8_t), sizeof(bgzfEndOfFile), bgzfFile->fileHandle);
+    int i = fclose(bgzfFile->fileHandle);
+    if (bgzfFile->gziFileName != NULL) {
+        bgzfFile_writeGzi(bgzfFile);
+        free(bgzfFile->gziFileName);
+        free(bgzfFile->blockOffsets);
+    }
+    pthread_mutex_destroy(&bgzfFile->mutex);
+    pthread_cond_destroy(&bgzfFile->condition);
+    free(bgzfFile->threads);
+    free(bgzfFile->blocks);
+    free(bgzfFile);
+    return i;
+}
+
+FILE *bgzfFile_open(const char *fileName, const char *gziFileName, int64_t threadNumber) {
+    BgzfFile *bgzfFile = st_malloc(sizeof(BgzfFile));
+    bgzfFile->fileHandle = fopen(fileName, "wb");
+    if (bgzfFile->fileHandle == NULL) {
+        st_errAbort("Could not open the BGZF file %s for writing\n", fileName);
+    }
+    bgzfFile->threadNumber = threadNumber > 0 ? threadNumber : 1;
+    bgzfFile->blockNumber = 2 * bgzfFile->threadNumber + 1; //Enough for every thread to be busy while finished blocks wait to be written
+    bgzfFile->blocks = st_malloc(sizeof(BgzfBlock) * bgzfFile->blockNumber);
+    for (int64_t i = 0; i < bgzfFile->blockNumber; i++) {
+        bgzfFile->blocks[i].inputLength = 0;
+        bgzfFile->blocks[i].state = BGZF_BLOCK_EMPTY;
+    }
+    bgzfFile->nextToFill = 0;
+    bgzfFile->nextToCompress = 0;
+    bgzfFile->nextToWrite = 0;
+    bgzfFile->finished = 0;
+    bgzfFile->uncompressedLength = 0;
+    bgzfFile->compressedLength = 0;
+    bgzfFile->gziFileName = gziFileName != NULL ? stString_copy(gziFileName) : NULL;
+    bgzfFile->blockOffsets = NULL;
+    bgzfFile->blockOffsetNumber = 0;
+    bgzfFile->maxBlockOffsetNumber = 0;
+    pthread_mutex_init(&bgzfFile->mutex, NULL);
+    pthread_cond_init(&bgzfFile->condition, NULL);
+    bgzfFile->threads = st_malloc(sizeof(pthread_t) * bgzfFile->threadNumber);
+    for (int64_t i = 0; i < bgzfFile->threadNumber; i++) {
+        if (pthread_create(&bgzfFile->threads[i], NULL, bgzfFile_compressBlocks, bgzfFile) != 0) {
+            st_errAbort("Could not start BGZF compression thread %" PRIi64 "\n", i);
+        }
+    }
+    cookie_io_functions_t functions = { NULL, bgzfFile_write, bgzfFile_seek, bgzfFile_close };
+    FILE *fileHandle = fopencookie(bgzfFile, "w", functions);
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open a stream for the BGZF file %s\n", fileName);
+    }
+    return fileHandle;
+}
+
+////////////////////////////////////
+////////////////////////////////////
+//Reading ranges of a BGZF file
+////////////////////////////////////
+////////////////////////////////////
+
+static uint64_t unpackInt(const uint8_t *bytes, int64_t byteNumber) { //Little endian
+    uint64_t i = 0;
+    for (int64_t j = byteNumber - 1; j >= 0; j--) {
+        i = (i << 8) | bytes[j];
+    }
+    return i;
+}
+
+static void getBlockStart(const char *gziFileName, int64_t start, int64_t *compressedOffset, int64_t *uncompressedOffset) {
+    /*
+     * Finds the last block starting at or before the uncompressed offset start, from the gzi
+     * index if there is one, otherwise the first block.
+     */
+    *compressedOffset = 0;
+    *uncompressedOffset = 0;
+    FILE *fileHandle = gziFileName != NULL ? fopen(gziFileName, "rb") : NULL;
+    if (fileHandle == NULL) {
+        return;
+    }
+    uint8_t bytes[16];
+    if (fread(bytes, sizeof(uint8_t), 8, fileHandle) == 8) {
+        uint64_t entryNumber = unpackInt(bytes, 8);
+        for (uint64_t i = 0; i < entryNumber && fread(bytes, sizeof(uint8_t), 16, fileHandle) == 16; i++) {
+            if ((int64_t) unpackInt(bytes + 8, 8) > start) {
+                break;
+            }
+            *compressedOffset = unpackInt(bytes, 8);
+            *uncompressedOffset = unpackInt(bytes + 8, 8);
+        }
+    }
+    fclose(fileHandle);
+}
+
+void bgzfFile_copyRange(const char *fileName, const char *gziFileName, int64_t start, int64_t end, FILE *output) {
+    FILE *fileHandle = fopen(fileName, "rb");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open the BGZF file %s\n", fileName);
+    }
+    int64_t compressedOffset, uncompressedOffset;
+    getBlockStart(gziFileName, start, &compressedOffset, &uncompressedOffset);
+    if (fseek(fileHandle, compressedOffset, SEEK_SET) != 0) {
+        st_errAbort("Could not seek in the BGZF file %s\n", fileName);
+    }
+    uint8_t *input = st_malloc(BGZF_MAX_BLOCK_SIZE);
+    uint8_t *block = st_malloc(BGZF_MAX_BLOCK_SIZE);
+    while ((end == -1 || uncompressedOffset < end) && fread(input, sizeof(uint8_t), BGZF_HEADER_SIZE, fileHandle) == BGZF_HEADER_SIZE) {
+        if (input[0] != 31 || input[1] != 139 || input[3] != 4 || input[12] != 'B' || input[13] != 'C') {
+            st_errAbort("The file %s is not BGZF\n", fileName);
+        }
+        int64_t blockSize = unpackInt(input + 16, 2) + 1;
+        if (blockSize < BGZF_HEADER_SIZE + BGZF_FOOTER_SIZE || fread(input + BGZF_HEADER_SIZE, sizeof(uint8_t),
+                blockSize - BGZF_HEADER_SIZE, fileHandle) != blockSize - BGZF_HEADER_SIZE) {
+            st_errAbort("The BGZF file %s is truncated\n", fileName);
+        }
+        z_stream zStream;
+        memset(&zStream, 0, sizeof(z_stream));
+        if (inflateInit2(&zStream, -15) != Z_OK) {
+            st_errAbort("Could not initialise zlib for BGZF decompression\n");
+        }
+        zStream.next_in = input + BGZF_HEADER_SIZE;
+        zStream.avail_in = blockSize - BGZF_HEADER_SIZE - BGZF_FOOTER_SIZE;
+        zStream.next_out = block;
+        zStream.avail_out = BGZF_MAX_BLOCK_SIZE;
+        if (inflate(&zStream, Z_FINISH) != Z_STREAM_END) {
+            st_errAbort("Could not decompress a block of the BGZF file %s\n", fileName);
+        }
+        int64_t length = zStream.total_out;
+        inflateEnd(&zStream);
+        int64_t i = start > uncompressedOffset ? start - uncompressedOffset : 0;
+        int64_t j = end != -1 && end - uncompressedOffset < length ? end - uncompressedOffset : length;
+        if (i < j) {
+            fwrite(block + i, sizeof(uint8_t), j - i, output);
+        }
+        uncompressedOffset += length;
+    }
+    free(input);
+    free(block);
+    fclose(fileHandle);
+}
+
+bool bgzfFile_isBgzf(const char *fileName) {
+    FILE *fileHandle = fopen(fileName, "rb");
+    if (fileHandle == NULL) {
+        return 0;
+    }
+    uint8_t header[BGZF_HEADER_SIZE];
+    bool isBgzf = fread(header, sizeof(uint8_t), BGZF_HEADER_SIZE, fileHandle) == BGZF_HEADER_SIZE &&
+            header[0] == 31 && header[1] == 139 && header[3] == 4 && header[12] == 'B' && header[13] == 'C';
+    fclose(fileHandle);
+    return isBgzf;
+}
@@ -0,0 +1,39 @@
+/*
+ * bgzfFile.h
+ *
+ *  Created on: 17 Oct 2026
+ */
+
+#ifndef BGZF_FILE_H_
+#define BGZF_FILE_H_
+
+/*
+ * Uncompressed bytes per BGZF block, as used by samtools/htslib.
+ */
+#define BGZF_BLOCK_SIZE 0xff00
+
+/*
+ * Opens a file for writing in BGZF format: a series of independent gzip members of at most
+ * BGZF_BLOCK_SIZE uncompressed bytes each, so the output is readable by gzip, bgzip and tabix.
+ * Whole blocks are compressed by a pool of threadNumber threads while the caller carries on
+ * writing, and written out in order. Closing the stream with fclose writes the last block and
+ * the BGZF end of file marker, and if gziFileName is not NULL a bgzip style .gzi index of the
+ * blocks. ftell on the stream gives the uncompressed offset; it can not otherwise seek.
+ *
+ * The compression threads never call into cactus, so they are safe alongside the traversal.
+ */
+FILE *bgzfFile_open(const char *fileName, const char *gziFileName, int64_t threadNumber);
+
+/*
+ * Copies the uncompressed bytes from start up to end, or to the end of the file if end is -1,
+ * of a BGZF file to output. Decompression starts from the block found through the .gzi index
+ * if gziFileName is not NULL and the index exists, otherwise from the start of the file.
+ */
+void bgzfFile_copyRange(const char *fileName, const char *gziFileName, int64_t start, int64_t end, FILE *output);
+
+/*
+ * Returns non-zero if the file starts with a BGZF block header.
+ */
+bool bgzfFile_isBgzf(const char *fileName);
+
+#endif /* BGZF_FILE_H_ */
@@ -0,0 +1,335 @@
+/*
+ * binaryMaf.c
+ *
+ *  Created on: 17 Oct 2026
+ */
+
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "cactus.h"
+#include "sonLib.h"
+#include "mafWriter.h"
+#include "binaryMaf.h"
+
+static const char *fourBitCodes = "ACGTacgtNn*"; //15 is any other character
+
+#define BINARY_MAF_EXCEPTION 15
+
+////////////////////////////////////
+////////////////////////////////////
+//Writing
+////////////////////////////////////
+////////////////////////////////////
+
+static void writeVarint(MafWriter *mafWriter, uint64_t i) {
+    while (i >= 0x80) {
+        mafWriter_writeChar(mafWriter, (char) ((i & 0x7f) | 0x80));
+        i >>= 7;
+    }
+    mafWriter_writeChar(mafWriter, (char) i);
+}
+
+void binaryMaf_writeHeader(MafWriter *mafWriter, const char *eventTreeString, int64_t sequenceNumber,
+        const char **sequenceHeaders, const int64_t *sequenceLengths) {
+    mafWriter_writeBytes(mafWriter, BINARY_MAF_MAGIC, strlen(BINARY_MAF_MAGIC));
+    mafWriter_writeBytes(mafWriter, eventTreeString, strlen(eventTreeString) + 1);
+    writeVarint(mafWriter, sequenceNumber);
+    for (int64_t i = 0; i < sequenceNumber; i++) {
+        mafWriter_writeBytes(mafWriter, sequenceHeaders[i], strlen(sequenceHeaders[i]) + 1);
+        writeVarint(mafWriter, sequenceLengths[i]);
+    }
+}
+
+void binaryMaf_writeBlockStart(MafWriter *mafWriter, int64_t score) {
+    mafWriter_writeChar(mafWriter, 'a');
+    writeVarint(mafWriter, score);
+}
+
+void binaryMaf_writeBlockTreeStart(MafWriter *mafWriter) {
+    mafWriter_writeChar(mafWriter, 't');
+}
+
+void binaryMaf_writeBlockTreeEnd(MafWriter *mafWriter) {
+    mafWriter_writeChar(mafWriter, '\0');
+}
+
+void binaryMaf_writeBlockEnd(MafWriter *mafWriter) {
+    mafWriter_writeChar(mafWriter, '\n');
+}
+
+static int64_t getFourBitCode(char c) {
+    switch (c) {
+        case 'A': return 0;
+        case 'C': return 1;
+        case 'G': return 2;
+        case 'T': return 3;
+        case 'a': return 4;
+        case 'c': return 5;
+        case 'g': return 6;
+        case 't': return 7;
+        case 'N': return 8;
+        case 'n': return 9;
+        case '*': return 10;
+        default: return BINARY_MAF_EXCEPTION;
+    }
+}
+
+void binaryMaf_writeRow(MafWriter *mafWriter, int64_t sequence, int64_t start, int64_t length,
+        bool strand, const char *text, int64_t textLength) {
+    bool fourBit = 0, gaps = 0;
+    for (int64_t i = 0; i < textLength; i++) {
+        int64_t code = getFourBitCode(text[i]);
+        if (code > 3) {
+            if (text[i] == '-') {
+                gaps = 1;
+            } else {
+                fourBit = 1;
+            }
+        }
+    }
+    mafWriter_writeChar(mafWriter, 's');
+    writeVarint(mafWriter, sequence);
+    writeVarint(mafWriter, start);
+    writeVarint(mafWriter, length);
+    mafWriter_writeChar(mafWriter, (strand ? BINARY_MAF_POSITIVE_STRAND : 0) | (fourBit ? BINARY_MAF_FOUR_BIT : 0)
+            | (gaps ? BINARY_MAF_GAPS : 0));
+    if (gaps) { //The runs of gaps, by the number of bases before each
+        int64_t runNumber = 0;
+        for (int64_t i = 0; i < textLength; i++) {
+            runNumber += text[i] == '-' && (i == 0 || text[i - 1] != '-');
+        }
+        writeVarint(mafWriter, runNumber);
+        int64_t bases = 0, previousBases = 0;
+        for (int64_t i = 0; i < textLength;) {
+            if (text[i] == '-') {
+                int64_t j = i;
+                while (j < textLength && text[j] == '-') {
+                    j++;
+                }
+                writeVarint(mafWriter, bases - previousBases);
+                writeVarint(mafWriter, j - i);
+                previousBases = bases;
+                i = j;
+            } else {
+                bases++;
+                i++;
+            }
+        }
+    }
+    //The bases, packed
+    int64_t basesPerByte = fourBit ? 2 : 4;
+    int64_t bitsPerBase = fourBit ? 4 : 2;
+    char byte = 0;
+    int64_t baseNumber = 0, exceptionNumber = 0;
+    for (int64_t i = 0; i < textLength; i++) {
+        if (text[i] != '-') {
+            int64_t code = getFourBitCode(text[i]);
+            exceptionNumber += code == BINARY_MAF_EXCEPTION;
+            byte |= code << (bitsPerBase * (baseNumber % basesPerByte));
+            if (++baseNumber % basesPerByte == 0) {
+                mafWriter_writeChar(mafWriter, byte);
+                byte = 0;
+            }
+        }
+    }
+    if (baseNumber % basesPerByte != 0) {
+        mafWriter_writeChar(mafWriter, byte);
+    }
+    assert(baseNumber == length);
+    if (exceptionNumber > 0) {
+        for (int64_t i = 0; i < textLength; i++) {
+            if (text[i] != '-' && getFourBitCode(text[i]) == BINARY_MAF_EXCEPTION) {
+                mafWriter_writeChar(mafWriter, text[i]);
+            }
+        }
+    }
+}
+
+////////////////////////////////////
+////////////////////////////////////
+//Reading
+////////////////////////////////////
+////////////////////////////////////
+
+#define BINARY_MAF_READ_BUFFER_SIZE 1048576
+
+typedef struct _binaryMafReader {
+    FILE *fileHandle;
+    unsigned char *buffer;
+    int64_t length;
+    int64_t position;
+} BinaryMafReader;
+
+static int readByte(BinaryMafReader *reader) { //Returns EOF at the end of the file
+    if (reader->position == reader->length) {
+        reader->length = fread(reader->buffer, sizeof(char), BINARY_MAF_READ_BUFFER_SIZE, reader->fileHandle);
+        reader->position = 0;
+        if (reader->length == 0) {
+            return EOF;
+        }
+    }
+    return reader->buffer[reader->position++];
+}
+
+static int readByte2(BinaryMafReader *reader) {
+    int c = readByte(reader);
+    if (c == EOF) {
+        st_errAbort("The binary MAF is truncated\n");
+    }
+    return c;
+}
+
+static uint64_t readVarint(BinaryMafReader *reader) {
+    uint64_t i = 0;
+    for (int64_t shift = 0;; shift += 7) {
+        int c = readByte2(reader);
+        i |= ((uint64_t) (c & 0x7f)) << shift;
+        if (!(c & 0x80)) {
+            return i;
+        }
+    }
+}
+
+static char *readString(BinaryMafReader *reader, char **string, int64_t *maxLength) {
+    /*
+     * Reads a NUL terminated string into the growable buffer *string.
+     */
+    int64_t length = 0;
+    while (1) {
+        if (length == *maxLength) {
+            *maxLength = 2 * *maxLength + 64;
+            *string = realloc(*string, *maxLength);
+            if (*string == NULL) {
+                st_errAbort("Ran out of memory reading a binary MAF\n");
+            }
+        }
+        char c = readByte2(reader);
+        (*string)[length++] = c;
+        if (c == '\0') {
+            return *string;
+        }
+    }
+}
+
+void binaryMaf_convertToMaf(FILE *input, FILE *output) {
+    BinaryMafReader reader = { input, st_malloc(BINARY_MAF_READ_BUFFER_SIZE), 0, 0 };
+    MafWriter *mafWriter = mafWriter_construct(output);
+    char *string = NULL, *text = NULL;
+    int64_t maxStringLength = 0, maxTextLength = 0;
+    int64_t *runs = NULL;
+    int64_t maxRunNumber = 0;
+    //The header
+    for (int64_t i = 0; i < strlen(BINARY_MAF_MAGIC); i++) {
+        if (readByte(&reader) != BINARY_MAF_MAGIC[i]) {
+            st_errAbort("The input is not a binary MAF\n");
+        }
+    }
+    mafWriter_writeHeader(mafWriter, readString(&reader, &string, &maxStringLength));
+    int64_t sequenceNumber = readVarint(&reader);
+    char **sequenceHeaders = st_malloc(sizeof(char *) * (sequenceNumber + 1));
+    int64_t *sequenceLengths = st_malloc(sizeof(int64_t) * (sequenceNumber + 1));
+    for (int64_t i = 0; i < sequenceNumber; i++) {
+        sequenceHeaders[i] = stString_copy(readString(&reader, &string, &maxStringLength));
+        sequenceLengths[i] = readVarint(&reader);
+    }
+    //The blocks
+    int c;
+    while ((c = readByte(&reader)) != EOF) {
+        if (c != 'a') {
+            st_errAbort("Expected a block record in the binary MAF\n");
+        }
+        mafWriter_writeString(mafWriter, "a score=");
+        mafWriter_writeInt(mafWriter, readVarint(&reader));
+        c = readByte2(&reader);
+        if (c == 't') {
+            mafWriter_writeString(mafWriter, " tree='");
+            mafWriter_writeString(mafWriter, readString(&reader, &string, &maxStringLength));
+            mafWriter_writeChar(mafWriter, '\'');
+            c = readByte2(&reader);
+        }
+        mafWriter_writeChar(mafWriter, '\n');
+        for (; c != '\n'; c = readByte2(&reader)) {
+            if (c != 's') {
+                st_errAbort("Expected a row record in the binary MAF\n");
+            }
+            int64_t sequence = readVarint(&reader);
+            if (sequence >= sequenceNumber) {
+                st_errAbort("A row of the binary MAF has sequence %" PRIi64 " of %" PRIi64 "\n", sequence, sequenceNumber);
+            }
+            int64_t start = readVarint(&reader);
+            int64_t length = readVarint(&reader);
+            int flags = readByte2(&reader);
+            //The gap runs, as pairs of the number of bases before the run and its length
+            int64_t runNumber = flags & BINARY_MAF_GAPS ? readVarint(&reader) : 0;
+            if (runNumber > maxRunNumber) {
+                maxRunNumber = 2 * runNumber;
+                free(runs);
+                runs = st_malloc(sizeof(int64_t) * 2 * maxRunNumber);
+            }
+            int64_t textLength = length;
+            for (int64_t j = 0; j < runNumber; j++) {
+                runs[2 * j] = readVarint(&reader) + (j > 0 ? runs[2 * (j - 1)] : 0);
+                runs[2 * j + 1] = readVarint(&reader);
+                textLength += runs[2 * j + 1];
+            }
+            if (textLength + 1 > maxTextLength) {
+                maxTextLength = 2 * (textLength + 1);
+                free(text);
+                text = st_malloc(maxTextLength);
+            }
+            //Unpack the bases, inserting the gap runs
+            int64_t basesPerByte = flags & BINARY_MAF_FOUR_BIT ? 2 : 4;
+            int64_t bitsPerBase = flags & BINARY_MAF_FOUR_BIT ? 4 : 2;
+            int64_t exceptionNumber = 0, k = 0, run = 0, byte = 0;
+            for (int64_t j = 0; j < length; j++) {
+                while (run < runNumber && runs[2 * run] == j) {
+                    memset(text + k, '-', runs[2 * run + 1]);
+                    k += runs[2 * run++ + 1];
+                }
+                if (j % basesPerByte == 0) {
+                    byte = readByte2(&reader);
+                }
+                int64_t code = (byte >> (bitsPerBase * (j % basesPerByte))) & ((1 << bitsPerBase) - 1);
+                if (code == BINARY_MAF_EXCEPTION) {
+                    exceptionNumber++;
+                    text[k++] = '\0'; //Filled in from the exceptions below
+                } else if (code > 10) {
+                    st_errAbort("A row of the binary MAF has the unknown base code %" PRIi64 "\n", code);
+                } else {
+                    text[k++] = fourBitCodes[code];
+                }
+            }
+            while (run < runNumber) { //Trailing gaps
+                memset(text + k, '-', runs[2 * run + 1]);
+                k += runs[2 * run++ + 1];
+            }
+            assert(k == textLength);
+            text[textLength] = '\0';
+            for (int64_t j = 0; exceptionNumber > 0; j++) {
+                if (text[j] == '\0') {
+                    text[j] = readByte2(&reader);
+                    exceptionNumber--;
+                }
+            }
+            mafWriter_writeSRow(mafWriter, sequenceHeaders[sequence], start, length,
+                    flags & BINARY_MAF_POSITIVE_STRAND ? '+' : '-', sequenceLengths[sequence], text);
+        }
+        mafWriter_writeChar(mafWriter, '\n');
+    }
+    mafWriter_destruct(mafWriter);
+    for (int64_t i = 0; i < sequenceNumber; i++) {
+        free(sequenceHeaders[i]);
+    }
+    free(sequenceHeaders);
+    free(sequenceLengths);
+    free(string);
+    free(text);
+    free(runs);
+    free(reader.buffer);
+}
@@ -0,0 +1,58 @@
+/*
+ * binaryMaf.h
+ *
+ *  Created on: 17 Oct 2026
+ */
+
+#ifndef BINARY_MAF_H_
+#define BINARY_MAF_H_
+
+/*
+ * A compact binary equivalent of MAF, which converts back to the MAF cactus_MAFGenerator writes.
+ * Integers are unsigned LEB128 varints and strings are NUL terminated.
+ *
+ * Header: the magic BINARY_MAF_MAGIC, the newick event tree, the number of sequences, then for
+ * each sequence (numbered from 0 in this order) its header and length.
+ *
+ * Then to the end of the file, block records: the byte 'a' and the score, optionally the byte 't'
+ * and the newick tree of the block, then the rows, each the byte 's', then the sequence number, start
+ * and number of bases (as in the MAF 's' line) and a flags byte (BINARY_MAF_*), and finally the byte
+ * '\n'. With gaps, the number of gap runs follows the flags, each run given as the number of bases
+ * since the previous run and its length. The bases follow, four to a byte in 2 bits if they are all
+ * ACGT, otherwise two to a byte in 4 bits (ACGTacgtNn*, and 15 for any other character, these being
+ * listed in order after the bases).
+ */
+
+#define BINARY_MAF_MAGIC "CMAFB001"
+
+#define BINARY_MAF_POSITIVE_STRAND 1
+#define BINARY_MAF_FOUR_BIT 2
+#define BINARY_MAF_GAPS 4
+
+void binaryMaf_writeHeader(MafWriter *mafWriter, const char *eventTreeString, int64_t sequenceNumber,
+        const char **sequenceHeaders, const int64_t *sequenceLengths);
+
+void binaryMaf_writeBlockStart(MafWriter *mafWriter, int64_t score);
+
+/*
+ * Starts the tree of the block, which is then written with mafWriter_writeString (including the
+ * ';'), and ended with binaryMaf_writeBlockTreeEnd.
+ */
+void binaryMaf_writeBlockTreeStart(MafWriter *mafWriter);
+
+void binaryMaf_writeBlockTreeEnd(MafWriter *mafWriter);
+
+/*
+ * Writes a row of the block, text being the alignment row as in the MAF, of textLength columns.
+ */
+void binaryMaf_writeRow(MafWriter *mafWriter, int64_t sequence, int64_t start, int64_t length,
+        bool strand, const char *text, int64_t textLength);
+
+void binaryMaf_writeBlockEnd(MafWriter *mafWriter);
+
+/*
+ * Converts a binary MAF to MAF, one block at a time.
+ */
+void binaryMaf_convertToMaf(FILE *input, FILE *output);
+
+#endif /* BINARY_MAF_H_ */
@@ -12,14 +12,119 @@ void getMAFBlock(Block *block, FILE *fileHandle);
 
 void getMAFBlockShowingOnlySubstitutionsWithRespectToTheReference(Block *block, FILE *fileHandle);
 
+/*
+ * As getMAFBlock and getMAFBlockShowingOnlySubstitutionsWithRespectToTheReference, writing the
+ * block in the binary MAF format (see binaryMaf.h), after a header written by makeBinaryMAFHeader.
+ */
+void getBinaryMAFBlock(Block *block, FILE *fileHandle);
+
+void getBinaryMAFBlockShowingOnlySubstitutionsWithRespectToTheReference(Block *block, FILE *fileHandle);
+
 void getMAFsReferenceOrdered2(const char *referenceEventName, Flower *flower,
         FILE *fileHandle, void(*getMafBlockFn)(Block *, FILE *));
 
+/*
+ * As getMAFsReferenceOrdered2, sharing the reference threads between workerNumber worker processes.
+ */
+void getMAFsReferenceOrdered3(const char *referenceEventName, Flower *flower,
+        FILE *fileHandle, void(*getMafBlockFn)(Block *, FILE *), int64_t workerNumber);
+
+/*
+ * As getMAFsReferenceOrdered3, also writing to indexFileHandle, if not NULL, a line for each block
+ * giving the reference sequence, the start and end of the block on the reference and the
+ * offset of the block in the output, tab separated. The offset is as given by ftell on the
+ * output, so it is the uncompressed offset of BGZF output. See cactus_MAFQuery.
+ */
+void getMAFsReferenceOrdered4(const char *referenceEventName, Flower *flower,
+        FILE *fileHandle, void(*getMafBlockFn)(Block *, FILE *), int64_t workerNumber, FILE *indexFileHandle);
+
+/*
+ * The index ends with a table of the runs of consecutive lines of each sequence, so a query can
+ * seek straight to the lines of its sequence. Each run is a line of MAF_INDEX_SEQUENCE, the
+ * sequence, the offsets in the index of the first line of the run and of the line after it, and
+ * 1 if the lines of the run are in order of start and end (so can be binary searched) else 0, tab
+ * separated. The last line is MAF_INDEX_SEQUENCE_TABLE and the offset of the first run line, in
+ * MAF_INDEX_SEQUENCE_TABLE_DIGITS digits, so the table is found from the end of the index.
+ */
+#define MAF_INDEX_SEQUENCE "#sequence"
+#define MAF_INDEX_SEQUENCE_TABLE "#sequenceTable"
+#define MAF_INDEX_SEQUENCE_TABLE_DIGITS 20
+
+/*
+ * Appends the sequence table to the index written by getMAFsReferenceOrdered4, which must be
+ * open for reading as well as writing.
+ */
+void writeMafIndexSequenceTable(FILE *indexFileHandle);
+
+/*
+ * As getMAFsReferenceOrdered2, for only the blocks whose segment of the sequence with the given
+ * header, a sequence of the reference event, overlaps start to end (zero based, half open, relative
+ * to the start of the sequence). The first block is found through the coordinate index and the
+ * traversal stops after the region, so only the part of the reference thread in the region is walked.
+ * The index, and the cache of the levels of the caps walked (may be NULL), can be shared by any
+ * number of regions.
+ */
+void getMAFsForReferenceRegion(const char *referenceEventName, Flower *flower, CapCoordinateIndex *capCoordinateIndex,
+        CapLevelCache *capLevelCache, const char *sequenceHeader, int64_t start, int64_t end, FILE *fileHandle,
+        void(*getMafBlockFn)(Block *, FILE *));
+
 void getMAFsReferenceOrdered(Flower *flower,
         FILE *fileHandle, void(*getMafBlockFn)(Block *, FILE *));
 
 void getMAFs(Flower *flower, FILE *fileHandle, void (*getMafBlock)(Block *, FILE *));
 
+/*
+ * As getMAFs, sharing the flowers of the subtree between workerNumber worker processes. The
+ * output is identical to that of getMAFs.
+ */
+void getMAFs2(Flower *flower, FILE *fileHandle, void (*getMafBlock)(Block *, FILE *), int64_t workerNumber);
+
+/*
+ * As getMAFsReferenceOrdered2, or as getMAFs if referenceEventName is NULL, also writing a manifest
+ * to manifestFileHandle giving a hash of the blocks of each unit of the output (each reference
+ * thread, or the top level flower's own blocks and each of its nested flowers' subtrees) and the
+ * byte range of its MAF. The MAF of each unit whose key and hash are in the previous manifest is
+ * copied from the previous MAF, plain or BGZF with a .gzi index, rather than rendered. The
+ * outputDescription (the options affecting the output) must match that of the previous manifest
+ * for any unit to be copied. The previous MAF must not be the output file. The levels of the caps
+ * of the reference threads, each walked to hash it and again to render it, are looked up in the
+ * cache if it is not NULL.
+ */
+void getMAFsIncremental(const char *referenceEventName, Flower *flower, FILE *fileHandle,
+        void(*getMafBlockFn)(Block *, FILE *), const char *outputDescription,
+        const char *previousMAFFile, const char *previousManifestFile, FILE *manifestFileHandle,
+        CapLevelCache *capLevelCache);
+
 void makeMAFHeader(Flower *flower, FILE *fileHandle);
 
+/*
+ * As makeMAFHeader, for a binary MAF, numbering the sequences of the flower for the binary blocks.
+ */
+void makeBinaryMAFHeader(Flower *flower, FILE *fileHandle);
+
+/*
+ * As getMAFBlock, for a block of a snapshot (see cactusSnapshot.h).
+ */
+void getMAFBlockFromSnapshot(CactusSnapshot *snapshot, int64_t block, FILE *fileHandle);
+
+/*
+ * As getMAFs, for all the blocks of a snapshot.
+ */
+void getMAFsFromSnapshot(CactusSnapshot *snapshot, FILE *fileHandle);
+
+/*
+ * As getMAFs2, for all the blocks of a snapshot. The output is identical to that of getMAFsFromSnapshot.
+ */
+void getMAFsFromSnapshot2(CactusSnapshot *snapshot, FILE *fileHandle, int64_t workerNumber);
+
+/*
+ * As getMAFsReferenceOrdered3 with getMAFBlock, or with
+ * getMAFBlockShowingOnlySubstitutionsWithRespectToTheReference if showOnlySubstitutionsWithRespectToTheReference
+ * is non-zero, for a snapshot, giving the same output as for the flowers it was written from.
+ */
+void getMAFsReferenceOrderedFromSnapshot(const char *referenceEventName, CactusSnapshot *snapshot, FILE *fileHandle,
+        bool showOnlySubstitutionsWithRespectToTheReference, int64_t workerNumber);
+
+void makeMAFHeaderFromSnapshot(CactusSnapshot *snapshot, FILE *fileHandle);
+
 #endif /* MAFS_H_ */
@@ -16,7 +16,12 @@
 #include "avl.h"
 #include "commonC.h"
 #include "hashTableC.h"
+#include "cactusSnapshot.h"
+#include "cactusTraversal.h"
+#include "cactusParallel.h"
 #include "cactusMafs.h"
+#include "mafWriter.h"
+#include "bgzfFile.h"
 #include "cactusUtils.h"
 //#include "cactus_addReferenceSeq.h"
 
@@ -34,6 +39,105 @@ static void usage() {
     fprintf(stderr, "-h --help : Print this help screen\n");
     fprintf(stderr,
             "-i --showOnlySubstitutionsWithRespectToTheReference : Display only substitutions with respect to the reference.\n");
+    fprintf(stderr,
+            "-j --workerNumber : The number of worker processes the reference threads, or without a reference the flowers, are shared between, by default 1.\n");
+    fprintf(stderr,
+            "-p --prefetch : Load the whole flower subtree from the disk in batches up front, rather than one flower at a time during the traversal.\n");
+    fprintf(stderr,
+            "-s --snapshot : Read the blocks from a snapshot written by cactus_snapshotExport, rather than the database.\n");
+    fprintf(stderr,
+            "-z --bgzf : Write the MAF block gzip compressed (BGZF), readable by gzip, bgzip and tabix.\n");
+    fprintf(stderr,
+            "-t --compressionThreadNumber : The number of threads compressing BGZF output while the blocks are generated, by default 4.\n");
+    fprintf(stderr,
+            "-r --region : Only output the blocks of the reference thread overlapping a region of a reference sequence, given as sequence:start-end, zero based and half open. May be given more than once.\n");
+    fprintf(stderr,
+            "-b --regionBedFile : As --region, for each region of a BED file.\n");
+    fprintf(stderr,
+            "-y --manifestFile : Write a manifest of the hash and byte range of each reference thread's blocks (or without a reference each top level subtree's) to this file, for regenerating the MAF incrementally. With --bgzf a .gzi index is written alongside the output file.\n");
+    fprintf(stderr,
+            "-u --previousMafFile : With --manifestFile, copy the blocks of the threads or subtrees unchanged since this MAF from it, rather than rendering them. Must not be the output file.\n");
+    fprintf(stderr,
+            "-v --previousManifestFile : The manifest written with the previous MAF.\n");
+    fprintf(stderr,
+            "-x --indexFile : Write an index of the blocks by reference coordinates to this file, ending with a table of where the blocks of each sequence are in it, for cactus_MAFQuery. Needs a reference event. With --bgzf a .gzi index of the compressed blocks is written alongside the output file.\n");
+    fprintf(stderr,
+            "-l --capLevelCacheSize : The number of caps whose levels are cached while regions or the reference threads of an incremental MAF are walked, 0 for none, by default %i.\n", CAP_LEVEL_CACHE_SIZE);
+    fprintf(stderr,
+            "-f --format : The output format, maf (the default) or binary, a compact binary MAF converted back to MAF by cactus_binaryMAFToMAF. Binary MAFs are not regenerated incrementally.\n");
+}
+
+typedef struct _region {
+    char *sequenceHeader;
+    int64_t start;
+    int64_t end;
+} Region;
+
+static Region *region_construct(const char *sequenceHeader, int64_t start, int64_t end) {
+    if (start < 0 || start > end) {
+        st_errAbort("The region %s:%" PRIi64 "-%" PRIi64 " is not valid\n", sequenceHeader, start, end);
+    }
+    Region *region = st_malloc(sizeof(Region));
+    region->sequenceHeader = stString_copy(sequenceHeader);
+    region->start = start;
+    region->end = end;
+    return region;
+}
+
+static void region_destruct(Region *region) {
+    free(region->sequenceHeader);
+    free(region);
+}
+
+static Region *parseRegion(const char *regionString) {
+    /*
+     * Parses sequence:start-end, splitting at the last ':' as sequence headers may contain them.
+     */
+    const char *colon = strrchr(regionString, ':');
+    int64_t start, end;
+    if (colon == NULL || sscanf(colon + 1, "%" SCNi64 "-%" SCNi64 "", &start, &end) != 2) {
+        st_errAbort("Could not parse the region %s, expected sequence:start-end\n", regionString);
+    }
+    char *sequenceHeader = stString_getSubString(regionString, 0, colon - regionString);
+    Region *region = region_construct(sequenceHeader, start, end);
+    free(sequenceHeader);
+    return region;
+}
+
+static void parseRegionBedFile(const char *regionBedFile, stList *regions) {
+    FILE *fileHandle = fopen(regionBedFile, "r");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open the region BED file %s\n", regionBedFile);
+    }
+    char *line;
+    while ((line = stFile_getLineFromFile(fileHandle)) != NULL) {
+        stList *tokens = stString_split(line);
+        if (stList_length(tokens) > 0 && strcmp(stList_get(tokens, 0), "track") != 0 && strcmp(stList_get(tokens, 0), "browser") != 0
+                && ((char *)stList_get(tokens, 0))[0] != '#') {
+            int64_t start, end;
+            if (stList_length(tokens) < 3 || sscanf(stList_get(tokens, 1), "%" SCNi64 "", &start) != 1
+                    || sscanf(stList_get(tokens, 2), "%" SCNi64 "", &end) != 1) {
+                st_errAbort("Could not parse the BED line %s\n", line);
+            }
+            stList_append(regions, region_construct(stList_get(tokens, 0), start, end));
+        }
+        stList_destruct(tokens);
+        free(line);
+    }
+    fclose(fileHandle);
+}
+
+static FILE *openOutputFile(const char *outputFile, bool bgzf, int64_t compressionThreadNumber, bool index) {
+    char *gziFile = bgzf && index ? stString_print("%s.gzi", outputFile) : NULL;
+    FILE *fileHandle = bgzf ? bgzfFile_open(outputFile, gziFile, compressionThreadNumber) : fopen(outputFile, "w");
+    if (gziFile != NULL) {
+        free(gziFile);
+    }
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open the output file %s\n", outputFile);
+    }
+    setvbuf(fileHandle, NULL, _IOFBF, MAF_WRITER_BUFFER_SIZE);
+    return fileHandle;
 }
 
 int main(int argc, char *argv[]) {
@@ -46,6 +150,18 @@ int main(int argc, char *argv[]) {
     char * outputFile = NULL;
     char *referenceEventString = (char *)cactusMisc_getDefaultReferenceEventHeader();
     bool showOnlySubstitutionsWithRespectToTheReference = 0;
+    int64_t workerNumber = 1;
+    bool prefetch = 0;
+    char *snapshotFile = NULL;
+    bool bgzf = 0;
+    int64_t compressionThreadNumber = 4;
+    char *indexFile = NULL;
+    stList *regions = stList_construct3(0, (void (*)(void *))region_destruct);
+    char *manifestFile = NULL;
+    char *previousMafFile = NULL;
+    char *previousManifestFile = NULL;
+    bool binary = 0;
+    int64_t capLevelCacheSize = CAP_LEVEL_CACHE_SIZE;
 
     ///////////////////////////////////////////////////////////////////////////
     // (0) Parse the inputs handed by genomeCactus.py / setup stuff.
@@ -58,11 +174,24 @@ int main(int argc, char *argv[]) {
                 "outputFile", required_argument, 0, 'e' }, {
                 "referenceEventString", optional_argument, 0, 'g' }, { "help",
                 no_argument, 0, 'h' },
-                { "showOnlySubstitutionsWithRespectToTheReference", no_argument, 0, 'i' }, { 0, 0, 0, 0 } };
+                { "showOnlySubstitutionsWithRespectToTheReference", no_argument, 0, 'i' },
+                { "workerNumber", required_argument, 0, 'j' },
+                { "prefetch", no_argument, 0, 'p' },
+                { "snapshot", required_argument, 0, 's' },
+                { "bgzf", no_argument, 0, 'z' },
+                { "compressionThreadNumber", required_argument, 0, 't' },
+                { "indexFile", required_argument, 0, 'x' },
+                { "region", required_argument, 0, 'r' },
+                { "regionBedFile", required_argument, 0, 'b' },
+                { "manifestFile", required_argument, 0, 'y' },
+                { "previousMafFile", required_argument, 0, 'u' },
+                { "previousManifestFile", required_argument, 0, 'v' },
+                { "capLevelCacheSize", required_argument, 0, 'l' },
+                { "format", required_argument, 0, 'f' }, { 0, 0, 0, 0 } };
 
         int option_index = 0;
 
-        int key = getopt_long(argc, argv, "a:c:d:e:g:hi", long_options,
+        int key = getopt_long(argc, argv, "a:c:d:e:g:hij:ps:zt:x:r:b:y:u:v:l:f:", long_options,
                 &option_index);
 
         if (key == -1) {
@@ -91,6 +220,55 @@ int main(int argc, char *argv[]) {
             case 'i':
                 showOnlySubstitutionsWithRespectToTheReference = 1;
                 break;
+            case 'j':
+                if (sscanf(optarg, "%" SCNi64 "", &workerNumber) != 1) {
+                    st_errAbort("Could not parse the worker number %s\n", optarg);
+                }
+                break;
+            case 'p':
+                prefetch = 1;
+                break;
+            case 's':
+                snapshotFile = stString_copy(optarg);
+                break;
+            case 'z':
+                bgzf = 1;
+                break;
+            case 't':
+                if (sscanf(optarg, "%" SCNi64 "", &compressionThreadNumber) != 1) {
+                    st_errAbort("Could not parse the compression thread number %s\n", optarg);
+                }
+                break;
+            case 'x':
+                indexFile = stString_copy(optarg);
+                break;
+            case 'r':
+                stList_append(regions, parseRegion(optarg));
+                break;
+            case 'b':
+                parseRegionBedFile(optarg, regions);
+                break;
+            case 'y':
+                manifestFile = stString_copy(optarg);
+                break;
+            case 'u':
+                previousMafFile = stString_copy(optarg);
+                break;
+            case 'v':
+                previousManifestFile = stString_copy(optarg);
+                break;
+            case 'l':
+                if (sscanf(optarg, "%" SCNi64 "", &capLevelCacheSize) != 1 || capLevelCacheSize < 0) {
+                    st_errAbort("Could not parse the cap level cache size %s\n", optarg);
+                }
+                break;
+            case 'f':
+                if (strcmp(optarg, "binary") == 0) {
+                    binary = 1;
+                } else if (strcmp(optarg, "maf") != 0) {
+                    st_errAbort("Unknown output format %s, expected maf or binary\n", optarg);
+                }
+                break;
             default:
                 usage();
                 return 1;
@@ -101,8 +279,20 @@ int main(int argc, char *argv[]) {
     // (0) Check the inputs.
     ///////////////////////////////////////////////////////////////////////////
 
-    assert(flowerName != NULL);
+    assert(flowerName != NULL || snapshotFile != NULL);
     assert(outputFile != NULL);
+    if ((previousMafFile != NULL || previousManifestFile != NULL) && manifestFile == NULL) {
+        st_errAbort("A previous MAF is only used with --manifestFile\n");
+    }
+    if (previousMafFile != NULL && strcmp(previousMafFile, outputFile) == 0) {
+        st_errAbort("The previous MAF %s can not be the output file\n", previousMafFile);
+    }
+    if (manifestFile != NULL && (indexFile != NULL || stList_length(regions) > 0 || snapshotFile != NULL)) {
+        st_errAbort("A manifest can not be written with an index, regions or a snapshot\n");
+    }
+    if (manifestFile != NULL && binary) { //Binary rows number the sequences, which a copied unit would keep as sequences come and go
+        st_errAbort("A manifest can not be written with the binary format\n");
+    }
 
     //////////////////////////////////////////////
     //Set up logging
@@ -116,6 +306,37 @@ int main(int argc, char *argv[]) {
 
     st_logInfo("Flower name : %s\n", flowerName);
     st_logInfo("Output MAF file : %s\n", outputFile);
+    st_logInfo("Worker number : %" PRIi64 "\n", workerNumber);
+
+    //////////////////////////////////////////////
+    //Read the blocks from a snapshot, without the database
+    //////////////////////////////////////////////
+
+    if (snapshotFile != NULL) {
+        st_logInfo("Snapshot file : %s\n", snapshotFile);
+        int64_t startTime = time(NULL);
+        CactusSnapshot *snapshot = cactusSnapshot_open(snapshotFile);
+        if (indexFile != NULL || stList_length(regions) > 0) {
+            st_errAbort("An index or regions can not be written from a snapshot\n");
+        }
+        if (binary) {
+            st_errAbort("Binary MAFs can not be written from a snapshot\n");
+        }
+        FILE *fileHandle = openOutputFile(outputFile, bgzf, compressionThreadNumber, 0);
+        makeMAFHeaderFromSnapshot(snapshot, fileHandle);
+        if (cactusSnapshot_getEventByHeader(snapshot, referenceEventString) == NULL_NAME) {
+            st_logInfo("No reference event found, so not ordering by reference\n");
+            getMAFsFromSnapshot2(snapshot, fileHandle, workerNumber);
+        } else {
+            st_logInfo("Ordering by reference by string %s\n", referenceEventString);
+            getMAFsReferenceOrderedFromSnapshot(referenceEventString, snapshot, fileHandle,
+                    showOnlySubstitutionsWithRespectToTheReference, workerNumber);
+        }
+        fclose(fileHandle);
+        cactusSnapshot_close(snapshot);
+        st_logInfo("Got the mafs from the snapshot in %" PRIi64 " seconds/\n", time(NULL) - startTime);
+        return 0;
+    }
 
     //////////////////////////////////////////////
     //Load the database
@@ -124,43 +345,114 @@ int main(int argc, char *argv[]) {
     stKVDatabaseConf *kvDatabaseConf = stKVDatabaseConf_constructFromString(
             cactusDiskDatabaseString);
     CactusDisk *cactusDisk = cactusDisk_construct(kvDatabaseConf, 0);
+    parallelOrderedMap_setDatabaseString(cactusDiskDatabaseString); //The workers fetch sequences on their own connections
     st_logInfo("Set up the flower disk\n");
 
     ///////////////////////////////////////////////////////////////////////////
     // Parse the basic reconstruction problem
     ///////////////////////////////////////////////////////////////////////////
 
-    Flower *flower = cactusDisk_getFlower(cactusDisk, cactusMisc_stringToName(
+    Flower *flower = getFlower(cactusDisk, cactusMisc_stringToName(
             flowerName));
     st_logInfo("Parsed the top level flower of the cactus tree to check\n");
+    if (prefetch) {
+        prefetchFlowerSubtree(flower, PREFETCH_BATCH_SIZE);
+    }
 
     ///////////////////////////////////////////////////////////////////////////
     // Recursive check the flowers.
     ///////////////////////////////////////////////////////////////////////////
 
     int64_t startTime = time(NULL);
-    FILE *fileHandle = fopen(outputFile, "w");
-    makeMAFHeader(flower, fileHandle);
+    CapLevelCache *capLevelCache = capLevelCacheSize > 0 ? capLevelCache_construct(capLevelCacheSize) : NULL;
+    FILE *fileHandle = openOutputFile(outputFile, bgzf, compressionThreadNumber, indexFile != NULL || manifestFile != NULL);
+    if (binary) {
+        makeBinaryMAFHeader(flower, fileHandle);
+    } else {
+        makeMAFHeader(flower, fileHandle);
+    }
+    FILE *manifestFileHandle = NULL;
+    char *outputDescription = NULL;
+    if (manifestFile != NULL) {
+        st_logInfo("Manifest file : %s\n", manifestFile);
+        manifestFileHandle = fopen(manifestFile, "w");
+        if (manifestFileHandle == NULL) {
+            st_errAbort("Could not open the manifest file %s\n", manifestFile);
+        }
+        if (workerNumber > 1) {
+            st_logInfo("The MAFs are regenerated incrementally by one worker\n");
+        }
+        outputDescription = stString_print("referenceEventString=%s showOnlySubstitutionsWithRespectToTheReference=%i",
+                referenceEventString, (int) showOnlySubstitutionsWithRespectToTheReference);
+    }
+    FILE *indexFileHandle = NULL;
+    if (indexFile != NULL) {
+        st_logInfo("Index file : %s\n", indexFile);
+        indexFileHandle = fopen(indexFile, "w+"); //Read back for the sequence table
+        if (indexFileHandle == NULL) {
+            st_errAbort("Could not open the index file %s\n", indexFile);
+        }
+    }
 
     if(eventTree_getEventByHeader(flower_getEventTree(flower), referenceEventString) == NULL) {
         st_logInfo("No reference event found, so not ordering by reference\n", referenceEventString);
-        getMAFs(flower, fileHandle, getMAFBlock);
+        if (indexFileHandle != NULL || stList_length(regions) > 0) {
+            st_errAbort("No reference event %s found to index the blocks by or to take the regions from\n", referenceEventString);
+        }
+        void (*getMafBlockFn)(Block *, FILE *) = binary ? getBinaryMAFBlock : getMAFBlock;
+        if (manifestFileHandle != NULL) {
+            getMAFsIncremental(NULL, flower, fileHandle, getMafBlockFn, outputDescription, previousMafFile,
+                    previousManifestFile, manifestFileHandle, NULL);
+        } else {
+            getMAFs2(flower, fileHandle, getMafBlockFn, workerNumber);
+        }
     }
     else {
         st_logInfo("Ordering by reference by string %s\n", referenceEventString);
-        if(showOnlySubstitutionsWithRespectToTheReference) {
-            getMAFsReferenceOrdered2(referenceEventString, flower, fileHandle, getMAFBlockShowingOnlySubstitutionsWithRespectToTheReference);
+        void (*getMafBlockFn)(Block *, FILE *) = showOnlySubstitutionsWithRespectToTheReference ?
+                (binary ? getBinaryMAFBlockShowingOnlySubstitutionsWithRespectToTheReference :
+                        getMAFBlockShowingOnlySubstitutionsWithRespectToTheReference) :
+                (binary ? getBinaryMAFBlock : getMAFBlock);
+        if (stList_length(regions) > 0) {
+            if (indexFileHandle != NULL) {
+                st_errAbort("Indexing the blocks of regions is not supported\n");
+            }
+            //Only the parts of the reference threads in the regions are traversed, from caps found by coordinate
+            CapCoordinateIndex *capCoordinateIndex = capCoordinateIndex_construct(
+                    event_getName(eventTree_getEventByHeader(flower_getEventTree(flower), referenceEventString)));
+            for (int64_t j = 0; j < stList_length(regions); j++) {
+                Region *region = stList_get(regions, j);
+                getMAFsForReferenceRegion(referenceEventString, flower, capCoordinateIndex, capLevelCache, region->sequenceHeader,
+                        region->start, region->end, fileHandle, getMafBlockFn);
+            }
+            capCoordinateIndex_destruct(capCoordinateIndex);
+        } else if (manifestFileHandle != NULL) {
+            getMAFsIncremental(referenceEventString, flower, fileHandle, getMafBlockFn, outputDescription, previousMafFile,
+                    previousManifestFile, manifestFileHandle, capLevelCache);
         } else {
-            getMAFsReferenceOrdered2(referenceEventString, flower, fileHandle, getMAFBlock);
+            getMAFsReferenceOrdered4(referenceEventString, flower, fileHandle, getMafBlockFn, workerNumber, indexFileHandle);
         }
     }
     fclose(fileHandle);
+    if (indexFileHandle != NULL) {
+        writeMafIndexSequenceTable(indexFileHandle);
+        fclose(indexFileHandle);
+    }
+    if (manifestFileHandle != NULL) {
+        fclose(manifestFileHandle);
+        free(outputDescription);
+    }
+    if (capLevelCache != NULL) {
+        capLevelCache_destruct(capLevelCache);
+    }
     st_logInfo("Got the mafs in %" PRIi64 " seconds/\n", time(NULL) - startTime);
+    logLoadedFlowerNumber();
 
     ///////////////////////////////////////////////////////////////////////////
     // Clean up.
     ///////////////////////////////////////////////////////////////////////////
 
+    stList_destruct(regions);
     cactusDisk_destruct(cactusDisk);
     stKVDatabaseConf_destruct(kvDatabaseConf);
 
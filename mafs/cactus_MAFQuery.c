@@ -0,0 +1,369 @@
+/*
+ * cactus_MAFQuery.c
+ *
+ *  Created on: 17 Oct 2026
+ */
+
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "cactus.h"
+#include "sonLib.h"
+#include "bgzfFile.h"
+#include "cactusTraversal.h"
+#include "cactusSnapshot.h"
+#include "cactusMafs.h" //For the format of the index
+
+static void usage() {
+    fprintf(stderr, "cactus_MAFQuery, version 0.1\n");
+    fprintf(stderr, "-a --logLevel : Set the log level\n");
+    fprintf(stderr, "-m --mafFile : The MAF file written by cactus_MAFGenerator, plain or BGZF.\n");
+    fprintf(stderr, "-x --indexFile : The index of the MAF file written by cactus_MAFGenerator --indexFile.\n");
+    fprintf(stderr, "-g --gziFile : The .gzi index of a BGZF MAF file, by default the MAF file name with .gzi appended.\n");
+    fprintf(stderr,
+            "-r --region : The reference region to get the blocks of, as sequence:start-end, zero based and half open, or just sequence for all of it.\n");
+    fprintf(stderr, "-e --outputFile : The file to write the MAF header and the blocks in, by default stdout.\n");
+    fprintf(stderr, "-h --help : Print this help screen\n");
+}
+
+static void parseRegion(const char *region, char **sequence, int64_t *start, int64_t *end) {
+    /*
+     * Parses sequence:start-end, splitting at the last ':' as sequence headers may contain them.
+     */
+    const char *colon = strrchr(region, ':');
+    int64_t i, j;
+    if (colon != NULL && sscanf(colon + 1, "%" SCNi64 "-%" SCNi64 "", &i, &j) == 2) {
+        *sequence = stString_getSubString(region, 0, colon - region);
+        *start = i;
+        *end = j;
+    } else {
+        *sequence = stString_copy(region);
+        *start = 0;
+        *end = INT64_MAX;
+    }
+    if (*start < 0 || *start > *end) {
+        st_errAbort("The region %s is not valid\n", region);
+    }
+}
+
+static void copyRange(FILE *mafFileHandle, const char *mafFile, const char *gziFile, int64_t start, int64_t end,
+        FILE *output) {
+    /*
+     * Copies the bytes of the MAF from start up to end, or to the end of the file if end is -1.
+     */
+    if (gziFile != NULL) {
+        bgzfFile_copyRange(mafFile, gziFile, start, end, output);
+        return;
+    }
+    if (fseek(mafFileHandle, start, SEEK_SET) != 0) {
+        st_errAbort("Could not seek to %" PRIi64 " in the MAF file %s\n", start, mafFile);
+    }
+    char buffer[65536];
+    for (int64_t i = start; end == -1 || i < end;) {
+        size_t j = end == -1 || end - i > sizeof(buffer) ? sizeof(buffer) : end - i;
+        size_t k = fread(buffer, sizeof(char), j, mafFileHandle);
+        if (k == 0) {
+            break;
+        }
+        fwrite(buffer, sizeof(char), k, output);
+        i += k;
+    }
+}
+
+typedef struct _indexEntry {
+    int64_t start;
+    int64_t end;
+    int64_t offset; //Of the block in the MAF
+} IndexEntry;
+
+static char *readIndexEntry(FILE *indexFileHandle, IndexEntry *entry) {
+    /*
+     * Reads the index line at the current position, returning its sequence, to be freed.
+     */
+    char *line = stFile_getLineFromFile(indexFileHandle);
+    char *tab = line != NULL ? strchr(line, '\t') : NULL;
+    if (tab == NULL || sscanf(tab + 1, "%" SCNi64 "\t%" SCNi64 "\t%" SCNi64 "", &entry->start, &entry->end, &entry->offset) != 3) {
+        st_errAbort("Could not parse the index line %s\n", line != NULL ? line : "at the end of the index");
+    }
+    *tab = '\0';
+    return line;
+}
+
+static void seekIndex(FILE *indexFileHandle, int64_t offset) {
+    if (fseek(indexFileHandle, offset, SEEK_SET) != 0) {
+        st_errAbort("Could not seek to %" PRIi64 " in the index\n", offset);
+    }
+}
+
+static int64_t getIndexLineAtOrAfter(FILE *indexFileHandle, int64_t runStart, int64_t runEnd, int64_t offset) {
+    /*
+     * Returns the offset of the first line of the run starting at or after offset, or runEnd if there is none.
+     */
+    if (offset == runStart) {
+        return runStart;
+    }
+    seekIndex(indexFileHandle, offset - 1);
+    int c;
+    while ((c = fgetc(indexFileHandle)) != EOF && c != '\n');
+    offset = ftell(indexFileHandle);
+    return offset < runEnd ? offset : runEnd;
+}
+
+static int64_t findFirstOverlappingIndexLine(FILE *indexFileHandle, int64_t runStart, int64_t runEnd, int64_t regionStart) {
+    /*
+     * Binary searches the lines of a run, in order of start and end, for the first that ends
+     * after regionStart, returning its offset, or runEnd if there is none. The search is over
+     * the bytes of the run, each probe taking the first line at or after the probed byte.
+     */
+    int64_t low = runStart, high = runEnd;
+    while (low < high) {
+        int64_t middle = low + (high - low) / 2;
+        int64_t offset = getIndexLineAtOrAfter(indexFileHandle, runStart, runEnd, middle);
+        bool after = 1;
+        if (offset < runEnd) {
+            IndexEntry entry;
+            seekIndex(indexFileHandle, offset);
+            free(readIndexEntry(indexFileHandle, &entry));
+            after = entry.end > regionStart;
+        }
+        if (after) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    return getIndexLineAtOrAfter(indexFileHandle, runStart, runEnd, low);
+}
+
+static int64_t readIndexSequenceTable(FILE *indexFileHandle, const char *indexFile) {
+    /*
+     * Returns the offset of the sequence table, from the trailer at the end of the index.
+     */
+    int64_t trailerLength = strlen(MAF_INDEX_SEQUENCE_TABLE) + MAF_INDEX_SEQUENCE_TABLE_DIGITS + 2;
+    char *line = NULL;
+    int64_t tableStart;
+    if (fseek(indexFileHandle, -trailerLength, SEEK_END) != 0 || (line = stFile_getLineFromFile(indexFileHandle)) == NULL
+            || strncmp(line, MAF_INDEX_SEQUENCE_TABLE "\t", strlen(MAF_INDEX_SEQUENCE_TABLE) + 1) != 0
+            || sscanf(line + strlen(MAF_INDEX_SEQUENCE_TABLE) + 1, "%" SCNd64 "", &tableStart) != 1) { //Zero padded, so not %i, which would take it as octal
+        st_errAbort("The index %s has no sequence table, it must be rewritten by cactus_MAFGenerator\n", indexFile);
+    }
+    free(line);
+    return tableStart;
+}
+
+static bool parseIndexSequenceRun(char *line, char **sequence, int64_t *runStart, int64_t *runEnd, int64_t *sorted) {
+    /*
+     * Parses a line of the sequence table, returning 0 for the trailer.
+     */
+    int64_t prefixLength = strlen(MAF_INDEX_SEQUENCE) + 1;
+    if (strncmp(line, MAF_INDEX_SEQUENCE "\t", prefixLength) != 0) {
+        if (strncmp(line, MAF_INDEX_SEQUENCE_TABLE "\t", strlen(MAF_INDEX_SEQUENCE_TABLE) + 1) == 0) {
+            return 0;
+        }
+        st_errAbort("Could not parse the sequence table line %s\n", line);
+    }
+    char *tab = line + strlen(line); //The sequence may contain tabs, so the numbers are found from the end
+    for (int64_t i = 0; i < 3; i++) {
+        while (tab > line + prefixLength && *(--tab) != '\t');
+    }
+    if (tab == line + prefixLength || sscanf(tab + 1, "%" SCNi64 "\t%" SCNi64 "\t%" SCNi64 "", runStart, runEnd, sorted) != 3) {
+        st_errAbort("Could not parse the sequence table line %s\n", line);
+    }
+    *tab = '\0';
+    *sequence = line + prefixLength;
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    /*
+     * Arguments/options
+     */
+    char * logLevelString = NULL;
+    char * mafFile = NULL;
+    char * indexFile = NULL;
+    char * gziFile = NULL;
+    char * region = NULL;
+    char * outputFile = NULL;
+
+    ///////////////////////////////////////////////////////////////////////////
+    // (0) Parse the inputs / setup stuff.
+    ///////////////////////////////////////////////////////////////////////////
+
+    while (1) {
+        static struct option long_options[] = { { "logLevel", required_argument, 0, 'a' },
+                { "mafFile", required_argument, 0, 'm' },
+                { "indexFile", required_argument, 0, 'x' },
+                { "gziFile", required_argument, 0, 'g' },
+                { "region", required_argument, 0, 'r' },
+                { "outputFile", required_argument, 0, 'e' },
+                { "help", no_argument, 0, 'h' }, { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+
+        int key = getopt_long(argc, argv, "a:m:x:g:r:e:h", long_options, &option_index);
+
+        if (key == -1) {
+            break;
+        }
+
+        switch (key) {
+            case 'a':
+                logLevelString = stString_copy(optarg);
+                break;
+            case 'm':
+                mafFile = stString_copy(optarg);
+                break;
+            case 'x':
+                indexFile = stString_copy(optarg);
+                break;
+            case 'g':
+                gziFile = stString_copy(optarg);
+                break;
+            case 'r':
+                region = stString_copy(optarg);
+                break;
+            case 'e':
+                outputFile = stString_copy(optarg);
+                break;
+            case 'h':
+                usage();
+                return 0;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    // (0) Check the inputs.
+    ///////////////////////////////////////////////////////////////////////////
+
+    assert(mafFile != NULL);
+    assert(indexFile != NULL);
+    assert(region != NULL);
+
+    st_setLogLevelFromString(logLevelString);
+
+    char *sequence;
+    int64_t regionStart, regionEnd;
+    parseRegion(region, &sequence, &regionStart, &regionEnd);
+    st_logInfo("Querying %s from %" PRIi64 " to %" PRIi64 "\n", sequence, regionStart, regionEnd);
+
+    FILE *mafFileHandle = NULL;
+    if (bgzfFile_isBgzf(mafFile)) {
+        if (gziFile == NULL) {
+            gziFile = stString_print("%s.gzi", mafFile);
+        }
+        st_logInfo("The MAF file is BGZF, using the block index %s\n", gziFile);
+    } else {
+        gziFile = NULL;
+        mafFileHandle = fopen(mafFile, "r");
+        if (mafFileHandle == NULL) {
+            st_errAbort("Could not open the MAF file %s\n", mafFile);
+        }
+    }
+    FILE *indexFileHandle = fopen(indexFile, "r");
+    if (indexFileHandle == NULL) {
+        st_errAbort("Could not open the index file %s\n", indexFile);
+    }
+    FILE *output = outputFile != NULL ? fopen(outputFile, "w") : stdout;
+    if (output == NULL) {
+        st_errAbort("Could not open the output file %s\n", outputFile);
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Copy the header, then each run of consecutive blocks overlapping the region.
+    // The lines of the sequence are found through the sequence table, and the first
+    // overlapping one by binary search. A block runs up to the offset of the next
+    // line, the last to the end of the file.
+    ///////////////////////////////////////////////////////////////////////////
+
+    int64_t tableStart = readIndexSequenceTable(indexFileHandle, indexFile);
+    stList *runs = stList_construct3(0, free);
+    seekIndex(indexFileHandle, tableStart);
+    char *line;
+    while ((line = stFile_getLineFromFile(indexFileHandle)) != NULL) {
+        char *runSequence;
+        int64_t runStart, runEnd, sorted;
+        if (!parseIndexSequenceRun(line, &runSequence, &runStart, &runEnd, &sorted)) {
+            free(line);
+            break;
+        }
+        if (strcmp(runSequence, sequence) == 0) {
+            int64_t *run = st_malloc(sizeof(int64_t) * 3);
+            run[0] = runStart;
+            run[1] = runEnd;
+            run[2] = sorted;
+            stList_append(runs, run);
+        }
+        free(line);
+    }
+    int64_t blockNumber = 0;
+    if (tableStart > 0) {
+        IndexEntry entry;
+        seekIndex(indexFileHandle, 0);
+        free(readIndexEntry(indexFileHandle, &entry));
+        copyRange(mafFileHandle, mafFile, gziFile, 0, entry.offset, output);
+    }
+    for (int64_t i = 0; i < stList_length(runs); i++) {
+        int64_t *run = stList_get(runs, i);
+        int64_t offset = run[2] ? findFirstOverlappingIndexLine(indexFileHandle, run[0], run[1], regionStart) : run[0];
+        int64_t copyStart = -1;
+        seekIndex(indexFileHandle, offset);
+        while (ftell(indexFileHandle) < run[1]) {
+            IndexEntry entry;
+            free(readIndexEntry(indexFileHandle, &entry));
+            if (entry.start < regionEnd && entry.end > regionStart) {
+                blockNumber++;
+                if (copyStart == -1) {
+                    copyStart = entry.offset;
+                }
+            } else {
+                if (copyStart != -1) {
+                    copyRange(mafFileHandle, mafFile, gziFile, copyStart, entry.offset, output);
+                    copyStart = -1;
+                }
+                if (run[2] && entry.start >= regionEnd) { //No later line of the run overlaps
+                    break;
+                }
+            }
+        }
+        if (copyStart != -1) { //The run overlaps up to its end, so copy up to the block of the next line, if any
+            int64_t copyEnd = -1;
+            if (run[1] < tableStart) {
+                IndexEntry entry;
+                seekIndex(indexFileHandle, run[1]);
+                free(readIndexEntry(indexFileHandle, &entry));
+                copyEnd = entry.offset;
+            }
+            copyRange(mafFileHandle, mafFile, gziFile, copyStart, copyEnd, output);
+        }
+    }
+    stList_destruct(runs);
+    st_logInfo("Got %" PRIi64 " blocks\n", blockNumber);
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Clean up.
+    ///////////////////////////////////////////////////////////////////////////
+
+    fclose(indexFileHandle);
+    if (mafFileHandle != NULL) {
+        fclose(mafFileHandle);
+    }
+    if (output != stdout) {
+        fclose(output);
+    }
+    free(sequence);
+
+    return 0;
+}
@@ -11,6 +11,9 @@
 #include "commonC.h"
 #include "hashTableC.h"
 #include "cactusUtils.h"
+#include "mafWriter.h"
+#include "cactusTraversal.h"
+#include "cactusParallel.h"
 //#include "cactus_addReferenceSeq.h"
 
 /*
@@ -21,40 +24,84 @@
  */
 
 //======= Global structures ======
-struct MafSegment {
-    Segment *segment;
-    char *name;
-    int64_t srcSize;
-    int64_t insertSize; //size of the insert between previous block and current block if there is any
-    int64_t gapSize; //size of the deletion between previous block and current block if there is any
-    int64_t gapStart;
-    char strand;
-    bool empty; //(white space)
-    bool unAligned; //double line
-    bool missingData; //missing data
-    struct MafSegment *prev;//previous segment
-    struct MafSegment *next;//next segment
+/*
+ * A row of the augmented MAF, with a cell per column of its reference row, stored as parallel
+ * arrays allocated from a RowArena. A cell holds an aligned segment, or is a gap (gapSize > 0)
+ * that takes its name, strand, start and source size from the segment it follows (gapSegment),
+ * or is unfilled until fillInEmptyCells. The previous and next cells of a cell are those either
+ * side of it in the arrays.
+ */
+#define MAF_CELL_EMPTY 1 //(white space)
+#define MAF_CELL_UNALIGNED 2 //double line
+#define MAF_CELL_MISSING_DATA 4 //missing data
+
+struct MafRow {
+    int64_t length;
+    Segment **segments;
+    Segment **gapSegments; //the segment before the gap, if the cell is a gap
+    int64_t *insertSizes; //size of the insert between previous block and current block if there is any
+    int64_t *gapSizes; //size of the deletion between previous block and current block if there is any
+    uint8_t *flags; //MAF_CELL_*
+};
+
+/*
+ * Bump allocates rows from chunks of ROW_ARENA_CHUNK_SIZE bytes (or one chunk for a larger row),
+ * all freed together when the arena is destructed.
+ */
+#define ROW_ARENA_CHUNK_SIZE 16777216
+
+struct RowArena {
+    struct List *chunks;
+    char *chunk;
+    int64_t used;
+    int64_t size;
 };
 
+/*
+ * The caps pulled from a thread's cursor at a time.
+ */
+#define CAP_BATCH_SIZE 256
+
 //====== Initialization functions ========
-struct MafSegment *constructMafSegment(Segment *segment){
-    struct MafSegment *mafSegment;
-    mafSegment = st_malloc(sizeof(struct MafSegment));
-    mafSegment->segment = segment;
-    mafSegment->name = NULL;
-    mafSegment->srcSize = 0;
-    mafSegment->insertSize = 0;
-    mafSegment->gapSize = 0;
-    mafSegment->empty = false;
-    mafSegment->unAligned = false;
-    mafSegment->missingData = false;
-    mafSegment->prev = NULL;
-    mafSegment->next = NULL;
-    return mafSegment;
-}
-
-void destructMafSegment(struct MafSegment *ms){
-    free(ms);
+struct RowArena *rowArena_construct(){
+    struct RowArena *arena = st_malloc(sizeof(struct RowArena));
+    arena->chunks = constructEmptyList(0, free);
+    arena->chunk = NULL;
+    arena->used = 0;
+    arena->size = 0;
+    return arena;
+}
+
+void rowArena_destruct(struct RowArena *arena){
+    destructList(arena->chunks);
+    free(arena);
+}
+
+void *rowArena_alloc(struct RowArena *arena, int64_t size){
+    //Returns size zeroed bytes, aligned for any of the row arrays
+    size = (size + 7) & ~((int64_t) 7);
+    if(arena->used + size > arena->size){
+        arena->size = size > ROW_ARENA_CHUNK_SIZE ? size : ROW_ARENA_CHUNK_SIZE;
+        arena->chunk = st_malloc(arena->size);
+        arena->used = 0;
+        listAppend(arena->chunks, arena->chunk);
+    }
+    void *memory = arena->chunk + arena->used;
+    arena->used += size;
+    memset(memory, 0, size);
+    return memory;
+}
+
+struct MafRow *mafRow_construct(struct RowArena *arena, int64_t length){
+    //create a row of 'length' unfilled cells
+    struct MafRow *row = rowArena_alloc(arena, sizeof(struct MafRow));
+    row->length = length;
+    row->segments = rowArena_alloc(arena, sizeof(Segment *) * length);
+    row->gapSegments = rowArena_alloc(arena, sizeof(Segment *) * length);
+    row->insertSizes = rowArena_alloc(arena, sizeof(int64_t) * length);
+    row->gapSizes = rowArena_alloc(arena, sizeof(int64_t) * length);
+    row->flags = rowArena_alloc(arena, sizeof(uint8_t) * length);
+    return row;
 }
 
 //=================
@@ -89,29 +136,28 @@ int64_t getSegmentStart(Segment *segment){
     return start;
 }
 
-bool checkContinuity(struct MafSegment *ms1, struct MafSegment *ms2, int64_t gapSize){
+bool checkContinuity(Segment *segment1, Segment *segment2, int64_t gapSize){
     /*
-     * Return true if ms1 and ms2 have same strand and:
-     *[ms1Start-ms1End](abuts)[ms2Start-ms2End]  or [ms2S-ms2E][ms1S-ms2E]
+     * Return true if segment1 and segment2 have same strand and:
+     *[s1Start-s1End](abuts)[s2Start-s2End]  or [s2S-s2E][s1S-s1E]
      */
 
-    //if(ms1->segment == NULL || ms2->segment == NULL){return true;}
-    assert(ms1->segment != NULL);
-    assert(ms2->segment != NULL);
+    assert(segment1 != NULL);
+    assert(segment2 != NULL);
     
-    if(strcmp(ms1->name, ms2->name) != 0){//030111
+    if(strcmp(getSegmentName(segment1), getSegmentName(segment2)) != 0){//030111
         return false;
     }
-    char strand1 = segment_getStrand(ms1->segment) ? '+' : '-';
-    char strand2 = segment_getStrand(ms2->segment) ? '+' : '-';
+    char strand1 = segment_getStrand(segment1) ? '+' : '-';
+    char strand2 = segment_getStrand(segment2) ? '+' : '-';
     if(strand1 == strand2){
-        int64_t start1 = getSegmentStart(ms1->segment);
-        int64_t end1 = start1 + segment_getLength(ms1->segment);
-        int64_t start2 = getSegmentStart(ms2->segment);
-        //int64_t end2 = start2 + segment_getLength(ms2->segment);
+        int64_t start1 = getSegmentStart(segment1);
+        int64_t end1 = start1 + segment_getLength(segment1);
+        int64_t start2 = getSegmentStart(segment2);
+        //int64_t end2 = start2 + segment_getLength(segment2);
         //if(start2 == end1 || start1 == end2){
-        //if((strand1 == '+' && end1 + gapSize == start2) || //  |--ms1-->|---ms2---> 
-        //   (strand1 == '-' && end2 + gapSize == start1)){  //  <--ms1---|<--ms2----|
+        //if((strand1 == '+' && end1 + gapSize == start2) || //  |--s1-->|---s2---> 
+        //   (strand1 == '-' && end2 + gapSize == start1)){  //  <--s1---|<--s2----|
         if(end1 + gapSize == start2) {
             return true;
         }
@@ -119,43 +165,48 @@ bool checkContinuity(struct MafSegment *ms1, struct MafSegment *ms2, int64_t gap
     return false;
 }
 
-struct IntList *getRefMatchedColumns(struct List *refrow, Block *block){
-    //Return indices (base 1) of reference cells (columns) that belong to the same block with 'block'
-    //If reference segment belong to opposite-strand block, then return
-    //index*(-1)
-    assert(refrow->list != NULL);
-    assert(block != NULL);
-    struct IntList *indexList = constructEmptyIntList(0);
-    int64_t i;
-    for (i = 0; i< refrow->length; i++){
-        struct MafSegment *refms = refrow->list[i];
-        Segment *segment = refms->segment;
-	if(segment == NULL){continue;}
-        if(block == segment_getBlock(segment)){
-	    intListAppend(indexList, i + 1);
-	}else if(block_getReverse(block) == segment_getBlock(segment)){
-	    intListAppend(indexList, (i+1)*(-1));
-	}
+stHash *getRefColumnIndex(struct MafRow *refrow){
+    /*
+     * Maps each block (in both orientations) of the reference row to the indices (base 1)
+     * of the reference cells (columns) that belong to it, in order, the index*(-1) if
+     * the reference segment belongs to the opposite-strand block. Built once per reference
+     * row, so the columns of a segment are found without scanning the row.
+     */
+    stHash *refColumnIndex = stHash_construct2(NULL, (void (*)(void *))destructIntList);
+    for (int64_t i = 0; i< refrow->length; i++){
+        Segment *segment = refrow->segments[i];
+        if(segment == NULL){continue;}
+        Block *block = segment_getBlock(segment);
+        for(int64_t j = 0; j < 2; j++){
+            struct IntList *indexList = stHash_search(refColumnIndex, block);
+            if(indexList == NULL){
+                indexList = constructEmptyIntList(0);
+                stHash_insert(refColumnIndex, block, indexList);
+            }
+            intListAppend(indexList, j == 0 ? i + 1 : (i+1)*(-1));
+            block = block_getReverse(block);
+        }
     }
-    return indexList;
+    return refColumnIndex;
 }
 
-struct List *getInitializedRow(int64_t length){
-    //create a list of length 'length' of MafSegments (a row)
-    struct List *row = constructEmptyList(0, free);
-    for(int64_t i =0; i< length; i++){
-        struct MafSegment *mafSegment = constructMafSegment( NULL );
-        if (i >= 1){
-            struct MafSegment *prevms = row->list[i-1];
-            prevms->next = mafSegment;
-            mafSegment->prev = prevms;
+struct IntList *getRefMatchedColumns(stHash *refColumnIndex, Block *block){
+    //Return indices (base 1) of reference cells (columns) that belong to the same block with 'block'
+    //If reference segment belong to opposite-strand block, then return
+    //index*(-1). The list belongs to the index, so must not be freed
+    static struct IntList *emptyIndexList = NULL;
+    assert(block != NULL);
+    struct IntList *indexList = stHash_search(refColumnIndex, block);
+    if(indexList == NULL){
+        if(emptyIndexList == NULL){
+            emptyIndexList = constructEmptyIntList(0);
         }
-        listAppend(row, mafSegment);   
+        indexList = emptyIndexList;
     }
-    return row;
+    return indexList;
 }
 
-bool checkInsert(struct List *row, int64_t c, struct IntList *prevCols, int64_t insertSize){
+bool checkInsert(struct MafRow *row, int64_t c, struct IntList *prevCols, int64_t insertSize){
     /*
      *c = index of the 'matched' cell of current segment(base 1)
      *prevCols = indices of 'matched' cells of previous segment (that
@@ -164,7 +215,7 @@ bool checkInsert(struct List *row, int64_t c, struct IntList *prevCols, int64_t
      *or immediately to the right of c (when thread goes from right to left), 
      *returns true. Otherwise return false.
      */
-    struct MafSegment *leftms, *rightms;
+    Segment *leftSegment, *rightSegment;
     int64_t i, pc, left, right;
     for(i = 0; i < prevCols->length; i++){
         pc = prevCols->list[i]; //previous column
@@ -177,13 +228,11 @@ bool checkInsert(struct List *row, int64_t c, struct IntList *prevCols, int64_t
                 left = c*(-1) -1;
                 right = pc*(-1) -1;
             }
-            leftms = row->list[left];
-            rightms = row->list[right];
-            if(leftms == NULL || rightms == NULL){continue;}
-            if(leftms->segment == NULL || rightms->segment == NULL){continue;}
-            if(strcmp(leftms->name, rightms->name) != 0){continue;} //030111
-            if (checkContinuity(leftms, rightms, insertSize)){
-                rightms->insertSize = insertSize;
+            leftSegment = row->segments[left];
+            rightSegment = row->segments[right];
+            if(leftSegment == NULL || rightSegment == NULL){continue;}
+            if (checkContinuity(leftSegment, rightSegment, insertSize)){
+                row->insertSizes[right] = insertSize;
                 return true;
             }
         }
@@ -191,15 +240,13 @@ bool checkInsert(struct List *row, int64_t c, struct IntList *prevCols, int64_t
     return false;
 }
 
-//void fillInDoubleLine(struct List *row, int64_t c, struct IntList *prevCols, 
-//                      int64_t gapStart, int64_t gapSize){
-void fillInDoubleLine(struct List *row, int64_t c, struct IntList *prevCols, 
+void fillInDoubleLine(struct MafRow *row, int64_t c, struct IntList *prevCols, 
                       int64_t gapSize){
     assert(row != NULL && row->length >= c);
     bool hasDoubleline;
     int64_t pc, i, j;
     int64_t left, right;
-    struct MafSegment * ms, *leftms, *rightms;
+    Segment *leftSegment, *rightSegment;
 
     for(i = 0; i< prevCols->length; i++){
         pc = prevCols->list[i];
@@ -212,33 +259,24 @@ void fillInDoubleLine(struct List *row, int64_t c, struct IntList *prevCols,
                 left = c*(-1) -1;
                 right = pc*(-1) -1;
             }
-            leftms = row->list[left];
-            rightms = row->list[right];
-            if(leftms == NULL || rightms == NULL){continue;}
-            if(leftms->segment == NULL || rightms->segment == NULL){continue;}
-            if(strcmp(leftms->name, rightms->name) != 0){continue;} //030111
-            if (!checkContinuity(leftms, rightms, gapSize)){continue;}
+            leftSegment = row->segments[left];
+            rightSegment = row->segments[right];
+            if(leftSegment == NULL || rightSegment == NULL){continue;}
+            if (!checkContinuity(leftSegment, rightSegment, gapSize)){continue;}
 
             //st_logInfo("checkingDoubleLine: pc: %" PRIi64 ", c: %" PRIi64 ", left: %" PRIi64 ", right: %" PRIi64 "\n", pc, c, left, right);
             hasDoubleline = true;
             for(j= left+1; j < right; j++){//all cells in between pc and c must be gaps
-                ms = row->list[j];
-                if(ms->segment != NULL || ms->gapSize > 0){
+                if(row->segments[j] != NULL || row->gapSizes[j] > 0){
                     hasDoubleline = false;
                     break;
                 }
             }
             if(hasDoubleline){//fill in gap-cells
                 for(j= left+1; j < right; j++){//all cells in btw pc and c are gaps
-                    ms = row->list[j];
-                    ms->srcSize = leftms->srcSize;
-                    ms->name = leftms->name;
-                    ms->gapSize = gapSize;
-                    ms->strand = segment_getStrand(leftms->segment) ? '+' : '-';
-                    ms->gapStart = getSegmentStart(leftms->segment) +
-                                   segment_getLength(leftms->segment);
-                    //ms->gapStart = gapStart;
-                    ms->unAligned = true;
+                    row->gapSegments[j] = leftSegment;
+                    row->gapSizes[j] = gapSize;
+                    row->flags[j] |= MAF_CELL_UNALIGNED;
                 }
                 break;
             }
@@ -258,7 +296,7 @@ bool hasInsert(struct IntList *insertSizes){
     return check;
 }
 
-void fillInDeletion(struct List *refrow, struct List *row, int64_t c, struct IntList *prevCols){
+void fillInDeletion(struct MafRow *refrow, struct MafRow *row, int64_t c, struct IntList *prevCols){
     /*
      * If there exists a column pc in prevCols so that pc + 1 < c and
      * [pc+1, c-1] are empty cells, then we mark those cells as a deletion
@@ -269,7 +307,7 @@ void fillInDeletion(struct List *refrow, struct List *row, int64_t c, struct Int
     int64_t pc, i, j;
     int64_t left, right;
     int64_t gapSize = 0;
-    struct MafSegment *ms, *refms, *leftms, *rightms;
+    Segment *leftSegment, *rightSegment;
 
     for(i = 0; i< prevCols->length; i++){
         pc = prevCols->list[i];
@@ -284,38 +322,24 @@ void fillInDeletion(struct List *refrow, struct List *row, int64_t c, struct Int
                 right = pc*(-1) -1;
             }
             assert(left < right);
-            leftms = row->list[left];
-            rightms = row->list[right];
-            assert(leftms != NULL && rightms != NULL);
-            if(leftms->segment == NULL || rightms->segment == NULL){continue;}
-            if(strcmp(leftms->name, rightms->name) != 0){continue;}//030111
+            leftSegment = row->segments[left];
+            rightSegment = row->segments[right];
+            if(leftSegment == NULL || rightSegment == NULL){continue;}
+            if(strcmp(getSegmentName(leftSegment), getSegmentName(rightSegment)) != 0){continue;}//030111
             
             //st_logInfo("checkingDeletion: pc: %" PRIi64 ", c: %" PRIi64 ", pc*c: %" PRIi64 ", left: %" PRIi64 ", right: %" PRIi64 "\n", pc, c, pc*c, left, right);
             hasDeletion = true;
             for(j= left+1; j < right; j++){//all cells in between pc and c must be gaps
-                ms = row->list[j];
-                assert(ms != NULL);
-                if(ms->segment != NULL || ms->gapSize > 0){
+                if(row->segments[j] != NULL || row->gapSizes[j] > 0){
                     hasDeletion = false;
                     break;
                 }
-                refms = refrow->list[j];
-	        gapSize += segment_getLength(refms->segment);
+	        gapSize += segment_getLength(refrow->segments[j]);
             }
             if(hasDeletion){//fill in gap-cells
                 for(j= left+1; j < right; j++){//all cells in btw pc and c are gaps
-                    ms = row->list[j];
-                    ms->srcSize = leftms->srcSize;
-                    ms->name = leftms->name;
-                    ms->gapSize = gapSize;
-                    ms->strand = segment_getStrand(leftms->segment) ? '+' : '-';
-                    //if(c > 0){//goes from left to right
-                        ms->gapStart = getSegmentStart(leftms->segment) +
-                                       segment_getLength(leftms->segment);
-                    /*}else{//goes from right to left
-                        ms->gapStart = getSegmentStart(rightms->segment) +
-                                       segment_getLength(rightms->segment);
-                    }*/
+                    row->gapSegments[j] = leftSegment;
+                    row->gapSizes[j] = gapSize;
                 }
                 break;
             }
@@ -341,28 +365,19 @@ bool block_hasRef(Block *block, char *name){
     return hasRef;
 }
 
-void addMafSegment(struct MafSegment *ms, Segment *segment){
-    ms->segment = segment;
-    ms->srcSize = getSrcSize(segment);
-    ms->name = getSegmentName(segment);
-    return;
-}
-
-int64_t putSegmentToCell(Cap *cap, struct List *rows, struct List *refrow, 
-                         char *refname, int64_t prevUnaligned, Cap *prevCap){
+int64_t putSegmentToCell(Cap *cap, struct List *rows, struct MafRow *refrow, stHash *refColumnIndex,
+                         struct RowArena *arena, char *refname, int64_t prevUnaligned, Cap *prevCap){
     Segment *segment = cap_getSegment(cap);
     Block *block = segment_getBlock(segment);
 
     //check if currentSegment aligns to anywhere on the ref species at all
     bool isAligned = block_hasRef(block, refname);
 
-    struct IntList *cols = getRefMatchedColumns(refrow, block);
+    struct IntList *cols = getRefMatchedColumns(refColumnIndex, block);
     //st_logInfo("Number of matched columns: %" PRIi64 "\n", cols->length);
 
-    struct List *r;
+    struct MafRow *r;
     int64_t c, i, j;
-    //int64_t insert;
-    struct MafSegment *mafsegment;
     struct IntList *prevCols = NULL;
     Segment *prevSegment = NULL;
  
@@ -373,7 +388,7 @@ int64_t putSegmentToCell(Cap *cap, struct List *rows, struct List *refrow,
         if(prevCap != NULL){
 	    prevSegment = cap_getSegment(prevCap);
 	    assert(prevSegment != NULL);
-	    prevCols =  getRefMatchedColumns(refrow, segment_getBlock(prevSegment));
+	    prevCols =  getRefMatchedColumns(refColumnIndex, segment_getBlock(prevSegment));
         }//else: prevCap == NULL: beginning of thread... ignored..
 
         for(i = 0; i < cols->length; i++){//each match
@@ -389,21 +404,17 @@ int64_t putSegmentToCell(Cap *cap, struct List *rows, struct List *refrow,
 	    bool needNewRow = true;
 	    for(j=0; j< rows->length; j++){//check to see if can fill segment into existing rows
 		r = rows->list[j];
-		mafsegment = r->list[c];
-		if(mafsegment->segment == NULL && mafsegment->gapSize ==0){
-		    //if(!checkDeletion(r, c, refrow)){//not deletion
-                    addMafSegment(mafsegment, segment2);
+		if(r->segments[c] == NULL && r->gapSizes[c] ==0){
+                    r->segments[c] = segment2;
                     needNewRow = false;
-		    //}
 		    break;
 		}
 	    }
 	    if(needNewRow){//haven't found a cell for segment yet
-                r = getInitializedRow(refrow->length);
+                r = mafRow_construct(arena, refrow->length);
                 st_logInfo("Adding row #%" PRIi64 ", length %" PRIi64 "\n", rows->length, r->length);
 
-		mafsegment = r->list[c];
-                addMafSegment(mafsegment, segment2);
+                r->segments[c] = segment2;
 		listAppend(rows, r);
 	    }
 
@@ -412,8 +423,6 @@ int64_t putSegmentToCell(Cap *cap, struct List *rows, struct List *refrow,
             if (prevCols != NULL && prevUnaligned >0){
                 hasInsert = checkInsert(r, cols->list[i], prevCols, prevUnaligned);
             }
-            //insert = hasInsert ? prevUnaligned : 0;
-            //mafsegment->insertSize = insert;
 
             if( prevCols != NULL ){
                 //if prevUnaligned == 0 && prevCols->length == 0: previous
@@ -422,17 +431,10 @@ int64_t putSegmentToCell(Cap *cap, struct List *rows, struct List *refrow,
                 if( prevUnaligned == 0){//check for deletion
                     fillInDeletion(refrow, r, cols->list[i], prevCols);
                 }else if(!hasInsert){//doubleLine
-                    //int64_t gapStart = getSegmentStart(prevSegment) + segment_getLength(prevSegment);
-                    //fillInDoubleLine(r, cols->list[i], prevCols, gapStart, prevUnaligned);
                     fillInDoubleLine(r, cols->list[i], prevCols, prevUnaligned);
                 }
             }
         }
-
-        /*if(prevCap != NULL){
-            destructIntList(cols);
-            destructIntList(prevCols);
-        }*/
         prevUnaligned = 0;
     }else if (isAligned){//current segment aligns somewhere on ref spc, but not current refrow
         prevUnaligned = 0;
@@ -443,181 +445,276 @@ int64_t putSegmentToCell(Cap *cap, struct List *rows, struct List *refrow,
     return prevUnaligned;
 }
 
-void walkDown(Cap *cap, struct List *rows, struct List *refrow, char *refname, int64_t prevUnaligned, Cap *prevCap);
-
-void walkUp(Cap *cap, struct List *rows, struct List *refrow, char *refname, int64_t prevUnaligned, Cap *prevCap) {
-    assert(cap != NULL);
-    //st_logInfo("walkUp: %" PRIi64 ", %s\n", cap_getCoordinate(cap), cactusMisc_nameToString(cap_getName(cap)));
-
-    Segment *segment = cap_getSegment(cap);
-    if (segment != NULL) {
-        prevUnaligned = putSegmentToCell(cap, rows, refrow, refname, prevUnaligned, prevCap);//add segment to cell
-        //prevUnaligned resets when segment aligns to one or more reference cell(s)
-        if(prevUnaligned == 0){//reset prevCap to current cap
-            prevCap = cap;
-        }
-        walkDown(cap_getOtherSegmentCap(cap), rows, refrow, refname, prevUnaligned, prevCap);
-    } else {
-        //assert(end_isAttached(cap_getEnd(cap)));
-        Group *parentGroup = flower_getParentGroup(end_getFlower(cap_getEnd(cap)));
-        if (parentGroup != NULL) {
-            Cap *upperCap = flower_getCap(group_getFlower(parentGroup), cap_getName(cap));
-            assert(upperCap != NULL);
-            
-            //Make sure always following the same strand
-            if(cap_getStrand(cap) != cap_getStrand(upperCap)){
-                upperCap = cap_getReverse(upperCap);
+void walkThread(CapCursor *capCursor, Cap *startCap, struct List *rows, struct MafRow *refrow, stHash *refColumnIndex,
+                struct RowArena *arena, char *refname) {
+    /*
+     * Puts the segments of the thread starting at startCap into the rows, in order along the
+     * thread. The cursor moves up and down the levels of the cactus tree with its own stack of
+     * levels, rather than recursing once per segment, so a whole chromosome needs bounded stack.
+     */
+    Cap *caps[CAP_BATCH_SIZE];
+    int64_t capNumber, prevUnaligned = 0;
+    Cap *prevCap = NULL;
+    capCursor_reset(capCursor, startCap);
+    while((capNumber = capCursor_nextBatch(capCursor, 1, caps, NULL, CAP_BATCH_SIZE)) > 0){
+        for(int64_t i = 0; i < capNumber; i++){
+            if(cap_getSegment(caps[i]) == NULL){continue;} //The stub at the end of the thread
+            prevUnaligned = putSegmentToCell(caps[i], rows, refrow, refColumnIndex, arena, refname, prevUnaligned, prevCap);//add segment to cell
+            //prevUnaligned resets when segment aligns to one or more reference cell(s)
+            if(prevUnaligned == 0){//reset prevCap to current cap
+                prevCap = caps[i];
             }
-            walkUp(upperCap, rows, refrow, refname, prevUnaligned, prevCap);
-        }
-    }
-}
-
-void walkDown(Cap *cap, struct List *rows, struct List *refrow, char *refname, int64_t prevUnaligned, Cap *prevCap) {
-    assert(cap != NULL);
-    //st_logInfo("walkDown: %" PRIi64 "\n", cap_getCoordinate(cap));
-    //assert(end_isAttached(end));
-    Group *group = end_getGroup(cap_getEnd(cap));
-    if (group_isLeaf(group)) { //Walk across
-        cap = cap_getAdjacency(cap);
-        //Now walk up
-        walkUp(cap, rows, refrow, refname, prevUnaligned, prevCap);
-    } else { //Walk down
-        Cap *lowerCap = flower_getCap(group_getNestedFlower(group), cap_getName(cap));
-        if(cap_getStrand(cap) != cap_getStrand(lowerCap)){
-            lowerCap = cap_getReverse(lowerCap);
         }
-        walkDown(lowerCap, rows, refrow, refname, prevUnaligned, prevCap);
     }
 }
 
-void fillInEmptyCells(struct List *threadRows, struct List *refRow){
-    struct MafSegment *rms;
-    struct MafSegment *ms;
+void fillInEmptyCells(struct List *threadRows, struct MafRow *refRow){
     for(int64_t j = 0; j < threadRows->length; j++){
-        struct List *row = threadRows->list[j];
+        struct MafRow *row = threadRows->list[j];
+        assert(refRow->length == row->length);
         for(int64_t i = 0; i< refRow->length; i++){
-	    assert(refRow->length == row->length);
-	    ms = row->list[i];
-	    if(ms->segment == NULL && ms->gapSize == 0){
-                rms = refRow->list[i];
-		ms->empty = true;
-		ms->gapSize = segment_getLength(rms->segment);
+	    if(row->segments[i] == NULL && row->gapSizes[i] == 0){
+		row->flags[i] |= MAF_CELL_EMPTY;
+		row->gapSizes[i] = segment_getLength(refRow->segments[i]);
 	    }
         } 
     } 
     return;
 }
 
-struct List *getRows(Flower *flower, char *name, struct List *refRows, char *refname){
+/*
+ * The cursor the threads are walked with, and the cache of their levels, as each species'
+ * threads are walked once per reference row. Per process, so each worker has its own.
+ */
+static CapLevelCache *capLevelCache = NULL;
+static CapCursor *capCursor = NULL;
+
+CapCursor *getCapCursor(Cap *startCap){
+    if(capCursor == NULL){
+        capLevelCache = capLevelCache_construct(CAP_LEVEL_CACHE_SIZE);
+        capCursor = capCursor_construct(startCap);
+        capCursor_setLevelCache(capCursor, capLevelCache);
+    }
+    return capCursor;
+}
+
+void destructCapCursor(){
+    if(capCursor != NULL){
+        capCursor_destruct(capCursor);
+        capLevelCache_destruct(capLevelCache);
+        capCursor = NULL;
+        capLevelCache = NULL;
+    }
+}
+
+struct List *getRowsForRefRow(Flower *flower, char *name, struct MafRow *refRow, stHash *refColumnIndex, char *refname,
+                              struct RowArena *arena){
     /*
-     *Get rows for species 'name'
+     *Get the rows for species 'name' that map to refRow, allocated from arena
      */
-    assert(refRows->list != NULL);
-    struct List *rowsList = constructEmptyList(0, free);//rowsList->(ref)rows->row1, row2, ...
-    struct List *refRow;
     Cap *cap;
-    int i, j;
-    
-    for(i = 0; i < refRows->length; i++){//for each row of the reference species
-        refRow = refRows->list[i];
-        st_logInfo("\tGetting rows for source species %s that map to refRow %" PRIi64 "\n", name, i);
-        st_logInfo("refRow Length: %" PRIi64 "\n", refRow->length);
+    st_logInfo("refRow Length: %" PRIi64 "\n", refRow->length);
 
-        //Get the starts of all the threads of current species
-        //struct List *startCaps = getLeftThreadStarts(name, refRow);
-        struct List *startCaps = flower_getThreadStarts(flower, name);
-        if(startCaps->length == 0){
-            st_logInfo("Could not find any %s sequence that aligns with the reference\n",name);
-        }
-        struct List *rows = constructEmptyList(0, free);
-        for(j = 0; j < startCaps->length; j++){//each thread in the current species
-            cap = startCaps->list[j];
-            st_logInfo("\nCap %" PRIi64 ": %s, sequence %s, coor: %" PRIi64 "\n", j, cactusMisc_nameToString(cap_getName(cap)),
-                                                            cap_getSequenceName(cap), cap_getCoordinate(cap));
-            walkDown(cap, rows, refRow, refname, 0, NULL);
-        }
+    //Get the starts of all the threads of current species
+    struct List *startCaps = flower_getThreadStarts(flower, name);
+    if(startCaps->length == 0){
+        st_logInfo("Could not find any %s sequence that aligns with the reference\n",name);
+    }
+    struct List *rows = constructEmptyList(0, NULL); //The rows are in the arena
+    for(int64_t j = 0; j < startCaps->length; j++){//each thread in the current species
+        cap = startCaps->list[j];
+        st_logInfo("\nCap %" PRIi64 ": %s, sequence %s, coor: %" PRIi64 "\n", j, cactusMisc_nameToString(cap_getName(cap)),
+                                                        cap_getSequenceName(cap), cap_getCoordinate(cap));
+        walkThread(getCapCursor(cap), cap, rows, refRow, refColumnIndex, arena, refname);
+    }
+    fillInEmptyCells(rows, refRow);
+    return rows;
+}
 
-        //free startCaps list, but not delete the Caps themselves
-        /*if(startCaps->length > 0){
-            free(startCaps->list);
-        }
-        free(startCaps);*/
-        //destructList(startCaps);
-        fillInEmptyCells(rows, refRow);
+struct List *getRows(Flower *flower, char *name, struct List *refRows, struct List *refColumnIndexes, char *refname,
+                     struct RowArena *arena){
+    /*
+     *Get rows for species 'name', allocated from arena
+     */
+    assert(refRows->list != NULL);
+    struct List *rowsList = constructEmptyList(0, (void (*)(void *))destructList);//rowsList->(ref)rows->row1, row2, ...
+    for(int64_t i = 0; i < refRows->length; i++){//for each row of the reference species
+        st_logInfo("\tGetting rows for source species %s that map to refRow %" PRIi64 "\n", name, i);
+        struct List *rows = getRowsForRefRow(flower, name, refRows->list[i], refColumnIndexes->list[i], refname, arena);
         listAppend(rowsList, rows);    
         st_logInfo("\tDone getting rows for %s, refRow %" PRIi64 ". Number of rows: %" PRIi64 "\n", name, i, rows->length);
     }
     return rowsList;
 }
 
-//====================
-void refWalkDown(Cap *cap, struct List *row);
+/*
+ * Getting the rows of each species for each reference row is an item of work for forked workers
+ * (see parallelOrderedMap), the items ordered by species then reference row. The flower subtree is
+ * loaded before they are forked, so the workers walk the threads without database requests. A worker
+ * writes the cells of the rows it gets to its output, each segment as its name and strand rather than
+ * a pointer, and they are read back into the rows of the species, the names resolved to the segments
+ * of the subtree by segmentsByName.
+ */
+typedef struct _speciesRows {
+    Flower *flower;
+    struct List *spcList;
+    struct List *refRows;
+    struct List *refColumnIndexes;
+    char *refSpc;
+    struct RowArena *arena;
+    struct List *spcRows;
+    stHash *segmentsByName;
+} SpeciesRows;
+
+void indexSegmentsByName(Flower *flower, stHash *segmentsByName){
+    /*
+     * Maps the name of each segment of the flower and its descendants to the segment.
+     */
+    Flower_BlockIterator *blockIterator = flower_getBlockIterator(flower);
+    Block *block;
+    while((block = flower_getNextBlock(blockIterator)) != NULL){
+        Block_InstanceIterator *instanceIterator = block_getInstanceIterator(block);
+        Segment *segment;
+        while((segment = block_getNext(instanceIterator)) != NULL){
+            stHash_insert(segmentsByName, stIntTuple_construct1(segment_getName(segment)), segment);
+        }
+        block_destructInstanceIterator(instanceIterator);
+    }
+    flower_destructBlockIterator(blockIterator);
+    Flower_GroupIterator *groupIterator = flower_getGroupIterator(flower);
+    Group *group;
+    while((group = flower_getNextGroup(groupIterator)) != NULL){
+        if(!group_isLeaf(group)){
+            indexSegmentsByName(getNestedFlower(group), segmentsByName);
+        }
+    }
+    flower_destructGroupIterator(groupIterator);
+}
 
-void refWalkUp(Cap *cap, struct List *row) {
-    assert(cap != NULL);
-    st_logInfo("refWalkUp, cap %" PRIi64 ", seq: %s\n", cap_getCoordinate(cap), cap_getSequenceName(cap));
-    Segment *segment = cap_getSegment(cap);
-    if (segment != NULL) {
-        struct MafSegment *mafSegment = constructMafSegment( segment );
-        mafSegment->srcSize = getSrcSize(segment);
-        mafSegment->name = getSegmentName(segment);
-        if(row->length >= 1){
-            struct MafSegment *prevMs = row->list[row->length -1];
-            prevMs->next = mafSegment;
-            mafSegment->prev = prevMs;
+void writeRowCells(void *cells, int64_t size, FILE *output){
+    if(fwrite(cells, 1, size, output) != size){
+        st_errAbort("Could not write the rows of a worker\n");
+    }
+}
+
+void readRowCells(void *cells, int64_t size, FILE *input){
+    if(fread(cells, 1, size, input) != size){
+        st_errAbort("Could not read the rows of a worker\n");
+    }
+}
+
+void writeRowSegments(Segment **segments, int64_t length, FILE *output){
+    for(int64_t i = 0; i < length; i++){
+        Name name = segments[i] != NULL ? segment_getName(segments[i]) : NULL_NAME;
+        uint8_t strand = segments[i] != NULL ? segment_getStrand(segments[i]) : 0;
+        writeRowCells(&name, sizeof(Name), output);
+        writeRowCells(&strand, sizeof(uint8_t), output);
+    }
+}
+
+void readRowSegments(Segment **segments, int64_t length, stHash *segmentsByName, FILE *input){
+    for(int64_t i = 0; i < length; i++){
+        Name name;
+        uint8_t strand;
+        readRowCells(&name, sizeof(Name), input);
+        readRowCells(&strand, sizeof(uint8_t), input);
+        if(name == NULL_NAME){
+            segments[i] = NULL;
+            continue;
         }
-        listAppend(row, mafSegment);
-        st_logInfo("\totherSegmentCap, cap %" PRIi64 ", seq: %s\n", cap_getCoordinate(cap_getOtherSegmentCap(cap)), cap_getSequenceName(cap_getOtherSegmentCap(cap)));
-        refWalkDown(cap_getOtherSegmentCap(cap), row);
-    } else {
-        //assert(end_isAttached(end));
-        Group *parentGroup = flower_getParentGroup(end_getFlower(cap_getEnd(cap)));
-        if (parentGroup != NULL) {
-            Cap *upperCap = flower_getCap(group_getFlower(parentGroup), cap_getName(cap));
-            if(cap_getStrand(cap) != cap_getStrand(upperCap)){
-                upperCap = cap_getReverse(upperCap);
-            }
-            st_logInfo("\tupperCap, cap %" PRIi64 ", seq: %s\n", cap_getCoordinate(upperCap), cap_getSequenceName(upperCap));
-            refWalkUp(upperCap, row);
+        stIntTuple *key = stIntTuple_construct1(name);
+        Segment *segment = stHash_search(segmentsByName, key);
+        stIntTuple_destruct(key);
+        if(segment == NULL){
+            st_errAbort("A worker returned segment %s, which is not in the flower subtree\n", cactusMisc_nameToStringStatic(name));
         }
+        segments[i] = segment_getStrand(segment) == strand ? segment : segment_getReverse(segment);
     }
 }
 
-void refWalkDown(Cap *cap, struct List *row) {
-    assert(cap != NULL);
-    st_logInfo("refWalkDown, cap %" PRIi64 ", seq: %s\n", cap_getCoordinate(cap), cap_getSequenceName(cap));
-    //assert(end_isAttached(end));
-    Group *group = end_getGroup(cap_getEnd(cap));
-    if (group_isLeaf(group)) { //Walk across
-        cap = cap_getAdjacency(cap);
-        st_logInfo("\tadjCap, cap %" PRIi64 ", seq: %s\n", cap_getCoordinate(cap), cap_getSequenceName(cap));
-        //Now walk up
-        refWalkUp(cap, row);
-    } else { //Walk down
-        Cap *lowerCap = flower_getCap(group_getNestedFlower(group), cap_getName(cap));
-        if(cap_getStrand(cap) != cap_getStrand(lowerCap)){
-            lowerCap = cap_getReverse(lowerCap);
+void getRowsP(int64_t item, FILE *output, SpeciesRows *speciesRows){
+    char *name = speciesRows->spcList->list[item / speciesRows->refRows->length];
+    int64_t i = item % speciesRows->refRows->length;
+    st_logInfo("\tGetting rows for source species %s that map to refRow %" PRIi64 "\n", name, i);
+    struct RowArena *arena = rowArena_construct();
+    struct List *rows = getRowsForRefRow(speciesRows->flower, name, speciesRows->refRows->list[i],
+                                         speciesRows->refColumnIndexes->list[i], speciesRows->refSpc, arena);
+    writeRowCells(&rows->length, sizeof(int64_t), output);
+    for(int64_t j = 0; j < rows->length; j++){
+        struct MafRow *row = rows->list[j];
+        writeRowSegments(row->segments, row->length, output);
+        writeRowSegments(row->gapSegments, row->length, output);
+        writeRowCells(row->insertSizes, sizeof(int64_t) * row->length, output);
+        writeRowCells(row->gapSizes, sizeof(int64_t) * row->length, output);
+        writeRowCells(row->flags, sizeof(uint8_t) * row->length, output);
+    }
+    destructList(rows);
+    rowArena_destruct(arena);
+}
+
+void mergeRows(int64_t item, FILE *input, int64_t length, SpeciesRows *speciesRows){
+    int64_t i = item % speciesRows->refRows->length;
+    struct MafRow *refRow = speciesRows->refRows->list[i];
+    if(i == 0){
+        listAppend(speciesRows->spcRows, constructEmptyList(0, (void (*)(void *))destructList));
+    }
+    struct List *rowsList = speciesRows->spcRows->list[speciesRows->spcRows->length - 1];
+    int64_t rowNumber;
+    readRowCells(&rowNumber, sizeof(int64_t), input);
+    struct List *rows = constructEmptyList(0, NULL); //The rows are in the arena
+    for(int64_t j = 0; j < rowNumber; j++){
+        struct MafRow *row = mafRow_construct(speciesRows->arena, refRow->length);
+        readRowSegments(row->segments, row->length, speciesRows->segmentsByName, input);
+        readRowSegments(row->gapSegments, row->length, speciesRows->segmentsByName, input);
+        readRowCells(row->insertSizes, sizeof(int64_t) * row->length, input);
+        readRowCells(row->gapSizes, sizeof(int64_t) * row->length, input);
+        readRowCells(row->flags, sizeof(uint8_t) * row->length, input);
+        listAppend(rows, row);
+    }
+    listAppend(rowsList, rows);
+    st_logInfo("\tDone getting rows for %s, refRow %" PRIi64 ". Number of rows: %" PRIi64 "\n",
+               speciesRows->spcList->list[item / speciesRows->refRows->length], i, rows->length);
+}
+
+//====================
+void refWalkThread(CapCursor *capCursor, Cap *startCap, struct List *segments) {
+    /*
+     * Appends the segments of the reference thread starting at startCap to segments, in order.
+     */
+    Cap *caps[CAP_BATCH_SIZE];
+    int64_t capNumber;
+    capCursor_reset(capCursor, startCap);
+    while((capNumber = capCursor_nextBatch(capCursor, 1, caps, NULL, CAP_BATCH_SIZE)) > 0){
+        for(int64_t i = 0; i < capNumber; i++){
+            if(cap_getSegment(caps[i]) != NULL){
+                listAppend(segments, cap_getSegment(caps[i]));
+            }
         }
-        st_logInfo("\tlowerCap, cap %" PRIi64 ", seq: %s\n", cap_getCoordinate(lowerCap), cap_getSequenceName(lowerCap));
-        refWalkDown(lowerCap, row);
     }
 }
 
-struct List *getReferenceRows(Flower *flower, char *name){
+struct List *getReferenceRows(Flower *flower, char *name, struct List *refColumnIndexes, struct RowArena *arena){
     /*
      * Each refRow represents a thread of the reference species
      * in the inputed flower. A thread could be a chromosome or a contig...
+     * The rows are allocated from arena, and the column index of each refRow
+     * (see getRefColumnIndex) is appended to refColumnIndexes.
      */
-    struct List *refRows = constructEmptyList(0, free);//list of rows of species 'name'
+    struct List *refRows = constructEmptyList(0, NULL);//list of rows of species 'name'
     Cap *cap;
     struct List *startCaps = flower_getThreadStarts(flower, name);
+    struct List *segments = constructEmptyList(0, NULL);
     for(int i = 0; i < startCaps->length; i++){
         cap = startCaps->list[i];
-        struct List *row = constructEmptyList(0, free);
-        refWalkDown(cap, row);
+        st_logInfo("Reference thread %d, cap %" PRIi64 ", seq: %s\n", i, cap_getCoordinate(cap), cap_getSequenceName(cap));
+        segments->length = 0;
+        refWalkThread(getCapCursor(cap), cap, segments);
+        struct MafRow *row = mafRow_construct(arena, segments->length);
+        memcpy(row->segments, segments->list, sizeof(Segment *) * segments->length);
         listAppend(refRows, row);    
+        listAppend(refColumnIndexes, getRefColumnIndex(row));
     }
+    destructList(segments);
     //free the startCaps list, but not the (Caps) themselves
     /*free(startCaps->list);
     free(startCaps);*/
@@ -625,30 +722,30 @@ struct List *getReferenceRows(Flower *flower, char *name){
 }
 
 //================= PRINT MAF FOR EACH BLOCK ==================
-char getLeftInfo(struct MafSegment *ms, int64_t *count){
-    assert(ms != NULL);
+char getLeftInfo(struct MafRow *row, int64_t i, int64_t *count){
+    assert(row->segments[i] != NULL);
     char status;
     
-    if(ms->prev == NULL){//start new sequence (or blue bar)
+    if(i == 0){//start new sequence (or blue bar)
         status = 'N';
-    }else{//(ms->segment != NULL) 
-        if( ms->insertSize > 0 ){//insertion
+    }else{
+        if( row->insertSizes[i] > 0 ){//insertion
             status = 'I';
-            *count = ms->insertSize;
-        }else if(ms->prev->segment != NULL){//prev block is not a gap
-            if( checkContinuity(ms->prev, ms, 0) ){//continuous
+            *count = row->insertSizes[i];
+        }else if(row->segments[i-1] != NULL){//prev block is not a gap
+            if( checkContinuity(row->segments[i-1], row->segments[i], 0) ){//continuous
                 status = 'C';
             }else{//blue bar
                 status = 'N';
             }
-        }else{//ms->prev is a gap
-            if(ms->prev->unAligned){
+        }else{//the previous cell is a gap
+            if(row->flags[i-1] & MAF_CELL_UNALIGNED){
                 status = 'I';
-                *count = ms->prev->gapSize;
-            }else if(ms->prev->missingData){
+                *count = row->gapSizes[i-1];
+            }else if(row->flags[i-1] & MAF_CELL_MISSING_DATA){
                 status = 'M';
-                *count = ms->prev->gapSize;
-            }else if(ms->prev->empty){
+                *count = row->gapSizes[i-1];
+            }else if(row->flags[i-1] & MAF_CELL_EMPTY){
                 status = 'N';
             }else{
                 status = 'C';
@@ -658,22 +755,22 @@ char getLeftInfo(struct MafSegment *ms, int64_t *count){
     return status;
 }
 
-char getRightInfo(struct MafSegment *rightms, int64_t *count){
+char getRightInfo(struct MafRow *row, int64_t i, int64_t *count){
     char status;
     
-    if(rightms == NULL){//start new sequence (or blue bar)
+    if(i == row->length){//start new sequence (or blue bar)
         status = 'N';
     }else{
-        if(rightms->segment != NULL){
-            status = getLeftInfo(rightms, count);
+        if(row->segments[i] != NULL){
+            status = getLeftInfo(row, i, count);
         }else{
-            if(rightms->unAligned){
+            if(row->flags[i] & MAF_CELL_UNALIGNED){
                 status = 'I';
-                *count = rightms->gapSize;
-            }else if (rightms->missingData){//NOTE!!! NEED TO COME BACK AND DEAL WITH MISSING DATA PROPERLY
+                *count = row->gapSizes[i];
+            }else if (row->flags[i] & MAF_CELL_MISSING_DATA){//NOTE!!! NEED TO COME BACK AND DEAL WITH MISSING DATA PROPERLY
                 status = 'M';
-                *count = rightms->gapSize;
-            }else if(rightms->empty){
+                *count = row->gapSizes[i];
+            }else if(row->flags[i] & MAF_CELL_EMPTY){
                 status = 'N';
             }else{//deletion
                 status = 'C';
@@ -683,99 +780,91 @@ char getRightInfo(struct MafSegment *rightms, int64_t *count){
     return status;
 }
 
-void printIrow(struct MafSegment *ms, char *name, FILE *fh){
-    assert(ms->segment != NULL);
+void printIrow(struct MafRow *row, int64_t i, char *name, MafWriter *mafWriter){
+    assert(row->segments[i] != NULL);
     char leftStatus;
     int64_t leftCount = 0;
     char rightStatus;
     int64_t rightCount = 0;
-    leftStatus = getLeftInfo( ms, &leftCount);
-    rightStatus = getRightInfo( ms->next, &rightCount);
-    fprintf(fh, "i\t%s\t%c\t%" PRIi64 "\t%c\t%" PRIi64 "\n", name, leftStatus, leftCount,
-                                           rightStatus, rightCount);
+    leftStatus = getLeftInfo(row, i, &leftCount);
+    rightStatus = getRightInfo(row, i + 1, &rightCount);
+    mafWriter_writeString(mafWriter, "i\t");
+    mafWriter_writeString(mafWriter, name);
+    mafWriter_writeChar(mafWriter, '\t');
+    mafWriter_writeChar(mafWriter, leftStatus);
+    mafWriter_writeChar(mafWriter, '\t');
+    mafWriter_writeInt(mafWriter, leftCount);
+    mafWriter_writeChar(mafWriter, '\t');
+    mafWriter_writeChar(mafWriter, rightStatus);
+    mafWriter_writeChar(mafWriter, '\t');
+    mafWriter_writeInt(mafWriter, rightCount);
+    mafWriter_writeChar(mafWriter, '\n');
     return;
 }
 
-void printErow(struct MafSegment *ms, char *name, FILE *fh){
+void printErow(struct MafRow *row, int64_t i, char *name, MafWriter *mafWriter){
     int64_t count = 0;
-    char status = getRightInfo(ms, &count);
-    fprintf(fh, "e\t%s\t%" PRIi64 "\t%" PRIi64 "\t%c\t%" PRIi64 "\t%c\n", name, ms->gapStart, ms->gapSize,
-                                               ms->strand, ms->srcSize, status);
+    char status = getRightInfo(row, i, &count);
+    Segment *gapSegment = row->gapSegments[i];
+    assert(gapSegment != NULL);
+    mafWriter_writeString(mafWriter, "e\t");
+    mafWriter_writeString(mafWriter, name);
+    mafWriter_writeChar(mafWriter, '\t');
+    mafWriter_writeInt(mafWriter, getSegmentStart(gapSegment) + segment_getLength(gapSegment));
+    mafWriter_writeChar(mafWriter, '\t');
+    mafWriter_writeInt(mafWriter, row->gapSizes[i]);
+    mafWriter_writeChar(mafWriter, '\t');
+    mafWriter_writeChar(mafWriter, segment_getStrand(gapSegment) ? '+' : '-');
+    mafWriter_writeChar(mafWriter, '\t');
+    mafWriter_writeInt(mafWriter, getSrcSize(gapSegment));
+    mafWriter_writeChar(mafWriter, '\t');
+    mafWriter_writeChar(mafWriter, status);
+    mafWriter_writeChar(mafWriter, '\n');
 }
 
-void printMafBlockRow(struct MafSegment *mafSegment, int rownum, FILE *fh){
-//void printMafBlockRow(struct MafSegment *mafSegment, char *name, FILE *fh){
-    assert(mafSegment != NULL);
-    Segment *segment = mafSegment->segment;
+void printMafBlockRow(struct MafRow *row, int64_t i, int rownum, MafWriter *mafWriter){
+    Segment *segment = row->segments[i];
     char *name;
     if(segment != NULL){
         if (rownum < 0 ){//reference sequence
-            name = mafSegment->name;
+            name = getSegmentName(segment);
         }else{
-            name = appendIntToName(mafSegment->name, rownum);
+            name = appendIntToName(getSegmentName(segment), rownum);
         }
 
-        int64_t totalLen = mafSegment->srcSize;
+        int64_t totalLen = getSrcSize(segment);
 	int64_t start = getSegmentStart(segment);
 	char strand = segment_getStrand(segment) ? '+' : '-';
 	int64_t len = segment_getLength(segment);//number of bases in the row
-	fprintf(fh, "s\t%s\t%" PRIi64 "\t%" PRIi64 "\t%c\t%" PRIi64 "\t%s\n", name, start, len, strand, totalLen, segment_getString(segment));
-        printIrow(mafSegment, name, fh);
+	char *string = segment_getString(segment);
+	mafWriter_writeSRow(mafWriter, name, start, len, strand, totalLen, string);
+	free(string);
+        printIrow(row, i, name, mafWriter);
+        if(rownum >= 0){
+            free(name);
+        }
     }else{//gap, write 'e' row
-        if(! mafSegment->empty ){
-            name = appendIntToName(mafSegment->name, rownum);
-            printErow(mafSegment, name, fh);
+        if(!(row->flags[i] & MAF_CELL_EMPTY)){
+            name = appendIntToName(getSegmentName(row->gapSegments[i]), rownum);
+            printErow(row, i, name, mafWriter);
+            free(name);
         }
     }
     return;
 }
-/*
-void printRefDup(struct MafSegment *mafSegment, FILE *fh){
-    assert(mafSegment != NULL);
-    Segment *segment = mafSegment->segment;
-    int64_t len = segment_getLength(segment);//number of bases in the row
-    if(segment != NULL){
-        Cap *cap = segment_get5Cap(segment);
-        char *seqName = cap_getSequenceName(cap);
-	int rownum = 0;
-	Block *block = segment_getBlock(segment);
-	Segment *currsegment;
-	Block_InstanceIterator *it = block_getInstanceIterator(block);
-	while((currsegment = block_getNext(it)) != NULL){
-	    Cap *currcap = segment_get5Cap(currsegment);
-	    char *currname = cap_getSequenceName(currcap);
-            if(strcmp(currname, seqName) == 0 && cap != currcap){
-	        currname = appendIntToName(seqName, rownum);
-		Sequence *sequence = segment_getSequence(currsegment);
-		assert(sequence != NULL);
-		int64_t totalLen = sequence_getLength(sequence);//length of the chromsome the row belongs to
-		int64_t start = getSegmentStart(currsegment);
-		char strand = segment_getStrand(currsegment) ? '+' : '-';
-		fprintf(fh, "s\t%s\t%" PRIi64 "\t%" PRIi64 "\t%c\t%" PRIi64 "\t%s\n", currname, start, len, strand, totalLen, segment_getString(currsegment));
-	        rownum++;
-	    }
-	}
-	block_destructInstanceIterator(it);
-    }
-    return;
-}*/
 
-void printMafBlocks(struct List *refrow, int64_t c, struct List *spcRows, FILE *fh){
+void printMafBlocks(struct MafRow *refrow, int64_t c, struct List *spcRows, MafWriter *mafWriter){
     int64_t i, j, h;
     for(i=0; i< refrow->length; i++){//each block
         //st_logInfo("\tColumn %" PRIi64 ":\t", i);
-        fprintf(fh, "\na\n");
-        struct MafSegment *refms = refrow->list[i];
-        printMafBlockRow(refms, -1, fh);//print the reference row
-        //printRefDup(refms, fh);
+        mafWriter_writeString(mafWriter, "\na\n");
+        printMafBlockRow(refrow, i, -1, mafWriter);//print the reference row
 	for(j=0; j < spcRows->length; j++){//each species
             struct List *currSpcRows = spcRows->list[j];
 	    struct List *rows = currSpcRows->list[c];//correspondant row(s) to refrow
 	    for(h=0; h < rows->length; h++){//each thread of current species that aligns to refrow
-                //if(j==0 && h==0){continue;}
-	        struct List *row = rows->list[h];
-	        struct MafSegment *ms = row->list[i];
-		printMafBlockRow(ms, h, fh);
+	        struct MafRow *row = rows->list[h];
+		printMafBlockRow(row, i, h, mafWriter);
             }
 	}
     }
@@ -784,83 +873,75 @@ void printMafBlocks(struct List *refrow, int64_t c, struct List *spcRows, FILE *
 
 //=============== END PRINTING MAF FOR EACH BLOCK =================
 
-/*void destructSpcRows(struct List *spcRows){
-    for(int i=0; i < spcRows->length; i++){//for each species
-        struct List *rowsList = spcRows->list[i];
-        for (int j=0; j < rowsList->length; j++){//each ref-row
-            struct List *rows = rowsList->list[j];
-            for (int k=0; k < rows->length; k++){//each row
-                //destructMyList(rows->list->list[k]);
-            }
-            free(rows->list);
-            free(rows);
-        }
-        free(rowsList->list);
-        free(rowsList);
-    }
-    free(spcRows->list);
-    free(spcRows);
-}*/
-
-void getAugmentedMafs(Flower *flower, FILE *fh, char *species){
+void getAugmentedMafs(Flower *flower, FILE *fh, char *species, int64_t workerNumber){
     /*
      *Get agumented mafs for the inputed flower. Agumented maf means new rows
      *or duplications are included in the maf records. Print to output file the
-     *annotated mafs
+     *annotated mafs. The rows of the species are got by workerNumber forked workers
      */
     struct List *spcList = splitString(species, " ");
     assert(spcList->length > 0);
     char *refSpc = spcList->list[0];
 
+    if(workerNumber > 1){
+        prefetchFlowerSubtree(flower, PREFETCH_BATCH_SIZE); //Required, the workers must not load flowers over the inherited connection, see parallelOrderedMap
+    }
+
     //Get the reference row
     st_logInfo("Getting the reference Rows (%s)\n", refSpc);
-    struct List *refRows = getReferenceRows(flower, refSpc);
+    struct RowArena *arena = rowArena_construct(); //All the rows, freed together
+    struct List *refColumnIndexes = constructEmptyList(0, (void (*)(void *))stHash_destruct);
+    struct List *refRows = getReferenceRows(flower, refSpc, refColumnIndexes, arena);
     st_logInfo("Done. There are %" PRIi64 " reference Rows.\n", refRows->length);
     assert(refRows->length > 0);
 
-    struct List *spcRows = constructEmptyList(0, free);//list of rows of other species
+    struct List *spcRows = constructEmptyList(0, (void (*)(void *))destructList);//list of rows of other species
+    MafWriter *mafWriter = mafWriter_construct(fh);
     struct List *currSpcRows;
     if(refRows->length > 0){
         //Get rows for other species
-        //for(int i=1; i < spcList->length; i++){//each species
-        for(int i=0; i < spcList->length; i++){//each species
-            st_logInfo("Getting Rows for %s\n", spcList->list[i]);
-	    currSpcRows = getRows(flower, spcList->list[i], refRows, refSpc);
-	    assert(currSpcRows->length == refRows->length);
-            listAppend(spcRows, currSpcRows);
+        if(workerNumber <= 1){
+            for(int i=0; i < spcList->length; i++){//each species
+                st_logInfo("Getting Rows for %s\n", spcList->list[i]);
+	        currSpcRows = getRows(flower, spcList->list[i], refRows, refColumnIndexes, refSpc, arena);
+	        assert(currSpcRows->length == refRows->length);
+                listAppend(spcRows, currSpcRows);
+            }
+        }else{
+            st_logInfo("Getting Rows for %" PRIi64 " species with %" PRIi64 " workers\n", spcList->length, workerNumber);
+            stHash *segmentsByName = stHash_construct3(stIntTuple_hashKey, stIntTuple_equalsFn,
+                    (void (*)(void *))stIntTuple_destruct, NULL);
+            indexSegmentsByName(flower, segmentsByName);
+            SpeciesRows speciesRows = { flower, spcList, refRows, refColumnIndexes, refSpc, arena, spcRows, segmentsByName };
+            parallelOrderedMap(spcList->length * refRows->length, workerNumber, &speciesRows,
+                    (void (*)(int64_t, FILE *, void *))getRowsP,
+                    (void (*)(int64_t, FILE *, int64_t, void *))mergeRows);
+            stHash_destruct(segmentsByName);
+            assert(spcRows->length == spcList->length);
         }
         //destructList(spcList);
  
 	for(int i=0; i < refRows->length; i++){//each reference row
-            //st_logInfo("\nRow: %" PRIi64 "\n", i);
-            printMafBlocks(refRows->list[i], i, spcRows, fh);
-            //destructMyList(refRows->list->list[i]);
-
-            /*fprintf(fh, "\na\n");
-	    printMafRow(refRows->list->list[i], fh);
-	    for(int s=0; s < spcRows->length; s++){//each species
-                currSpcRows = spcRows->list[s];
-		struct MyList *crows = currSpcRows->list->list[i];//correspondant row(s) to current refrow (ith)
-		for(int k=0; k< crows->list->length; k++){
-	            struct MyList *row = crows->list->list[k];
-		    printMafRow(row, fh);
-		}
-            }*/
+            printMafBlocks(refRows->list[i], i, spcRows, mafWriter);
 	}
     }else{
         fprintf(stderr, "Could not find the reference sequence (species): %s\n", refSpc);
     }
-    /*free(refRows->list);
-    free(refRows);*/
-    //destructSpcRows(spcRows);
+    mafWriter_destruct(mafWriter);
+    destructList(spcRows);
+    destructList(refRows);
+    destructList(refColumnIndexes);
+    rowArena_destruct(arena);
+    destructCapCursor();
     return;
 }
 
 void makeMAFHeader(Flower *flower, FILE *fileHandle) {
-    fprintf(fileHandle, "##maf version=1 scoring=N/A\n");
+    MafWriter *mafWriter = mafWriter_construct(fileHandle);
     char *cA = eventTree_makeNewickString(flower_getEventTree(flower));
-    fprintf(fileHandle, "# cactus %s\n\n", cA);
+    mafWriter_writeHeader(mafWriter, cA);
     free(cA);
+    mafWriter_destruct(mafWriter);
 }
 
 void usage(){
@@ -871,6 +952,9 @@ void usage(){
     fprintf(stderr, "-c --cactusDisk: location of the flower disk directory\n");
     fprintf(stderr, "-d --flowerName: name of the starting flower (key in the database)\n");
     fprintf(stderr, "-e --outputFile: name of the file to write the Mafs in\n");
+    fprintf(stderr, "-p --prefetch: load the whole flower subtree from the disk in batches up front, rather than one flower at a time during the traversal\n");
+    fprintf(stderr, "-f --threadStartsFile: file caching the thread starts of the flower. Loaded if it exists and matches the flower, written otherwise\n");
+    fprintf(stderr, "-j --workerNumber: the number of worker processes the rows of the species for each reference thread are shared between, by default 1\n");
     fprintf(stderr, "-h --help: print this help screen\n");
 }
 
@@ -880,6 +964,9 @@ int main(int argc, char *argv[]){
     char *flowerName = NULL;
     char *species = NULL;
     char *outputFile = NULL;
+    char *threadStartsFile = NULL;
+    bool prefetch = 0;
+    int64_t workerNumber = 1;
 
     while(1){
         static struct option long_options[] = { 
@@ -888,11 +975,14 @@ int main(int argc, char *argv[]){
 	    {"cactusDisk", required_argument, 0, 'c'},
 	    {"flowerName", required_argument, 0, 'd'},
 	    {"outputFile", required_argument, 0, 'e'},
+	    {"threadStartsFile", required_argument, 0, 'f'},
+	    {"prefetch", no_argument, 0, 'p'},
+	    {"workerNumber", required_argument, 0, 'j'},
 	    {"help", no_argument, 0, 'h'},
 	    {0, 0, 0, 0}
 	};
 	int option_index = 0;
-	int key = getopt_long(argc, argv, "a:b:c:d:e:h", long_options, &option_index);
+	int key = getopt_long(argc, argv, "a:b:c:d:e:f:hpj:", long_options, &option_index);
 	if (key == -1){ break; }
 	switch(key){
 	    case 'a':
@@ -910,6 +1000,17 @@ int main(int argc, char *argv[]){
 	    case 'e':
 	        outputFile = stString_copy(optarg);
 		break;
+	    case 'f':
+	        threadStartsFile = stString_copy(optarg);
+		break;
+	    case 'p':
+	        prefetch = 1;
+		break;
+	    case 'j':
+	        if(sscanf(optarg, "%" SCNi64 "", &workerNumber) != 1){
+		    st_errAbort("Could not parse the worker number %s\n", optarg);
+		}
+		break;
 	    case 'h':
 	        usage();
 		return 0;
@@ -934,9 +1035,19 @@ int main(int argc, char *argv[]){
     // Parse the basic reconstruction problem
     ///////////////////////////////////////////////////////////////////////////
 
-    Flower *flower = cactusDisk_getFlower(cactusDisk, cactusMisc_stringToName(
+    Flower *flower = getFlower(cactusDisk, cactusMisc_stringToName(
             flowerName));
     st_logInfo("Parsed the top level flower of the cactus tree to check\n");
+    if(prefetch){
+        prefetchFlowerSubtree(flower, PREFETCH_BATCH_SIZE);
+    }
+    flower_buildSequenceHeaderIndex(flower); //Species are matched against the headers once per reference row
+    //getRows gets the thread starts of every species for every reference row, so find them once
+    if(threadStartsFile == NULL){
+        flower_buildThreadStartTable(flower);
+    }else if(flower_loadThreadStartTable(flower, threadStartsFile) == NULL){
+        flower_writeThreadStartTable(flower, threadStartsFile);
+    }
 
     ///////////////////////////////////////////////////////////////////////////
     // Recursive check the flowers.
@@ -955,9 +1066,10 @@ int main(int argc, char *argv[]){
     }
 
     FILE *fh = fopen(outputFile, "w");
+    setvbuf(fh, NULL, _IOFBF, MAF_WRITER_BUFFER_SIZE);
     makeMAFHeader(flower, fh);
        
-    getAugmentedMafs(flower, fh, species);
+    getAugmentedMafs(flower, fh, species, workerNumber);
     fprintf(fh, "\n");
 
     fclose(fh);
@@ -967,6 +1079,9 @@ int main(int argc, char *argv[]){
     // Clean up.
     ///////////////////////////////////////////////////////////////////////////
 
+    flower_destructThreadStartTable(flower);
+    flower_destructSequenceHeaderIndex(flower);
+    destructInternedSequenceHeaders();
     cactusDisk_destruct(cactusDisk);
     stKVDatabaseConf_destruct(kvDatabaseConf);
 
@@ -0,0 +1,102 @@
+/*
+ * cactus_binaryMAFToMAF.c
+ *
+ *  Created on: 17 Oct 2026
+ */
+
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "cactus.h"
+#include "sonLib.h"
+#include "mafWriter.h"
+#include "binaryMaf.h"
+
+static void usage() {
+    fprintf(stderr, "cactus_binaryMAFToMAF, version 0.1\n");
+    fprintf(stderr, "-a --logLevel : Set the log level\n");
+    fprintf(stderr, "-i --inputFile : The binary MAF written by cactus_MAFGenerator --format binary, by default stdin.\n");
+    fprintf(stderr, "-e --outputFile : The file to write the MAF in, by default stdout.\n");
+    fprintf(stderr, "-h --help : Print this help screen\n");
+}
+
+int main(int argc, char *argv[]) {
+    /*
+     * Arguments/options
+     */
+    char * logLevelString = NULL;
+    char * inputFile = NULL;
+    char * outputFile = NULL;
+
+    ///////////////////////////////////////////////////////////////////////////
+    // (0) Parse the inputs / setup stuff.
+    ///////////////////////////////////////////////////////////////////////////
+
+    while (1) {
+        static struct option long_options[] = { { "logLevel", required_argument, 0, 'a' },
+                { "inputFile", required_argument, 0, 'i' },
+                { "outputFile", required_argument, 0, 'e' },
+                { "help", no_argument, 0, 'h' }, { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+
+        int key = getopt_long(argc, argv, "a:i:e:h", long_options, &option_index);
+
+        if (key == -1) {
+            break;
+        }
+
+        switch (key) {
+            case 'a':
+                logLevelString = stString_copy(optarg);
+                break;
+            case 'i':
+                inputFile = stString_copy(optarg);
+                break;
+            case 'e':
+                outputFile = stString_copy(optarg);
+                break;
+            case 'h':
+                usage();
+                return 0;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    st_setLogLevelFromString(logLevelString);
+
+    FILE *input = inputFile != NULL ? fopen(inputFile, "rb") : stdin;
+    if (input == NULL) {
+        st_errAbort("Could not open the binary MAF file %s\n", inputFile);
+    }
+    FILE *output = outputFile != NULL ? fopen(outputFile, "w") : stdout;
+    if (output == NULL) {
+        st_errAbort("Could not open the output file %s\n", outputFile);
+    }
+
+    binaryMaf_convertToMaf(input, output);
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Clean up.
+    ///////////////////////////////////////////////////////////////////////////
+
+    if (input != stdin) {
+        fclose(input);
+    }
+    if (output != stdout) {
+        fclose(output);
+    }
+
+    return 0;
+}
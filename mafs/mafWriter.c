@@ -0,0 +1,119 @@
+/*
+ * mafWriter.c
+ *
+ *  Created on: 17 Oct 2026
+ */
+
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "cactus.h"
+#include "sonLib.h"
+#include "mafWriter.h"
+
+struct _mafWriter {
+    FILE *fileHandle;
+    char *buffer;
+    int64_t length;
+};
+
+MafWriter *mafWriter_construct(FILE *fileHandle) {
+    MafWriter *mafWriter = st_malloc(sizeof(MafWriter));
+    mafWriter->fileHandle = fileHandle;
+    mafWriter->buffer = st_malloc(MAF_WRITER_BUFFER_SIZE);
+    mafWriter->length = 0;
+    return mafWriter;
+}
+
+void mafWriter_destruct(MafWriter *mafWriter) {
+    mafWriter_flush(mafWriter);
+    free(mafWriter->buffer);
+    free(mafWriter);
+}
+
+void mafWriter_flush(MafWriter *mafWriter) {
+    if (mafWriter->length > 0) {
+        if (fwrite(mafWriter->buffer, sizeof(char), mafWriter->length, mafWriter->fileHandle) != mafWriter->length) {
+            st_errAbort("Could not write %" PRIi64 " bytes of MAF output\n", mafWriter->length);
+        }
+        mafWriter->length = 0;
+    }
+}
+
+FILE *mafWriter_getFile(MafWriter *mafWriter) {
+    return mafWriter->fileHandle;
+}
+
+void mafWriter_setFile(MafWriter *mafWriter, FILE *fileHandle) {
+    mafWriter_flush(mafWriter);
+    mafWriter->fileHandle = fileHandle;
+}
+
+void mafWriter_writeBytes(MafWriter *mafWriter, const char *data, int64_t length) {
+    if (mafWriter->length + length > MAF_WRITER_BUFFER_SIZE) {
+        mafWriter_flush(mafWriter);
+        if (length > MAF_WRITER_BUFFER_SIZE) { //Too big to buffer, so write it straight out
+            if (fwrite(data, sizeof(char), length, mafWriter->fileHandle) != length) {
+                st_errAbort("Could not write %" PRIi64 " bytes of MAF output\n", length);
+            }
+            return;
+        }
+    }
+    memcpy(mafWriter->buffer + mafWriter->length, data, length);
+    mafWriter->length += length;
+}
+
+void mafWriter_writeChar(MafWriter *mafWriter, char c) {
+    if (mafWriter->length == MAF_WRITER_BUFFER_SIZE) {
+        mafWriter_flush(mafWriter);
+    }
+    mafWriter->buffer[mafWriter->length++] = c;
+}
+
+void mafWriter_writeString(MafWriter *mafWriter, const char *string) {
+    mafWriter_writeBytes(mafWriter, string, strlen(string));
+}
+
+void mafWriter_writeInt(MafWriter *mafWriter, int64_t i) {
+    char digits[21]; //Enough for the digits of any int64_t, written backwards
+    int64_t digitNumber = 0;
+    uint64_t j = i < 0 ? -((uint64_t) i) : (uint64_t) i;
+    do {
+        digits[digitNumber++] = '0' + j % 10;
+        j /= 10;
+    } while (j > 0);
+    if (i < 0) {
+        mafWriter_writeChar(mafWriter, '-');
+    }
+    while (digitNumber > 0) {
+        mafWriter_writeChar(mafWriter, digits[--digitNumber]);
+    }
+}
+
+void mafWriter_writeSRow(MafWriter *mafWriter, const char *name, int64_t start, int64_t length,
+        char strand, int64_t sourceLength, const char *text) {
+    mafWriter_writeBytes(mafWriter, "s\t", 2);
+    mafWriter_writeString(mafWriter, name);
+    mafWriter_writeChar(mafWriter, '\t');
+    mafWriter_writeInt(mafWriter, start);
+    mafWriter_writeChar(mafWriter, '\t');
+    mafWriter_writeInt(mafWriter, length);
+    mafWriter_writeChar(mafWriter, '\t');
+    mafWriter_writeChar(mafWriter, strand);
+    mafWriter_writeChar(mafWriter, '\t');
+    mafWriter_writeInt(mafWriter, sourceLength);
+    mafWriter_writeChar(mafWriter, '\t');
+    mafWriter_writeString(mafWriter, text);
+    mafWriter_writeChar(mafWriter, '\n');
+}
+
+void mafWriter_writeHeader(MafWriter *mafWriter, const char *eventTreeString) {
+    mafWriter_writeString(mafWriter, "##maf version=1 scoring=N/A\n# cactus ");
+    mafWriter_writeString(mafWriter, eventTreeString);
+    mafWriter_writeBytes(mafWriter, "\n\n", 2);
+}
@@ -0,0 +1,58 @@
+/*
+ * mafWriter.h
+ *
+ *  Created on: 17 Oct 2026
+ */
+
+#ifndef MAF_WRITER_H_
+#define MAF_WRITER_H_
+
+/*
+ * Writes MAF text through a user space buffer, formatting integers by hand and copying strings
+ * in bulk, rather than with an fprintf per row. Output reaches the file only when the buffer
+ * fills or is flushed, so flush before anything else writes to the file or asks its position.
+ */
+
+#define MAF_WRITER_BUFFER_SIZE 1048576
+
+typedef struct _mafWriter MafWriter;
+
+MafWriter *mafWriter_construct(FILE *fileHandle);
+
+/*
+ * Flushes the writer, but does not close its file.
+ */
+void mafWriter_destruct(MafWriter *mafWriter);
+
+void mafWriter_flush(MafWriter *mafWriter);
+
+FILE *mafWriter_getFile(MafWriter *mafWriter);
+
+/*
+ * Flushes the writer, then directs further output to the given file.
+ */
+void mafWriter_setFile(MafWriter *mafWriter, FILE *fileHandle);
+
+void mafWriter_writeChar(MafWriter *mafWriter, char c);
+
+void mafWriter_writeString(MafWriter *mafWriter, const char *string);
+
+/*
+ * Writes length bytes, which may include NULs.
+ */
+void mafWriter_writeBytes(MafWriter *mafWriter, const char *data, int64_t length);
+
+void mafWriter_writeInt(MafWriter *mafWriter, int64_t i);
+
+/*
+ * Writes an 's' row, "s\tname\tstart\tlength\tstrand\tsourceLength\ttext\n".
+ */
+void mafWriter_writeSRow(MafWriter *mafWriter, const char *name, int64_t start, int64_t length,
+        char strand, int64_t sourceLength, const char *text);
+
+/*
+ * Writes the header of a MAF file for the given newick event tree.
+ */
+void mafWriter_writeHeader(MafWriter *mafWriter, const char *eventTreeString);
+
+#endif /* MAF_WRITER_H_ */
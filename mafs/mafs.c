@@ -12,59 +12,186 @@
 #include <time.h>
 #include <getopt.h>
 #include <ctype.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #include "cactus.h"
 #include "avl.h"
 #include "commonC.h"
 #include "hashTableC.h"
 #include "cactusTraversal.h"
+#include "cactusParallel.h"
+#include "cactusUtils.h"
+#include "cactusSnapshot.h"
+#include "mafWriter.h"
+#include "binaryMaf.h"
+#include "segmentStrings.h"
+#include "bgzfFile.h"
+#include "cactusMafs.h"
 
 
 /*
  * Library for generating mafs from cactus.
  */
 
-static char *formatSequenceHeader(Sequence *sequence) {
-    const char *sequenceHeader = sequence_getHeader(sequence);
-    if (strlen(sequenceHeader) > 0) {
-        char *cA = st_malloc(sizeof(char) * (1 + strlen(sequenceHeader)));
-        sscanf(sequenceHeader, "%s", cA);
-        return cA;
-    } else {
-        return cactusMisc_nameToString(sequence_getName(sequence));
-    }
-}
+//The reference caps of the 5' end of the last block shown with only substitutions, as all its segments are shown in turn
+static EndEventIndex *referenceEndEventIndex = NULL;
 
-static char *getSegmentStringShowingOnlySubstitutionsWithRespectToTheReference(Segment *segment) {
-    char *string = segment_getString(segment);
-    assert(string != NULL);
+static Segment *getOtherReferenceSegment(Segment *segment) {
+    /*
+     * Gets the first segment of the reference event in the segment's block, other than the segment itself.
+     */
     Block *block = segment_getBlock(segment);
-    Block_InstanceIterator *it = block_getInstanceIterator(block);
-    Segment *segment2;
-    while((segment2 = block_getNext(it)) != NULL) {
-        if(segment2 != segment && strcmp(cactusMisc_getDefaultReferenceEventHeader(), event_getHeader(segment_getEvent(segment2))) == 0) {
+    End *end = block_get5End(block_getPositiveOrientation(block));
+    if (referenceEndEventIndex == NULL || endEventIndex_getEnd(referenceEndEventIndex) != end) {
+        if (referenceEndEventIndex != NULL) {
+            endEventIndex_destruct(referenceEndEventIndex);
+        }
+        referenceEndEventIndex = endEventIndex_construct(end);
+    }
+    Event *referenceEvent = eventTree_getEventByHeader(flower_getEventTree(block_getFlower(block)),
+            cactusMisc_getDefaultReferenceEventHeader());
+    if (referenceEvent == NULL) {
+        return NULL;
+    }
+    int64_t capNumber;
+    Cap **caps = endEventIndex_getCaps(referenceEndEventIndex, event_getName(referenceEvent), &capNumber);
+    for (int64_t i = 0; i < capNumber; i++) {
+        Segment *segment2 = cap_getSegment(caps[i]);
+        assert(segment2 != NULL);
+        if (segment_getBlock(segment2) != block) { //Same orientation as the segment
+            segment2 = segment_getReverse(segment2);
+        }
+        if (segment2 != segment) {
             assert(segment != segment_getReverse(segment2));
-            char *string2 = segment_getString(segment2);
-            assert(string2 != NULL);
-            assert(strlen(string) == strlen(string2));
-            for(int64_t i=0; i<strlen(string); i++) {
-                if(toupper(string[i]) == toupper(string2[i])) {
-                    string[i] = '*';
-                }
-            }
-            free(string2);
-            break;
+            return segment2;
         }
     }
-    block_destructInstanceIterator(it);
+    return NULL;
+}
+
+//Buffers the rows of a block, which are written out once the block is complete
+static MafWriter *mafWriter = NULL;
+
+static MafWriter *getMafWriter(FILE *fileHandle) {
+    if (mafWriter == NULL) {
+        mafWriter = mafWriter_construct(fileHandle);
+    } else if (mafWriter_getFile(mafWriter) != fileHandle) {
+        mafWriter_setFile(mafWriter, fileHandle);
+    }
+    return mafWriter;
+}
+
+/*
+ * Replaces each character of string that matches the character of referenceString at the same
+ * position, ignoring case, with '*'. Only ASCII letters are case folded, as by toupper in the C
+ * locale. Two characters match if they are equal, or differ only in the 0x20 bit and are letters.
+ * Vectorised with AVX2 or SSE2 where the compiler targets them, with a scalar loop for the tail.
+ */
+static void maskSubstitutions(char *string, const char *referenceString, int64_t length) {
+    int64_t i = 0;
+#if defined(__AVX2__)
+    const __m256i caseBit = _mm256_set1_epi8(0x20);
+    const __m256i letterShift = _mm256_set1_epi8((char) (128 - 'a'));
+    const __m256i letterLimit = _mm256_set1_epi8((char) (-128 + 26));
+    const __m256i mask = _mm256_set1_epi8('*');
+    for (; i + 32 <= length; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (string + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (referenceString + i));
+        __m256i isLetter = _mm256_cmpgt_epi8(letterLimit, _mm256_add_epi8(_mm256_or_si256(a, caseBit), letterShift));
+        __m256i matches = _mm256_or_si256(_mm256_cmpeq_epi8(a, b),
+                _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_xor_si256(a, b), caseBit), isLetter));
+        _mm256_storeu_si256((__m256i *) (string + i), _mm256_blendv_epi8(a, mask, matches));
+    }
+#elif defined(__SSE2__)
+    const __m128i caseBit = _mm_set1_epi8(0x20);
+    const __m128i letterShift = _mm_set1_epi8((char) (128 - 'a'));
+    const __m128i letterLimit = _mm_set1_epi8((char) (-128 + 26));
+    const __m128i mask = _mm_set1_epi8('*');
+    for (; i + 16 <= length; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (string + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (referenceString + i));
+        //(a | 0x20) - 'a' is in 0..25 for letters, so shifted into the signed range it is below -128 + 26
+        __m128i isLetter = _mm_cmplt_epi8(_mm_add_epi8(_mm_or_si128(a, caseBit), letterShift), letterLimit);
+        __m128i matches = _mm_or_si128(_mm_cmpeq_epi8(a, b),
+                _mm_and_si128(_mm_cmpeq_epi8(_mm_xor_si128(a, b), caseBit), isLetter));
+        _mm_storeu_si128((__m128i *) (string + i), _mm_or_si128(_mm_and_si128(matches, mask), _mm_andnot_si128(matches, a)));
+    }
+#endif
+    for (; i < length; i++) {
+        unsigned char c = string[i], d = referenceString[i];
+        if (c == d || ((c ^ d) == 0x20 && (unsigned char) ((c | 0x20) - 'a') < 26)) {
+            string[i] = '*';
+        }
+    }
+}
+
+//The strings of the segments of the current block, in an arena reused between blocks (and per worker, as they are forked)
+static SegmentStrings *segmentStrings = NULL;
+
+/*
+ * The strings of the reference segments of the current block that other rows are compared to. A
+ * row is compared to the first reference segment of its block, or the first reference row to the
+ * second, so there are at most two, each got once per block rather than once per row.
+ */
+static Segment *referenceStringSegments[2] = { NULL, NULL };
+static char *referenceStrings[2] = { NULL, NULL };
+
+static const char *getReferenceString(Segment *segment) {
+    for (int64_t i = 0; i < 2; i++) {
+        if (referenceStringSegments[i] == segment) {
+            return referenceStrings[i];
+        }
+        if (referenceStringSegments[i] == NULL) {
+            referenceStringSegments[i] = segment;
+            referenceStrings[i] = segmentStrings_get(segmentStrings, segment);
+            return referenceStrings[i];
+        }
+    }
+    assert(0); //A block only has two reference segments that are compared to
+    return NULL;
+}
+
+static char *getSegmentStringShowingOnlySubstitutionsWithRespectToTheReference(Segment *segment) {
+    char *string = segmentStrings_get(segmentStrings, segment);
+    Segment *segment2 = getOtherReferenceSegment(segment);
+    if (segment2 != NULL) {
+        maskSubstitutions(string, getReferenceString(segment2), segment_getLength(segment));
+    }
     return string;
 }
 
-static void getMAFBlockP2(Segment *segment, FILE *fileHandle, char *(*getString)(Segment *segment)) {
+static char *getSegmentString(Segment *segment) {
+    return segmentStrings_get(segmentStrings, segment);
+}
+
+/*
+ * The names of the sequences of a binary MAF, sorted, so a sequence's number in the header is the
+ * index of its name, set by makeBinaryMAFHeader.
+ */
+static Name *binarySequenceNames = NULL;
+static int64_t binarySequenceNumber = 0;
+
+static int compareNames(const void *a, const void *b) {
+    Name i = *(const Name *) a, j = *(const Name *) b;
+    return i < j ? -1 : (i > j ? 1 : 0);
+}
+
+static int64_t getBinarySequenceNumber(Sequence *sequence) {
+    Name name = sequence_getName(sequence);
+    Name *i = bsearch(&name, binarySequenceNames, binarySequenceNumber, sizeof(Name), compareNames);
+    if (i == NULL) {
+        st_errAbort("The sequence %s is not in the header of the binary MAF\n", getInternedSequenceHeader(sequence));
+    }
+    return i - binarySequenceNames;
+}
+
+static void getMAFBlockP2(Segment *segment, MafWriter *mafWriter, char *(*getString)(Segment *segment), bool binary) {
     assert(segment != NULL);
     Sequence *sequence = segment_getSequence(segment);
     if (sequence != NULL) {
-        char *sequenceHeader = formatSequenceHeader(sequence);
+        const char *sequenceHeader = getInternedSequenceHeader(sequence);
         int64_t start;
         if (segment_getStrand(segment)) {
             start = segment_getStart(segment) - sequence_getStart(sequence);
@@ -72,23 +199,44 @@ static void getMAFBlockP2(Segment *segment, FILE *fileHandle, char *(*getString)
             start = (sequence_getStart(sequence) + sequence_getLength(sequence)
                     - 1) - segment_getStart(segment);
         }
-        int64_t length = segment_getLength(segment);
-        char *strand = segment_getStrand(segment) ? "+" : "-";
-        int64_t sequenceLength = sequence_getLength(sequence);
-        char *instanceString = getString(segment); //segment_getString(segment);
-        fprintf(fileHandle, "s\t%s\t%" PRIi64 "\t%" PRIi64 "\t%s\t%" PRIi64 "\t%s\n", sequenceHeader,
-                start, length, strand, sequenceLength, instanceString);
-        free(instanceString);
-        free(sequenceHeader);
+        char *instanceString = getString(segment); //In the block's arena, so not freed
+        if (binary) {
+            binaryMaf_writeRow(mafWriter, getBinarySequenceNumber(sequence), start, segment_getLength(segment),
+                    segment_getStrand(segment), instanceString, segment_getLength(segment));
+        } else {
+            mafWriter_writeSRow(mafWriter, sequenceHeader, start, segment_getLength(segment),
+                    segment_getStrand(segment) ? '+' : '-', sequence_getLength(sequence), instanceString);
+        }
+    }
+}
+
+static void writeBlockNewickString(MafWriter *mafWriter, Segment *segment) {
+    /*
+     * Writes the newick string of the segment's subtree, as block_makeNewickString(block, 1, 0) (without
+     * the ';'), straight into the writer's buffer rather than building and concatenating a string per node.
+     */
+    while (segment_getChildNumber(segment) == 1) { //Skip unary events
+        segment = segment_getChild(segment, 0);
     }
+    if (segment_getChildNumber(segment) > 0) {
+        mafWriter_writeChar(mafWriter, '(');
+        for (int64_t i = 0; i < segment_getChildNumber(segment); i++) {
+            if (i > 0) {
+                mafWriter_writeChar(mafWriter, ',');
+            }
+            writeBlockNewickString(mafWriter, segment_getChild(segment, i));
+        }
+        mafWriter_writeChar(mafWriter, ')');
+    }
+    mafWriter_writeInt(mafWriter, segment_getName(segment));
 }
 
-static void getMAFBlockP(Segment *segment, FILE *fileHandle, char *(*getString)(Segment *segment)) {
+static void getMAFBlockP(Segment *segment, MafWriter *mafWriter, char *(*getString)(Segment *segment), bool binary) {
     int64_t i;
     for (i = 0; i < segment_getChildNumber(segment); i++) {
-        getMAFBlockP(segment_getChild(segment, i), fileHandle, getString);
+        getMAFBlockP(segment_getChild(segment, i), mafWriter, getString, binary);
     }
-    getMAFBlockP2(segment, fileHandle, getString);
+    getMAFBlockP2(segment, mafWriter, getString, binary);
 }
 
 static int64_t getNumberOnPositiveStrand(Block *block) {
@@ -106,28 +254,43 @@ static int64_t getNumberOnPositiveStrand(Block *block) {
     return i;
 }
 
-static void getMAFBlock2(Block *block, FILE *fileHandle, char *(*getString)(Segment *segment)) {
+static void getMAFBlock2(Block *block, FILE *fileHandle, char *(*getString)(Segment *segment), bool binary) {
     //void getMAFBlock(Block *block, FILE *fileHandle, ReferenceSequence *referenceSequence) {
     /*
-     * Outputs a MAF representation of the block to the given file handle.
+     * Outputs a MAF representation of the block to the given file handle, or if binary its binary MAF record.
      */
     //Correct the orientation..
     if (getNumberOnPositiveStrand(block) == 0) {
         block = block_getReverse(block);
     }
     if (block_getInstanceNumber(block) > 0) {
+        MafWriter *mafWriter = getMafWriter(fileHandle);
+        //Room for each row, and the reference rows compared to
+        if (segmentStrings == NULL) {
+            segmentStrings = segmentStrings_construct(SEGMENT_STRINGS_CHUNK_NUMBER);
+        }
+        segmentStrings_reset(segmentStrings, block_getInstanceNumber(block) + 2, block_getLength(block));
+        referenceStringSegments[0] = NULL;
+        referenceStringSegments[1] = NULL;
         //Add in the header
-        if (block_getRootInstance(block) != NULL) {
-            /* Get newick tree string with internal labels and no unary events */
-            char *newickTreeString = block_makeNewickString(block, 1, 0);
-            assert(newickTreeString != NULL);
-            fprintf(fileHandle, "a score=%" PRIi64 " tree='%s'\n",
-                    block_getLength(block) * block_getInstanceNumber(block),
-                    newickTreeString);
-            free(newickTreeString);
+        if (binary) {
+            binaryMaf_writeBlockStart(mafWriter, block_getLength(block) * block_getInstanceNumber(block));
+            if (block_getRootInstance(block) != NULL) {
+                binaryMaf_writeBlockTreeStart(mafWriter);
+                writeBlockNewickString(mafWriter, block_getRootInstance(block));
+                mafWriter_writeChar(mafWriter, ';');
+                binaryMaf_writeBlockTreeEnd(mafWriter);
+            }
         } else {
-            fprintf(fileHandle, "a score=%" PRIi64 "\n",
-                    block_getLength(block) * block_getInstanceNumber(block));
+            mafWriter_writeString(mafWriter, "a score=");
+            mafWriter_writeInt(mafWriter, block_getLength(block) * block_getInstanceNumber(block));
+            if (block_getRootInstance(block) != NULL) {
+                /* The newick tree string with internal labels and no unary events */
+                mafWriter_writeString(mafWriter, " tree='");
+                writeBlockNewickString(mafWriter, block_getRootInstance(block));
+                mafWriter_writeString(mafWriter, ";'");
+            }
+            mafWriter_writeChar(mafWriter, '\n');
         }
         //Now for the reference segment
         /*if (referenceSequence != NULL) {
@@ -142,60 +305,311 @@ static void getMAFBlock2(Block *block, FILE *fileHandle, char *(*getString)(Segm
         //Now add the blocks in
         if (block_getRootInstance(block) != NULL) {
             assert(block_getRootInstance(block) != NULL);
-            getMAFBlockP(block_getRootInstance(block), fileHandle, getString);
-            fprintf(fileHandle, "\n");
+            getMAFBlockP(block_getRootInstance(block), mafWriter, getString, binary);
         } else {
             Block_InstanceIterator *iterator = block_getInstanceIterator(block);
             Segment *segment;
             while ((segment = block_getNext(iterator)) != NULL) {
-                getMAFBlockP2(segment, fileHandle, getString);
+                getMAFBlockP2(segment, mafWriter, getString, binary);
             }
             block_destructInstanceIterator(iterator);
-            fprintf(fileHandle, "\n");
         }
+        if (binary) {
+            binaryMaf_writeBlockEnd(mafWriter);
+        } else {
+            mafWriter_writeChar(mafWriter, '\n');
+        }
+        mafWriter_flush(mafWriter); //So the file is up to date between blocks
     }
 }
 
 void getMAFBlock(Block *block, FILE *fileHandle) {
-    getMAFBlock2(block, fileHandle, segment_getString);
+    getMAFBlock2(block, fileHandle, getSegmentString, 0);
 }
 
 void getMAFBlockShowingOnlySubstitutionsWithRespectToTheReference(Block *block, FILE *fileHandle) {
-    getMAFBlock2(block, fileHandle, getSegmentStringShowingOnlySubstitutionsWithRespectToTheReference);
+    getMAFBlock2(block, fileHandle, getSegmentStringShowingOnlySubstitutionsWithRespectToTheReference, 0);
 }
 
-void(*prepMafBlockFn)(Block *, FILE *);
+void getBinaryMAFBlock(Block *block, FILE *fileHandle) {
+    getMAFBlock2(block, fileHandle, getSegmentString, 1);
+}
 
-void prepMafBlock(stList *caps, FILE *fileHandle) {
-    Cap *cap = stList_get(caps, 0);
-    assert(cap_getSide(cap));
-    if(cap_getSegment(cap)) {
-        prepMafBlockFn(segment_getBlock(cap_getSegment(cap)), fileHandle);
-    }
+void getBinaryMAFBlockShowingOnlySubstitutionsWithRespectToTheReference(Block *block, FILE *fileHandle) {
+    getMAFBlock2(block, fileHandle, getSegmentStringShowingOnlySubstitutionsWithRespectToTheReference, 1);
 }
 
-void getMAFsReferenceOrdered2(const char *referenceEventString, Flower *flower,
-        FILE *fileHandle, void(*getMafBlockFn)(Block *, FILE *)) {
+#define CAP_BATCH_SIZE 256
+
+
+static stList *getReferenceThreadStarts(const char *referenceEventString, Flower *flower) {
     /*
-     * Outputs MAF representations of all the block in the flower and its descendants, ordered
-     * according to the reference ordering.
+     * Gets the 3' caps of the reference threads, in the order of the flower's ends.
      */
     Event *referenceEvent = eventTree_getEventByHeader(flower_getEventTree(flower), referenceEventString);
+    stList *startCaps = stList_construct();
     End *end;
     Flower_EndIterator *endIt = flower_getEndIterator(flower);
-    prepMafBlockFn = getMafBlockFn;
     while ((end = flower_getNextEnd(endIt)) != NULL) {
         if (end_isStubEnd(end) && end_isAttached(end)) {
             Cap *cap = getCapForReferenceEvent(end, event_getName(referenceEvent)); //The cap in the reference
-            assert(cap != NULL);
+            if (cap == NULL) {
+                st_logDebug("Attached stub end %s has no reference cap, skipping it\n", cactusMisc_nameToStringStatic(end_getName(end)));
+                continue;
+            }
             assert(cap_getSequence(cap) != NULL);
             cap = cap_getStrand(cap) ? cap : cap_getReverse(cap);
             if(!cap_getSide(cap)) {
-                traverseCapsInSequenceOrderFrom3PrimeCap(cap, fileHandle, NULL, (void (*)(stList *, void *))prepMafBlock);
+                stList_append(startCaps, cap);
             }
         }
     }
     flower_destructEndIterator(endIt);
+    return startCaps;
+}
+
+static void writeMafIndexEntry(FILE *indexFileHandle, Segment *segment, int64_t offset) {
+    /*
+     * Writes the index line of the block of a reference segment: the reference sequence, the
+     * start and end of the segment on its positive strand and the offset of the block in the MAF.
+     */
+    Sequence *sequence = segment_getSequence(segment);
+    assert(sequence != NULL);
+    int64_t start = segment_getStart(segment_getStrand(segment) ? segment : segment_getReverse(segment))
+            - sequence_getStart(sequence);
+    fprintf(indexFileHandle, "%s\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\n", getInternedSequenceHeader(sequence),
+            start, start + segment_getLength(segment), offset);
+}
+
+static char *getMafIndexSequenceRun(const char *sequenceHeader, int64_t runStart, int64_t runEnd, bool sorted) {
+    return stString_print("%s\t%s\t%" PRIi64 "\t%" PRIi64 "\t%i\n", MAF_INDEX_SEQUENCE, sequenceHeader, runStart, runEnd,
+            (int) sorted);
+}
+
+void writeMafIndexSequenceTable(FILE *indexFileHandle) {
+    /*
+     * Reads back the index lines, finding the runs of consecutive lines of each sequence, then
+     * appends a line for each run and the trailer giving the offset of the first.
+     */
+    if (fflush(indexFileHandle) != 0 || fseek(indexFileHandle, 0, SEEK_SET) != 0) {
+        st_errAbort("Could not read back the MAF index\n");
+    }
+    stList *runs = stList_construct3(0, free);
+    char *sequenceHeader = NULL;
+    int64_t runStart = 0, lineStart = 0, previousStart = 0, previousEnd = 0;
+    bool sorted = 1;
+    char *line;
+    while ((line = stFile_getLineFromFile(indexFileHandle)) != NULL) {
+        char *tab = strchr(line, '\t');
+        int64_t start, end;
+        if (tab == NULL || sscanf(tab + 1, "%" SCNi64 "\t%" SCNi64 "", &start, &end) != 2) {
+            st_errAbort("Could not parse the index line %s\n", line);
+        }
+        *tab = '\0';
+        if (sequenceHeader == NULL || strcmp(sequenceHeader, line) != 0) {
+            if (sequenceHeader != NULL) {
+                stList_append(runs, getMafIndexSequenceRun(sequenceHeader, runStart, lineStart, sorted));
+                free(sequenceHeader);
+            }
+            sequenceHeader = stString_copy(line);
+            runStart = lineStart;
+            sorted = 1;
+        } else if (start < previousStart || end < previousEnd) {
+            sorted = 0;
+        }
+        previousStart = start;
+        previousEnd = end;
+        lineStart = ftell(indexFileHandle);
+        free(line);
+    }
+    if (sequenceHeader != NULL) {
+        stList_append(runs, getMafIndexSequenceRun(sequenceHeader, runStart, lineStart, sorted));
+        free(sequenceHeader);
+    }
+    if (fseek(indexFileHandle, 0, SEEK_END) != 0) {
+        st_errAbort("Could not append the sequence table to the MAF index\n");
+    }
+    for (int64_t i = 0; i < stList_length(runs); i++) {
+        fputs(stList_get(runs, i), indexFileHandle);
+    }
+    fprintf(indexFileHandle, "%s\t%0*" PRIi64 "\n", MAF_INDEX_SEQUENCE_TABLE, MAF_INDEX_SEQUENCE_TABLE_DIGITS, lineStart);
+    st_logInfo("Wrote a sequence table of %" PRIi64 " runs to the MAF index\n", stList_length(runs));
+    stList_destruct(runs);
+}
+
+static void copyMafIndexEntries(FILE *input, int64_t length, int64_t offsetShift, FILE *output) {
+    /*
+     * Copies length bytes of index lines, adding offsetShift to the offset of each.
+     */
+    int64_t end = ftell(input) + length;
+    while (ftell(input) < end) {
+        for (int64_t tabs = 0; tabs < 3;) { //Copy the sequence, start and end
+            int c = fgetc(input);
+            if (c == EOF) {
+                st_errAbort("The MAF index entries of a parallel item were truncated\n");
+            }
+            fputc(c, output);
+            tabs += c == '\t';
+        }
+        int64_t offset;
+        if (fscanf(input, "%" SCNi64 "\n", &offset) != 1) {
+            st_errAbort("The MAF index entries of a parallel item were truncated\n");
+        }
+        fprintf(output, "%" PRIi64 "\n", offset + offsetShift);
+    }
+}
+
+static void getMAFsForReferenceThread(CapCursor *capCursor, Cap *startCap,
+        FILE *fileHandle, void(*getMafBlockFn)(Block *, FILE *), FILE *indexFileHandle, int64_t startOffset) {
+    /*
+     * If indexFileHandle is not NULL writes an index entry for each block, its offset being
+     * relative to startOffset.
+     */
+    Cap *caps[CAP_BATCH_SIZE];
+    capCursor_reset(capCursor, startCap);
+    //Pull the 5' caps of the thread in order, a batch at a time
+    int64_t capNumber;
+    while ((capNumber = capCursor_nextBatch(capCursor, 1, caps, NULL, CAP_BATCH_SIZE)) > 0) {
+        for (int64_t i = 0; i < capNumber; i++) {
+            Segment *segment = cap_getSegment(caps[i]);
+            if (segment != NULL) {
+                if (indexFileHandle != NULL) {
+                    writeMafIndexEntry(indexFileHandle, segment, ftell(fileHandle) - startOffset);
+                }
+                getMafBlockFn(segment_getBlock(segment), fileHandle);
+            }
+        }
+    }
+}
+
+typedef struct _referenceThreadMafs {
+    stList *startCaps;
+    CapCursor *capCursor;
+    FILE *fileHandle;
+    void(*getMafBlockFn)(Block *, FILE *);
+    FILE *indexFileHandle;
+} ReferenceThreadMafs;
+
+static void getMAFsForReferenceThreadP(int64_t item, FILE *output, ReferenceThreadMafs *referenceThreadMafs) {
+    /*
+     * With an index, the output of the item is its MAF, then its index lines, then the length of its MAF.
+     */
+    if (referenceThreadMafs->indexFileHandle == NULL) {
+        getMAFsForReferenceThread(referenceThreadMafs->capCursor, stList_get(referenceThreadMafs->startCaps, item),
+                output, referenceThreadMafs->getMafBlockFn, NULL, 0);
+        return;
+    }
+    int64_t startOffset = ftell(output);
+    FILE *indexLines = tmpfile();
+    if (indexLines == NULL) {
+        st_errAbort("Could not create a temporary file for the MAF index entries\n");
+    }
+    getMAFsForReferenceThread(referenceThreadMafs->capCursor, stList_get(referenceThreadMafs->startCaps, item),
+            output, referenceThreadMafs->getMafBlockFn, indexLines, startOffset);
+    int64_t mafLength = ftell(output) - startOffset;
+    int64_t indexLength = ftell(indexLines);
+    rewind(indexLines);
+    copyParallelOutput(indexLines, indexLength, output);
+    fclose(indexLines);
+    fwrite(&mafLength, sizeof(int64_t), 1, output);
+}
+
+static void mergeMAFsForReferenceThread(int64_t item, FILE *input, int64_t length,
+        ReferenceThreadMafs *referenceThreadMafs) {
+    if (referenceThreadMafs->indexFileHandle == NULL) {
+        copyParallelOutput(input, length, referenceThreadMafs->fileHandle);
+        return;
+    }
+    int64_t startOffset = ftell(input);
+    int64_t mafLength;
+    if (fseek(input, startOffset + length - sizeof(int64_t), SEEK_SET) != 0 ||
+            fread(&mafLength, sizeof(int64_t), 1, input) != 1 || fseek(input, startOffset, SEEK_SET) != 0) {
+        st_errAbort("Could not read back the MAF index entries of parallel item %" PRIi64 "\n", item);
+    }
+    int64_t offset = ftell(referenceThreadMafs->fileHandle);
+    copyParallelOutput(input, mafLength, referenceThreadMafs->fileHandle);
+    copyMafIndexEntries(input, length - mafLength - sizeof(int64_t), offset, referenceThreadMafs->indexFileHandle);
+}
+
+void getMAFsReferenceOrdered4(const char *referenceEventString, Flower *flower,
+        FILE *fileHandle, void(*getMafBlockFn)(Block *, FILE *), int64_t workerNumber, FILE *indexFileHandle) {
+    /*
+     * Outputs MAF representations of all the block in the flower and its descendants, ordered
+     * according to the reference ordering. The reference threads are independent, so with
+     * more than one worker they are shared out between worker processes and their MAFs
+     * concatenated in the original order. The workers fetch the sequences of the blocks on
+     * their own database connections, see parallelSequence_getString.
+     */
+    stList *startCaps = getReferenceThreadStarts(referenceEventString, flower);
+    if (stList_length(startCaps) > 0) {
+        CapCursor *capCursor = capCursor_construct(stList_get(startCaps, 0));
+        if (workerNumber <= 1) {
+            for (int64_t i = 0; i < stList_length(startCaps); i++) {
+                getMAFsForReferenceThread(capCursor, stList_get(startCaps, i), fileHandle, getMafBlockFn,
+                        indexFileHandle, 0);
+            }
+        } else {
+            prefetchFlowerSubtree(flower, PREFETCH_BATCH_SIZE); //Required, the workers must not load flowers over the inherited connection, see parallelOrderedMap
+            ReferenceThreadMafs referenceThreadMafs = { startCaps, capCursor, fileHandle, getMafBlockFn, indexFileHandle };
+            parallelOrderedMap(stList_length(startCaps), workerNumber, &referenceThreadMafs,
+                    (void (*)(int64_t, FILE *, void *))getMAFsForReferenceThreadP,
+                    (void (*)(int64_t, FILE *, int64_t, void *))mergeMAFsForReferenceThread);
+        }
+        capCursor_destruct(capCursor);
+    }
+    stList_destruct(startCaps);
+}
+
+void getMAFsForReferenceRegion(const char *referenceEventString, Flower *flower, CapCoordinateIndex *capCoordinateIndex,
+        CapLevelCache *capLevelCache, const char *sequenceHeader, int64_t start, int64_t end, FILE *fileHandle,
+        void(*getMafBlockFn)(Block *, FILE *)) {
+    /*
+     * Starts the cursor at the last reference cap before the region, found through the coordinate
+     * index, then outputs the blocks of the thread until one starts at or after the end of the region.
+     */
+    Event *referenceEvent = eventTree_getEventByHeader(flower_getEventTree(flower), referenceEventString);
+    if (referenceEvent == NULL) {
+        st_errAbort("No reference event %s found\n", referenceEventString);
+    }
+    Sequence *sequence = getSequenceByHeader(flower, (char *)sequenceHeader);
+    if (sequence == NULL || sequence_getEvent(sequence) != referenceEvent) {
+        st_errAbort("The sequence %s of the region is not a sequence of the reference event %s\n", sequenceHeader, referenceEventString);
+    }
+    Cap *startCap = capCoordinateIndex_getCap(capCoordinateIndex, flower, sequence, sequence_getStart(sequence) + start);
+    if (startCap == NULL) {
+        st_logInfo("The sequence %s is not in the reference threads\n", sequenceHeader);
+        return;
+    }
+    CapCursor *capCursor = capCursor_constructAt2(startCap, capLevelCache);
+    Cap *caps[CAP_BATCH_SIZE];
+    int64_t capNumber;
+    int64_t blockNumber = 0;
+    bool pastEnd = 0;
+    while (!pastEnd && (capNumber = capCursor_nextBatch(capCursor, 1, caps, NULL, CAP_BATCH_SIZE)) > 0) {
+        for (int64_t i = 0; i < capNumber && !pastEnd; i++) {
+            Segment *segment = cap_getSegment(caps[i]);
+            if (segment != NULL) {
+                Segment *positiveSegment = segment_getStrand(segment) ? segment : segment_getReverse(segment);
+                pastEnd = segment_getStart(positiveSegment) - sequence_getStart(sequence) >= end;
+                if (!pastEnd) {
+                    getMafBlockFn(segment_getBlock(segment), fileHandle);
+                    blockNumber++;
+                }
+            }
+        }
+    }
+    capCursor_destruct(capCursor);
+    st_logInfo("Got %" PRIi64 " blocks for the region %s:%" PRIi64 "-%" PRIi64 "\n", blockNumber, sequenceHeader, start, end);
+}
+
+void getMAFsReferenceOrdered3(const char *referenceEventString, Flower *flower,
+        FILE *fileHandle, void(*getMafBlockFn)(Block *, FILE *), int64_t workerNumber) {
+    getMAFsReferenceOrdered4(referenceEventString, flower, fileHandle, getMafBlockFn, workerNumber, NULL);
+}
+
+void getMAFsReferenceOrdered2(const char *referenceEventString, Flower *flower,
+        FILE *fileHandle, void(*getMafBlockFn)(Block *, FILE *)) {
+    getMAFsReferenceOrdered3(referenceEventString, flower, fileHandle, getMafBlockFn, 1);
 }
 
 void getMAFsReferenceOrdered(Flower *flower,
@@ -203,6 +617,20 @@ void getMAFsReferenceOrdered(Flower *flower,
     getMAFsReferenceOrdered2(cactusMisc_getDefaultReferenceEventHeader(), flower, fileHandle, getMafBlockFn);
 }
 
+static void getMAFsForFlower(Flower *flower, FILE *fileHandle,
+        void(*getMafBlock)(Block *, FILE *)) {
+    /*
+     * Outputs MAF representations of the blocks of the flower, but not its descendants.
+     */
+    Flower_BlockIterator *blockIterator = flower_getBlockIterator(flower);
+    Block *block;
+    while ((block = flower_getNextBlock(blockIterator)) != NULL) {
+        getMafBlock(block, fileHandle);
+        //getMAFBlock(block, fileHandle, NULL);
+    }
+    flower_destructBlockIterator(blockIterator);
+}
+
 void getMAFs(Flower *flower, FILE *fileHandle,
         void(*getMafBlock)(Block *, FILE *)) {
     /*
@@ -210,28 +638,556 @@ void getMAFs(Flower *flower, FILE *fileHandle,
      */
 
     //Make MAF blocks for each block
+    getMAFsForFlower(flower, fileHandle, getMafBlock);
+
+    //Call child flowers recursively.
+    Flower_GroupIterator *groupIterator = flower_getGroupIterator(flower);
+    Group *group;
+    while ((group = flower_getNextGroup(groupIterator)) != NULL) {
+        if (!group_isLeaf(group)) {
+            getMAFs(getNestedFlower(group), fileHandle, getMafBlock); //recursive call.
+        }
+    }
+    flower_destructGroupIterator(groupIterator);
+}
+
+/*
+ * The blocks of a snapshot are rendered in their stored orientation or reversed. The segment tree
+ * and instance order are the same in both orientations, so a reversed block lists its segments in
+ * the stored order, each reversed.
+ */
+
+static char *getSnapshotSegmentString(CactusSnapshot *snapshot, int64_t segment, bool reversed) {
+    /*
+     * As cactusSnapshot_getSegmentString, for the segment in the stored orientation or reversed.
+     */
+    SnapshotSegment *record = &(snapshot->segments[segment]);
+    assert(record->sequence != -1);
+    int64_t length = snapshot->blocks[record->block].length;
+    int64_t start = record->strand ? record->start : record->start - length + 1; //The lowest coordinate
+    return cactusSnapshot_getSequenceString(snapshot, record->sequence, start, length, record->strand != reversed);
+}
+
+static int64_t getOtherReferenceSegmentFromSnapshot(CactusSnapshot *snapshot, int64_t segment, Name referenceEventName) {
+    /*
+     * As getOtherReferenceSegment, returning -1 if there is none. The 5' end of the block's positive
+     * orientation holds the 5' caps of its segments if the block is stored in positive orientation,
+     * else their 3' caps.
+     */
+    SnapshotSegment *record = &(snapshot->segments[segment]);
+    SnapshotEnd *end = &(snapshot->ends[snapshot->caps[snapshot->blocks[record->block].orientation ?
+            record->cap5 : record->cap3].end]);
+    for (int64_t i = end->firstCap; i < end->firstCap + end->capNumber; i++) {
+        if (snapshot->caps[i].event == referenceEventName && snapshot->caps[i].segment != segment) {
+            return snapshot->caps[i].segment;
+        }
+    }
+    return -1;
+}
+
+static void getMAFBlockFromSnapshotP(CactusSnapshot *snapshot, int64_t segment, bool reversed, Name referenceEventName,
+        MafWriter *mafWriter) {
+    SnapshotSegment *record = &(snapshot->segments[segment]);
+    if (record->sequence != -1) {
+        SnapshotSequence *sequence = &(snapshot->sequences[record->sequence]);
+        int64_t length = snapshot->blocks[record->block].length;
+        bool strand = record->strand != reversed;
+        int64_t start = record->strand ? record->start : record->start - length + 1; //The lowest coordinate
+        if (strand) {
+            start = start - sequence->start;
+        } else { //start with respect to the start of the reverse complement sequence
+            start = (sequence->start + sequence->length) - (start + length);
+        }
+        char *instanceString = getSnapshotSegmentString(snapshot, segment, reversed);
+        int64_t segment2 = referenceEventName != NULL_NAME ?
+                getOtherReferenceSegmentFromSnapshot(snapshot, segment, referenceEventName) : -1;
+        if (segment2 != -1) {
+            char *referenceString = getSnapshotSegmentString(snapshot, segment2, reversed);
+            maskSubstitutions(instanceString, referenceString, length);
+            free(referenceString);
+        }
+        mafWriter_writeSRow(mafWriter, cactusSnapshot_getString(snapshot, sequence->header), start,
+                length, strand ? '+' : '-', sequence->length, instanceString);
+        free(instanceString);
+    }
+}
+
+static int64_t getNumberOnPositiveStrandFromSnapshot(CactusSnapshot *snapshot, SnapshotBlock *record, bool reversed) {
+    /*
+     * As getNumberOnPositiveStrand. The segments are in post-order, so a segment is a leaf unless
+     * the segment before it is its child.
+     */
+    int64_t j = 0;
+    for (int64_t i = record->firstSegment; i < record->firstSegment + record->segmentNumber; i++) {
+        if ((i == record->firstSegment || snapshot->segments[i - 1].parent != i)
+                && snapshot->segments[i].strand != reversed) {
+            j++;
+        }
+    }
+    return j;
+}
+
+static void getMAFBlockFromSnapshot2(CactusSnapshot *snapshot, int64_t block, bool reversed, Name referenceEventName,
+        FILE *fileHandle) {
+    /*
+     * As getMAFBlock2, for the block in its stored orientation or reversed. If referenceEventName is
+     * not NULL_NAME only the substitutions with respect to the reference event are shown.
+     */
+    SnapshotBlock *record = &(snapshot->blocks[block]);
+    //Correct the orientation..
+    if (getNumberOnPositiveStrandFromSnapshot(snapshot, record, reversed) == 0) {
+        reversed = !reversed;
+    }
+    if (record->segmentNumber > 0) {
+        MafWriter *mafWriter = getMafWriter(fileHandle);
+        mafWriter_writeString(mafWriter, "a score=");
+        mafWriter_writeInt(mafWriter, record->length * record->segmentNumber);
+        if (record->newickString != -1) { //The segment names are the same in both orientations
+            mafWriter_writeString(mafWriter, " tree='");
+            mafWriter_writeString(mafWriter, cactusSnapshot_getString(snapshot, record->newickString));
+            mafWriter_writeChar(mafWriter, '\'');
+        }
+        mafWriter_writeChar(mafWriter, '\n');
+        for (int64_t i = record->firstSegment; i < record->firstSegment + record->segmentNumber; i++) {
+            getMAFBlockFromSnapshotP(snapshot, i, reversed, referenceEventName, mafWriter);
+        }
+        mafWriter_writeChar(mafWriter, '\n');
+        mafWriter_flush(mafWriter);
+    }
+}
+
+void getMAFBlockFromSnapshot(CactusSnapshot *snapshot, int64_t block, FILE *fileHandle) {
+    /*
+     * As getMAFBlock, the snapshot holding the block's segments already oriented and ordered.
+     */
+    getMAFBlockFromSnapshot2(snapshot, block, 0, NULL_NAME, fileHandle);
+}
+
+static void getMAFsForReferenceThreadFromSnapshot(CactusSnapshot *snapshot, int64_t startCap, Name referenceEventName,
+        FILE *fileHandle) {
+    /*
+     * As getMAFsForReferenceThread, stepping as reportReferenceStatsForSnapshotThread does. The block
+     * of each highest level 5' cap is rendered in the orientation of the segment the cap is the 5'
+     * cap of, as cap_getSegment gives it, which is the stored orientation if the cap is the stored
+     * segment's 5' cap.
+     */
+    int64_t cap = startCap;
+    while (1) {
+        while (snapshot->caps[cap].nestedCap != -1) {
+            cap = snapshot->caps[cap].nestedCap;
+        }
+        cap = snapshot->caps[cap].adjacency;
+        while (snapshot->ends[snapshot->caps[cap].end].block == -1 && snapshot->caps[cap].parentCap != -1) {
+            cap = snapshot->caps[cap].parentCap;
+        }
+        int64_t segment = snapshot->caps[cap].segment;
+        if (segment == -1) {
+            return;
+        }
+        SnapshotSegment *record = &(snapshot->segments[segment]);
+        getMAFBlockFromSnapshot2(snapshot, record->block, record->cap5 != cap, referenceEventName, fileHandle);
+        cap = record->cap5 == cap ? record->cap3 : record->cap5;
+    }
+}
+
+typedef struct _snapshotMafs {
+    CactusSnapshot *snapshot;
+    stList *startCaps; //NULL if the items are the flowers
+    Name referenceEventName; //Of the substitutions shown, NULL_NAME to show all the bases
+    FILE *fileHandle;
+} SnapshotMafs;
+
+static void getMAFsFromSnapshotP(int64_t item, FILE *output, SnapshotMafs *snapshotMafs) {
+    CactusSnapshot *snapshot = snapshotMafs->snapshot;
+    if (snapshotMafs->startCaps != NULL) {
+        getMAFsForReferenceThreadFromSnapshot(snapshot, stIntTuple_get(stList_get(snapshotMafs->startCaps, item), 0),
+                snapshotMafs->referenceEventName, output);
+        return;
+    }
+    SnapshotFlower *flowerRecord = &(snapshot->flowers[item]);
+    for (int64_t i = flowerRecord->firstBlock; i < flowerRecord->firstBlock + flowerRecord->blockNumber; i++) {
+        getMAFBlockFromSnapshot2(snapshot, i, 0, NULL_NAME, output);
+    }
+}
+
+static void mergeMAFsFromSnapshot(int64_t item, FILE *input, int64_t length, SnapshotMafs *snapshotMafs) {
+    copyParallelOutput(input, length, snapshotMafs->fileHandle);
+}
+
+void getMAFsFromSnapshot2(CactusSnapshot *snapshot, FILE *fileHandle, int64_t workerNumber) {
+    /*
+     * The flowers of a snapshot are in pre-order, so its blocks are already in the order getMAFs visits
+     * them, and each flower is an item of work, as in getMAFs2. The snapshot is mapped shared, so the
+     * workers read the same pages and make no database requests.
+     */
+    if (workerNumber <= 1) {
+        for (int64_t i = 0; i < cactusSnapshot_getLength(snapshot, SNAPSHOT_BLOCKS); i++) {
+            getMAFBlockFromSnapshot(snapshot, i, fileHandle);
+        }
+        return;
+    }
+    SnapshotMafs snapshotMafs = { snapshot, NULL, NULL_NAME, fileHandle };
+    parallelOrderedMap(cactusSnapshot_getLength(snapshot, SNAPSHOT_FLOWERS), workerNumber, &snapshotMafs,
+            (void (*)(int64_t, FILE *, void *))getMAFsFromSnapshotP,
+            (void (*)(int64_t, FILE *, int64_t, void *))mergeMAFsFromSnapshot);
+}
+
+void getMAFsFromSnapshot(CactusSnapshot *snapshot, FILE *fileHandle) {
+    getMAFsFromSnapshot2(snapshot, fileHandle, 1);
+}
+
+void getMAFsReferenceOrderedFromSnapshot(const char *referenceEventString, CactusSnapshot *snapshot, FILE *fileHandle,
+        bool showOnlySubstitutionsWithRespectToTheReference, int64_t workerNumber) {
+    Name referenceEventName = cactusSnapshot_getEventByHeader(snapshot, referenceEventString);
+    if (referenceEventName == NULL_NAME) {
+        st_errAbort("No reference event %s found\n", referenceEventString);
+    }
+    //As getOtherReferenceSegment, the substitutions are with respect to the default reference event
+    SnapshotMafs snapshotMafs = { snapshot, cactusSnapshot_getThreadStarts(snapshot, referenceEventName),
+            showOnlySubstitutionsWithRespectToTheReference ?
+                    cactusSnapshot_getEventByHeader(snapshot, cactusMisc_getDefaultReferenceEventHeader()) : NULL_NAME,
+            fileHandle };
+    if (workerNumber <= 1) {
+        for (int64_t i = 0; i < stList_length(snapshotMafs.startCaps); i++) {
+            getMAFsForReferenceThreadFromSnapshot(snapshot, stIntTuple_get(stList_get(snapshotMafs.startCaps, i), 0),
+                    snapshotMafs.referenceEventName, fileHandle);
+        }
+    } else {
+        parallelOrderedMap(stList_length(snapshotMafs.startCaps), workerNumber, &snapshotMafs,
+                (void (*)(int64_t, FILE *, void *))getMAFsFromSnapshotP,
+                (void (*)(int64_t, FILE *, int64_t, void *))mergeMAFsFromSnapshot);
+    }
+    stList_destruct(snapshotMafs.startCaps);
+}
+
+static void getFlowersInPreOrder(Flower *flower, stList *flowers) {
+    /*
+     * Appends the flower then its descendants to the list, in the order getMAFs visits them.
+     */
+    stList_append(flowers, flower);
+    Flower_GroupIterator *groupIterator = flower_getGroupIterator(flower);
+    Group *group;
+    while ((group = flower_getNextGroup(groupIterator)) != NULL) {
+        if (!group_isLeaf(group)) {
+            getFlowersInPreOrder(getNestedFlower(group), flowers);
+        }
+    }
+    flower_destructGroupIterator(groupIterator);
+}
+
+typedef struct _flowerMafs {
+    stList *flowers;
+    FILE *fileHandle;
+    void(*getMafBlockFn)(Block *, FILE *);
+} FlowerMafs;
+
+static void getMAFsForFlowerP(int64_t item, FILE *output, FlowerMafs *flowerMafs) {
+    getMAFsForFlower(stList_get(flowerMafs->flowers, item), output, flowerMafs->getMafBlockFn);
+}
+
+static void mergeMAFsForFlower(int64_t item, FILE *input, int64_t length, FlowerMafs *flowerMafs) {
+    copyParallelOutput(input, length, flowerMafs->fileHandle);
+}
+
+void getMAFs2(Flower *flower, FILE *fileHandle,
+        void(*getMafBlock)(Block *, FILE *), int64_t workerNumber) {
+    /*
+     * As getMAFs, with each flower of the subtree a separate item of work. Workers take the next
+     * flower in pre-order as they become free, rendering its blocks to their own buffer, and the
+     * buffers are then concatenated in pre-order, which is the order of the serial recursion.
+     * The subtree is loaded before forking, so the only database requests of the workers are
+     * for the sequences of the blocks, which go over their own connections (see segmentStrings).
+     */
+    if (workerNumber <= 1) {
+        getMAFs(flower, fileHandle, getMafBlock);
+        return;
+    }
+    prefetchFlowerSubtree(flower, PREFETCH_BATCH_SIZE); //Required, the workers must not load flowers over the inherited connection, see parallelOrderedMap
+    stList *flowers = stList_construct();
+    getFlowersInPreOrder(flower, flowers);
+    st_logInfo("Getting the MAFs of %" PRIi64 " flowers with %" PRIi64 " workers\n", stList_length(flowers), workerNumber);
+    FlowerMafs flowerMafs = { flowers, fileHandle, getMafBlock };
+    parallelOrderedMap(stList_length(flowers), workerNumber, &flowerMafs,
+            (void (*)(int64_t, FILE *, void *))getMAFsForFlowerP,
+            (void (*)(int64_t, FILE *, int64_t, void *))mergeMAFsForFlower);
+    stList_destruct(flowers);
+}
+
+////////////////////////////////////
+////////////////////////////////////
+//Incremental MAFs
+////////////////////////////////////
+////////////////////////////////////
+
+/*
+ * The output is split into units, each the reference thread from a start cap or, without a
+ * reference, the blocks of the top level flower itself or the subtree of one of its nested flowers.
+ * A unit's MAF is contiguous in the output, so the manifest gives each unit's key, a hash of its
+ * blocks and the byte range of its MAF. A unit whose key and hash are in the previous manifest is
+ * copied from the previous MAF instead of being rendered.
+ *
+ * The hash is FNV-1a over the structure of the blocks in output order: their names, lengths and
+ * instances, and for each instance its name, parent, sequence, coordinate and strand. The bases are
+ * not hashed, as they are fixed by the sequences, so hashing a unit needs no sequence fetches.
+ */
+
+#define MAF_MANIFEST_HEADER "#cactusMAFManifest"
+
+static void hashInt(uint64_t *hash, int64_t i) {
+    for (int64_t j = 0; j < 8; j++) {
+        *hash ^= (i >> (8 * j)) & 0xff;
+        *hash *= 0x100000001b3ULL;
+    }
+}
+
+static void hashBlock(Block *block, uint64_t *hash) {
+    hashInt(hash, block_getName(block));
+    hashInt(hash, block_getLength(block));
+    hashInt(hash, block_getInstanceNumber(block));
+    Block_InstanceIterator *it = block_getInstanceIterator(block);
+    Segment *segment;
+    while ((segment = block_getNext(it)) != NULL) {
+        hashInt(hash, segment_getName(segment));
+        hashInt(hash, segment_getParent(segment) != NULL ? segment_getName(segment_getParent(segment)) : NULL_NAME);
+        hashInt(hash, segment_getSequence(segment) != NULL ? sequence_getName(segment_getSequence(segment)) : NULL_NAME);
+        hashInt(hash, segment_getStart(segment));
+        hashInt(hash, segment_getStrand(segment));
+    }
+    block_destructInstanceIterator(it);
+}
+
+static void hashFlowerBlocks(Flower *flower, uint64_t *hash) {
     Flower_BlockIterator *blockIterator = flower_getBlockIterator(flower);
     Block *block;
     while ((block = flower_getNextBlock(blockIterator)) != NULL) {
-        getMafBlock(block, fileHandle);
-        //getMAFBlock(block, fileHandle, NULL);
+        hashBlock(block, hash);
     }
     flower_destructBlockIterator(blockIterator);
+}
 
-    //Call child flowers recursively.
+static void hashFlowerSubtree(Flower *flower, uint64_t *hash) {
+    hashFlowerBlocks(flower, hash);
     Flower_GroupIterator *groupIterator = flower_getGroupIterator(flower);
     Group *group;
     while ((group = flower_getNextGroup(groupIterator)) != NULL) {
         if (!group_isLeaf(group)) {
-            getMAFs(group_getNestedFlower(group), fileHandle, getMafBlock); //recursive call.
+            hashFlowerSubtree(getNestedFlower(group), hash);
         }
     }
     flower_destructGroupIterator(groupIterator);
 }
 
+static void hashReferenceThread(CapCursor *capCursor, Cap *startCap, uint64_t *hash) {
+    Cap *caps[CAP_BATCH_SIZE];
+    capCursor_reset(capCursor, startCap);
+    int64_t capNumber;
+    while ((capNumber = capCursor_nextBatch(capCursor, 1, caps, NULL, CAP_BATCH_SIZE)) > 0) {
+        for (int64_t i = 0; i < capNumber; i++) {
+            Segment *segment = cap_getSegment(caps[i]);
+            if (segment != NULL) {
+                hashBlock(segment_getBlock(segment), hash);
+            }
+        }
+    }
+}
+
+typedef struct _mafManifestEntry {
+    uint64_t hash;
+    int64_t start;
+    int64_t length;
+} MafManifestEntry;
+
+static stHash *readMafManifest(const char *manifestFile, const char *outputDescription) {
+    /*
+     * Reads the entries of a manifest, keyed by unit key. If the manifest was written for other
+     * output, it has no usable entries.
+     */
+    stHash *entries = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, free);
+    FILE *fileHandle = fopen(manifestFile, "r");
+    if (fileHandle == NULL) {
+        st_logInfo("No previous manifest %s, so rendering all the MAFs\n", manifestFile);
+        return entries;
+    }
+    char *header = stFile_getLineFromFile(fileHandle);
+    char *expectedHeader = stString_print("%s\t%s", MAF_MANIFEST_HEADER, outputDescription);
+    if (header == NULL || strcmp(header, expectedHeader) != 0) {
+        st_logInfo("The previous manifest %s is for other output, so rendering all the MAFs\n", manifestFile);
+    } else {
+        char *line;
+        while ((line = stFile_getLineFromFile(fileHandle)) != NULL) {
+            char *tab = strchr(line, '\t');
+            MafManifestEntry *entry = st_malloc(sizeof(MafManifestEntry));
+            if (tab == NULL || sscanf(tab + 1, "%" SCNx64 "\t%" SCNi64 "\t%" SCNi64 "", &entry->hash, &entry->start, &entry->length) != 3) {
+                st_errAbort("Could not parse the manifest line %s\n", line);
+            }
+            stHash_insert(entries, stString_getSubString(line, 0, tab - line), entry);
+            free(line);
+        }
+    }
+    free(expectedHeader);
+    free(header);
+    fclose(fileHandle);
+    return entries;
+}
+
+typedef struct _incrementalMafs {
+    FILE *fileHandle;
+    void(*getMafBlockFn)(Block *, FILE *);
+    stHash *previousEntries;
+    const char *previousMAFFile;
+    char *previousGziFile; //Not NULL if the previous MAF is BGZF
+    FILE *previousMAFFileHandle; //Not NULL if the previous MAF is plain
+    FILE *manifestFileHandle;
+    int64_t copiedUnits;
+    int64_t renderedUnits;
+} IncrementalMafs;
+
+static void copyPreviousMAF(IncrementalMafs *incrementalMafs, MafManifestEntry *entry) {
+    if (incrementalMafs->previousGziFile != NULL) {
+        bgzfFile_copyRange(incrementalMafs->previousMAFFile, incrementalMafs->previousGziFile, entry->start,
+                entry->start + entry->length, incrementalMafs->fileHandle);
+        return;
+    }
+    if (fseek(incrementalMafs->previousMAFFileHandle, entry->start, SEEK_SET) != 0) {
+        st_errAbort("Could not seek to %" PRIi64 " in the previous MAF %s\n", entry->start, incrementalMafs->previousMAFFile);
+    }
+    copyParallelOutput(incrementalMafs->previousMAFFileHandle, entry->length, incrementalMafs->fileHandle);
+}
+
+static bool startUnit(IncrementalMafs *incrementalMafs, const char *key, uint64_t hash) {
+    /*
+     * Copies the unit's MAF from the previous MAF if it is unchanged, returning non-zero if so, and
+     * writes the unit's manifest entry. Otherwise the caller renders the unit.
+     */
+    int64_t start = ftell(incrementalMafs->fileHandle);
+    MafManifestEntry *entry = incrementalMafs->previousMAFFile != NULL ?
+            stHash_search(incrementalMafs->previousEntries, (void *)key) : NULL;
+    if (entry == NULL || entry->hash != hash) {
+        fprintf(incrementalMafs->manifestFileHandle, "%s\t%" PRIx64 "\t%" PRIi64 "\t", key, hash, start);
+        incrementalMafs->renderedUnits++;
+        return 0;
+    }
+    copyPreviousMAF(incrementalMafs, entry);
+    fprintf(incrementalMafs->manifestFileHandle, "%s\t%" PRIx64 "\t%" PRIi64 "\t%" PRIi64 "\n", key, hash, start, entry->length);
+    incrementalMafs->copiedUnits++;
+    return 1;
+}
+
+static void endUnit(IncrementalMafs *incrementalMafs, int64_t start) {
+    fprintf(incrementalMafs->manifestFileHandle, "%" PRIi64 "\n", ftell(incrementalMafs->fileHandle) - start);
+}
+
+void getMAFsIncremental(const char *referenceEventString, Flower *flower, FILE *fileHandle,
+        void(*getMafBlockFn)(Block *, FILE *), const char *outputDescription,
+        const char *previousMAFFile, const char *previousManifestFile, FILE *manifestFileHandle, CapLevelCache *capLevelCache) {
+    IncrementalMafs incrementalMafs = { fileHandle, getMafBlockFn, NULL, previousMAFFile, NULL, NULL, manifestFileHandle, 0, 0 };
+    incrementalMafs.previousEntries = previousManifestFile != NULL ? readMafManifest(previousManifestFile, outputDescription) :
+            stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, free);
+    if (previousMAFFile != NULL) {
+        if (bgzfFile_isBgzf(previousMAFFile)) {
+            incrementalMafs.previousGziFile = stString_print("%s.gzi", previousMAFFile);
+        } else if ((incrementalMafs.previousMAFFileHandle = fopen(previousMAFFile, "r")) == NULL) {
+            st_errAbort("Could not open the previous MAF %s\n", previousMAFFile);
+        }
+    }
+    fprintf(manifestFileHandle, "%s\t%s\n", MAF_MANIFEST_HEADER, outputDescription);
+    if (referenceEventString != NULL) {
+        stList *startCaps = getReferenceThreadStarts(referenceEventString, flower);
+        if (stList_length(startCaps) > 0) {
+            CapCursor *capCursor = capCursor_construct(stList_get(startCaps, 0));
+            capCursor_setLevelCache(capCursor, capLevelCache); //A thread rendered is walked again after it is hashed
+            for (int64_t i = 0; i < stList_length(startCaps); i++) {
+                Cap *startCap = stList_get(startCaps, i);
+                uint64_t hash = 0xcbf29ce484222325ULL;
+                hashReferenceThread(capCursor, startCap, &hash);
+                char *key = stString_print("thread%s", cactusMisc_nameToStringStatic(cap_getName(startCap)));
+                int64_t start = ftell(fileHandle);
+                if (!startUnit(&incrementalMafs, key, hash)) {
+                    getMAFsForReferenceThread(capCursor, startCap, fileHandle, getMafBlockFn, NULL, 0);
+                    endUnit(&incrementalMafs, start);
+                }
+                free(key);
+            }
+            capCursor_destruct(capCursor);
+        }
+        stList_destruct(startCaps);
+    } else {
+        //The blocks of the top level flower, then the subtree of each nested flower, as getMAFs outputs them
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        hashFlowerBlocks(flower, &hash);
+        char *key = stString_print("blocks%s", cactusMisc_nameToStringStatic(flower_getName(flower)));
+        int64_t start = ftell(fileHandle);
+        if (!startUnit(&incrementalMafs, key, hash)) {
+            getMAFsForFlower(flower, fileHandle, getMafBlockFn);
+            endUnit(&incrementalMafs, start);
+        }
+        free(key);
+        Flower_GroupIterator *groupIterator = flower_getGroupIterator(flower);
+        Group *group;
+        while ((group = flower_getNextGroup(groupIterator)) != NULL) {
+            if (!group_isLeaf(group)) {
+                Flower *nestedFlower = getNestedFlower(group);
+                hash = 0xcbf29ce484222325ULL;
+                hashFlowerSubtree(nestedFlower, &hash);
+                key = stString_print("subtree%s", cactusMisc_nameToStringStatic(flower_getName(nestedFlower)));
+                start = ftell(fileHandle);
+                if (!startUnit(&incrementalMafs, key, hash)) {
+                    getMAFs(nestedFlower, fileHandle, getMafBlockFn);
+                    endUnit(&incrementalMafs, start);
+                }
+                free(key);
+            }
+        }
+        flower_destructGroupIterator(groupIterator);
+    }
+    st_logInfo("Copied %" PRIi64 " units of the MAF from the previous MAF and rendered %" PRIi64 "\n",
+            incrementalMafs.copiedUnits, incrementalMafs.renderedUnits);
+    if (incrementalMafs.previousMAFFileHandle != NULL) {
+        fclose(incrementalMafs.previousMAFFileHandle);
+    }
+    free(incrementalMafs.previousGziFile);
+    stHash_destruct(incrementalMafs.previousEntries);
+}
+
+void makeMAFHeaderFromSnapshot(CactusSnapshot *snapshot, FILE *fileHandle) {
+    MafWriter *mafWriter = getMafWriter(fileHandle);
+    mafWriter_writeHeader(mafWriter, cactusSnapshot_getEventTreeString(snapshot));
+    mafWriter_flush(mafWriter);
+}
+
 void makeMAFHeader(Flower *flower, FILE *fileHandle) {
-    fprintf(fileHandle, "##maf version=1 scoring=N/A\n");
+    MafWriter *mafWriter = getMafWriter(fileHandle);
+    char *cA = eventTree_makeNewickString(flower_getEventTree(flower));
+    mafWriter_writeHeader(mafWriter, cA);
+    free(cA);
+    mafWriter_flush(mafWriter);
+}
+
+void makeBinaryMAFHeader(Flower *flower, FILE *fileHandle) {
+    free(binarySequenceNames);
+    binarySequenceNumber = flower_getSequenceNumber(flower);
+    binarySequenceNames = st_malloc(sizeof(Name) * (binarySequenceNumber + 1));
+    Flower_SequenceIterator *sequenceIt = flower_getSequenceIterator(flower);
+    Sequence *sequence;
+    int64_t i = 0;
+    while ((sequence = flower_getNextSequence(sequenceIt)) != NULL) {
+        binarySequenceNames[i++] = sequence_getName(sequence);
+    }
+    flower_destructSequenceIterator(sequenceIt);
+    assert(i == binarySequenceNumber);
+    qsort(binarySequenceNames, binarySequenceNumber, sizeof(Name), compareNames);
+    const char **sequenceHeaders = st_malloc(sizeof(char *) * (binarySequenceNumber + 1));
+    int64_t *sequenceLengths = st_malloc(sizeof(int64_t) * (binarySequenceNumber + 1));
+    for (i = 0; i < binarySequenceNumber; i++) {
+        sequence = flower_getSequence(flower, binarySequenceNames[i]);
+        sequenceHeaders[i] = getInternedSequenceHeader(sequence);
+        sequenceLengths[i] = sequence_getLength(sequence);
+    }
+    MafWriter *mafWriter = getMafWriter(fileHandle);
     char *cA = eventTree_makeNewickString(flower_getEventTree(flower));
-    fprintf(fileHandle, "# cactus %s\n\n", cA);
+    binaryMaf_writeHeader(mafWriter, cA, binarySequenceNumber, sequenceHeaders, sequenceLengths);
     free(cA);
+    free(sequenceHeaders);
+    free(sequenceLengths);
+    mafWriter_flush(mafWriter);
 }
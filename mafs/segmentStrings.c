@@ -0,0 +1,155 @@
+/*
+ * segmentStrings.c
+ *
+ *  Created on: 17 Oct 2026
+ */
+
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "cactus.h"
+#include "sonLib.h"
+#include "cactusParallel.h"
+#include "segmentStrings.h"
+
+typedef struct _sequenceChunk {
+    Name sequenceName;
+    int64_t chunk; //The chunk's index in the sequence, -1 if the slot is empty
+    char *string; //NULL if the chunk has only been seen, not fetched
+    int64_t length;
+} SequenceChunk;
+
+struct _segmentStrings {
+    SequenceChunk *chunks;
+    int64_t chunkNumber;
+    char *arena;
+    int64_t arenaLength; //The end of the strings got since the last reset
+    int64_t maxArenaLength;
+    char complements[256];
+};
+
+SegmentStrings *segmentStrings_construct(int64_t chunkNumber) {
+    assert(chunkNumber > 0);
+    SegmentStrings *segmentStrings = st_malloc(sizeof(SegmentStrings));
+    segmentStrings->chunks = st_malloc(sizeof(SequenceChunk) * chunkNumber);
+    for (int64_t i = 0; i < chunkNumber; i++) {
+        segmentStrings->chunks[i].chunk = -1;
+        segmentStrings->chunks[i].string = NULL;
+    }
+    segmentStrings->chunkNumber = chunkNumber;
+    segmentStrings->arena = NULL;
+    segmentStrings->arenaLength = 0;
+    segmentStrings->maxArenaLength = 0;
+    for (int64_t i = 0; i < 256; i++) {
+        segmentStrings->complements[i] = i;
+    }
+    const char *bases = "ACGTacgt";
+    const char *complements = "TGCAtgca";
+    for (int64_t i = 0; i < 8; i++) {
+        segmentStrings->complements[(unsigned char) bases[i]] = complements[i];
+    }
+    return segmentStrings;
+}
+
+void segmentStrings_destruct(SegmentStrings *segmentStrings) {
+    for (int64_t i = 0; i < segmentStrings->chunkNumber; i++) {
+        free(segmentStrings->chunks[i].string);
+    }
+    free(segmentStrings->chunks);
+    free(segmentStrings->arena);
+    free(segmentStrings);
+}
+
+void segmentStrings_reset(SegmentStrings *segmentStrings, int64_t stringNumber, int64_t length) {
+    int64_t maxArenaLength = stringNumber * (length + 1);
+    if (maxArenaLength > segmentStrings->maxArenaLength) {
+        free(segmentStrings->arena);
+        segmentStrings->arena = st_malloc(maxArenaLength);
+        segmentStrings->maxArenaLength = maxArenaLength;
+    }
+    segmentStrings->arenaLength = 0;
+}
+
+static SequenceChunk *getChunkSlot(SegmentStrings *segmentStrings, Name sequenceName, int64_t chunk) {
+    uint64_t hash = (uint64_t) sequenceName * 0x9E3779B97F4A7C15ULL + (uint64_t) chunk;
+    return &segmentStrings->chunks[(hash ^ (hash >> 32)) % segmentStrings->chunkNumber];
+}
+
+static SequenceChunk *getChunk(SegmentStrings *segmentStrings, Sequence *sequence, int64_t chunk) {
+    Name sequenceName = sequence_getName(sequence);
+    SequenceChunk *sequenceChunk = getChunkSlot(segmentStrings, sequenceName, chunk);
+    if (sequenceChunk->chunk != chunk || sequenceChunk->sequenceName != sequenceName || sequenceChunk->string == NULL) {
+        free(sequenceChunk->string);
+        int64_t start = sequence_getStart(sequence) + chunk * SEGMENT_STRINGS_CHUNK_SIZE;
+        int64_t end = sequence_getStart(sequence) + sequence_getLength(sequence);
+        sequenceChunk->sequenceName = sequenceName;
+        sequenceChunk->chunk = chunk;
+        sequenceChunk->length = end - start < SEGMENT_STRINGS_CHUNK_SIZE ? end - start : SEGMENT_STRINGS_CHUNK_SIZE;
+        sequenceChunk->string = parallelSequence_getString(sequence, start, sequenceChunk->length, 1);
+        assert(sequenceChunk->string != NULL);
+    }
+    return sequenceChunk;
+}
+
+static bool fetchExactly(SegmentStrings *segmentStrings, Sequence *sequence, int64_t start, int64_t length) {
+    /*
+     * Returns non-zero if the segment at start (from the start of the sequence) is short and its
+     * chunk has not been seen, marking the chunk as seen.
+     */
+    int64_t chunk = start / SEGMENT_STRINGS_CHUNK_SIZE;
+    if (length > SEGMENT_STRINGS_EXACT_LENGTH || (start + length - 1) / SEGMENT_STRINGS_CHUNK_SIZE != chunk) {
+        return 0;
+    }
+    Name sequenceName = sequence_getName(sequence);
+    SequenceChunk *sequenceChunk = getChunkSlot(segmentStrings, sequenceName, chunk);
+    if (sequenceChunk->chunk == chunk && sequenceChunk->sequenceName == sequenceName) {
+        return 0;
+    }
+    free(sequenceChunk->string);
+    sequenceChunk->sequenceName = sequenceName;
+    sequenceChunk->chunk = chunk;
+    sequenceChunk->string = NULL;
+    sequenceChunk->length = 0;
+    return 1;
+}
+
+char *segmentStrings_get(SegmentStrings *segmentStrings, Segment *segment) {
+    Sequence *sequence = segment_getSequence(segment);
+    assert(sequence != NULL);
+    int64_t length = segment_getLength(segment);
+    assert(segmentStrings->arenaLength + length + 1 <= segmentStrings->maxArenaLength);
+    char *string = segmentStrings->arena + segmentStrings->arenaLength;
+    segmentStrings->arenaLength += length + 1;
+    //Copy the positive strand from the chunks the segment overlaps
+    int64_t start = segment_getStart(segment_getStrand(segment) ? segment : segment_getReverse(segment))
+            - sequence_getStart(sequence);
+    if (fetchExactly(segmentStrings, sequence, start, length)) {
+        char *cA = parallelSequence_getString(sequence, sequence_getStart(sequence) + start, length, 1);
+        memcpy(string, cA, length);
+        free(cA);
+    } else {
+        for (int64_t i = 0; i < length;) {
+            int64_t chunk = (start + i) / SEGMENT_STRINGS_CHUNK_SIZE;
+            int64_t offset = (start + i) % SEGMENT_STRINGS_CHUNK_SIZE;
+            SequenceChunk *sequenceChunk = getChunk(segmentStrings, sequence, chunk);
+            int64_t j = sequenceChunk->length - offset < length - i ? sequenceChunk->length - offset : length - i;
+            assert(j > 0);
+            memcpy(string + i, sequenceChunk->string + offset, j);
+            i += j;
+        }
+    }
+    string[length] = '\0';
+    if (!segment_getStrand(segment)) { //Reverse complement in place
+        for (int64_t i = 0, j = length - 1; i <= j; i++, j--) {
+            char c = segmentStrings->complements[(unsigned char) string[i]];
+            string[i] = segmentStrings->complements[(unsigned char) string[j]];
+            string[j] = c;
+        }
+    }
+    return string;
+}
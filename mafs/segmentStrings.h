@@ -0,0 +1,46 @@
+/*
+ * segmentStrings.h
+ *
+ *  Created on: 17 Oct 2026
+ */
+
+#ifndef SEGMENT_STRINGS_H_
+#define SEGMENT_STRINGS_H_
+
+/*
+ * Renders the strings of the segments of a block into one arena, reused from block to block,
+ * rather than allocating a string per segment with segment_getString. The sequences are fetched
+ * in chunks of SEGMENT_STRINGS_CHUNK_SIZE bases, which are kept in a direct mapped cache of
+ * chunkNumber chunks, so neighbouring segments of a sequence share a fetch. A segment of up to
+ * SEGMENT_STRINGS_EXACT_LENGTH bases in a chunk not seen before is fetched exactly, only the
+ * chunk being marked as seen, so isolated short rows do not each fetch a whole chunk; the chunk is
+ * fetched the next time it is needed. Negative strand segments are reverse complemented in place
+ * in the arena.
+ */
+
+#define SEGMENT_STRINGS_CHUNK_SIZE 65536
+
+#define SEGMENT_STRINGS_EXACT_LENGTH (SEGMENT_STRINGS_CHUNK_SIZE / 16)
+
+#define SEGMENT_STRINGS_CHUNK_NUMBER 256
+
+typedef struct _segmentStrings SegmentStrings;
+
+SegmentStrings *segmentStrings_construct(int64_t chunkNumber);
+
+void segmentStrings_destruct(SegmentStrings *segmentStrings);
+
+/*
+ * Empties the arena, making room for stringNumber strings of up to length characters each,
+ * invalidating the strings got since the last call.
+ */
+void segmentStrings_reset(SegmentStrings *segmentStrings, int64_t stringNumber, int64_t length);
+
+/*
+ * Returns the string of the segment, on the segment's strand, in the arena. The string may be
+ * modified, is valid until the next reset and must not be freed. No more strings may be got
+ * than were made room for by the last reset.
+ */
+char *segmentStrings_get(SegmentStrings *segmentStrings, Segment *segment);
+
+#endif /* SEGMENT_STRINGS_H_ */
@@ -16,6 +16,8 @@
 #include "avl.h"
 #include "commonC.h"
 #include "hashTableC.h"
+#include "cactusUtils.h"
+#include "cactusSnapshot.h"
 #include "common.h"
 #include "psl.h"
 /*
@@ -71,14 +73,35 @@
  */
 
 //====================== GLOBAL STRUCTURES ====================================
+struct OrientedCap{
+   /*
+    *A cap of a snapshot, which stores caps in positive orientation, in the orientation that is on 'strand'.
+    *Adjacent caps and the two caps of a segment are on the same strand, so a thread keeps its strand.
+    */
+   int64_t cap; //-1 for none
+   bool strand;
+};
+
 struct Thread{
    /*
     *Thread is a series of connected caps (each cap corresponds to one segment). It represents DNA (or a.a) sequence.
     */
    Cap **caps;//array of caps in order
+   CactusSnapshot *snapshot; //if not NULL, the thread is of the snapshot's caps, in snapshotCaps rather than caps
+   struct OrientedCap *snapshotCaps;
    int size; //number of caps
 };
 
+struct PslCap{
+   /*
+    *What a psl needs of a cap, whether from the database or a snapshot.
+    */
+   int64_t coordinate; //coordinate on the + strand
+   bool strand;
+   int64_t sequenceLength;
+   int64_t segmentLength;
+};
+
 struct Align{
    /*
     * Align represents the alignment of two threads.
@@ -103,7 +126,6 @@ struct Stubs{
 };
 
 //========================== PROTOTYPES =======================================
-bool isStubCap(Cap *cap);
 int getPSL(struct Align *align, struct Thread *qThread, struct Thread *tThread, char *query, char *target, FILE *fileHandle);
 void getPSLFlower(FILE *fileHandle, char *query, char *target, int start, int end, Cap *qstartCap, bool exhaust);
 Cap *flower_getChildCap(Flower *flower, Cap *pcap);
@@ -111,6 +133,7 @@ Cap *flower_getChildCap(Flower *flower, Cap *pcap);
 //========================= INITIALIZATION FUNCTIONS ==========================
 struct Thread *setThread(){
    struct Thread *thread = AllocA(struct Thread);
+   thread->snapshot = NULL;
    thread->size = 0;
    return thread;
 }
@@ -149,18 +172,6 @@ void makePSLHeader(Flower *flower, FILE *fileHandle) {
    pslWriteHead(fileHandle);
 } 
 
-char *formatSequenceHeader(Sequence *sequence) {
-   const char *sequenceHeader = sequence_getHeader(sequence);
-   if(strlen(sequenceHeader) > 0) {
-      char *cA = st_malloc(sizeof(char) *(1 + strlen(sequenceHeader)));
-      sscanf(sequenceHeader, "%s", cA);
-      return cA;
-   }
-   else {
-      return cactusMisc_nameToString(sequence_getName(sequence));
-   }
-}
-
 Sequence *flower_getSequenceByName(Flower *flower, char *name){
    /*
     *Return sequence in 'flower' whose name is 'name'
@@ -168,10 +179,10 @@ Sequence *flower_getSequenceByName(Flower *flower, char *name){
    Sequence *sequence;
    Flower_SequenceIterator * seqIterator = flower_getSequenceIterator(flower);
    while((sequence = flower_getNextSequence(seqIterator)) != NULL){
-      char *sequenceHeader = formatSequenceHeader(sequence);
+      const char *sequenceHeader = getInternedSequenceHeader(sequence);
       //if 'sequenceHeader' starts with 'name'
       if(strcmp(sequenceHeader, name) == 0){
-         free(sequenceHeader);
+         flower_destructSequenceIterator(seqIterator);
          return sequence;
       }
    }
@@ -179,13 +190,13 @@ Sequence *flower_getSequenceByName(Flower *flower, char *name){
    return NULL;
 }
 
-int getSequences(Flower *flower, char ***seqs, char *name){
+int getSequenceHeaders(Flower *flower, char ***seqs, char *name){
    //get names of all the sequences in 'flower' that have their names start with 'name'
    int num = 0;
    Sequence *sequence;
    Flower_SequenceIterator * seqIterator = flower_getSequenceIterator(flower);
    while((sequence = flower_getNextSequence(seqIterator)) != NULL){
-      char *sequenceHeader = formatSequenceHeader(sequence);
+      const char *sequenceHeader = getInternedSequenceHeader(sequence);
       //if 'sequenceHeader' starts with 'name'
       if(strstr(sequenceHeader, name) == sequenceHeader){
          if(num == 0){
@@ -193,27 +204,53 @@ int getSequences(Flower *flower, char ***seqs, char *name){
          }else{
             (*seqs) = needMoreMem((*seqs), num*sizeof(char*), (num+1)*sizeof(char *));
          } 
-         *((*seqs) + num) = sequenceHeader;
+         *((*seqs) + num) = (char *)sequenceHeader; //Interned, so only the array is freed
          num++;
       }
-      //free(sequenceHeader);
    }
    flower_destructSequenceIterator(seqIterator);
    return num;
 }
 
-bool isStubCap(Cap *cap){
-   /*
-    *Return true if cap is of a stubEnd, otherwise return false
-    */
-   End *end = cap_getEnd(cap);
-   return (end_isStubEnd(end)) ? true : false;
-}
-
 bool isPlus(char strand){
    return (strand == '+')? true : false;
 }
 
+bool snapshotCap_getOrientation(CactusSnapshot *snapshot, struct OrientedCap cap){
+   return snapshot->caps[cap.cap].strand == cap.strand;
+}
+
+bool snapshotCap_getSide(CactusSnapshot *snapshot, struct OrientedCap cap){
+   bool side = snapshot->caps[cap.cap].side;
+   return snapshotCap_getOrientation(snapshot, cap) ? side : !side;
+}
+
+bool snapshotCap_endEquals(CactusSnapshot *snapshot, struct OrientedCap cap1, struct OrientedCap cap2){
+   /*As comparing the Ends of two caps, which are the same only if they are in the same orientation*/
+   return snapshot->caps[cap1.cap].end == snapshot->caps[cap2.cap].end &&
+          snapshotCap_getOrientation(snapshot, cap1) == snapshotCap_getOrientation(snapshot, cap2);
+}
+
+struct OrientedCap snapshotCap_getAdjacency(CactusSnapshot *snapshot, struct OrientedCap cap){
+   struct OrientedCap adjCap = { snapshot->caps[cap.cap].adjacency, cap.strand };
+   return adjCap;
+}
+
+struct OrientedCap snapshotCap_getOtherSegmentCap(CactusSnapshot *snapshot, struct OrientedCap cap){
+   SnapshotSegment *segment = &(snapshot->segments[snapshot->caps[cap.cap].segment]);
+   struct OrientedCap otherCap = { segment->cap5 == cap.cap ? segment->cap3 : segment->cap5, cap.strand };
+   return otherCap;
+}
+
+bool isStubCapFromSnapshot(CactusSnapshot *snapshot, struct OrientedCap cap){
+   return snapshot->ends[snapshot->caps[cap.cap].end].isStubEnd;
+}
+
+const char *snapshotCap_getSequenceHeader(CactusSnapshot *snapshot, int64_t cap){
+   int64_t sequence = snapshot->caps[cap].sequence;
+   return sequence == -1 ? NULL : cactusSnapshot_getSequenceHeader(snapshot, sequence);
+}
+
 bool isCommonBlock(Block *block, char *query, char *target){
    /*
     *Return true if block contains both query and target
@@ -228,7 +265,7 @@ bool isCommonBlock(Block *block, char *query, char *target){
       if(sequence == NULL){
          continue;
       }
-      char *sequenceHeader = formatSequenceHeader(sequence);
+      const char *sequenceHeader = getInternedSequenceHeader(sequence);
       if(strcmp(sequenceHeader, query) == 0){
          hasQ = true;
       }else 
@@ -244,7 +281,7 @@ bool isCommonBlock(Block *block, char *query, char *target){
    }
 }
 
-void moveCapToNextBlock(Cap **cap){
+void moveCapToNextBlockOrSelfEdge(Cap **cap){
    /*Move cap to the next block that its segment is adjacency to*/
    Cap *adjCap = cap_getAdjacency(*cap);
    if(cap_getEnd(*cap) == cap_getEnd(adjCap)){//self connected end
@@ -271,15 +308,14 @@ void moveCapToNextCommonBlock(Cap **cap, char *name){
    bool commonBlock = false;
    Cap *currCap;
    while(!commonBlock && !isStubCap(*cap)){
-      moveCapToNextBlock(cap);
+      moveCapToNextBlockOrSelfEdge(cap);
       End *end = cap_getEnd(*cap);
       End_InstanceIterator *capIterator= end_getInstanceIterator(end);
       while((currCap= end_getNext(capIterator)) != NULL){
          Sequence *sequence = cap_getSequence(currCap);
          if(sequence == NULL){ continue; }
-         char *sequenceHeader = formatSequenceHeader(sequence);
+         const char *sequenceHeader = getInternedSequenceHeader(sequence);
 	 if(strcmp(sequenceHeader, name) == 0){
-	    free(sequenceHeader);
 	    commonBlock = true;
 	    break;
 	 }
@@ -291,6 +327,9 @@ void moveCapToNextCommonBlock(Cap **cap, char *name){
 
 bool isMatch(struct Thread *qThread, struct Thread *tThread, int qi, int ti){
    /*Return true if qcao & tcap come from same end, false otherwise*/
+   if(qThread->snapshot != NULL){
+      return snapshotCap_endEquals(qThread->snapshot, *(qThread->snapshotCaps + qi), *(tThread->snapshotCaps + ti));
+   }
    Cap *qcap = *(qThread->caps + qi);
    Cap *tcap = *(tThread->caps + ti);
    End *qend = cap_getEnd(qcap);
@@ -330,39 +369,67 @@ void addStub(Cap ***caps, Cap *cap, int *num){
 }
 
 //========== CONSTRUCTING A PSL - ADDING THE PARTS ============================
-int64_t getBlockStart(Cap *cap){
+struct PslCap getPslCap(Cap *cap){
+   struct PslCap pslCap;
+   pslCap.coordinate = cap_getCoordinate(cap);
+   pslCap.strand = cap_getStrand(cap);
+   pslCap.sequenceLength = sequence_getLength(cap_getSequence(cap));
+   pslCap.segmentLength = segment_getLength(cap_getSegment(cap));
+   return pslCap;
+}
+
+struct PslCap getPslCapFromSnapshot(CactusSnapshot *snapshot, struct OrientedCap cap){
+   SnapshotCap *record = &(snapshot->caps[cap.cap]);
+   struct PslCap pslCap;
+   pslCap.coordinate = record->coordinate;
+   pslCap.strand = cap.strand;
+   pslCap.sequenceLength = snapshot->sequences[record->sequence].length;
+   pslCap.segmentLength = snapshot->blocks[snapshot->segments[record->segment].block].length;
+   return pslCap;
+}
+
+struct PslCap thread_getPslCap(struct Thread *thread, int i){
+   if(thread->snapshot != NULL){
+      return getPslCapFromSnapshot(thread->snapshot, *(thread->snapshotCaps + i));
+   }
+   return getPslCap(*(thread->caps + i));
+}
+
+int64_t thread_getSegmentLength(struct Thread *thread, int i){
+   if(thread->snapshot != NULL){
+      SnapshotCap *record = &(thread->snapshot->caps[(thread->snapshotCaps + i)->cap]);
+      return thread->snapshot->blocks[thread->snapshot->segments[record->segment].block].length;
+   }
+   return segment_getLength(cap_getSegment(*(thread->caps + i)));
+}
+
+int64_t getBlockStart(struct PslCap *cap){
    /*Get the start coordinate of input segment
     *psl starts from 0, while catus start at an added stub, which is at position 1
     *Therefore need to substract 2 to convert to the right coordinate
     */
-   int64_t start = cap_getCoordinate(cap);//coordinate of cap on positive strand
-   if(cap_getStrand(cap)){
+   int64_t start = cap->coordinate;//coordinate of cap on positive strand
+   if(cap->strand){
       return start -2;
    }else{
-      Sequence *sequence = cap_getSequence(cap);
-      int64_t seqLen = sequence_getLength(sequence);
-      return seqLen - 1 - (start -2);
+      return cap->sequenceLength - 1 - (start -2);
    }
 }
 
-void addPSLSizes(struct psl *psl, Cap *qcap, Cap *tcap){
-   Sequence *qsequence = cap_getSequence(qcap);
-   Sequence *tsequence = cap_getSequence(tcap);
-   psl->qSize = sequence_getLength(qsequence);
-   psl->tSize = sequence_getLength(tsequence);
+void addPSLSizes(struct psl *psl, struct PslCap *qcap, struct PslCap *tcap){
+   psl->qSize = qcap->sequenceLength;
+   psl->tSize = tcap->sequenceLength;
 }
 
-void addPSLStarts(struct psl *psl, Cap *qcap, Cap *tcap){
+void addPSLStarts(struct psl *psl, struct PslCap *qcap, struct PslCap *tcap){
    //Get threads' starts relatively to the forward strands
-   int64_t qstart = cap_getCoordinate(qcap);
-   int64_t tstart = cap_getCoordinate(tcap);
-   psl->qStart = qstart-2;
-   psl->tStart = tstart-2;
+   psl->qStart = qcap->coordinate-2;
+   psl->tStart = tcap->coordinate-2;
 }
 
-void addPSLStrand(struct psl *psl, Cap *qcap, Cap *tcap){
-   psl->strand[0] = cap_getStrand(qcap) ? '+' : '-';
-   psl->strand[1] = cap_getStrand(tcap) ? '+' : '-';
+void addPSLStrand(struct psl *psl, struct PslCap *qcap, struct PslCap *tcap){
+   psl->strand[0] = qcap->strand ? '+' : '-';
+   psl->strand[1] = tcap->strand ? '+' : '-';
    //psl->strand[2] = NULL;
 }
 
@@ -392,12 +459,11 @@ void addPSLInserts(struct psl *psl, int64_t currIndex){
    }
 }
 
-void addBlockToPSL(struct psl *psl, Cap *qcap, Cap *tcap){
+void addBlockToPSL(struct psl *psl, struct PslCap *qcap, struct PslCap *tcap){
    /*
     */
    psl->blockCount++;
-   Segment *segment = cap_getSegment(qcap);
-   int64_t length = segment_getLength(segment);
+   int64_t length = qcap->segmentLength;
    int64_t currIndex = psl->blockCount -1;
    //blockSizes
    psl->blockSizes = (unsigned *)realloc(psl->blockSizes, psl->blockCount*sizeof(unsigned));
@@ -416,10 +482,8 @@ void addBlockToPSL(struct psl *psl, Cap *qcap, Cap *tcap){
 void addPSLBlocks(struct psl *psl, struct Align *align, struct Thread *qThread, struct Thread *tThread, FILE *fileHandle){
    //return number of blocks get added
    int i, qi, ti;
-   Cap *qcap;
-   Cap *tcap;
-   bool qStrand;
-   bool tStrand;
+   struct PslCap qcap;
+   struct PslCap tcap;
    char pslStrands[2];
    pslStrands[0] = psl->strand[0];
    pslStrands[1] = psl->strand[1];
@@ -428,11 +492,9 @@ void addPSLBlocks(struct psl *psl, struct Align *align, struct Thread *qThread,
    while(i <align->size){
       qi = *(align->qIndices + i);
       ti = *(align->tIndices + i);
-      qcap = *(qThread->caps + qi);
-      tcap = *(tThread->caps + ti);
-      qStrand = cap_getStrand(qcap);
-      tStrand = cap_getStrand(tcap);
-      addBlockToPSL(psl, qcap, tcap);//add to qstarts, tstarts   
+      qcap = thread_getPslCap(qThread, qi);
+      tcap = thread_getPslCap(tThread, ti);
+      addBlockToPSL(psl, &qcap, &tcap);//add to qstarts, tstarts   
       i++;
    }
    return;
@@ -453,11 +515,11 @@ int getPSL(struct Align *align, struct Thread *qThread, struct Thread *tThread,
    int numBlocks = 0;
    int qi = align->qIndices[0];
    int ti = align->tIndices[0];
-   Cap *qcap = *(qThread->caps + qi);
-   Cap *tcap = *(tThread->caps + ti);
-   addPSLSizes(psl, qcap, tcap);
-   addPSLStarts(psl, qcap, tcap);
-   addPSLStrand(psl, qcap, tcap);
+   struct PslCap qcap = thread_getPslCap(qThread, qi);
+   struct PslCap tcap = thread_getPslCap(tThread, ti);
+   addPSLSizes(psl, &qcap, &tcap);
+   addPSLStarts(psl, &qcap, &tcap);
+   addPSLStrand(psl, &qcap, &tcap);
    addPSLBlocks(psl, align, qThread, tThread, fileHandle);
    addPSLEnds(psl);
    if(psl->blockCount >= 1){
@@ -519,17 +581,13 @@ struct Align *align_getBest(struct Align **aligns, int num, struct Thread *qthre
    int max = 0;
    struct Align *align;
    struct Align *best = NULL;
-   Cap *cap;
-   Cap **caps = qthread->caps;
    //fprintf(stderr, "Getting Best alignment\n");
    for(i=0; i< num; i++){//each align
       align = *(aligns + i);
       //if(align == NULL){ continue; } 
       numbase = 0;
       for(j=0; j< align->size; j++){//each block in the align
-         cap = *(caps + *(align->qIndices + j));
-         Segment *segment = cap_getSegment(cap);
-         numbase += segment_getLength(segment);
+         numbase += thread_getSegmentLength(qthread, *(align->qIndices + j));
       }
       if(max < numbase){
          max = numbase;
@@ -775,6 +833,19 @@ void thread_hasInversion(struct Thread *thread){
    int i, j;
    Cap *cap1;
    Cap *cap2;
+   if(thread->snapshot != NULL){
+      for(i=0; i< thread->size -1; i++){
+         //Get the cap at the other end of the segment
+         struct OrientedCap otherCap1 = snapshotCap_getOtherSegmentCap(thread->snapshot, *(thread->snapshotCaps + i));
+         for(j=i+1; j< thread->size; j++){
+            struct OrientedCap cap2 = *(thread->snapshotCaps + j);
+            if(cap2.cap == otherCap1.cap && cap2.strand != otherCap1.strand){//inversion
+	       fprintf(stderr, "Inversion at indices %d and %d\n", i, j);
+	    }
+         }
+      }
+      return;
+   }
    for(i=0; i< thread->size -1; i++){
       cap1 = *(thread->caps + i);
       //Get the cap at the other end of the segment
@@ -834,7 +905,7 @@ End *traverseQuery(Cap *cap, struct Thread **thread, char *query, char *target,
 	 size++;
          //Traverse lower level flowers if exists
 	 Group *group = end_getGroup(end_getOppEnd(cend));
-	 Flower *nestedFlower = group_getNestedFlower(group);
+	 Flower *nestedFlower = getNestedFlower(group);
          flower_check(nestedFlower);
 	 if(nestedFlower != NULL){//recursive call
             Cap *childCap = flower_getChildCap(nestedFlower, cap_getOppCap(cap));
@@ -854,7 +925,7 @@ bool cmpWithEnd(Cap *cap, char *name, int end){
    End_InstanceIterator *capIterator = end_getInstanceIterator(cap_getEnd(cap));
    while((currCap = end_getNext(capIterator)) != NULL){
       Sequence *sequence = cap_getSequence(cap);
-      char *sequenceHeader = formatSequenceHeader(sequence);
+      const char *sequenceHeader = getInternedSequenceHeader(sequence);
       if(strcmp(sequenceHeader, name) == 0){
          if(cap_getCoordinate(currCap) < end){
 	    isLess = true;
@@ -896,11 +967,10 @@ Cap *flower_getThreadStart(Flower *flower, char *name){// from Flower = 0
       if(isStubCap(cap) && !cap_getSide(cap)){//3' dead end or inherited end
          Sequence *sequence = cap_getSequence(cap);
          if(sequence == NULL){continue;}
-         char *sequenceHeader = formatSequenceHeader(sequence);
+         const char *sequenceHeader = getInternedSequenceHeader(sequence);
          if(strcmp(sequenceHeader, name) == 0){
             break;
          }
-         free(sequenceHeader);
       }
    }
    flower_destructCapIterator(capIterator);
@@ -925,16 +995,39 @@ Cap *flower_getChildCap(Flower *flower, Cap *pcap){
 }
 
 //===================== GETTING PSLs FROM CHAINS FOR CURRENT NET ==============
+void getPSLThreads(struct Thread *qThread, struct Thread *tThread, char *query, char *target, FILE *fileHandle, bool exhaust){
+   /*
+    *Align the query thread to a target thread and print the PSLs, freeing the target thread
+    */
+   struct Align *align;
+   int size;
+   if(!exhaust){
+      align = alignThreads(qThread, tThread);
+      if(align != NULL){
+         getPSL(align, qThread, tThread, query, target, fileHandle);
+         freeMem(align);
+      }
+   }else{
+      size = 0;
+      struct Align **aligns;
+      aligns = alignThreads_exhaust(qThread, tThread, &size);
+      int a;
+      for(a = 0; a < size; a++){
+            getPSL(*(aligns + a), qThread, tThread, query, target, fileHandle);
+      }
+      if(size > 0){ freeMem(aligns); }
+   }
+   if(tThread != NULL){ freeMem(tThread); }
+}
+
 void getPSLFlower(FILE *fileHandle, char *query, char *target, int start, int end, Cap *qstartCap, bool exhaust){
    /*
     *Get PSLs for flower, current level
     */
    //Each thread is an array of ordered caps obtained by traversing the flower
-   int size;
    int i=0;
    Cap *cap;
    struct Thread *qThread = setThread();
-   struct Align *align;
    End *startEnd = traverseQuery(qstartCap, &qThread, query, target, start, end, fileHandle, exhaust);
    if(startEnd == NULL){
       return;
@@ -946,28 +1039,12 @@ void getPSLFlower(FILE *fileHandle, char *query, char *target, int start, int en
    while((cap = end_getNext(capIterator)) != NULL){
       Sequence *sequence = cap_getSequence(cap);
       if(sequence == NULL){ continue; }
-      char *sequenceHeader = formatSequenceHeader(sequence);
+      const char *sequenceHeader = getInternedSequenceHeader(sequence);
       if(strcmp(sequenceHeader, target) == 0){
          struct Thread *tThread = setThread();
          traverseTarget(cap, &tThread, query, target, start, end);
          i++;
-         if(!exhaust){
-            align = alignThreads(qThread, tThread);
-            if(align != NULL){
-               getPSL(align, qThread, tThread, query, target, fileHandle);
-	       freeMem(align);
-            }
-	 }else{
-            size = 0;
-            struct Align **aligns;
-            aligns = alignThreads_exhaust(qThread, tThread, &size);
-            int a;
-            for(a = 0; a < size; a++){
-                  getPSL(*(aligns + a), qThread, tThread, query, target, fileHandle);
-            }
-	    if(size > 0){ freeMem(aligns); }
-         }
-         if(tThread != NULL){ freeMem(tThread); }
+         getPSLThreads(qThread, tThread, query, target, fileHandle, exhaust);
       }
    }
    if(qThread != NULL){ freeMem(qThread); }
@@ -976,7 +1053,7 @@ void getPSLFlower(FILE *fileHandle, char *query, char *target, int start, int en
 }
 
 //========================= TANGLE PSLs =======================================
-void block_getPSL(Flower *flower, Cap *qcap, Cap *tcap, char *query, char *target, FILE *fileHandle){
+void block_getPSL(struct PslCap *qcap, struct PslCap *tcap, char *query, char *target, FILE *fileHandle){
    /*
     *print PSL for 2 aligned segments (applied for tangle cases)
     */
@@ -1017,7 +1094,7 @@ bool block_inRange(Block *block, char *name, int s, int e){
    while((segment = block_getNext(segmentIterator)) != NULL){
       Sequence *sequence = segment_getSequence(segment);
       if(sequence == NULL){continue;}
-      char *sequenceHeader = formatSequenceHeader(sequence);
+      const char *sequenceHeader = getInternedSequenceHeader(sequence);
       if(strcmp(sequenceHeader, name) == 0){
          bstart = cap_getCoordinate(segment_get5Cap(segment));
          bend = cap_getCoordinate(segment_get3Cap(segment));
@@ -1038,8 +1115,6 @@ bool block_inRange(Block *block, char *name, int s, int e){
 void getPSLTangle(Flower *flower, FILE *fileHandle, char *query, char *target, int s, int e){
    End *end;
    Cap *cap;
-   Cap *qcap;
-   Cap *tcap;
    int i, j;
    struct Stubs *stubs = setStubs();
    Flower_EndIterator *endIterator = flower_getEndIterator(flower);
@@ -1052,7 +1127,7 @@ void getPSLTangle(Flower *flower, FILE *fileHandle, char *query, char *target, i
          while((cap=end_getNext(capIterator)) != NULL){ 
             Sequence *sequence = cap_getSequence(cap);
             if(sequence == NULL){continue;}
-            char *sequenceHeader = formatSequenceHeader(sequence);
+            const char *sequenceHeader = getInternedSequenceHeader(sequence);
             if(strcmp(sequenceHeader, query) == 0){
                if(cap_getSide(cap)){//5' cap
                   addStub(&(stubs->qstubs), cap, &(stubs->qnum));
@@ -1062,14 +1137,13 @@ void getPSLTangle(Flower *flower, FILE *fileHandle, char *query, char *target, i
                   addStub(&(stubs->tstubs), cap, &(stubs->tnum));
                }
             }
-            //free(sequenceHeader);
          }
          if(stubs->qnum > 0 && stubs->tnum > 0){
             for(i=0; i< stubs->qnum; i++){
-	       qcap = *(stubs->qstubs + i);
+	       struct PslCap qPslCap = getPslCap(*(stubs->qstubs + i));
                for(j=0; j< stubs->tnum; j++){
-	          tcap = *(stubs->tstubs + j);
-                  block_getPSL(flower, qcap, tcap,query, target, fileHandle);
+	          struct PslCap tPslCap = getPslCap(*(stubs->tstubs + j));
+                  block_getPSL(&qPslCap, &tPslCap, query, target, fileHandle);
 	       }
 	    }
 	 }
@@ -1085,7 +1159,7 @@ void getPSLTangle(Flower *flower, FILE *fileHandle, char *query, char *target, i
    Flower_GroupIterator *groupIterator = flower_getGroupIterator(flower);
    Group *group;
    while((group = flower_getNextGroup(groupIterator)) != NULL) {
-      Flower *nestedFlower = group_getNestedFlower(group);
+      Flower *nestedFlower = getNestedFlower(group);
       if(nestedFlower != NULL) {
          getPSLTangle(nestedFlower, fileHandle, query, target, s, e);
       }
@@ -1166,10 +1240,10 @@ void getAllPSLs(Flower *flower, FILE *fileHandle, char *query, char *target, str
    char *qName;
    char *tName;
    int q, t;
-   flower = group_getNestedFlower(flower_getFirstGroup(flower));
+   flower = getNestedFlower(flower_getFirstGroup(flower));
    //Look for all query and target sequences with name start with 'query' and 'target'
-   int qnum = getSequences(flower, &qseqs, query);
-   int tnum = getSequences(flower, &tseqs, target);
+   int qnum = getSequenceHeaders(flower, &qseqs, query);
+   int tnum = getSequenceHeaders(flower, &tseqs, target);
 
    //Find the set of limits from refpslList
    int *starts = NULL; 
@@ -1198,6 +1272,327 @@ void getAllPSLs(Flower *flower, FILE *fileHandle, char *query, char *target, str
 }
 
 
+//======================= GETTING THE PSLs FROM A SNAPSHOT ===================
+/*
+ * The same PSLs, read from a snapshot written by cactus_snapshotExport rather than the database.
+ * Threads are of OrientedCaps, and 'isChainBlock' says for each block of the snapshot if it is in a chain.
+ */
+void getPSLFlowerFromSnapshot(CactusSnapshot *snapshot, bool *isChainBlock, FILE *fileHandle, char *query, char *target,
+                              int start, int end, struct OrientedCap qstartCap, bool exhaust);
+
+bool isCommonBlockFromSnapshot(CactusSnapshot *snapshot, int64_t block, char *query, char *target){
+   if(block == -1){ return false; }
+   bool hasT = false;
+   bool hasQ = false;
+   SnapshotBlock *record = &(snapshot->blocks[block]);
+   for(int64_t i = record->firstSegment; i < record->firstSegment + record->segmentNumber; i++){
+      int64_t sequence = snapshot->segments[i].sequence;
+      if(sequence == -1){
+         continue;
+      }
+      const char *sequenceHeader = cactusSnapshot_getSequenceHeader(snapshot, sequence);
+      if(strcmp(sequenceHeader, query) == 0){
+         hasQ = true;
+      }else
+      if(strcmp(sequenceHeader, target) == 0){
+         hasT = true;
+      }
+   }
+   return hasQ && hasT;
+}
+
+bool snapshotEnd_hasSequence(CactusSnapshot *snapshot, int64_t end, char *name){
+   /*Return true if a cap of the end is of the sequence 'name'*/
+   SnapshotEnd *record = &(snapshot->ends[end]);
+   for(int64_t i = record->firstCap; i < record->firstCap + record->capNumber; i++){
+      const char *sequenceHeader = snapshotCap_getSequenceHeader(snapshot, i);
+      if(sequenceHeader != NULL && strcmp(sequenceHeader, name) == 0){
+         return true;
+      }
+   }
+   return false;
+}
+
+void moveCapToNextBlockOrSelfEdgeFromSnapshot(CactusSnapshot *snapshot, struct OrientedCap *cap){
+   struct OrientedCap adjCap = snapshotCap_getAdjacency(snapshot, *cap);
+   if(snapshotCap_endEquals(snapshot, *cap, adjCap)){//self connected end
+      *cap = adjCap;
+   }else{
+      *cap = snapshotCap_getAdjacency(snapshot, snapshotCap_getOtherSegmentCap(snapshot, *cap));
+   }
+}
+
+void moveCapToNextCommonBlockFromSnapshot(CactusSnapshot *snapshot, struct OrientedCap *cap, char *name){
+   bool commonBlock = false;
+   while(!commonBlock && !isStubCapFromSnapshot(snapshot, *cap)){
+      moveCapToNextBlockOrSelfEdgeFromSnapshot(snapshot, cap);
+      commonBlock = snapshotEnd_hasSequence(snapshot, snapshot->caps[cap->cap].end, name);
+   }
+}
+
+void thread_addSnapshotCap(struct Thread *thread, struct OrientedCap cap, int *size){
+   if(*size == 0){
+      thread->snapshotCaps = AllocA(struct OrientedCap);
+   }else{
+      thread->snapshotCaps = needMoreMem(thread->snapshotCaps, (*size)*sizeof(struct OrientedCap), (*size+1)*sizeof(struct OrientedCap));
+   }
+   *(thread->snapshotCaps + *size) = cap;
+   (*size)++;
+}
+
+struct OrientedCap traverseQueryFromSnapshot(CactusSnapshot *snapshot, bool *isChainBlock, struct OrientedCap cap, struct Thread **thread,
+                                             char *query, char *target, int start, int end, FILE *fileHandle, bool exhaust){
+   /*As traverseQuery, returning the first cap of the thread, whose end is the start end, or a cap of -1 if there is none*/
+   cap = snapshotCap_getAdjacency(snapshot, cap);
+   int coor;
+   bool past = false;
+   struct OrientedCap prevcap = cap;
+   int size = (*thread)->size;
+   struct OrientedCap startCap = { -1, 1 };
+   if(!isCommonBlockFromSnapshot(snapshot, snapshot->ends[snapshot->caps[cap.cap].end].block, query, target)){
+      moveCapToNextCommonBlockFromSnapshot(snapshot, &cap, target);
+   }
+   //traverse the flower, start from 'cap', to get the thread
+   while(!isStubCapFromSnapshot(snapshot, cap)){
+      int64_t block = snapshot->ends[snapshot->caps[cap.cap].end].block;
+      int blockLen = snapshot->blocks[block].length;
+      coor = snapshot->caps[cap.cap].coordinate;//Cap coordinate is always the coordinate on + strand
+      if(coor >= end){ //past range
+         if(past){//if already visited this cap before, break
+            break;
+         }else{//if past the range, but hasn't visited any lower flowers
+            cap = prevcap;
+            past = true;
+            continue;
+         }
+      }
+      if(coor + blockLen < start){ //curr cap is upstream of 'start'
+         if(!past){//hasn't visited this cap yet
+            prevcap = cap;
+            moveCapToNextCommonBlockFromSnapshot(snapshot, &cap, target);
+            continue;
+         }
+      }
+      past = true;
+      if(isChainBlock[block]){//if block belongs to a chain
+         if(startCap.cap == -1){
+            startCap = cap;
+         }
+         thread_addSnapshotCap(*thread, cap, &size);
+         //Traverse lower level flowers if exists
+         struct OrientedCap oppCap = snapshotCap_getOtherSegmentCap(snapshot, cap);
+         int64_t group = snapshot->ends[snapshot->caps[oppCap.cap].end].group;
+         if(snapshot->groups[group].nestedFlower != -1){//recursive call
+            //As flower_getChildCap, the stub of the same name in the nested flower, on the positive strand
+            struct OrientedCap childCap = { snapshot->caps[oppCap.cap].nestedCap, 1 };
+            if(childCap.cap != -1){
+               getPSLFlowerFromSnapshot(snapshot, isChainBlock, fileHandle, query, target, start, end, childCap, exhaust);
+            }
+         }
+      }
+      moveCapToNextCommonBlockFromSnapshot(snapshot, &cap, target);
+   }
+   (*thread)->size = size;
+   return startCap;
+}
+
+bool cmpWithEndFromSnapshot(CactusSnapshot *snapshot, int64_t cap, char *name, int end){
+   /*As cmpWithEnd, which checks the sequence of 'cap' rather than of each cap of its end*/
+   const char *sequenceHeader = snapshotCap_getSequenceHeader(snapshot, cap);
+   if(sequenceHeader == NULL || strcmp(sequenceHeader, name) != 0){
+      return false;
+   }
+   SnapshotEnd *record = &(snapshot->ends[snapshot->caps[cap].end]);
+   for(int64_t i = record->firstCap; i < record->firstCap + record->capNumber; i++){
+      if(snapshot->caps[i].coordinate < end){
+         return true;
+      }
+   }
+   return false;
+}
+
+void traverseTargetFromSnapshot(CactusSnapshot *snapshot, bool *isChainBlock, struct OrientedCap cap, struct Thread **thread,
+                                char *query, char *target, int start, int end){
+   int size = (*thread)->size;
+   //traverse the flower, start from 'cap', to get the thread
+   while(!isStubCapFromSnapshot(snapshot, cap)){
+      int64_t block = snapshot->ends[snapshot->caps[cap.cap].end].block;
+      if(!cmpWithEndFromSnapshot(snapshot, cap.cap, target, end)){ break; } //past range
+      if(isChainBlock[block]){//if block belongs to a chain
+         thread_addSnapshotCap(*thread, cap, &size);
+      }
+      moveCapToNextCommonBlockFromSnapshot(snapshot, &cap, query);
+   }
+   (*thread)->size = size;
+}
+
+struct OrientedCap flower_getThreadStartFromSnapshot(CactusSnapshot *snapshot, int64_t flower, char *name){
+   /*As flower_getThreadStart, the first 3' stub of the sequence in the order of the flower's caps, which is by name*/
+   SnapshotFlower *record = &(snapshot->flowers[flower]);
+   struct OrientedCap cap = { -1, 1 };
+   for(int64_t i = record->firstCap; i < record->firstCap + record->capNumber; i++){
+      SnapshotCap *capRecord = &(snapshot->caps[i]);
+      if(snapshot->ends[capRecord->end].isStubEnd && !capRecord->side){//3' dead end or inherited end
+         const char *sequenceHeader = snapshotCap_getSequenceHeader(snapshot, i);
+         if(sequenceHeader != NULL && strcmp(sequenceHeader, name) == 0 &&
+            (cap.cap == -1 || cactusMisc_nameCompare(capRecord->name, snapshot->caps[cap.cap].name) < 0)){
+            cap.cap = i;
+            cap.strand = capRecord->strand;
+         }
+      }
+   }
+   return cap;
+}
+
+void getPSLFlowerFromSnapshot(CactusSnapshot *snapshot, bool *isChainBlock, FILE *fileHandle, char *query, char *target,
+                              int start, int end, struct OrientedCap qstartCap, bool exhaust){
+   if(qstartCap.cap == -1){ //the query has no thread in the flower
+      return;
+   }
+   struct Thread *qThread = setThread();
+   qThread->snapshot = snapshot;
+   struct OrientedCap startCap = traverseQueryFromSnapshot(snapshot, isChainBlock, qstartCap, &qThread, query, target, start, end, fileHandle, exhaust);
+   if(startCap.cap == -1){
+      return;
+   }
+   //DEBUG: check for inversion:
+   thread_hasInversion(qThread);
+   //END DEBUG
+   //The caps of the start end, in the orientation of the start cap
+   bool orientation = snapshotCap_getOrientation(snapshot, startCap);
+   SnapshotEnd *record = &(snapshot->ends[snapshot->caps[startCap.cap].end]);
+   for(int64_t i = record->firstCap; i < record->firstCap + record->capNumber; i++){
+      const char *sequenceHeader = snapshotCap_getSequenceHeader(snapshot, i);
+      if(sequenceHeader != NULL && strcmp(sequenceHeader, target) == 0){
+         struct Thread *tThread = setThread();
+         tThread->snapshot = snapshot;
+         struct OrientedCap cap = { i, orientation ? snapshot->caps[i].strand : !snapshot->caps[i].strand };
+         traverseTargetFromSnapshot(snapshot, isChainBlock, cap, &tThread, query, target, start, end);
+         getPSLThreads(qThread, tThread, query, target, fileHandle, exhaust);
+      }
+   }
+   freeMem(qThread);
+}
+
+bool block_inRangeFromSnapshot(CactusSnapshot *snapshot, int64_t block, char *name, int s, int e){
+   SnapshotBlock *record = &(snapshot->blocks[block]);
+   for(int64_t i = record->firstSegment; i < record->firstSegment + record->segmentNumber; i++){
+      SnapshotSegment *segment = &(snapshot->segments[i]);
+      if(segment->sequence == -1){continue;}
+      if(strcmp(cactusSnapshot_getSequenceHeader(snapshot, segment->sequence), name) == 0){
+         //segment starts on the - strand are the highest coordinate of the segment
+         int64_t bstart = segment->strand ? segment->start : segment->start - record->length + 1;
+         int64_t bend = bstart + record->length - 1;
+         if(bstart < e && s < bend){
+            return true;
+         }
+      }
+   }
+   return false;
+}
+
+void getPSLTangleFromSnapshot(CactusSnapshot *snapshot, bool *isChainBlock, int64_t flower, FILE *fileHandle,
+                              char *query, char *target, int s, int e){
+   SnapshotFlower *flowerRecord = &(snapshot->flowers[flower]);
+   for(int64_t i = flowerRecord->firstEnd; i < flowerRecord->firstEnd + flowerRecord->endNumber; i++){
+      SnapshotEnd *end = &(snapshot->ends[i]);
+      if(end->block == -1 || isChainBlock[end->block] || !block_inRangeFromSnapshot(snapshot, end->block, query, s, e)){
+         continue;
+      }
+      //blocks that don't belong to any chain, pairing each 5' query cap with each 5' target cap
+      for(int64_t qcap = end->firstCap; qcap < end->firstCap + end->capNumber; qcap++){
+         const char *qHeader = snapshotCap_getSequenceHeader(snapshot, qcap);
+         if(qHeader == NULL || strcmp(qHeader, query) != 0 || !snapshot->caps[qcap].side){
+            continue;
+         }
+         struct OrientedCap qOrientedCap = { qcap, snapshot->caps[qcap].strand };
+         struct PslCap qPslCap = getPslCapFromSnapshot(snapshot, qOrientedCap);
+         for(int64_t tcap = end->firstCap; tcap < end->firstCap + end->capNumber; tcap++){
+            const char *tHeader = snapshotCap_getSequenceHeader(snapshot, tcap);
+            if(tHeader == NULL || strcmp(tHeader, query) == 0 || strcmp(tHeader, target) != 0 || !snapshot->caps[tcap].side){
+               continue;
+            }
+            struct OrientedCap tOrientedCap = { tcap, snapshot->caps[tcap].strand };
+            struct PslCap tPslCap = getPslCapFromSnapshot(snapshot, tOrientedCap);
+            block_getPSL(&qPslCap, &tPslCap, query, target, fileHandle);
+         }
+      }
+   }
+
+   for(int64_t i = flowerRecord->firstGroup; i < flowerRecord->firstGroup + flowerRecord->groupNumber; i++){
+      if(snapshot->groups[i].nestedFlower != -1){
+         getPSLTangleFromSnapshot(snapshot, isChainBlock, snapshot->groups[i].nestedFlower, fileHandle, query, target, s, e);
+      }
+   }
+}
+
+void getPSLsFromSnapshot(CactusSnapshot *snapshot, bool *isChainBlock, int64_t flower, FILE *fileHandle, char *query, char *target,
+                         int *starts, int *ends, int size, bool tangle, bool exhaust) {
+   char *flowerName = cactusMisc_nameToString(snapshot->flowers[flower].name);
+   fprintf(stderr, "\nNET: %s\n", flowerName);
+   free(flowerName);
+   int i, start, end;
+   struct OrientedCap qstartCap = flower_getThreadStartFromSnapshot(snapshot, flower, query);
+   if(size == 0){//No reference - set limit to the whole sequence - Won't do exhaust!
+      start = 2;
+      end = 2;
+      for(int64_t j = 0; j < cactusSnapshot_getLength(snapshot, SNAPSHOT_SEQUENCES); j++){
+         if(strcmp(cactusSnapshot_getSequenceHeader(snapshot, j), query) == 0){
+            end = snapshot->sequences[j].length + 2;
+            break;
+         }
+      }
+      fprintf(stderr, "Getting psl for range: <%d -  %d>\n", start, end);
+      getPSLFlowerFromSnapshot(snapshot, isChainBlock, fileHandle, query, target, start, end, qstartCap, false);
+      if(tangle){
+         getPSLTangleFromSnapshot(snapshot, isChainBlock, flower, fileHandle, query, target, start, end);
+      }
+   }else{
+      for(i=0; i< size; i++){
+         fprintf(stderr, "Getting psl for range: <%d -  %d>\n", *(starts +i), *(ends +i));
+         getPSLFlowerFromSnapshot(snapshot, isChainBlock, fileHandle, query, target, *(starts + i), *(ends + i), qstartCap, exhaust);
+         if(tangle){
+            getPSLTangleFromSnapshot(snapshot, isChainBlock, flower, fileHandle, query, target, *(starts + i), *(ends + i));
+         }
+      }
+   }
+}
+
+void getAllPSLsFromSnapshot(CactusSnapshot *snapshot, FILE *fileHandle, char *query, char *target, struct psl *refpsl, int offset, bool tangle, bool exhaust) {
+   if(snapshot->flowers[0].groupNumber == 0 || snapshot->groups[snapshot->flowers[0].firstGroup].nestedFlower == -1){
+      return;
+   }
+   int64_t flower = snapshot->groups[snapshot->flowers[0].firstGroup].nestedFlower;
+   int64_t blockNumber = cactusSnapshot_getLength(snapshot, SNAPSHOT_BLOCKS);
+   bool *isChainBlock = st_calloc(blockNumber + 1, sizeof(bool));
+   for(int64_t i = 0; i < cactusSnapshot_getLength(snapshot, SNAPSHOT_CHAIN_BLOCKS); i++){
+      isChainBlock[snapshot->chainBlocks[i]] = 1;
+   }
+   //Look for all query and target sequences with name start with 'query' and 'target'
+   stList *qseqs = cactusSnapshot_getSequencesMatchingHeader(snapshot, query, 1);
+   stList *tseqs = cactusSnapshot_getSequencesMatchingHeader(snapshot, target, 1);
+
+   //Find the set of limits from refpslList
+   int *starts = NULL;
+   int *ends = NULL;
+   int size = getRanges(refpsl,offset, &starts, &ends);
+   for(int64_t q = 0; q < stList_length(qseqs); q++){
+      char *qName = (char *)cactusSnapshot_getSequenceHeader(snapshot, stIntTuple_get(stList_get(qseqs, q), 0));
+      fprintf(stderr, "Current Query: %s\n", qName);
+      for(int64_t t = 0; t < stList_length(tseqs); t++){
+         char *tName = (char *)cactusSnapshot_getSequenceHeader(snapshot, stIntTuple_get(stList_get(tseqs, t), 0));
+         fprintf(stderr, "\tCurrent Target: %s\n", tName);
+         getPSLsFromSnapshot(snapshot, isChainBlock, flower, fileHandle, qName, tName, starts, ends, size, tangle, exhaust);
+      }
+   }
+   if(size > 0){
+      freeMem(starts);
+      freeMem(ends);
+   }
+   stList_destruct(qseqs);
+   stList_destruct(tseqs);
+   free(isChainBlock);
+}
 
 void usage() {
    fprintf(stderr, "cactus_pslGenerator, version 0.2\n");
@@ -1212,6 +1607,7 @@ void usage() {
    fprintf(stderr, "-x --exhaust : if specified, will exhaustly return all possible pairwise alignments.\n");
    fprintf(stderr, "Very slow - do not use for large regions.");
    fprintf(stderr, "If not specified, return the best alignment. Note, if no ref is specified, then will not do exhaust\n");
+   fprintf(stderr, "-s --snapshot : Read the flowers from a snapshot written by cactus_snapshotExport, rather than the database.\n");
    fprintf(stderr, "-h --help : Print this help screen\n");
 }
 
@@ -1230,6 +1626,7 @@ int main(int argc, char *argv[]) {
    int offset = 0;
    bool tangle = false;
    bool exhaust = false;
+   char * snapshotFile = NULL;
 
    ///////////////////////////////////////////////////////////////////////////
    // (0) Parse the inputs handed by genomeCactus.py / setup stuff.
@@ -1247,12 +1644,13 @@ int main(int argc, char *argv[]) {
          { "cactusDisk", required_argument, 0, 'c' },
          { "outputFile", required_argument, 0, 'e' },
          { "help", no_argument, 0, 'h' },
+         { "snapshot", required_argument, 0, 's' },
          { 0, 0, 0, 0 }
       };
 
       int option_index = 0;
 
-      int key = getopt_long(argc, argv, "o:r:q:t:a:c:d:e:fxgh", long_options, &option_index);
+      int key = getopt_long(argc, argv, "o:r:q:t:a:c:d:e:fxghs:", long_options, &option_index);
 
       if(key == -1) {
          break;
@@ -1286,6 +1684,9 @@ int main(int argc, char *argv[]) {
          case 'x':
             exhaust = true;
             break;
+         case 's':
+            snapshotFile = stString_copy(optarg);
+            break;
          case 'h':
             usage();
             return 0;
@@ -1299,7 +1700,7 @@ int main(int argc, char *argv[]) {
    // (0) Check the inputs.
    ///////////////////////////////////////////////////////////////////////////
 
-   assert(cactusDiskDatabaseString != NULL);
+   assert(cactusDiskDatabaseString != NULL || snapshotFile != NULL);
    assert(outputFile != NULL);
    assert(query != NULL);
    assert(target != NULL);
@@ -1319,6 +1720,27 @@ int main(int argc, char *argv[]) {
    st_logInfo("Query: %s\n", query);
    st_logInfo("Target: %s\n", target);
 
+   //////////////////////////////////////////////
+   //Read the flowers from a snapshot, without the database
+   //////////////////////////////////////////////
+
+   if(snapshotFile != NULL){
+      st_logInfo("Snapshot file : %s\n", snapshotFile);
+      int64_t startTime = time(NULL);
+      CactusSnapshot *snapshot = cactusSnapshot_open(snapshotFile);
+      FILE *fileHandle = fopen(outputFile, "w");
+      makePSLHeader(NULL, fileHandle);
+      struct psl *refpsl = NULL;
+      if(ref != NULL){
+         refpsl = pslLoadAll(ref);
+      }
+      getAllPSLsFromSnapshot(snapshot, fileHandle, query, target, refpsl, offset, tangle, exhaust);
+      fclose(fileHandle);
+      cactusSnapshot_close(snapshot);
+      st_logInfo("Got the psls from the snapshot in %" PRIi64 " seconds/\n", time(NULL) - startTime);
+      return 0;
+   }
+
    //////////////////////////////////////////////
    //Load the database
    //////////////////////////////////////////////
@@ -1331,7 +1753,7 @@ int main(int argc, char *argv[]) {
    // Parse the basic reconstruction problem
    ///////////////////////////////////////////////////////////////////////////
    flowerName = stString_copy("0");
-   Flower *flower = cactusDisk_getFlower(cactusDisk, cactusMisc_stringToName(flowerName));
+   Flower *flower = getFlower(cactusDisk, cactusMisc_stringToName(flowerName));
    st_logInfo("Parsed the top level flower of the cactus tree to check\n");
 
    ///////////////////////////////////////////////////////////////////////////
@@ -1348,6 +1770,7 @@ int main(int argc, char *argv[]) {
    getAllPSLs(flower, fileHandle, query, target, refpsl, offset, tangle, exhaust);
    fclose(fileHandle);
    st_logInfo("Got the psls in %" PRIi64 " seconds/\n", time(NULL) - startTime);
+   logLoadedFlowerNumber();
 
    ///////////////////////////////////////////////////////////////////////////
    // Clean up.
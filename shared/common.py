@@ -29,10 +29,13 @@ def getLogLevelString2(logLevelString):
 #############################################
 #############################################    
     
-def runCactusTreeStats(outputFile, cactusDiskDatabaseString, flowerName='0', logLevel=None, referenceEventString=None):
+def runCactusTreeStats(outputFile, cactusDiskDatabaseString, flowerName='0', logLevel=None, referenceEventString=None, workerNumber=None, prefetch=None, snapshotFile=None):
     logLevel = getLogLevelString2(logLevel)
     referenceEventString = nameValue("referenceEventString", referenceEventString, str)
-    command = "cactus_treeStats --cactusDisk '%s' --flowerName %s --outputFile %s --logLevel %s %s" % (cactusDiskDatabaseString, flowerName, outputFile, logLevel, referenceEventString)
+    workerNumber = nameValue("workerNumber", workerNumber, int)
+    prefetch = nameValue("prefetch", prefetch, bool)
+    snapshotFile = nameValue("snapshot", snapshotFile, str)
+    command = "cactus_treeStats --cactusDisk '%s' --flowerName %s --outputFile %s --logLevel %s %s %s %s %s" % (cactusDiskDatabaseString, flowerName, outputFile, logLevel, referenceEventString, workerNumber, prefetch, snapshotFile)
     system(command)
     logger.info("Ran the cactus tree stats command apprently okay")
 
@@ -63,10 +66,67 @@ def runCactusAdjacencyGraphViewer(graphFile,
     
 def runCactusMAFGenerator(mAFFile, cactusDiskDatabaseString, flowerName="0",
                           logLevel=None, referenceEventString=None, 
-                          showOnlySubstitutionsWithRespectToTheReference=None):
+                          showOnlySubstitutionsWithRespectToTheReference=None, workerNumber=None, prefetch=None,
+                          snapshotFile=None, bgzf=None, compressionThreadNumber=None, indexFile=None,
+                          regions=None, manifestFile=None, previousMafFile=None, previousManifestFile=None,
+                          format=None, capLevelCacheSize=None):
     logLevel = getLogLevelString2(logLevel)
     referenceEventString = nameValue("referenceEventString", referenceEventString, str)
     showOnlySubstitutionsWithRespectToTheReference = nameValue("showOnlySubstitutionsWithRespectToTheReference", showOnlySubstitutionsWithRespectToTheReference, bool)
-    system("cactus_MAFGenerator --cactusDisk '%s' --flowerName %s --outputFile %s --logLevel %s %s %s" \
-            % (cactusDiskDatabaseString, flowerName, mAFFile, logLevel, referenceEventString, showOnlySubstitutionsWithRespectToTheReference))
+    workerNumber = nameValue("workerNumber", workerNumber, int)
+    prefetch = nameValue("prefetch", prefetch, bool)
+    snapshotFile = nameValue("snapshot", snapshotFile, str)
+    bgzf = nameValue("bgzf", bgzf, bool)
+    compressionThreadNumber = nameValue("compressionThreadNumber", compressionThreadNumber, int)
+    indexFile = nameValue("indexFile", indexFile, str)
+    regions = " ".join([ "--region '%s'" % region for region in regions ]) if regions != None else ""
+    manifestFile = nameValue("manifestFile", manifestFile, str)
+    previousMafFile = nameValue("previousMafFile", previousMafFile, str)
+    previousManifestFile = nameValue("previousManifestFile", previousManifestFile, str)
+    format = nameValue("format", format, str)
+    capLevelCacheSize = nameValue("capLevelCacheSize", capLevelCacheSize, int)
+    system("cactus_MAFGenerator --cactusDisk '%s' --flowerName %s --outputFile %s --logLevel %s %s %s %s %s %s %s %s %s %s %s %s %s %s %s" \
+            % (cactusDiskDatabaseString, flowerName, mAFFile, logLevel, referenceEventString, showOnlySubstitutionsWithRespectToTheReference, workerNumber, prefetch, snapshotFile, bgzf, compressionThreadNumber, indexFile, regions, manifestFile, previousMafFile, previousManifestFile, format, capLevelCacheSize))
     logger.info("Created a MAF for the given cactusDisk")
+
+def runCactusAugmentedMaf(mAFFile, cactusDiskDatabaseString, species, flowerName="0", logLevel=None, workerNumber=None, prefetch=None):
+    logLevel = getLogLevelString2(logLevel)
+    workerNumber = nameValue("workerNumber", workerNumber, int)
+    prefetch = nameValue("prefetch", prefetch, bool)
+    system("cactus_augmentedMaf --cactusDisk '%s' --flowerName %s --species '%s' --outputFile %s --logLevel %s %s %s" \
+            % (cactusDiskDatabaseString, flowerName, " ".join(species), mAFFile, logLevel, workerNumber, prefetch))
+    logger.info("Created an augmented MAF for the given cactusDisk")
+
+def runCactusMAFQuery(mAFFile, indexFile, region, outputFile, logLevel=None):
+    logLevel = getLogLevelString2(logLevel)
+    system("cactus_MAFQuery --mafFile %s --indexFile %s --region '%s' --outputFile %s --logLevel %s" \
+            % (mAFFile, indexFile, region, outputFile, logLevel))
+    logger.info("Queried a region of the MAF")
+
+def runCactusBinaryMAFToMAF(binaryMAFFile, mAFFile, logLevel=None):
+    logLevel = getLogLevelString2(logLevel)
+    system("cactus_binaryMAFToMAF --inputFile %s --outputFile %s --logLevel %s" \
+            % (binaryMAFFile, mAFFile, logLevel))
+    logger.info("Converted a binary MAF to MAF")
+
+def runCactusSnapshotExport(snapshotFile, cactusDiskDatabaseString, flowerName="0", logLevel=None):
+    logLevel = getLogLevelString2(logLevel)
+    system("cactus_snapshotExport --cactusDisk '%s' --flowerName %s --outputFile %s --logLevel %s" \
+            % (cactusDiskDatabaseString, flowerName, snapshotFile, logLevel))
+    logger.info("Wrote a snapshot of the given cactusDisk")
+
+def runCactusBedGenerator(bedFile, cactusDiskDatabaseString, species, flowerName="0", logLevel=None, prefetch=None, snapshotFile=None):
+    logLevel = getLogLevelString2(logLevel)
+    prefetch = nameValue("prefetch", prefetch, bool)
+    snapshotFile = nameValue("snapshot", snapshotFile, str)
+    system("cactus_bedGenerator --cactusDisk '%s' --flowerName %s --species '%s' --outputFile %s --logLevel %s %s %s" \
+            % (cactusDiskDatabaseString, flowerName, species, bedFile, logLevel, prefetch, snapshotFile))
+    logger.info("Created the BEDs for the given cactusDisk")
+
+def runCactusPslGenerator(pslFile, cactusDiskDatabaseString, query, target, logLevel=None, tangle=None, snapshotFile=None):
+    logLevel = getLogLevelString2(logLevel)
+    tangle = nameValue("tangle", tangle, bool)
+    snapshotFile = nameValue("snapshot", snapshotFile, str)
+    system("cactus_pslGenerator --cactusDisk '%s' --query '%s' --target '%s' --outputFile %s --logLevel %s %s %s" \
+            % (cactusDiskDatabaseString, query, target, pslFile, logLevel, tangle, snapshotFile))
+    logger.info("Created the PSLs for the given cactusDisk")
@@ -9,6 +9,9 @@ cactus workflow and the various utilities.
 
 import random
 import os
+import re
+import gzip
+from distutils.spawn import find_executable
 import xml.etree.ElementTree as ET
 
 from sonLib.bioio import logger
@@ -18,6 +21,7 @@ from sonLib.bioio import getRandomSequence
 from sonLib.bioio import mutateSequence
 from sonLib.bioio import reverseComplement
 from sonLib.bioio import fastaWrite
+from sonLib.bioio import fastaRead
 from sonLib.bioio import printBinaryTree
 from sonLib.bioio import system
 from sonLib.bioio import getRandomAlphaNumericString
@@ -27,6 +31,12 @@ from cactusTools.shared.common import runCactusTreeViewer
 from cactusTools.shared.common import runCactusAdjacencyGraphViewer
 from cactusTools.shared.common import runCactusTreeStats
 from cactusTools.shared.common import runCactusMAFGenerator
+from cactusTools.shared.common import runCactusMAFQuery
+from cactusTools.shared.common import runCactusAugmentedMaf
+from cactusTools.shared.common import runCactusBinaryMAFToMAF
+from cactusTools.shared.common import runCactusSnapshotExport
+from cactusTools.shared.common import runCactusBedGenerator
+from cactusTools.shared.common import runCactusPslGenerator
 from cactusTools.shared.common import runCactusTreeStatsToLatexTables
 
 from sonLib.bioio import TestStatus
@@ -91,6 +101,19 @@ def runWorkflow_TestScript(sequences, newickTreeString,
     if makeCactusTreeStats:
         cactusTreeFile = os.path.join(outputDir, "cactusStats.xml")
         runCactusTreeStats(cactusTreeFile, cactusDiskDatabaseString)
+        #The stats must not depend on the number of workers, or on prefetching
+        parallelCactusTreeFile = os.path.join(outputDir, "cactusStatsParallel.xml")
+        runCactusTreeStats(parallelCactusTreeFile, cactusDiskDatabaseString, workerNumber=3, prefetch=True)
+        assert open(cactusTreeFile).read() == open(parallelCactusTreeFile).read()
+        #Nor on reading the flowers from a snapshot
+        statsSnapshotFile = os.path.join(outputDir, "cactusStats.snapshot")
+        runCactusSnapshotExport(statsSnapshotFile, cactusDiskDatabaseString)
+        snapshotCactusTreeFile = os.path.join(outputDir, "cactusStatsSnapshot.xml")
+        runCactusTreeStats(snapshotCactusTreeFile, cactusDiskDatabaseString, snapshotFile=statsSnapshotFile)
+        assert open(cactusTreeFile).read() == open(snapshotCactusTreeFile).read()
+        parallelSnapshotCactusTreeFile = os.path.join(outputDir, "cactusStatsSnapshotParallel.xml")
+        runCactusTreeStats(parallelSnapshotCactusTreeFile, cactusDiskDatabaseString, workerNumber=3, snapshotFile=statsSnapshotFile)
+        assert open(cactusTreeFile).read() == open(parallelSnapshotCactusTreeFile).read()
         #Now run the latex script
         statsFileTEX = os.path.join(outputDir, "cactusStats.tex")
         runCactusTreeStatsToLatexTables([ cactusTreeFile ], [ "region0" ], statsFileTEX)
@@ -101,6 +124,130 @@ def runWorkflow_TestScript(sequences, newickTreeString,
     if makeMAFs:
         mAFFile = os.path.join(outputDir, "cactus.maf")
         runCactusMAFGenerator(mAFFile, cactusDiskDatabaseString)
+        #Nor must the MAFs
+        parallelMAFFile = os.path.join(outputDir, "cactusParallel.maf")
+        runCactusMAFGenerator(parallelMAFFile, cactusDiskDatabaseString, workerNumber=3, prefetch=True)
+        assert open(mAFFile).read() == open(parallelMAFFile).read()
+        #Nor must compressing them
+        bgzfMAFFile = os.path.join(outputDir, "cactus.maf.gz")
+        runCactusMAFGenerator(bgzfMAFFile, cactusDiskDatabaseString, bgzf=True, compressionThreadNumber=3)
+        assert open(mAFFile).read() == gzip.open(bgzfMAFFile).read()
+        #The index must not depend on the number of workers, and querying a region gives the header and a subset of the blocks
+        indexFile = os.path.join(outputDir, "cactus.maf.index")
+        runCactusMAFGenerator(mAFFile, cactusDiskDatabaseString, indexFile=indexFile)
+        parallelIndexFile = os.path.join(outputDir, "cactusParallel.maf.index")
+        runCactusMAFGenerator(bgzfMAFFile, cactusDiskDatabaseString, workerNumber=3, bgzf=True, indexFile=parallelIndexFile)
+        assert open(indexFile).read() == open(parallelIndexFile).read()
+        indexLines = [ line.split() for line in open(indexFile).readlines() if not line.startswith("#") ] #Skipping the sequence table
+        if len(indexLines) > 0:
+            mAF = open(mAFFile).read()
+            region = "%s:%s-%s" % (indexLines[0][0], indexLines[0][1], int(indexLines[0][2]) + 1000)
+            queryFile = os.path.join(outputDir, "cactusQuery.maf")
+            runCactusMAFQuery(mAFFile, indexFile, region, queryFile)
+            bgzfQueryFile = os.path.join(outputDir, "cactusQueryBgzf.maf")
+            runCactusMAFQuery(bgzfMAFFile, parallelIndexFile, region, bgzfQueryFile)
+            query = open(queryFile).read()
+            assert query == open(bgzfQueryFile).read()
+            header = mAF[:int(indexLines[0][3])]
+            assert query.startswith(header)
+            assert query[len(header):len(header) + 1] == "a"
+            for block in query[len(header):].split("\na")[1:]:
+                assert block in mAF
+            #Extracting the region from the cactus disk gives the same blocks, without the whole traversal
+            regionMAFFile = os.path.join(outputDir, "cactusRegion.maf")
+            runCactusMAFGenerator(regionMAFFile, cactusDiskDatabaseString, regions=[ region ])
+            assert query == open(regionMAFFile).read()
+            #With or without the cap level cache, or with one evicting at every cap
+            for capLevelCacheSize in [ 0, 1 ]:
+                runCactusMAFGenerator(regionMAFFile, cactusDiskDatabaseString, regions=[ region, region ], capLevelCacheSize=capLevelCacheSize)
+                assert query + query[len(header):] == open(regionMAFFile).read()
+        #Nor must regenerating them from the previous MAF and manifest, with or without a reference
+        mAF = open(mAFFile).read()
+        for referenceEventString in [ None, "noSuchEvent" ]:
+            manifestFile = os.path.join(outputDir, "cactus.maf.manifest")
+            runCactusMAFGenerator(mAFFile, cactusDiskDatabaseString, referenceEventString=referenceEventString, manifestFile=manifestFile)
+            if referenceEventString == None:
+                assert open(mAFFile).read() == mAF
+            incrementalMAFFile = os.path.join(outputDir, "cactusIncremental.maf")
+            incrementalManifestFile = os.path.join(outputDir, "cactusIncremental.maf.manifest")
+            runCactusMAFGenerator(incrementalMAFFile, cactusDiskDatabaseString, referenceEventString=referenceEventString, manifestFile=incrementalManifestFile,
+                                  previousMafFile=mAFFile, previousManifestFile=manifestFile)
+            assert open(mAFFile).read() == open(incrementalMAFFile).read()
+            assert open(manifestFile).read() == open(incrementalManifestFile).read()
+            #With or without the cap level cache, or with one evicting at every cap
+            for capLevelCacheSize in [ 0, 1 ]:
+                runCactusMAFGenerator(incrementalMAFFile, cactusDiskDatabaseString, referenceEventString=referenceEventString, manifestFile=incrementalManifestFile,
+                                      capLevelCacheSize=capLevelCacheSize)
+                assert open(mAFFile).read() == open(incrementalMAFFile).read()
+                assert open(manifestFile).read() == open(incrementalManifestFile).read()
+            #A unit whose hash is changed in the previous manifest is rendered again, not copied from the (here scribbled over) previous MAF
+            manifestLines = open(manifestFile).readlines()
+            editedLines = [ i for i in xrange(1, len(manifestLines)) if int(manifestLines[i].split("\t")[3]) > 0 ]
+            if len(editedLines) > 0:
+                key, unitHash, start, length = manifestLines[editedLines[0]].split("\t")
+                start, length = int(start), int(length)
+                manifestLines[editedLines[0]] = "%s\t%x\t%i\t%i\n" % (key, int(unitHash, 16) ^ 1, start, length)
+                editedManifestFile = os.path.join(outputDir, "cactusEdited.maf.manifest")
+                open(editedManifestFile, "w").write("".join(manifestLines))
+                staleMAF = open(mAFFile).read()
+                staleMAFFile = os.path.join(outputDir, "cactusStale.maf")
+                open(staleMAFFile, "w").write(staleMAF[:start] + "#" * length + staleMAF[start + length:])
+                runCactusMAFGenerator(incrementalMAFFile, cactusDiskDatabaseString, referenceEventString=referenceEventString, manifestFile=incrementalManifestFile,
+                                      previousMafFile=staleMAFFile, previousManifestFile=editedManifestFile)
+                assert open(mAFFile).read() == open(incrementalMAFFile).read()
+                assert open(manifestFile).read() == open(incrementalManifestFile).read()
+        runCactusMAFGenerator(mAFFile, cactusDiskDatabaseString)
+        #The binary MAF must convert back to the MAF, with or without a reference and substitutions only
+        for referenceEventString, showOnlySubstitutions in [ (None, None), (None, True), ("noSuchEvent", None) ]:
+            textMAFFile = os.path.join(outputDir, "cactusText.maf")
+            runCactusMAFGenerator(textMAFFile, cactusDiskDatabaseString, referenceEventString=referenceEventString,
+                                  showOnlySubstitutionsWithRespectToTheReference=showOnlySubstitutions)
+            binaryMAFFile = os.path.join(outputDir, "cactus.maf.bin")
+            runCactusMAFGenerator(binaryMAFFile, cactusDiskDatabaseString, referenceEventString=referenceEventString,
+                                  showOnlySubstitutionsWithRespectToTheReference=showOnlySubstitutions, workerNumber=3, format="binary")
+            convertedMAFFile = os.path.join(outputDir, "cactusBinary.maf")
+            runCactusBinaryMAFToMAF(binaryMAFFile, convertedMAFFile)
+            assert open(textMAFFile).read() == open(convertedMAFFile).read()
+        #The MAFs of a snapshot must match those of the database, with or without reference ordering and substitutions only, and with workers
+        snapshotFile = os.path.join(outputDir, "cactus.snapshot")
+        runCactusSnapshotExport(snapshotFile, cactusDiskDatabaseString)
+        unorderedMAFFile = os.path.join(outputDir, "cactusUnordered.maf")
+        runCactusMAFGenerator(unorderedMAFFile, cactusDiskDatabaseString, referenceEventString="noSuchEvent")
+        parallelUnorderedMAFFile = os.path.join(outputDir, "cactusUnorderedParallel.maf")
+        runCactusMAFGenerator(parallelUnorderedMAFFile, cactusDiskDatabaseString, referenceEventString="noSuchEvent", workerNumber=3)
+        assert open(unorderedMAFFile).read() == open(parallelUnorderedMAFFile).read()
+        for referenceEventString, showOnlySubstitutions in [ (None, None), (None, True), ("noSuchEvent", None) ]:
+            databaseMAFFile = os.path.join(outputDir, "cactusDatabase.maf")
+            runCactusMAFGenerator(databaseMAFFile, cactusDiskDatabaseString, referenceEventString=referenceEventString,
+                                  showOnlySubstitutionsWithRespectToTheReference=showOnlySubstitutions)
+            for workerNumber in [ None, 3 ]:
+                snapshotMAFFile = os.path.join(outputDir, "cactusSnapshot.maf")
+                runCactusMAFGenerator(snapshotMAFFile, cactusDiskDatabaseString, referenceEventString=referenceEventString,
+                                      showOnlySubstitutionsWithRespectToTheReference=showOnlySubstitutions, workerNumber=workerNumber,
+                                      snapshotFile=snapshotFile)
+                assert open(databaseMAFFile).read() == open(snapshotMAFFile).read()
+        #Nor must the BEDs of each leaf event
+        for event in re.findall("[(,]([^(),:;]+)", newickTreeString):
+            databaseBEDFile = os.path.join(outputDir, "cactusDatabase.bed")
+            runCactusBedGenerator(databaseBEDFile, cactusDiskDatabaseString, event)
+            snapshotBEDFile = os.path.join(outputDir, "cactusSnapshot.bed")
+            runCactusBedGenerator(snapshotBEDFile, cactusDiskDatabaseString, event, snapshotFile=snapshotFile)
+            assert open(databaseBEDFile).read() == open(snapshotBEDFile).read()
+        #Nor must the augmented MAFs, taking a species from the first header of each sequence file
+        species = [ header.split()[0] for header, sequence in [ fastaRead(open(sequenceFile)).next() for sequenceFile in sequences if os.path.isfile(sequenceFile) ] ]
+        if len(species) > 0:
+            augmentedMAFFile = os.path.join(outputDir, "cactusAugmented.maf")
+            runCactusAugmentedMaf(augmentedMAFFile, cactusDiskDatabaseString, species)
+            parallelAugmentedMAFFile = os.path.join(outputDir, "cactusAugmentedParallel.maf")
+            runCactusAugmentedMaf(parallelAugmentedMAFFile, cactusDiskDatabaseString, species, workerNumber=3)
+            assert open(augmentedMAFFile).read() == open(parallelAugmentedMAFFile).read()
+        #Nor the PSLs between the first two species, where the PSL generator is built
+        if len(species) > 1 and find_executable("cactus_pslGenerator") != None:
+            databasePSLFile = os.path.join(outputDir, "cactusDatabase.psl")
+            runCactusPslGenerator(databasePSLFile, cactusDiskDatabaseString, species[0], species[1], tangle=True)
+            snapshotPSLFile = os.path.join(outputDir, "cactusSnapshot.psl")
+            runCactusPslGenerator(snapshotPSLFile, cactusDiskDatabaseString, species[0], species[1], tangle=True, snapshotFile=snapshotFile)
+            assert open(databasePSLFile).read() == open(snapshotPSLFile).read()
         logger.info("Ran the MAF building script")
     else:
         logger.info("Not building the MAFs")
@@ -0,0 +1,687 @@
+/*
+ * cactusSnapshot.c
+ *
+ *  Created on: 17 Oct 2026
+ */
+
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#define _GNU_SOURCE //For mmap under -std=c99
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cactus.h"
+#include "sonLib.h"
+#include "cactusUtils.h"
+#include "cactusSnapshot.h"
+
+static const char snapshotMagic[8] = { 'C', 'A', 'C', 'T', 'S', 'N', 'A', 'P' };
+
+static const int64_t snapshotRecordSizes[SNAPSHOT_SECTION_NUMBER] = {
+        sizeof(SnapshotFlower), sizeof(SnapshotGroup), sizeof(SnapshotEnd), sizeof(SnapshotCap),
+        sizeof(SnapshotBlock), sizeof(SnapshotSegment), sizeof(SnapshotSequence),
+        sizeof(SnapshotRun), sizeof(SnapshotRun), sizeof(SnapshotEvent), sizeof(SnapshotChain), sizeof(int64_t),
+        sizeof(SnapshotFace), sizeof(char), sizeof(uint8_t) };
+
+////////////////////////////////////
+////////////////////////////////////
+//Writing a snapshot
+////////////////////////////////////
+////////////////////////////////////
+
+typedef struct _snapshotBuffer {
+    char *data;
+    int64_t length;
+    int64_t maxLength;
+} SnapshotBuffer;
+
+typedef struct _snapshotWriter {
+    SnapshotBuffer sections[SNAPSHOT_SECTION_NUMBER];
+    stHash *objectsToIndices; //The positive orientations of the groups, ends, caps and blocks to their indices
+    stHash *sequenceNamesToIndices;
+    int64_t baseNumber;
+} SnapshotWriter;
+
+//The record of the given type at the given index of a section being written. Only valid until the section is next appended to.
+#define snapshotWriter_get(writer, section, type, index) (((type *) (writer)->sections[section].data) + (index))
+
+static int64_t snapshotWriter_getLength(SnapshotWriter *writer, SnapshotSection section) {
+    return writer->sections[section].length / snapshotRecordSizes[section];
+}
+
+static int64_t snapshotWriter_append(SnapshotWriter *writer, SnapshotSection section, const void *record) {
+    /*
+     * Appends a record to the section, returning its index.
+     */
+    SnapshotBuffer *buffer = &(writer->sections[section]);
+    int64_t size = snapshotRecordSizes[section];
+    if (buffer->length + size > buffer->maxLength) {
+        buffer->maxLength = 2 * buffer->maxLength + size;
+        buffer->data = realloc(buffer->data, buffer->maxLength);
+        if (buffer->data == NULL) {
+            st_errAbort("Ran out of memory writing a snapshot\n");
+        }
+    }
+    memcpy(buffer->data + buffer->length, record, size);
+    buffer->length += size;
+    return buffer->length / size - 1;
+}
+
+static void snapshotWriter_setIndex(SnapshotWriter *writer, void *object, int64_t index) {
+    stHash_insert(writer->objectsToIndices, object, stIntTuple_construct1(index));
+}
+
+static int64_t snapshotWriter_getIndex(SnapshotWriter *writer, void *object) {
+    if (object == NULL) {
+        return -1;
+    }
+    stIntTuple *index = stHash_search(writer->objectsToIndices, object);
+    assert(index != NULL);
+    return stIntTuple_get(index, 0);
+}
+
+static int64_t snapshotWriter_addString(SnapshotWriter *writer, const char *string) {
+    int64_t offset = writer->sections[SNAPSHOT_STRINGS].length;
+    for (const char *cA = string; 1; cA++) {
+        snapshotWriter_append(writer, SNAPSHOT_STRINGS, cA);
+        if (*cA == '\0') {
+            return offset;
+        }
+    }
+}
+
+static void snapshotWriter_addBase(SnapshotWriter *writer, uint8_t code) {
+    if (writer->baseNumber % 4 == 0) {
+        uint8_t byte = 0;
+        snapshotWriter_append(writer, SNAPSHOT_BASES, &byte);
+    }
+    *snapshotWriter_get(writer, SNAPSHOT_BASES, uint8_t, writer->baseNumber / 4) |= code << (2 * (writer->baseNumber % 4));
+    writer->baseNumber++;
+}
+
+static void snapshotWriter_addRun(SnapshotWriter *writer, SnapshotSection section, int64_t start, int64_t length,
+        int64_t character) {
+    SnapshotRun run = { start, length, character };
+    snapshotWriter_append(writer, section, &run);
+}
+
+static int64_t snapshotWriter_addSequence(SnapshotWriter *writer, Sequence *sequence) {
+    /*
+     * Gets the index of the sequence, adding the sequence and its bases if not seen in another flower.
+     */
+    if (sequence == NULL) {
+        return -1;
+    }
+    stIntTuple *sequenceName = stIntTuple_construct1(sequence_getName(sequence));
+    stIntTuple *index = stHash_search(writer->sequenceNamesToIndices, sequenceName);
+    if (index != NULL) {
+        stIntTuple_destruct(sequenceName);
+        return stIntTuple_get(index, 0);
+    }
+    SnapshotSequence record;
+    record.name = sequence_getName(sequence);
+    record.event = event_getName(sequence_getEvent(sequence));
+    record.header = snapshotWriter_addString(writer, getInternedSequenceHeader(sequence));
+    record.start = sequence_getStart(sequence);
+    record.length = sequence_getLength(sequence);
+    record.firstBase = writer->baseNumber;
+    record.firstMaskRun = snapshotWriter_getLength(writer, SNAPSHOT_MASK_RUNS);
+    record.firstExceptionRun = snapshotWriter_getLength(writer, SNAPSHOT_EXCEPTION_RUNS);
+    char *string = sequence_getString(sequence, record.start, record.length, 1);
+    int64_t maskStart = -1, exceptionStart = -1;
+    for (int64_t i = 0; i <= record.length; i++) {
+        char c = i < record.length ? string[i] : '\0';
+        char upperC = toupper(c);
+        if (maskStart != -1 && !islower(c)) {
+            snapshotWriter_addRun(writer, SNAPSHOT_MASK_RUNS, maskStart, i - maskStart, 0);
+            maskStart = -1;
+        }
+        if (exceptionStart != -1 && upperC != toupper(string[exceptionStart])) {
+            snapshotWriter_addRun(writer, SNAPSHOT_EXCEPTION_RUNS, exceptionStart, i - exceptionStart,
+                    toupper(string[exceptionStart]));
+            exceptionStart = -1;
+        }
+        if (i == record.length) {
+            break;
+        }
+        if (maskStart == -1 && islower(c)) {
+            maskStart = i;
+        }
+        switch (upperC) {
+            case 'A':
+                snapshotWriter_addBase(writer, 0);
+                break;
+            case 'C':
+                snapshotWriter_addBase(writer, 1);
+                break;
+            case 'G':
+                snapshotWriter_addBase(writer, 2);
+                break;
+            case 'T':
+                snapshotWriter_addBase(writer, 3);
+                break;
+            default:
+                snapshotWriter_addBase(writer, 0);
+                if (exceptionStart == -1) {
+                    exceptionStart = i;
+                }
+        }
+    }
+    free(string);
+    record.maskRunNumber = snapshotWriter_getLength(writer, SNAPSHOT_MASK_RUNS) - record.firstMaskRun;
+    record.exceptionRunNumber = snapshotWriter_getLength(writer, SNAPSHOT_EXCEPTION_RUNS) - record.firstExceptionRun;
+    int64_t i = snapshotWriter_append(writer, SNAPSHOT_SEQUENCES, &record);
+    stHash_insert(writer->sequenceNamesToIndices, sequenceName, stIntTuple_construct1(i));
+    return i;
+}
+
+static int64_t snapshotWriter_addSegment(SnapshotWriter *writer, Segment *segment, int64_t block) {
+    /*
+     * Adds the segment after its children, in post-order, returning its index.
+     */
+    int64_t childNumber = segment_getChildNumber(segment);
+    int64_t *children = st_malloc(sizeof(int64_t) * (childNumber + 1));
+    for (int64_t i = 0; i < childNumber; i++) {
+        children[i] = snapshotWriter_addSegment(writer, segment_getChild(segment, i), block);
+    }
+    SnapshotSegment record;
+    record.name = segment_getName(segment);
+    record.block = block;
+    record.parent = -1;
+    record.sequence = snapshotWriter_addSequence(writer, segment_getSequence(segment));
+    record.start = segment_getStart(segment);
+    record.strand = segment_getStrand(segment);
+    record.cap5 = snapshotWriter_getIndex(writer, cap_getPositiveOrientation(segment_get5Cap(segment)));
+    record.cap3 = snapshotWriter_getIndex(writer, cap_getPositiveOrientation(segment_get3Cap(segment)));
+    int64_t i = snapshotWriter_append(writer, SNAPSHOT_SEGMENTS, &record);
+    snapshotWriter_get(writer, SNAPSHOT_CAPS, SnapshotCap, record.cap5)->segment = i;
+    snapshotWriter_get(writer, SNAPSHOT_CAPS, SnapshotCap, record.cap3)->segment = i;
+    for (int64_t j = 0; j < childNumber; j++) {
+        snapshotWriter_get(writer, SNAPSHOT_SEGMENTS, SnapshotSegment, children[j])->parent = i;
+    }
+    free(children);
+    return i;
+}
+
+static int64_t getNumberOnPositiveStrand(Block *block) {
+    Block_InstanceIterator *it = block_getInstanceIterator(block);
+    Segment *segment;
+    int64_t i = 0;
+    while ((segment = block_getNext(it)) != NULL) {
+        if (segment_getChildNumber(segment) == 0 && segment_getStrand(segment)) {
+            i++;
+        }
+    }
+    block_destructInstanceIterator(it);
+    return i;
+}
+
+static void snapshotWriter_addSegments(SnapshotWriter *writer, Block *block) {
+    /*
+     * Adds the segments of the block, oriented and ordered as getMAFBlock lists them.
+     */
+    int64_t blockIndex = snapshotWriter_getIndex(writer, block_getPositiveOrientation(block));
+    if (getNumberOnPositiveStrand(block) == 0) {
+        block = block_getReverse(block);
+    }
+    int64_t newickString = -1;
+    int64_t firstSegment = snapshotWriter_getLength(writer, SNAPSHOT_SEGMENTS);
+    if (block_getRootInstance(block) != NULL) {
+        char *cA = block_makeNewickString(block, 1, 0);
+        newickString = snapshotWriter_addString(writer, cA);
+        free(cA);
+        snapshotWriter_addSegment(writer, block_getRootInstance(block), blockIndex);
+    } else {
+        Block_InstanceIterator *it = block_getInstanceIterator(block);
+        Segment *segment;
+        while ((segment = block_getNext(it)) != NULL) {
+            snapshotWriter_addSegment(writer, segment, blockIndex);
+        }
+        block_destructInstanceIterator(it);
+    }
+    SnapshotBlock *record = snapshotWriter_get(writer, SNAPSHOT_BLOCKS, SnapshotBlock, blockIndex);
+    record->orientation = block_getOrientation(block);
+    record->newickString = newickString;
+    record->firstSegment = firstSegment;
+    record->segmentNumber = snapshotWriter_getLength(writer, SNAPSHOT_SEGMENTS) - firstSegment;
+}
+
+static int64_t snapshotWriter_addFlower(SnapshotWriter *writer, Flower *flower, int64_t parentGroup) {
+    /*
+     * Adds the flower then its descendants, in pre-order, returning the flower's index.
+     */
+    SnapshotFlower flowerRecord;
+    flowerRecord.name = flower_getName(flower);
+    flowerRecord.parentGroup = parentGroup;
+    flowerRecord.isTerminal = flower_isTerminal(flower);
+    flowerRecord.totalBaseLength = flower_getTotalBaseLength(flower);
+    flowerRecord.freeStubEndNumber = flower_getFreeStubEndNumber(flower);
+    //The flower the caps of the same names are in, only if it is in the snapshot
+    Flower *parentFlower = parentGroup != -1 ? group_getFlower(flower_getParentGroup(flower)) : NULL;
+    int64_t flowerIndex = snapshotWriter_append(writer, SNAPSHOT_FLOWERS, &flowerRecord);
+
+    //Groups
+    flowerRecord.firstGroup = snapshotWriter_getLength(writer, SNAPSHOT_GROUPS);
+    Flower_GroupIterator *groupIt = flower_getGroupIterator(flower);
+    Group *group;
+    while ((group = flower_getNextGroup(groupIt)) != NULL) {
+        SnapshotGroup record = { group_getName(group), flowerIndex, -1, group_getLink(group) != NULL,
+                group_isTangle(group), group_getTotalBaseLength(group) };
+        snapshotWriter_setIndex(writer, group, snapshotWriter_append(writer, SNAPSHOT_GROUPS, &record));
+    }
+    flower_destructGroupIterator(groupIt);
+    flowerRecord.groupNumber = snapshotWriter_getLength(writer, SNAPSHOT_GROUPS) - flowerRecord.firstGroup;
+
+    //Blocks, their segments are added once the caps are
+    flowerRecord.firstBlock = snapshotWriter_getLength(writer, SNAPSHOT_BLOCKS);
+    Flower_BlockIterator *blockIt = flower_getBlockIterator(flower);
+    Block *block;
+    while ((block = flower_getNextBlock(blockIt)) != NULL) {
+        SnapshotBlock record = { block_getName(block), flowerIndex, block_getLength(block), 1, -1, 0, 0 };
+        snapshotWriter_setIndex(writer, block_getPositiveOrientation(block),
+                snapshotWriter_append(writer, SNAPSHOT_BLOCKS, &record));
+    }
+    flower_destructBlockIterator(blockIt);
+    flowerRecord.blockNumber = snapshotWriter_getLength(writer, SNAPSHOT_BLOCKS) - flowerRecord.firstBlock;
+
+    //Ends and their caps
+    flowerRecord.firstEnd = snapshotWriter_getLength(writer, SNAPSHOT_ENDS);
+    flowerRecord.firstCap = snapshotWriter_getLength(writer, SNAPSHOT_CAPS);
+    stList *caps = stList_construct();
+    Flower_EndIterator *endIt = flower_getEndIterator(flower);
+    End *end;
+    while ((end = flower_getNextEnd(endIt)) != NULL) {
+        end = end_getPositiveOrientation(end);
+        SnapshotEnd record;
+        record.name = end_getName(end);
+        record.flower = flowerIndex;
+        record.group = snapshotWriter_getIndex(writer, end_getGroup(end));
+        record.block = end_isBlockEnd(end) ? snapshotWriter_getIndex(writer,
+                block_getPositiveOrientation(end_getBlock(end))) : -1;
+        record.side = end_getSide(end);
+        record.isStubEnd = end_isStubEnd(end);
+        record.isAttached = end_isAttached(end);
+        record.firstCap = snapshotWriter_getLength(writer, SNAPSHOT_CAPS);
+        End_InstanceIterator *capIt = end_getInstanceIterator(end);
+        Cap *cap;
+        while ((cap = end_getNext(capIt)) != NULL) {
+            cap = cap_getPositiveOrientation(cap);
+            SnapshotCap capRecord;
+            capRecord.name = cap_getName(cap);
+            capRecord.end = snapshotWriter_getLength(writer, SNAPSHOT_ENDS);
+            capRecord.event = event_getName(cap_getEvent(cap));
+            capRecord.sequence = snapshotWriter_addSequence(writer, cap_getSequence(cap));
+            capRecord.coordinate = cap_getCoordinate(cap);
+            capRecord.strand = cap_getStrand(cap);
+            capRecord.side = cap_getSide(cap);
+            capRecord.adjacency = -1;
+            capRecord.segment = -1;
+            Cap *parentCap = parentFlower != NULL ? flower_getCap(parentFlower, cap_getName(cap)) : NULL;
+            capRecord.parentCap = parentCap != NULL ? snapshotWriter_getIndex(writer, cap_getPositiveOrientation(parentCap)) : -1;
+            capRecord.nestedCap = -1;
+            int64_t capIndex = snapshotWriter_append(writer, SNAPSHOT_CAPS, &capRecord);
+            if (capRecord.parentCap != -1) {
+                snapshotWriter_get(writer, SNAPSHOT_CAPS, SnapshotCap, capRecord.parentCap)->nestedCap = capIndex;
+            }
+            snapshotWriter_setIndex(writer, cap, capIndex);
+            stList_append(caps, cap);
+        }
+        end_destructInstanceIterator(capIt);
+        record.capNumber = snapshotWriter_getLength(writer, SNAPSHOT_CAPS) - record.firstCap;
+        snapshotWriter_setIndex(writer, end, snapshotWriter_append(writer, SNAPSHOT_ENDS, &record));
+    }
+    flower_destructEndIterator(endIt);
+    flowerRecord.endNumber = snapshotWriter_getLength(writer, SNAPSHOT_ENDS) - flowerRecord.firstEnd;
+    flowerRecord.capNumber = snapshotWriter_getLength(writer, SNAPSHOT_CAPS) - flowerRecord.firstCap;
+
+    //Adjacencies, now every cap of the flower has an index
+    for (int64_t i = 0; i < stList_length(caps); i++) {
+        Cap *cap = stList_get(caps, i);
+        Cap *adjacentCap = cap_getAdjacency(cap);
+        snapshotWriter_get(writer, SNAPSHOT_CAPS, SnapshotCap, flowerRecord.firstCap + i)->adjacency =
+                adjacentCap == NULL ? -1 : snapshotWriter_getIndex(writer, cap_getPositiveOrientation(adjacentCap));
+    }
+    stList_destruct(caps);
+
+    blockIt = flower_getBlockIterator(flower);
+    while ((block = flower_getNextBlock(blockIt)) != NULL) {
+        snapshotWriter_addSegments(writer, block);
+    }
+    flower_destructBlockIterator(blockIt);
+
+    //Chains, their blocks are all in the flower so already have indices
+    flowerRecord.firstChain = snapshotWriter_getLength(writer, SNAPSHOT_CHAINS);
+    Flower_ChainIterator *chainIt = flower_getChainIterator(flower);
+    Chain *chain;
+    while ((chain = flower_getNextChain(chainIt)) != NULL) {
+        SnapshotChain record;
+        record.name = chain_getName(chain);
+        record.flower = flowerIndex;
+        record.firstBlock = snapshotWriter_getLength(writer, SNAPSHOT_CHAIN_BLOCKS);
+        Block **blocks = chain_getBlockChain(chain, &record.blockNumber);
+        for (int64_t i = 0; i < record.blockNumber; i++) {
+            int64_t blockIndex = snapshotWriter_getIndex(writer, block_getPositiveOrientation(blocks[i]));
+            snapshotWriter_append(writer, SNAPSHOT_CHAIN_BLOCKS, &blockIndex);
+        }
+        free(blocks);
+        record.linkNumber = chain_getLength(chain);
+        record.averageInstanceBaseLength = chain_getAverageInstanceBaseLength(chain);
+        snapshotWriter_append(writer, SNAPSHOT_CHAINS, &record);
+    }
+    flower_destructChainIterator(chainIt);
+    flowerRecord.chainNumber = snapshotWriter_getLength(writer, SNAPSHOT_CHAINS) - flowerRecord.firstChain;
+
+    //Faces
+    flowerRecord.firstFace = snapshotWriter_getLength(writer, SNAPSHOT_FACES);
+    Flower_FaceIterator *faceIt = flower_getFaceIterator(flower);
+    Face *face;
+    while ((face = flower_getNextFace(faceIt)) != NULL) {
+        SnapshotFace record = { flowerIndex, face_getCardinal(face), face_isSimple(face), face_isRegular(face),
+                face_isCanonical(face) };
+        snapshotWriter_append(writer, SNAPSHOT_FACES, &record);
+    }
+    flower_destructFaceIterator(faceIt);
+    flowerRecord.faceNumber = snapshotWriter_getLength(writer, SNAPSHOT_FACES) - flowerRecord.firstFace;
+
+    *snapshotWriter_get(writer, SNAPSHOT_FLOWERS, SnapshotFlower, flowerIndex) = flowerRecord;
+
+    //The descendants
+    groupIt = flower_getGroupIterator(flower);
+    while ((group = flower_getNextGroup(groupIt)) != NULL) {
+        if (!group_isLeaf(group)) {
+            int64_t groupIndex = snapshotWriter_getIndex(writer, group);
+            int64_t nestedFlower = snapshotWriter_addFlower(writer, group_getNestedFlower(group), groupIndex);
+            snapshotWriter_get(writer, SNAPSHOT_GROUPS, SnapshotGroup, groupIndex)->nestedFlower = nestedFlower;
+        }
+    }
+    flower_destructGroupIterator(groupIt);
+
+    return flowerIndex;
+}
+
+static int64_t snapshot_align(int64_t offset) {
+    return (offset + 7) & ~((int64_t) 7);
+}
+
+void cactusSnapshot_write(Flower *flower, const char *fileName) {
+    prefetchFlowerSubtree(flower, PREFETCH_BATCH_SIZE);
+    SnapshotWriter writer;
+    memset(&writer, 0, sizeof(SnapshotWriter));
+    writer.objectsToIndices = stHash_construct2(NULL, (void (*)(void *)) stIntTuple_destruct);
+    writer.sequenceNamesToIndices = stHash_construct3(stIntTuple_hashKey, stIntTuple_equalsFn,
+            (void (*)(void *)) stIntTuple_destruct, (void (*)(void *)) stIntTuple_destruct);
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(SnapshotHeader));
+    memcpy(header.magic, snapshotMagic, sizeof(snapshotMagic));
+    header.version = CACTUS_SNAPSHOT_VERSION;
+    char *eventTreeString = eventTree_makeNewickString(flower_getEventTree(flower));
+    header.eventTreeString = snapshotWriter_addString(&writer, eventTreeString);
+    free(eventTreeString);
+    EventTree_Iterator *eventIt = eventTree_getIterator(flower_getEventTree(flower));
+    Event *event;
+    while ((event = eventTree_getNext(eventIt)) != NULL) {
+        SnapshotEvent record = { event_getName(event), snapshotWriter_addString(&writer, event_getHeader(event)) };
+        snapshotWriter_append(&writer, SNAPSHOT_EVENTS, &record);
+    }
+    eventTree_destructIterator(eventIt);
+    snapshotWriter_addFlower(&writer, flower, -1);
+
+    int64_t offset = snapshot_align(sizeof(SnapshotHeader));
+    for (int64_t i = 0; i < SNAPSHOT_SECTION_NUMBER; i++) {
+        header.sectionOffsets[i] = offset;
+        header.sectionLengths[i] = snapshotWriter_getLength(&writer, i);
+        offset = snapshot_align(offset + writer.sections[i].length);
+    }
+    FILE *fileHandle = fopen(fileName, "wb");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open the snapshot file %s for writing\n", fileName);
+    }
+    static const char padding[8] = { 0 };
+    fwrite(&header, sizeof(SnapshotHeader), 1, fileHandle);
+    fwrite(padding, 1, snapshot_align(sizeof(SnapshotHeader)) - sizeof(SnapshotHeader), fileHandle);
+    for (int64_t i = 0; i < SNAPSHOT_SECTION_NUMBER; i++) {
+        SnapshotBuffer *buffer = &(writer.sections[i]);
+        if (fwrite(buffer->data, 1, buffer->length, fileHandle) != buffer->length) {
+            st_errAbort("Could not write the snapshot file %s\n", fileName);
+        }
+        fwrite(padding, 1, snapshot_align(buffer->length) - buffer->length, fileHandle);
+        free(buffer->data);
+    }
+    fclose(fileHandle);
+    st_logInfo("Wrote a snapshot of %" PRIi64 " flowers, %" PRIi64 " blocks, %" PRIi64 " caps and %" PRIi64
+            " bases to %s\n", header.sectionLengths[SNAPSHOT_FLOWERS], header.sectionLengths[SNAPSHOT_BLOCKS],
+            header.sectionLengths[SNAPSHOT_CAPS], writer.baseNumber, fileName);
+
+    stHash_destruct(writer.objectsToIndices);
+    stHash_destruct(writer.sequenceNamesToIndices);
+}
+
+////////////////////////////////////
+////////////////////////////////////
+//Reading a snapshot
+////////////////////////////////////
+////////////////////////////////////
+
+CactusSnapshot *cactusSnapshot_open(const char *fileName) {
+    int fileDescriptor = open(fileName, O_RDONLY);
+    if (fileDescriptor == -1) {
+        st_errAbort("Could not open the snapshot file %s\n", fileName);
+    }
+    struct stat fileStat;
+    if (fstat(fileDescriptor, &fileStat) != 0 || fileStat.st_size < sizeof(SnapshotHeader)) {
+        st_errAbort("The snapshot file %s is truncated\n", fileName);
+    }
+    CactusSnapshot *snapshot = st_malloc(sizeof(CactusSnapshot));
+    snapshot->mapLength = fileStat.st_size;
+    snapshot->map = mmap(NULL, snapshot->mapLength, PROT_READ, MAP_SHARED, fileDescriptor, 0);
+    close(fileDescriptor);
+    if (snapshot->map == MAP_FAILED) {
+        st_errAbort("Could not map the snapshot file %s\n", fileName);
+    }
+    snapshot->header = snapshot->map;
+    if (memcmp(snapshot->header->magic, snapshotMagic, sizeof(snapshotMagic)) != 0) {
+        st_errAbort("The file %s is not a cactus snapshot\n", fileName);
+    }
+    if (snapshot->header->version != CACTUS_SNAPSHOT_VERSION) {
+        st_errAbort("The snapshot file %s is version %" PRIi64 ", expected version %" PRIi64 "\n", fileName,
+                snapshot->header->version, (int64_t) CACTUS_SNAPSHOT_VERSION);
+    }
+    void *sections[SNAPSHOT_SECTION_NUMBER];
+    for (int64_t i = 0; i < SNAPSHOT_SECTION_NUMBER; i++) {
+        int64_t offset = snapshot->header->sectionOffsets[i];
+        int64_t length = snapshot->header->sectionLengths[i];
+        if (offset < 0 || length < 0 || offset + length * snapshotRecordSizes[i] > snapshot->mapLength) {
+            st_errAbort("The snapshot file %s is truncated\n", fileName);
+        }
+        sections[i] = (char *) snapshot->map + offset;
+    }
+    snapshot->flowers = sections[SNAPSHOT_FLOWERS];
+    snapshot->groups = sections[SNAPSHOT_GROUPS];
+    snapshot->ends = sections[SNAPSHOT_ENDS];
+    snapshot->caps = sections[SNAPSHOT_CAPS];
+    snapshot->blocks = sections[SNAPSHOT_BLOCKS];
+    snapshot->segments = sections[SNAPSHOT_SEGMENTS];
+    snapshot->sequences = sections[SNAPSHOT_SEQUENCES];
+    snapshot->maskRuns = sections[SNAPSHOT_MASK_RUNS];
+    snapshot->exceptionRuns = sections[SNAPSHOT_EXCEPTION_RUNS];
+    snapshot->events = sections[SNAPSHOT_EVENTS];
+    snapshot->chains = sections[SNAPSHOT_CHAINS];
+    snapshot->chainBlocks = sections[SNAPSHOT_CHAIN_BLOCKS];
+    snapshot->faces = sections[SNAPSHOT_FACES];
+    snapshot->strings = sections[SNAPSHOT_STRINGS];
+    snapshot->bases = sections[SNAPSHOT_BASES];
+    return snapshot;
+}
+
+void cactusSnapshot_close(CactusSnapshot *snapshot) {
+    munmap(snapshot->map, snapshot->mapLength);
+    free(snapshot);
+}
+
+int64_t cactusSnapshot_getLength(CactusSnapshot *snapshot, SnapshotSection section) {
+    return snapshot->header->sectionLengths[section];
+}
+
+const char *cactusSnapshot_getString(CactusSnapshot *snapshot, int64_t offset) {
+    assert(offset >= 0 && offset < snapshot->header->sectionLengths[SNAPSHOT_STRINGS]);
+    return snapshot->strings + offset;
+}
+
+const char *cactusSnapshot_getEventTreeString(CactusSnapshot *snapshot) {
+    return cactusSnapshot_getString(snapshot, snapshot->header->eventTreeString);
+}
+
+Name cactusSnapshot_getEventByHeader(CactusSnapshot *snapshot, const char *header) {
+    for (int64_t i = 0; i < cactusSnapshot_getLength(snapshot, SNAPSHOT_EVENTS); i++) {
+        if (strcmp(cactusSnapshot_getString(snapshot, snapshot->events[i].header), header) == 0) {
+            return snapshot->events[i].name;
+        }
+    }
+    return NULL_NAME;
+}
+
+stList *cactusSnapshot_getThreadStarts(CactusSnapshot *snapshot, Name eventName) {
+    stList *startCaps = stList_construct3(0, (void(*)(void *)) stIntTuple_destruct);
+    SnapshotFlower *flowerRecord = &(snapshot->flowers[0]);
+    for (int64_t i = flowerRecord->firstEnd; i < flowerRecord->firstEnd + flowerRecord->endNumber; i++) {
+        SnapshotEnd *end = &(snapshot->ends[i]);
+        if (end->isStubEnd && end->isAttached) {
+            int64_t cap = end->firstCap; //The first cap of the event, as getCapForReferenceEvent
+            while (cap < end->firstCap + end->capNumber && snapshot->caps[cap].event != eventName) {
+                cap++;
+            }
+            if (cap == end->firstCap + end->capNumber) {
+                st_logDebug("Attached stub end %s has no reference cap, skipping it\n", cactusMisc_nameToStringStatic(end->name));
+                continue;
+            }
+            //The side of the cap's orientation on the positive strand
+            if ((snapshot->caps[cap].strand ? snapshot->caps[cap].side : !snapshot->caps[cap].side) == 0) {
+                stList_append(startCaps, stIntTuple_construct1(cap));
+            }
+        }
+    }
+    return startCaps;
+}
+
+typedef struct _snapshotNamedIndex {
+    Name name;
+    int64_t index;
+} SnapshotNamedIndex;
+
+static int snapshotNamedIndex_cmp(const void *o1, const void *o2) {
+    return cactusMisc_nameCompare(((SnapshotNamedIndex *) o1)->name, ((SnapshotNamedIndex *) o2)->name);
+}
+
+static stList *snapshotNamedIndices_sort(SnapshotNamedIndex *namedIndices, int64_t length) {
+    /*
+     * Sorts the indices by name, as the sorted sets of a flower, block or end iterate, and frees them.
+     */
+    qsort(namedIndices, length, sizeof(SnapshotNamedIndex), snapshotNamedIndex_cmp);
+    stList *indices = stList_construct3(0, (void(*)(void *)) stIntTuple_destruct);
+    for (int64_t i = 0; i < length; i++) {
+        stList_append(indices, stIntTuple_construct1(namedIndices[i].index));
+    }
+    free(namedIndices);
+    return indices;
+}
+
+stList *cactusSnapshot_getBlockInstances(CactusSnapshot *snapshot, int64_t block) {
+    SnapshotBlock *record = &(snapshot->blocks[block]);
+    SnapshotNamedIndex *segments = st_malloc(sizeof(SnapshotNamedIndex) * (record->segmentNumber + 1));
+    for (int64_t i = 0; i < record->segmentNumber; i++) {
+        segments[i].name = snapshot->segments[record->firstSegment + i].name;
+        segments[i].index = record->firstSegment + i;
+    }
+    return snapshotNamedIndices_sort(segments, record->segmentNumber);
+}
+
+stList *cactusSnapshot_getSequencesMatchingHeader(CactusSnapshot *snapshot, const char *pattern, bool prefixOnly) {
+    int64_t sequenceNumber = cactusSnapshot_getLength(snapshot, SNAPSHOT_SEQUENCES);
+    SnapshotNamedIndex *sequences = st_malloc(sizeof(SnapshotNamedIndex) * (sequenceNumber + 1));
+    int64_t j = 0;
+    for (int64_t i = 0; i < sequenceNumber; i++) {
+        const char *sequenceHeader = cactusSnapshot_getSequenceHeader(snapshot, i);
+        const char *match = strstr(sequenceHeader, pattern);
+        if (match != NULL && (!prefixOnly || match == sequenceHeader)) {
+            sequences[j].name = snapshot->sequences[i].name;
+            sequences[j++].index = i;
+        }
+    }
+    return snapshotNamedIndices_sort(sequences, j);
+}
+
+const char *cactusSnapshot_getSequenceHeader(CactusSnapshot *snapshot, int64_t sequence) {
+    return cactusSnapshot_getString(snapshot, snapshot->sequences[sequence].header);
+}
+
+static int64_t snapshotRun_getFirst(SnapshotRun *runs, int64_t runNumber, int64_t position) {
+    /*
+     * Binary search for the first of the sorted runs that ends after the position.
+     */
+    int64_t low = 0, high = runNumber;
+    while (low < high) {
+        int64_t middle = (low + high) / 2;
+        if (runs[middle].start + runs[middle].length <= position) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+char *cactusSnapshot_getSequenceString(CactusSnapshot *snapshot, int64_t sequence,
+        int64_t start, int64_t length, int64_t strand) {
+    SnapshotSequence *record = &(snapshot->sequences[sequence]);
+    int64_t offset = start - record->start;
+    assert(offset >= 0 && length >= 0 && offset + length <= record->length);
+    char *string = st_malloc(sizeof(char) * (length + 1));
+    for (int64_t i = 0; i < length; i++) {
+        int64_t j = record->firstBase + offset + i;
+        string[i] = "ACGT"[(snapshot->bases[j / 4] >> (2 * (j % 4))) & 3];
+    }
+    SnapshotRun *runs = snapshot->exceptionRuns + record->firstExceptionRun;
+    for (int64_t i = snapshotRun_getFirst(runs, record->exceptionRunNumber, offset);
+            i < record->exceptionRunNumber && runs[i].start < offset + length; i++) {
+        for (int64_t j = runs[i].start > offset ? runs[i].start : offset;
+                j < runs[i].start + runs[i].length && j < offset + length; j++) {
+            string[j - offset] = runs[i].character;
+        }
+    }
+    runs = snapshot->maskRuns + record->firstMaskRun;
+    for (int64_t i = snapshotRun_getFirst(runs, record->maskRunNumber, offset);
+            i < record->maskRunNumber && runs[i].start < offset + length; i++) {
+        for (int64_t j = runs[i].start > offset ? runs[i].start : offset;
+                j < runs[i].start + runs[i].length && j < offset + length; j++) {
+            string[j - offset] = tolower(string[j - offset]);
+        }
+    }
+    string[length] = '\0';
+    if (!strand) {
+        char *reverseComplement = cactusMisc_reverseComplementString(string);
+        free(string);
+        return reverseComplement;
+    }
+    return string;
+}
+
+char *cactusSnapshot_getSegmentString(CactusSnapshot *snapshot, int64_t segment) {
+    SnapshotSegment *record = &(snapshot->segments[segment]);
+    if (record->sequence == -1) {
+        return NULL;
+    }
+    int64_t length = snapshot->blocks[record->block].length;
+    //Segment starts on the negative strand are the highest coordinate of the segment
+    int64_t start = record->strand ? record->start : record->start - length + 1;
+    return cactusSnapshot_getSequenceString(snapshot, record->sequence, start, length, record->strand);
+}
@@ -0,0 +1,262 @@
+/*
+ * cactusSnapshot.h
+ *
+ *  Created on: 17 Oct 2026
+ */
+
+#ifndef CACTUS_SNAPSHOT_H_
+#define CACTUS_SNAPSHOT_H_
+
+/*
+ * A snapshot is a single binary file holding a flower subtree as flat arrays of fixed size
+ * records, which refer to one another by index rather than by pointer, followed by a string
+ * section and the sequences packed at two bits per base. It is written once from the cactus
+ * disk and then mapped read only, so repeat analyses of a frozen alignment start immediately
+ * and need no database. Besides the blocks, it holds the chains, faces and levels of caps the
+ * tree stats walk. All indices are into the arrays of the same snapshot, -1 meaning none.
+ */
+
+#define CACTUS_SNAPSHOT_VERSION 2
+
+typedef enum {
+    SNAPSHOT_FLOWERS = 0,
+    SNAPSHOT_GROUPS,
+    SNAPSHOT_ENDS,
+    SNAPSHOT_CAPS,
+    SNAPSHOT_BLOCKS,
+    SNAPSHOT_SEGMENTS,
+    SNAPSHOT_SEQUENCES,
+    SNAPSHOT_MASK_RUNS,
+    SNAPSHOT_EXCEPTION_RUNS,
+    SNAPSHOT_EVENTS,
+    SNAPSHOT_CHAINS,
+    SNAPSHOT_CHAIN_BLOCKS,
+    SNAPSHOT_FACES,
+    SNAPSHOT_STRINGS,
+    SNAPSHOT_BASES,
+    SNAPSHOT_SECTION_NUMBER
+} SnapshotSection;
+
+typedef struct _snapshotHeader {
+    char magic[8];
+    int64_t version;
+    int64_t eventTreeString; //Offset of the newick string of the event tree in the strings
+    int64_t sectionOffsets[SNAPSHOT_SECTION_NUMBER]; //In bytes from the start of the file
+    int64_t sectionLengths[SNAPSHOT_SECTION_NUMBER]; //In records, or in bytes for the strings and bases
+} SnapshotHeader;
+
+/*
+ * The flowers are in pre-order, so each flower's blocks come before those of its descendants,
+ * as in getMAFs. The groups, ends, caps, blocks, chains and faces of a flower are each
+ * contiguous, and in the order of the flower's iterators.
+ */
+typedef struct _snapshotFlower {
+    Name name;
+    int64_t parentGroup;
+    int64_t isTerminal;
+    int64_t totalBaseLength;
+    int64_t freeStubEndNumber;
+    int64_t firstGroup, groupNumber;
+    int64_t firstEnd, endNumber;
+    int64_t firstCap, capNumber;
+    int64_t firstBlock, blockNumber;
+    int64_t firstChain, chainNumber;
+    int64_t firstFace, faceNumber;
+} SnapshotFlower;
+
+typedef struct _snapshotGroup {
+    Name name;
+    int64_t flower;
+    int64_t nestedFlower; //-1 if the group is a leaf
+    int64_t isLink, isTangle;
+    int64_t totalBaseLength;
+} SnapshotGroup;
+
+/*
+ * Ends and caps are stored in positive orientation. The caps of an end are contiguous.
+ */
+typedef struct _snapshotEnd {
+    Name name;
+    int64_t flower;
+    int64_t group;
+    int64_t block; //-1 for stub ends
+    int64_t side;
+    int64_t isStubEnd, isAttached;
+    int64_t firstCap, capNumber;
+} SnapshotEnd;
+
+typedef struct _snapshotCap {
+    Name name;
+    int64_t end;
+    Name event;
+    int64_t sequence; //-1 if the cap has no sequence
+    int64_t coordinate;
+    int64_t strand, side;
+    int64_t adjacency;
+    int64_t segment; //-1 for the caps of stub ends
+    int64_t parentCap; //The cap of the same name in the parent flower, -1 in the top level flower
+    int64_t nestedCap; //The cap of the same name in the nested flower of the end's group, -1 if the group is a leaf
+} SnapshotCap;
+
+/*
+ * A block is stored in the orientation in which at least one of its leaf segments is on the
+ * positive strand, if any is, and its segments in the order a MAF lists them: a post-order
+ * of the segment tree if the block has one, otherwise the order of the block's instances.
+ */
+typedef struct _snapshotBlock {
+    Name name;
+    int64_t flower;
+    int64_t length;
+    int64_t orientation; //Of the stored orientation, relative to the block's positive orientation
+    int64_t newickString; //Offset of the newick string of the segment tree in the strings, or -1
+    int64_t firstSegment, segmentNumber;
+} SnapshotBlock;
+
+typedef struct _snapshotSegment {
+    Name name;
+    int64_t block;
+    int64_t parent;
+    int64_t sequence; //-1 for ancestral segments without sequence
+    int64_t start; //As segment_getStart
+    int64_t strand;
+    int64_t cap5, cap3; //The positive orientations of the segment's 5 and 3 prime caps
+} SnapshotSegment;
+
+/*
+ * Bases are packed A, C, G, T = 0, 1, 2, 3. Runs of any other character are recorded as
+ * exception runs, soft masked bases as mask runs, both sorted by start relative to the start of
+ * the sequence.
+ */
+typedef struct _snapshotSequence {
+    Name name;
+    Name event;
+    int64_t header; //Offset of the header in the strings
+    int64_t start, length;
+    int64_t firstBase; //Index of the first base in the packed bases
+    int64_t firstMaskRun, maskRunNumber;
+    int64_t firstExceptionRun, exceptionRunNumber;
+} SnapshotSequence;
+
+typedef struct _snapshotRun {
+    int64_t start, length;
+    int64_t character; //Upper case, the exception runs only
+} SnapshotRun;
+
+/*
+ * The events of the event tree of the top level flower, in the event tree's order.
+ */
+typedef struct _snapshotEvent {
+    Name name;
+    int64_t header; //Offset of the header in the strings
+} SnapshotEvent;
+
+/*
+ * The blocks of a chain are contiguous in the chain blocks, which are indices of blocks, in
+ * the order of chain_getBlockChain.
+ */
+typedef struct _snapshotChain {
+    Name name;
+    int64_t flower;
+    int64_t firstBlock, blockNumber;
+    int64_t linkNumber;
+    double averageInstanceBaseLength;
+} SnapshotChain;
+
+typedef struct _snapshotFace {
+    int64_t flower;
+    int64_t cardinal;
+    int64_t isSimple, isRegular, isCanonical;
+} SnapshotFace;
+
+typedef struct _cactusSnapshot {
+    void *map;
+    int64_t mapLength;
+    SnapshotHeader *header;
+    SnapshotFlower *flowers;
+    SnapshotGroup *groups;
+    SnapshotEnd *ends;
+    SnapshotCap *caps;
+    SnapshotBlock *blocks;
+    SnapshotSegment *segments;
+    SnapshotSequence *sequences;
+    SnapshotRun *maskRuns;
+    SnapshotRun *exceptionRuns;
+    SnapshotEvent *events;
+    SnapshotChain *chains;
+    int64_t *chainBlocks;
+    SnapshotFace *faces;
+    const char *strings;
+    const uint8_t *bases;
+} CactusSnapshot;
+
+/*
+ * Writes the flower and all its descendants to a snapshot file. The subtree is prefetched first,
+ * and stays loaded.
+ */
+void cactusSnapshot_write(Flower *flower, const char *fileName);
+
+/*
+ * Maps a snapshot file read only, aborting if it is not a snapshot of this version.
+ */
+CactusSnapshot *cactusSnapshot_open(const char *fileName);
+
+void cactusSnapshot_close(CactusSnapshot *snapshot);
+
+/*
+ * Number of records in the given section.
+ */
+int64_t cactusSnapshot_getLength(CactusSnapshot *snapshot, SnapshotSection section);
+
+/*
+ * Gets a string from the string section.
+ */
+const char *cactusSnapshot_getString(CactusSnapshot *snapshot, int64_t offset);
+
+/*
+ * Gets the newick string of the event tree of the snapshot's top level flower.
+ */
+const char *cactusSnapshot_getEventTreeString(CactusSnapshot *snapshot);
+
+/*
+ * Returns the name of the event with the given header, or NULL_NAME if there is none.
+ */
+Name cactusSnapshot_getEventByHeader(CactusSnapshot *snapshot, const char *header);
+
+/*
+ * Returns the caps starting the threads of the event, as the cap cursor takes them: for each attached
+ * stub end of the top level flower, its first cap of the event, if that is a 3' cap on the positive
+ * strand. The caps are stIntTuples of their indices, in the order of the ends.
+ */
+stList *cactusSnapshot_getThreadStarts(CactusSnapshot *snapshot, Name eventName);
+
+/*
+ * Returns the segments of the block in the order of block_getInstanceIterator, which is by name, rather
+ * than the order they are stored in. The segments are stIntTuples of their indices.
+ */
+stList *cactusSnapshot_getBlockInstances(CactusSnapshot *snapshot, int64_t block);
+
+/*
+ * As flower_getSequencesMatchingHeader (or flower_getSequencesWithPrefix, if prefixOnly) for the
+ * top level flower: the sequences whose header contains the pattern, in the order of the flower's
+ * sequence iterator, which is by name. The sequences are stIntTuples of their indices.
+ */
+stList *cactusSnapshot_getSequencesMatchingHeader(CactusSnapshot *snapshot, const char *pattern, bool prefixOnly);
+
+/*
+ * Gets the header of the given sequence.
+ */
+const char *cactusSnapshot_getSequenceHeader(CactusSnapshot *snapshot, int64_t sequence);
+
+/*
+ * As sequence_getString, for the given sequence of the snapshot. Returned string is the
+ * callers to free.
+ */
+char *cactusSnapshot_getSequenceString(CactusSnapshot *snapshot, int64_t sequence,
+        int64_t start, int64_t length, int64_t strand);
+
+/*
+ * As segment_getString, returns NULL if the segment has no sequence.
+ */
+char *cactusSnapshot_getSegmentString(CactusSnapshot *snapshot, int64_t segment);
+
+#endif /* CACTUS_SNAPSHOT_H_ */
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "cactus.h"
+#include "sonLib.h"
+#include "cactusSnapshot.h"
+
+static void usage() {
+    fprintf(stderr, "cactus_snapshotExport, version 0.2\n");
+    fprintf(stderr, "Writes a flower and its descendants to a snapshot file, which the MAF generator can read in place of the database\n");
+    fprintf(stderr, "-a --logLevel : Set the log level\n");
+    fprintf(stderr,
+            "-c --cactusDisk : The location of the flower disk directory\n");
+    fprintf(stderr,
+            "-d --flowerName : The name of the flower (the key in the database)\n");
+    fprintf(stderr, "-e --outputFile : The file to write the snapshot in.\n");
+    fprintf(stderr, "-h --help : Print this help screen\n");
+}
+
+int main(int argc, char *argv[]) {
+    /*
+     * Arguments/options
+     */
+    char * logLevelString = NULL;
+    char * cactusDiskDatabaseString = NULL;
+    char * flowerName = NULL;
+    char * outputFile = NULL;
+
+    ///////////////////////////////////////////////////////////////////////////
+    // (0) Parse the inputs handed by genomeCactus.py / setup stuff.
+    ///////////////////////////////////////////////////////////////////////////
+
+    while (1) {
+        static struct option long_options[] = { { "logLevel",
+                required_argument, 0, 'a' }, { "cactusDisk", required_argument,
+                0, 'c' }, { "flowerName", required_argument, 0, 'd' }, {
+                "outputFile", required_argument, 0, 'e' }, { "help",
+                no_argument, 0, 'h' }, { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+
+        int key = getopt_long(argc, argv, "a:c:d:e:h", long_options,
+                &option_index);
+
+        if (key == -1) {
+            break;
+        }
+
+        switch (key) {
+            case 'a':
+                logLevelString = stString_copy(optarg);
+                break;
+            case 'c':
+                cactusDiskDatabaseString = stString_copy(optarg);
+                break;
+            case 'd':
+                flowerName = stString_copy(optarg);
+                break;
+            case 'e':
+                outputFile = stString_copy(optarg);
+                break;
+            case 'h':
+                usage();
+                return 0;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    // (0) Check the inputs.
+    ///////////////////////////////////////////////////////////////////////////
+
+    assert(flowerName != NULL);
+    assert(outputFile != NULL);
+
+    //////////////////////////////////////////////
+    //Set up logging
+    //////////////////////////////////////////////
+
+    st_setLogLevelFromString(logLevelString);
+
+    //////////////////////////////////////////////
+    //Log (some of) the inputs
+    //////////////////////////////////////////////
+
+    st_logInfo("Flower name : %s\n", flowerName);
+    st_logInfo("Output snapshot file : %s\n", outputFile);
+
+    //////////////////////////////////////////////
+    //Load the database
+    //////////////////////////////////////////////
+
+    stKVDatabaseConf *kvDatabaseConf = stKVDatabaseConf_constructFromString(
+            cactusDiskDatabaseString);
+    CactusDisk *cactusDisk = cactusDisk_construct(kvDatabaseConf, 0);
+    st_logInfo("Set up the flower disk\n");
+
+    Flower *flower = cactusDisk_getFlower(cactusDisk, cactusMisc_stringToName(
+            flowerName));
+    st_logInfo("Parsed the top level flower of the cactus tree to export\n");
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Write the snapshot.
+    ///////////////////////////////////////////////////////////////////////////
+
+    int64_t startTime = time(NULL);
+    cactusSnapshot_write(flower, outputFile);
+    st_logInfo("Wrote the snapshot in %" PRIi64 " seconds\n", time(NULL) - startTime);
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Clean up.
+    ///////////////////////////////////////////////////////////////////////////
+
+    cactusDisk_destruct(cactusDisk);
+    stKVDatabaseConf_destruct(kvDatabaseConf);
+
+    return 0;
+}
@@ -20,7 +20,9 @@
 #include <getopt.h>
 
 #include "cactus.h"
+#include "cactusSnapshot.h"
 #include "treeStats.h"
+#include "cactusUtils.h"
 
 /*
  * Script gathers a whole gamut of statistics about the cactus/avg datastructure and reports them in an XML formatted document.
@@ -41,6 +43,12 @@ void usage() {
             stderr,
             "-g --referenceEventString : String identifying the reference event.\n");
     fprintf(stderr, "-h --help : Print this help screen\n");
+    fprintf(stderr,
+            "-j --workerNumber : The number of worker processes the reference threads are shared between, by default 1.\n");
+    fprintf(stderr,
+            "-p --prefetch : Load the whole flower subtree from the disk in batches up front, rather than one flower at a time during the traversal.\n");
+    fprintf(stderr,
+            "-s --snapshot : Read the flowers from a snapshot written by cactus_snapshotExport, rather than the database.\n");
 }
 
 int main(int argc, char *argv[]) {
@@ -58,6 +66,9 @@ int main(int argc, char *argv[]) {
     char * outputFile = NULL;
     bool perColumnStats = 1;
     char *referenceEventString = (char *)cactusMisc_getDefaultReferenceEventHeader();
+    int64_t workerNumber = 1;
+    bool prefetch = 0;
+    char *snapshotFile = NULL;
 
     ///////////////////////////////////////////////////////////////////////////
     // (0) Parse the inputs handed by genomeCactus.py / setup stuff.
@@ -70,11 +81,13 @@ int main(int argc, char *argv[]) {
                 "outputFile", required_argument, 0, 'e' }, {
                 "noPerColumnStats", no_argument, 0, 'f' }, {
                 "referenceEventString", optional_argument, 0, 'g' }, { "help",
-                no_argument, 0, 'h' }, { 0, 0, 0, 0 } };
+                no_argument, 0, 'h' }, { "workerNumber", required_argument, 0, 'j' },
+                { "prefetch", no_argument, 0, 'p' },
+                { "snapshot", required_argument, 0, 's' }, { 0, 0, 0, 0 } };
 
         int option_index = 0;
 
-        int key = getopt_long(argc, argv, "a:c:d:e:fg:hi:", long_options,
+        int key = getopt_long(argc, argv, "a:c:d:e:fg:hi:j:ps:", long_options,
                 &option_index);
 
         if (key == -1) {
@@ -103,6 +116,17 @@ int main(int argc, char *argv[]) {
             case 'g':
                 referenceEventString = stString_copy(optarg);
                 break;
+            case 'j':
+                if (sscanf(optarg, "%" SCNi64 "", &workerNumber) != 1) {
+                    st_errAbort("Could not parse the worker number %s\n", optarg);
+                }
+                break;
+            case 'p':
+                prefetch = 1;
+                break;
+            case 's':
+                snapshotFile = stString_copy(optarg);
+                break;
             default:
                 usage();
                 return 1;
@@ -113,7 +137,7 @@ int main(int argc, char *argv[]) {
     // (0) Check the inputs.
     ///////////////////////////////////////////////////////////////////////////
 
-    assert(cactusDiskDatabaseString != NULL);
+    assert(cactusDiskDatabaseString != NULL || snapshotFile != NULL);
     assert(flowerName != NULL);
     assert(outputFile != NULL);
 
@@ -130,6 +154,22 @@ int main(int argc, char *argv[]) {
     st_logInfo("Flower name : %s\n", flowerName);
     st_logInfo("Output graph file : %s\n", outputFile);
 
+    //////////////////////////////////////////////
+    //Read the flowers from a snapshot, without the database
+    //////////////////////////////////////////////
+
+    if (snapshotFile != NULL) {
+        st_logInfo("Snapshot file : %s\n", snapshotFile);
+        CactusSnapshot *snapshot = cactusSnapshot_open(snapshotFile);
+        FILE *fileHandle = fopen(outputFile, "w");
+        reportSnapshotStats("EMPTY", snapshot, referenceEventString, fileHandle,
+                perColumnStats, workerNumber);
+        st_logInfo("Finished writing out the stats.\n");
+        fclose(fileHandle);
+        cactusSnapshot_close(snapshot);
+        return 0;
+    }
+
     //////////////////////////////////////////////
     //Load the database
     //////////////////////////////////////////////
@@ -143,19 +183,23 @@ int main(int argc, char *argv[]) {
     // Parse the basic reconstruction problem
     ///////////////////////////////////////////////////////////////////////////
 
-    Flower *flower = cactusDisk_getFlower(cactusDisk,
+    Flower *flower = getFlower(cactusDisk,
             cactusMisc_stringToName(flowerName));
     assert(flower != NULL);
     st_logInfo("Parsed the top level flower of the cactus tree to build\n");
+    if (prefetch) {
+        prefetchFlowerSubtree(flower, PREFETCH_BATCH_SIZE);
+    }
 
     ///////////////////////////////////////////////////////////////////////////
     // Calculate and print to file a crap load of numbers.
     ///////////////////////////////////////////////////////////////////////////
 
     FILE *fileHandle = fopen(outputFile, "w");
-    reportCactusDiskStats("EMPTY", flower, referenceEventString, fileHandle,
-            perColumnStats);
+    reportCactusDiskStats2("EMPTY", flower, referenceEventString, fileHandle,
+            perColumnStats, workerNumber);
     st_logInfo("Finished writing out the stats.\n");
+    logLoadedFlowerNumber();
     fclose(fileHandle);
 
     ///////////////////////////////////////////////////////////////////////////
@@ -17,6 +17,11 @@
 #include "commonC.h"
 #include "hashTableC.h"
 #include "cactusTraversal.h"
+#include "cactusParallel.h"
+#include "cactusUtils.h"
+#include "cactusSnapshot.h"
+
+#define CAP_BATCH_SIZE 256
 
 /*
  * Stats for a cactus tree that passes cactus_check.
@@ -173,7 +178,7 @@ double calculateTreeBits(Flower *flower, double pathBitScore) {
                     / log(2.0)) + followingPathBitScore) * totalSequenceSize
                     : 0.0);
         } else {
-            totalBitScore += calculateTreeBits(group_getNestedFlower(group),
+            totalBitScore += calculateTreeBits(getNestedFlower(group),
                     followingPathBitScore);
         }
     }
@@ -190,12 +195,7 @@ double calculateTreeBits(Flower *flower, double pathBitScore) {
             / log(2.0)) + pathBitScore) * totalSequenceSize : 0.0);
 }
 
-void reportRelativeEntopyStats(Flower *flower, FILE *fileHandle) {
-    /*
-     * Relative entropy stats. Supposed to give a metric of how balanced the tree is in how it subdivides the input sequences.
-     */
-    double totalSeqSize = flower_getTotalBaseLength(flower);
-    double totalP = calculateTreeBits(flower, 0.0);
+static void printRelativeEntropyStats(double totalSeqSize, double totalP, FILE *fileHandle) {
     double totalQ = (log(totalSeqSize) / log(2.0)) * totalSeqSize;
     //assert(totalP >= totalQ);
     double relativeEntropy = totalP - totalQ;
@@ -207,6 +207,13 @@ void reportRelativeEntopyStats(Flower *flower, FILE *fileHandle) {
             totalP, totalQ, relativeEntropy, normalisedRelativeEntropy);
 }
 
+void reportRelativeEntopyStats(Flower *flower, FILE *fileHandle) {
+    /*
+     * Relative entropy stats. Supposed to give a metric of how balanced the tree is in how it subdivides the input sequences.
+     */
+    printRelativeEntropyStats(flower_getTotalBaseLength(flower), calculateTreeBits(flower, 0.0), fileHandle);
+}
+
 static void flowerStats(Flower *flower, int64_t currentDepth,
         struct IntList *children, struct IntList *tangleChildren,
         struct IntList *linkChildren, struct IntList *depths) {
@@ -223,7 +230,7 @@ static void flowerStats(Flower *flower, int64_t currentDepth,
         int64_t i = 0;
         while ((group = flower_getNextGroup(groupIterator)) != NULL) {
             if(!group_isLeaf(group)) {
-                flowerStats(group_getNestedFlower(group), currentDepth + 1,
+                flowerStats(getNestedFlower(group), currentDepth + 1,
                         children, tangleChildren, linkChildren, depths);
             }
             if (group_getLink(group) != NULL) {
@@ -239,15 +246,11 @@ static void flowerStats(Flower *flower, int64_t currentDepth,
     }
 }
 
-void reportFlowerStats(Flower *flower, FILE *fileHandle) {
+static void printFlowerStats(struct IntList *children, struct IntList *tangleChildren,
+        struct IntList *linkChildren, struct IntList *depths, FILE *fileHandle) {
     /*
-     * Prints the chain stats to the XML file.
+     * Prints the flower stats to the XML file, then destructs them.
      */
-    struct IntList *children = constructEmptyIntList(0);
-    struct IntList *tangleChildren = constructEmptyIntList(0);
-    struct IntList *linkChildren = constructEmptyIntList(0);
-    struct IntList *depths = constructEmptyIntList(0);
-    flowerStats(flower, 0, children, tangleChildren, linkChildren, depths);
     printOpeningTag("flowers", fileHandle);
     tabulateAndPrintIntValues(children, "children", fileHandle);
     tabulateAndPrintIntValues(tangleChildren, "tangle_children", fileHandle);
@@ -260,6 +263,18 @@ void reportFlowerStats(Flower *flower, FILE *fileHandle) {
     destructIntList(depths);
 }
 
+void reportFlowerStats(Flower *flower, FILE *fileHandle) {
+    /*
+     * Prints the chain stats to the XML file.
+     */
+    struct IntList *children = constructEmptyIntList(0);
+    struct IntList *tangleChildren = constructEmptyIntList(0);
+    struct IntList *linkChildren = constructEmptyIntList(0);
+    struct IntList *depths = constructEmptyIntList(0);
+    flowerStats(flower, 0, children, tangleChildren, linkChildren, depths);
+    printFlowerStats(children, tangleChildren, linkChildren, depths, fileHandle);
+}
+
 void blockStats(Flower *flower, struct IntList *counts,
         struct IntList *lengths, struct IntList *degrees,
         struct IntList *leafDegrees, struct IntList *coverage,
@@ -280,7 +295,7 @@ void blockStats(Flower *flower, struct IntList *counts,
         Group *group;
         while ((group = flower_getNextGroup(groupIterator)) != NULL) {
             if(!group_isLeaf(group)) {
-                blockStats(group_getNestedFlower(group), counts, lengths, degrees,
+                blockStats(getNestedFlower(group), counts, lengths, degrees,
                         leafDegrees, coverage, leafCoverage, includeBlock,
                         columnDegrees, columnLeafDegrees, perColumnStats);
             }
@@ -320,23 +335,14 @@ void blockStats(Flower *flower, struct IntList *counts,
     }
 }
 
-void reportBlockStatsP(Flower *flower, FILE *fileHandle,
-        bool(*includeBlock)(Block *), const char *attribString,
-        bool perColumnStats) {
+static void printBlockStats(struct IntList *counts, struct IntList *lengths,
+        struct IntList *degrees, struct IntList *leafDegrees,
+        struct IntList *coverage, struct IntList *leafCoverage,
+        struct IntList *columnDegrees, struct IntList *columnLeafDegrees,
+        const char *attribString, bool perColumnStats, FILE *fileHandle) {
     /*
-     * Prints the block stats to the XML file.
+     * Prints the block stats to the XML file, then destructs them.
      */
-    struct IntList *counts = constructEmptyIntList(0);
-    struct IntList *lengths = constructEmptyIntList(0);
-    struct IntList *degrees = constructEmptyIntList(0);
-    struct IntList *leafDegrees = constructEmptyIntList(0);
-    struct IntList *coverage = constructEmptyIntList(0);
-    struct IntList *leafCoverage = constructEmptyIntList(0);
-    struct IntList *columnDegrees = constructEmptyIntList(0);
-    struct IntList *columnLeafDegrees = constructEmptyIntList(0);
-    blockStats(flower, counts, lengths, degrees, leafDegrees, coverage,
-            leafCoverage, includeBlock, columnDegrees, columnLeafDegrees,
-            perColumnStats);
     fprintf(fileHandle, "<blocks %s>", attribString);
     tabulateAndPrintIntValues(counts, "counts", fileHandle);
     tabulateAndPrintIntValues(lengths, "lengths", fileHandle);
@@ -360,6 +366,28 @@ void reportBlockStatsP(Flower *flower, FILE *fileHandle,
     destructIntList(columnLeafDegrees);
 }
 
+void reportBlockStatsP(Flower *flower, FILE *fileHandle,
+        bool(*includeBlock)(Block *), const char *attribString,
+        bool perColumnStats) {
+    /*
+     * Prints the block stats to the XML file.
+     */
+    struct IntList *counts = constructEmptyIntList(0);
+    struct IntList *lengths = constructEmptyIntList(0);
+    struct IntList *degrees = constructEmptyIntList(0);
+    struct IntList *leafDegrees = constructEmptyIntList(0);
+    struct IntList *coverage = constructEmptyIntList(0);
+    struct IntList *leafCoverage = constructEmptyIntList(0);
+    struct IntList *columnDegrees = constructEmptyIntList(0);
+    struct IntList *columnLeafDegrees = constructEmptyIntList(0);
+    blockStats(flower, counts, lengths, degrees, leafDegrees, coverage,
+            leafCoverage, includeBlock, columnDegrees, columnLeafDegrees,
+            perColumnStats);
+    printBlockStats(counts, lengths, degrees, leafDegrees, coverage,
+            leafCoverage, columnDegrees, columnLeafDegrees, attribString,
+            perColumnStats, fileHandle);
+}
+
 int64_t reportBlockStats_minBlockDegree;
 bool reportBlockStatsP2(Block *block) {
     Segment *segment;
@@ -398,8 +426,8 @@ static void chainStats(Flower *flower, struct IntList *counts,
         Flower_GroupIterator *groupIterator = flower_getGroupIterator(flower);
         Group *group;
         while ((group = flower_getNextGroup(groupIterator)) != NULL) {
-            if(group_getNestedFlower(group) != NULL) {
-                chainStats(group_getNestedFlower(group), counts, blockNumbers,
+            if(getNestedFlower(group) != NULL) {
+                chainStats(getNestedFlower(group), counts, blockNumbers,
                         baseBlockLengths, linkNumbers, avgInstanceBaseLengths,
                         minNumberOfBlocksInChain);
             }
@@ -433,18 +461,13 @@ static void chainStats(Flower *flower, struct IntList *counts,
     }
 }
 
-static void reportChainStats(Flower *flower, int64_t minNumberOfBlocksInChain,
+static void printChainStats(struct IntList *counts, struct IntList *blockNumbers,
+        struct IntList *baseBlockLengths, struct IntList *linkNumbers,
+        struct IntList *avgInstanceBaseLengths, int64_t minNumberOfBlocksInChain,
         FILE *fileHandle) {
     /*
-     * Prints the chain stats to the XML file.
+     * Prints the chain stats to the XML file, then destructs them.
      */
-    struct IntList *counts = constructEmptyIntList(0);
-    struct IntList *blockNumbers = constructEmptyIntList(0);
-    struct IntList *baseBlockLengths = constructEmptyIntList(0);
-    struct IntList *linkNumbers = constructEmptyIntList(0);
-    struct IntList *avgInstanceBaseLengths = constructEmptyIntList(0);
-    chainStats(flower, counts, blockNumbers, baseBlockLengths, linkNumbers,
-            avgInstanceBaseLengths, minNumberOfBlocksInChain);
     fprintf(fileHandle, "<chains minimum_number_of_blocks_in_chain=\"%" PRIi64 "\">",
             minNumberOfBlocksInChain);
     tabulateAndPrintIntValues(counts, "counts", fileHandle);
@@ -462,6 +485,22 @@ static void reportChainStats(Flower *flower, int64_t minNumberOfBlocksInChain,
     destructIntList(avgInstanceBaseLengths);
 }
 
+static void reportChainStats(Flower *flower, int64_t minNumberOfBlocksInChain,
+        FILE *fileHandle) {
+    /*
+     * Prints the chain stats to the XML file.
+     */
+    struct IntList *counts = constructEmptyIntList(0);
+    struct IntList *blockNumbers = constructEmptyIntList(0);
+    struct IntList *baseBlockLengths = constructEmptyIntList(0);
+    struct IntList *linkNumbers = constructEmptyIntList(0);
+    struct IntList *avgInstanceBaseLengths = constructEmptyIntList(0);
+    chainStats(flower, counts, blockNumbers, baseBlockLengths, linkNumbers,
+            avgInstanceBaseLengths, minNumberOfBlocksInChain);
+    printChainStats(counts, blockNumbers, baseBlockLengths, linkNumbers,
+            avgInstanceBaseLengths, minNumberOfBlocksInChain, fileHandle);
+}
+
 void terminalFlowerSizes(Flower *flower, struct IntList *sizes) {
     /*
      * Reports stats on the size of terminal flowers..
@@ -475,7 +514,7 @@ void terminalFlowerSizes(Flower *flower, struct IntList *sizes) {
         Group *group;
         while ((group = flower_getNextGroup(groupIterator)) != NULL) {
             if(!group_isLeaf(group)) {
-                terminalFlowerSizes(group_getNestedFlower(group), sizes);
+                terminalFlowerSizes(getNestedFlower(group), sizes);
             }
         }
         flower_destructGroupIterator(groupIterator);
@@ -548,8 +587,8 @@ int64_t netStats(Flower *flower, stList *totalEndNumbersPerTerminalGroup,
         Flower_GroupIterator *groupIterator = flower_getGroupIterator(flower);
         Group *group;
         while ((group = flower_getNextGroup(groupIterator)) != NULL) {
-            if(group_getNestedFlower(group) != NULL) {
-                totalGroups += netStats(group_getNestedFlower(group),
+            if(getNestedFlower(group) != NULL) {
+                totalGroups += netStats(getNestedFlower(group),
                         totalEndNumbersPerTerminalGroup,
                         totalNonFreeStubEndNumbersPerTerminalGroup, endDegrees,
                         totalGroupsPerNet);
@@ -567,22 +606,12 @@ int64_t netStats(Flower *flower, stList *totalEndNumbersPerTerminalGroup,
     }
 }
 
-void reportNetStats(Flower *flower, FILE *fileHandle) {
+static void printNetStats(stList *totalEndNumbersPerTerminalGroup,
+        stList *totalNonFreeStubEndNumbersPerTerminalGroup,
+        struct List *endDegrees, stList *totalGroupsPerNet, FILE *fileHandle) {
     /*
-     * Prints the end stats to the XML file.
+     * Prints the end stats to the XML file, then destructs them.
      */
-    stList *totalEndNumbersPerTerminalGroup = stList_construct3(0,
-            (void(*)(void *)) stIntTuple_destruct);
-    stList *totalNonFreeStubEndNumbersPerTerminalGroup = stList_construct3(0,
-            (void(*)(void *)) stIntTuple_destruct);
-    struct List *endDegrees = constructEmptyList(0, free);
-    stList *totalGroupsPerNet = stList_construct3(0,
-            (void(*)(void *)) stIntTuple_destruct);
-
-    netStats(flower, totalEndNumbersPerTerminalGroup,
-            totalNonFreeStubEndNumbersPerTerminalGroup, endDegrees,
-            totalGroupsPerNet);
-
     fprintf(fileHandle, "<nets>");
     tabulateAndPrintIntTupleValues(totalEndNumbersPerTerminalGroup,
             "total_end_numbers_per_terminal_group", fileHandle);
@@ -600,6 +629,27 @@ void reportNetStats(Flower *flower, FILE *fileHandle) {
     stList_destruct(totalGroupsPerNet);
 }
 
+void reportNetStats(Flower *flower, FILE *fileHandle) {
+    /*
+     * Prints the end stats to the XML file.
+     */
+    stList *totalEndNumbersPerTerminalGroup = stList_construct3(0,
+            (void(*)(void *)) stIntTuple_destruct);
+    stList *totalNonFreeStubEndNumbersPerTerminalGroup = stList_construct3(0,
+            (void(*)(void *)) stIntTuple_destruct);
+    struct List *endDegrees = constructEmptyList(0, free);
+    stList *totalGroupsPerNet = stList_construct3(0,
+            (void(*)(void *)) stIntTuple_destruct);
+
+    netStats(flower, totalEndNumbersPerTerminalGroup,
+            totalNonFreeStubEndNumbersPerTerminalGroup, endDegrees,
+            totalGroupsPerNet);
+
+    printNetStats(totalEndNumbersPerTerminalGroup,
+            totalNonFreeStubEndNumbersPerTerminalGroup, endDegrees,
+            totalGroupsPerNet, fileHandle);
+}
+
 void faceStats(Flower *flower, struct IntList *numberPerGroup,
         struct IntList *cardinality, struct IntList *isSimple,
         struct IntList *isRegular, struct IntList *isCanonical,
@@ -638,7 +688,7 @@ void faceStats(Flower *flower, struct IntList *numberPerGroup,
         while ((group = flower_getNextGroup(groupIterator)) != NULL) {
             //Call recursively..
             if(!group_isLeaf(group)) {
-                faceStats(group_getNestedFlower(group), numberPerGroup,
+                faceStats(getNestedFlower(group), numberPerGroup,
                         cardinality, isSimple, isRegular, isCanonical,
                         facesPerFaceAssociatedEnd, includeLinkGroups,
                         includeTangleGroups);
@@ -648,20 +698,14 @@ void faceStats(Flower *flower, struct IntList *numberPerGroup,
     }
 }
 
-void reportFaceStats(Flower *flower, int64_t includeLinkGroups,
+static void printFaceStats(struct IntList *numberPerGroup,
+        struct IntList *cardinality, struct IntList *isSimple,
+        struct IntList *isRegular, struct IntList *isCanonical,
+        struct IntList *facesPerFaceAssociatedEnd, int64_t includeLinkGroups,
         int64_t includeTangleGroups, FILE *fileHandle) {
     /*
-     * Prints the reference stats to the XML file.
+     * Prints the face stats to the XML file, then destructs them.
      */
-    struct IntList *numberPerGroup = constructEmptyIntList(0);
-    struct IntList *cardinality = constructEmptyIntList(0);
-    struct IntList *isSimple = constructEmptyIntList(0);
-    struct IntList *isRegular = constructEmptyIntList(0);
-    struct IntList *isCanonical = constructEmptyIntList(0);
-    struct IntList *facesPerFaceAssociatedEnd = constructEmptyIntList(0);
-    faceStats(flower, numberPerGroup, cardinality, isSimple, isRegular,
-            isCanonical, facesPerFaceAssociatedEnd, includeLinkGroups,
-            includeTangleGroups);
     fprintf(fileHandle,
             "<faces include_link_groups=\"%i\" include_tangle_groups=\"%i\">",
             includeLinkGroups != 0, includeTangleGroups != 0);
@@ -680,8 +724,26 @@ void reportFaceStats(Flower *flower, int64_t includeLinkGroups,
     destructIntList(isCanonical);
 }
 
-void reportReferenceStatsP(stList *caps, stList *adjacencyWeights) {
-    Cap *cap = stList_peek(caps);
+void reportFaceStats(Flower *flower, int64_t includeLinkGroups,
+        int64_t includeTangleGroups, FILE *fileHandle) {
+    /*
+     * Prints the reference stats to the XML file.
+     */
+    struct IntList *numberPerGroup = constructEmptyIntList(0);
+    struct IntList *cardinality = constructEmptyIntList(0);
+    struct IntList *isSimple = constructEmptyIntList(0);
+    struct IntList *isRegular = constructEmptyIntList(0);
+    struct IntList *isCanonical = constructEmptyIntList(0);
+    struct IntList *facesPerFaceAssociatedEnd = constructEmptyIntList(0);
+    faceStats(flower, numberPerGroup, cardinality, isSimple, isRegular,
+            isCanonical, facesPerFaceAssociatedEnd, includeLinkGroups,
+            includeTangleGroups);
+    printFaceStats(numberPerGroup, cardinality, isSimple, isRegular,
+            isCanonical, facesPerFaceAssociatedEnd, includeLinkGroups,
+            includeTangleGroups, fileHandle);
+}
+
+void reportReferenceStatsP(Cap *cap, stList *adjacencyWeights) {
     End *end = cap_getEnd(cap);
     Cap *cap2;
     End_InstanceIterator *instanceIt = end_getInstanceIterator(end);
@@ -700,10 +762,69 @@ void reportReferenceStatsP(stList *caps, stList *adjacencyWeights) {
     stList_append(adjacencyWeights, stIntTuple_construct1( i-1));
 }
 
+static void reportReferenceStatsForThread(CapCursor *capCursor, Cap *startCap, stList *adjacencyWeights) {
+    Cap *caps[CAP_BATCH_SIZE];
+    capCursor_reset(capCursor, startCap);
+    //The lowest level versions of the 5' caps of the thread, in order
+    int64_t capNumber;
+    while ((capNumber = capCursor_nextBatch(capCursor, 1, NULL, caps, CAP_BATCH_SIZE)) > 0) {
+        for (int64_t i = 0; i < capNumber; i++) {
+            reportReferenceStatsP(caps[i], adjacencyWeights);
+        }
+    }
+}
+
+typedef struct _referenceThreadStats {
+    stList *startCaps; //Of caps, or of the indices of caps for a snapshot
+    CapCursor *capCursor;
+    CactusSnapshot *snapshot;
+    stList *adjacencyWeights;
+} ReferenceThreadStats;
+
+static void writeAdjacencyWeights(stList *adjacencyWeights, FILE *output) {
+    for (int64_t i = 0; i < stList_length(adjacencyWeights); i++) {
+        fprintf(output, "%" PRIi64 "\n", stIntTuple_get(stList_get(adjacencyWeights, i), 0));
+    }
+}
+
+static void reportReferenceStatsForThreadP(int64_t item, FILE *output, ReferenceThreadStats *referenceThreadStats) {
+    /*
+     * Runs in a worker process, so writes the weights out for the merge rather than keeping them.
+     */
+    stList *adjacencyWeights = stList_construct3(0, (void(*)(void *)) stIntTuple_destruct);
+    reportReferenceStatsForThread(referenceThreadStats->capCursor, stList_get(referenceThreadStats->startCaps, item),
+            adjacencyWeights);
+    writeAdjacencyWeights(adjacencyWeights, output);
+    stList_destruct(adjacencyWeights);
+}
+
+static void mergeReferenceStatsForThread(int64_t item, FILE *input, int64_t length,
+        ReferenceThreadStats *referenceThreadStats) {
+    int64_t weight;
+    for (int64_t end = ftell(input) + length; ftell(input) < end;) {
+        if (fscanf(input, "%" SCNi64 "\n", &weight) != 1) {
+            st_errAbort("The adjacency weights of a parallel reference thread were truncated\n");
+        }
+        stList_append(referenceThreadStats->adjacencyWeights, stIntTuple_construct1(weight));
+    }
+}
+
+static void printReferenceStats(stList *adjacencyWeights, FILE *fileHandle) {
+    /*
+     * Prints the reference stats to the XML file, then destructs them.
+     */
+    fprintf(fileHandle, "<reference method=\"default\">");
+    tabulateAndPrintIntTupleValues(adjacencyWeights, "adjacencyWeights",
+            fileHandle);
+    printClosingTag("reference", fileHandle);
+    stList_destruct(adjacencyWeights);
+}
+
 void reportReferenceStats(Flower *flower, const char *referenceEventString,
-        FILE *fileHandle) {
+        FILE *fileHandle, int64_t workerNumber) {
     /*
-     * Prints the reference stats to the XML file.
+     * Prints the reference stats to the XML file. The reference threads are independent, so
+     * with more than one worker they are shared out between worker processes.
      */
     assert(referenceEventString != NULL);
     Event *referenceEvent = eventTree_getEventByHeader(
@@ -716,30 +837,45 @@ void reportReferenceStats(Flower *flower, const char *referenceEventString,
     stList *adjacencyWeights = stList_construct3(0,
             (void(*)(void *)) stIntTuple_destruct);
 
+    stList *startCaps = stList_construct();
     Flower_EndIterator *endIt = flower_getEndIterator(flower);
     End *end;
     while ((end = flower_getNextEnd(endIt)) != NULL) {
         if (end_isStubEnd(end) && end_isAttached(end)) {
             Cap *cap = getCapForReferenceEvent(end, event_getName(referenceEvent)); //The cap in the reference
-            assert(cap != NULL);
+            if (cap == NULL) {
+                st_logDebug("Attached stub end %s has no reference cap, skipping it\n", cactusMisc_nameToStringStatic(end_getName(end)));
+                continue;
+            }
             cap = cap_getStrand(cap) ? cap : cap_getReverse(cap);
             if (!cap_getSide(cap)) {
-                traverseCapsInSequenceOrderFrom3PrimeCap(cap, adjacencyWeights,
-                        NULL, (void(*)(stList *, void *)) reportReferenceStatsP);
+                stList_append(startCaps, cap);
             }
         }
     }
     flower_destructEndIterator(endIt);
+    if (stList_length(startCaps) > 0) {
+        CapCursor *capCursor = capCursor_construct(stList_get(startCaps, 0));
+        if (workerNumber <= 1) {
+            for (int64_t i = 0; i < stList_length(startCaps); i++) {
+                reportReferenceStatsForThread(capCursor, stList_get(startCaps, i), adjacencyWeights);
+            }
+        } else {
+            prefetchFlowerSubtree(flower, PREFETCH_BATCH_SIZE); //Required, the workers must not load flowers over the inherited connection, see parallelOrderedMap
+            ReferenceThreadStats referenceThreadStats = { startCaps, capCursor, NULL, adjacencyWeights };
+            parallelOrderedMap(stList_length(startCaps), workerNumber, &referenceThreadStats,
+                    (void (*)(int64_t, FILE *, void *))reportReferenceStatsForThreadP,
+                    (void (*)(int64_t, FILE *, int64_t, void *))mergeReferenceStatsForThread);
+        }
+        capCursor_destruct(capCursor);
+    }
+    stList_destruct(startCaps);
 
-    fprintf(fileHandle, "<reference method=\"default\">");
-    tabulateAndPrintIntTupleValues(adjacencyWeights, "adjacencyWeights",
-            fileHandle);
-    printClosingTag("reference", fileHandle);
-    stList_destruct(adjacencyWeights);
+    printReferenceStats(adjacencyWeights, fileHandle);
 }
 
-void reportCactusDiskStats(char *cactusDiskName, Flower *flower, const char *referenceEventString,
-        FILE *fileHandle, bool perColumnStats) {
+void reportCactusDiskStats2(char *cactusDiskName, Flower *flower, const char *referenceEventString,
+        FILE *fileHandle, bool perColumnStats, int64_t workerNumber) {
 
     double totalSeqSize = flower_getTotalBaseLength(flower);
     fprintf(
@@ -790,8 +926,453 @@ void reportCactusDiskStats(char *cactusDiskName, Flower *flower, const char *ref
     /*
      * Stats on the reference in the reconstruction..
      */
-     reportReferenceStats(flower, referenceEventString, fileHandle);
+     reportReferenceStats(flower, referenceEventString, fileHandle, workerNumber);
 
     printClosingTag("stats", fileHandle);
 }
 
+void reportCactusDiskStats(char *cactusDiskName, Flower *flower, const char *referenceEventString,
+        FILE *fileHandle, bool perColumnStats) {
+    reportCactusDiskStats2(cactusDiskName, flower, referenceEventString, fileHandle, perColumnStats, 1);
+}
+
+
+/////
+//The same stats from a snapshot, walking its records in the order of the flower iterators
+/////
+
+static double calculateTreeBitsFromSnapshot(CactusSnapshot *snapshot, int64_t flower, double pathBitScore) {
+    /*
+     * As calculateTreeBits.
+     */
+    SnapshotFlower *flowerRecord = &(snapshot->flowers[flower]);
+    double totalBitScore = 0.0;
+    int64_t totalSequenceSize;
+    double followingPathBitScore = (log(flowerRecord->groupNumber) / log(
+            2.0)) + pathBitScore;
+    for (int64_t i = flowerRecord->firstGroup; i < flowerRecord->firstGroup + flowerRecord->groupNumber; i++) {
+        SnapshotGroup *group = &(snapshot->groups[i]);
+        if (group->nestedFlower == -1) {
+            totalSequenceSize = group->totalBaseLength;
+            totalBitScore += (totalSequenceSize > 0 ? ((log(totalSequenceSize)
+                    / log(2.0)) + followingPathBitScore) * totalSequenceSize
+                    : 0.0);
+        } else {
+            totalBitScore += calculateTreeBitsFromSnapshot(snapshot, group->nestedFlower,
+                    followingPathBitScore);
+        }
+    }
+    totalSequenceSize = 0.0;
+    for (int64_t i = flowerRecord->firstBlock; i < flowerRecord->firstBlock + flowerRecord->blockNumber; i++) {
+        totalSequenceSize += snapshot->blocks[i].length * snapshot->blocks[i].segmentNumber;
+    }
+    return totalBitScore + (totalSequenceSize > 0 ? ((log(totalSequenceSize)
+            / log(2.0)) + pathBitScore) * totalSequenceSize : 0.0);
+}
+
+static void flowerStatsFromSnapshot(CactusSnapshot *snapshot, int64_t flower, int64_t currentDepth,
+        struct IntList *children, struct IntList *tangleChildren,
+        struct IntList *linkChildren, struct IntList *depths) {
+    /*
+     * As flowerStats.
+     */
+    SnapshotFlower *flowerRecord = &(snapshot->flowers[flower]);
+    if (!flowerRecord->isTerminal) {
+        int64_t j = 0;
+        for (int64_t i = flowerRecord->firstGroup; i < flowerRecord->firstGroup + flowerRecord->groupNumber; i++) {
+            if (snapshot->groups[i].nestedFlower != -1) {
+                flowerStatsFromSnapshot(snapshot, snapshot->groups[i].nestedFlower, currentDepth + 1,
+                        children, tangleChildren, linkChildren, depths);
+            }
+            if (snapshot->groups[i].isLink) {
+                j++;
+            }
+        }
+        intListAppend(children, flowerRecord->groupNumber);
+        intListAppend(tangleChildren, flowerRecord->groupNumber - j);
+        intListAppend(linkChildren, j);
+    } else {
+        intListAppend(depths, currentDepth);
+    }
+}
+
+static int64_t snapshotBlock_getLeafDegree(CactusSnapshot *snapshot, SnapshotBlock *block) {
+    /*
+     * The segments of a block are in post-order, if it has a segment tree, so a segment has
+     * children exactly when the segment before it is its (last) child.
+     */
+    int64_t leafDegree = 0;
+    for (int64_t i = block->firstSegment; i < block->firstSegment + block->segmentNumber; i++) {
+        if (i == block->firstSegment || snapshot->segments[i - 1].parent != i) {
+            leafDegree++;
+        }
+    }
+    return leafDegree;
+}
+
+static void blockStatsFromSnapshot(CactusSnapshot *snapshot, int64_t flower, struct IntList *counts,
+        struct IntList *lengths, struct IntList *degrees,
+        struct IntList *leafDegrees, struct IntList *coverage,
+        struct IntList *leafCoverage, int64_t minBlockDegree,
+        struct IntList *columnDegrees, struct IntList *columnLeafDegrees,
+        bool perColumnStats) {
+    /*
+     * As blockStats, including the blocks with at least minBlockDegree leaf segments.
+     */
+    SnapshotFlower *flowerRecord = &(snapshot->flowers[flower]);
+    if (!flowerRecord->isTerminal) {
+        for (int64_t i = flowerRecord->firstGroup; i < flowerRecord->firstGroup + flowerRecord->groupNumber; i++) {
+            if (snapshot->groups[i].nestedFlower != -1) {
+                blockStatsFromSnapshot(snapshot, snapshot->groups[i].nestedFlower, counts, lengths, degrees,
+                        leafDegrees, coverage, leafCoverage, minBlockDegree,
+                        columnDegrees, columnLeafDegrees, perColumnStats);
+            }
+        }
+        for (int64_t i = flowerRecord->firstBlock; i < flowerRecord->firstBlock + flowerRecord->blockNumber; i++) {
+            SnapshotBlock *block = &(snapshot->blocks[i]);
+            int64_t leafDegree = snapshotBlock_getLeafDegree(snapshot, block);
+            if (leafDegree >= minBlockDegree) {
+                intListAppend(lengths, block->length);
+                intListAppend(degrees, block->segmentNumber);
+                intListAppend(coverage, block->length * block->segmentNumber);
+                intListAppend(leafDegrees, leafDegree);
+                intListAppend(leafCoverage, block->length * leafDegree);
+                if (perColumnStats) {
+                    for (int64_t j = 0; j < block->length; j++) {
+                        intListAppend(columnDegrees, block->segmentNumber);
+                        intListAppend(columnLeafDegrees, leafDegree);
+                    }
+                }
+            }
+        }
+        intListAppend(counts, flowerRecord->blockNumber);
+    }
+}
+
+static void reportBlockStatsFromSnapshot(CactusSnapshot *snapshot, FILE *fileHandle,
+        int64_t minBlockDegree, bool perColumnStats) {
+    struct IntList *counts = constructEmptyIntList(0);
+    struct IntList *lengths = constructEmptyIntList(0);
+    struct IntList *degrees = constructEmptyIntList(0);
+    struct IntList *leafDegrees = constructEmptyIntList(0);
+    struct IntList *coverage = constructEmptyIntList(0);
+    struct IntList *leafCoverage = constructEmptyIntList(0);
+    struct IntList *columnDegrees = constructEmptyIntList(0);
+    struct IntList *columnLeafDegrees = constructEmptyIntList(0);
+    blockStatsFromSnapshot(snapshot, 0, counts, lengths, degrees, leafDegrees, coverage,
+            leafCoverage, minBlockDegree, columnDegrees, columnLeafDegrees,
+            perColumnStats);
+    char *cA = stString_print("minimum_leaf_degree=\"%" PRIi64 "\"", minBlockDegree);
+    printBlockStats(counts, lengths, degrees, leafDegrees, coverage,
+            leafCoverage, columnDegrees, columnLeafDegrees, cA,
+            perColumnStats, fileHandle);
+    free(cA);
+}
+
+static void chainStatsFromSnapshot(CactusSnapshot *snapshot, int64_t flower, struct IntList *counts,
+        struct IntList *blockNumbers, struct IntList *baseBlockLengths,
+        struct IntList *linkNumbers, struct IntList *avgInstanceBaseLengths,
+        int64_t minNumberOfBlocksInChain) {
+    /*
+     * As chainStats.
+     */
+    SnapshotFlower *flowerRecord = &(snapshot->flowers[flower]);
+    if (!flowerRecord->isTerminal) {
+        for (int64_t i = flowerRecord->firstGroup; i < flowerRecord->firstGroup + flowerRecord->groupNumber; i++) {
+            if (snapshot->groups[i].nestedFlower != -1) {
+                chainStatsFromSnapshot(snapshot, snapshot->groups[i].nestedFlower, counts, blockNumbers,
+                        baseBlockLengths, linkNumbers, avgInstanceBaseLengths,
+                        minNumberOfBlocksInChain);
+            }
+        }
+        int64_t l = 0;
+        for (int64_t i = flowerRecord->firstChain; i < flowerRecord->firstChain + flowerRecord->chainNumber; i++) {
+            SnapshotChain *chain = &(snapshot->chains[i]);
+            int64_t k = 0;
+            for (int64_t j = chain->firstBlock; j < chain->firstBlock + chain->blockNumber; j++) {
+                k += snapshot->blocks[snapshot->chainBlocks[j]].length;
+            }
+            if (chain->blockNumber >= minNumberOfBlocksInChain) {
+                intListAppend(blockNumbers, chain->blockNumber);
+                intListAppend(baseBlockLengths, k);
+                intListAppend(linkNumbers, chain->linkNumber);
+                intListAppend(avgInstanceBaseLengths, chain->averageInstanceBaseLength);
+                l++;
+            }
+        }
+        intListAppend(counts, l);
+    }
+}
+
+static void reportChainStatsFromSnapshot(CactusSnapshot *snapshot, int64_t minNumberOfBlocksInChain,
+        FILE *fileHandle) {
+    struct IntList *counts = constructEmptyIntList(0);
+    struct IntList *blockNumbers = constructEmptyIntList(0);
+    struct IntList *baseBlockLengths = constructEmptyIntList(0);
+    struct IntList *linkNumbers = constructEmptyIntList(0);
+    struct IntList *avgInstanceBaseLengths = constructEmptyIntList(0);
+    chainStatsFromSnapshot(snapshot, 0, counts, blockNumbers, baseBlockLengths, linkNumbers,
+            avgInstanceBaseLengths, minNumberOfBlocksInChain);
+    printChainStats(counts, blockNumbers, baseBlockLengths, linkNumbers,
+            avgInstanceBaseLengths, minNumberOfBlocksInChain, fileHandle);
+}
+
+static void terminalFlowerSizesFromSnapshot(CactusSnapshot *snapshot, int64_t flower, struct IntList *sizes) {
+    /*
+     * As terminalFlowerSizes.
+     */
+    SnapshotFlower *flowerRecord = &(snapshot->flowers[flower]);
+    if (flowerRecord->isTerminal) {
+        intListAppend(sizes, flowerRecord->totalBaseLength);
+    } else {
+        for (int64_t i = flowerRecord->firstGroup; i < flowerRecord->firstGroup + flowerRecord->groupNumber; i++) {
+            if (snapshot->groups[i].nestedFlower != -1) {
+                terminalFlowerSizesFromSnapshot(snapshot, snapshot->groups[i].nestedFlower, sizes);
+            }
+        }
+    }
+}
+
+static int64_t endDegreeFromSnapshot(CactusSnapshot *snapshot, SnapshotEnd *end) {
+    /*
+     * As endDegree.
+     */
+    int64_t *ends = st_malloc(sizeof(int64_t) * (end->capNumber + 1));
+    int64_t endNumber = 0;
+    for (int64_t i = end->firstCap; i < end->firstCap + end->capNumber; i++) {
+        if (snapshot->caps[i].adjacency != -1) {
+            int64_t adjacentEnd = snapshot->caps[snapshot->caps[i].adjacency].end;
+            int64_t j = 0;
+            while (j < endNumber && ends[j] != adjacentEnd) {
+                j++;
+            }
+            if (j == endNumber) {
+                ends[endNumber++] = adjacentEnd;
+            }
+        }
+    }
+    free(ends);
+    return endNumber;
+}
+
+static int64_t netStatsFromSnapshot(CactusSnapshot *snapshot, int64_t flower,
+        stList *totalEndNumbersPerTerminalGroup,
+        stList *totalNonFreeStubEndNumbersPerTerminalGroup,
+        struct List *endDegrees, stList *totalGroupsPerNet) {
+    /*
+     * As netStats.
+     */
+    SnapshotFlower *flowerRecord = &(snapshot->flowers[flower]);
+    if (flowerRecord->isTerminal) {
+        stList_append(totalEndNumbersPerTerminalGroup,
+                stIntTuple_construct1(flowerRecord->endNumber));
+        stList_append(totalNonFreeStubEndNumbersPerTerminalGroup,
+                stIntTuple_construct1(flowerRecord->endNumber - flowerRecord->freeStubEndNumber));
+        int64_t endConnectivity = 0;
+        for (int64_t i = flowerRecord->firstEnd; i < flowerRecord->firstEnd + flowerRecord->endNumber; i++) {
+            endConnectivity += endDegreeFromSnapshot(snapshot, &(snapshot->ends[i]));
+        }
+        listAppend(endDegrees,
+                constructFloat((0.0 + endConnectivity) / flowerRecord->endNumber));
+        return 1;
+    } else {
+        int64_t totalGroups = 0;
+        for (int64_t i = flowerRecord->firstGroup; i < flowerRecord->firstGroup + flowerRecord->groupNumber; i++) {
+            if (snapshot->groups[i].nestedFlower != -1) {
+                totalGroups += netStatsFromSnapshot(snapshot, snapshot->groups[i].nestedFlower,
+                        totalEndNumbersPerTerminalGroup,
+                        totalNonFreeStubEndNumbersPerTerminalGroup, endDegrees,
+                        totalGroupsPerNet);
+            }
+        }
+        if (flowerRecord->parentGroup != -1 && snapshot->groups[flowerRecord->parentGroup].isTangle) {
+            return totalGroups;
+        }
+        stList_append(totalGroupsPerNet, stIntTuple_construct1(totalGroups));
+        return 0;
+    }
+}
+
+static void reportNetStatsFromSnapshot(CactusSnapshot *snapshot, FILE *fileHandle) {
+    stList *totalEndNumbersPerTerminalGroup = stList_construct3(0,
+            (void(*)(void *)) stIntTuple_destruct);
+    stList *totalNonFreeStubEndNumbersPerTerminalGroup = stList_construct3(0,
+            (void(*)(void *)) stIntTuple_destruct);
+    struct List *endDegrees = constructEmptyList(0, free);
+    stList *totalGroupsPerNet = stList_construct3(0,
+            (void(*)(void *)) stIntTuple_destruct);
+    netStatsFromSnapshot(snapshot, 0, totalEndNumbersPerTerminalGroup,
+            totalNonFreeStubEndNumbersPerTerminalGroup, endDegrees,
+            totalGroupsPerNet);
+    printNetStats(totalEndNumbersPerTerminalGroup,
+            totalNonFreeStubEndNumbersPerTerminalGroup, endDegrees,
+            totalGroupsPerNet, fileHandle);
+}
+
+static void faceStatsFromSnapshot(CactusSnapshot *snapshot, int64_t flower,
+        struct IntList *cardinality, struct IntList *isSimple,
+        struct IntList *isRegular, struct IntList *isCanonical,
+        int64_t includeLinkGroups, int64_t includeTangleGroups) {
+    /*
+     * As faceStats.
+     */
+    SnapshotFlower *flowerRecord = &(snapshot->flowers[flower]);
+    if (flowerRecord->isTerminal) {
+        if (flowerRecord->parentGroup != -1) {
+            SnapshotGroup *group = &(snapshot->groups[flowerRecord->parentGroup]);
+            if ((includeLinkGroups && group->isLink)
+                    || (includeTangleGroups && !group->isLink)) {
+                for (int64_t i = flowerRecord->firstFace; i < flowerRecord->firstFace + flowerRecord->faceNumber; i++) {
+                    intListAppend(cardinality, snapshot->faces[i].cardinal);
+                    intListAppend(isSimple, snapshot->faces[i].isSimple);
+                    intListAppend(isRegular, snapshot->faces[i].isRegular);
+                    intListAppend(isCanonical, snapshot->faces[i].isCanonical);
+                }
+            }
+        }
+    } else {
+        for (int64_t i = flowerRecord->firstGroup; i < flowerRecord->firstGroup + flowerRecord->groupNumber; i++) {
+            if (snapshot->groups[i].nestedFlower != -1) {
+                faceStatsFromSnapshot(snapshot, snapshot->groups[i].nestedFlower,
+                        cardinality, isSimple, isRegular, isCanonical,
+                        includeLinkGroups, includeTangleGroups);
+            }
+        }
+    }
+}
+
+static void reportFaceStatsFromSnapshot(CactusSnapshot *snapshot, int64_t includeLinkGroups,
+        int64_t includeTangleGroups, FILE *fileHandle) {
+    struct IntList *numberPerGroup = constructEmptyIntList(0);
+    struct IntList *cardinality = constructEmptyIntList(0);
+    struct IntList *isSimple = constructEmptyIntList(0);
+    struct IntList *isRegular = constructEmptyIntList(0);
+    struct IntList *isCanonical = constructEmptyIntList(0);
+    struct IntList *facesPerFaceAssociatedEnd = constructEmptyIntList(0);
+    faceStatsFromSnapshot(snapshot, 0, cardinality, isSimple, isRegular,
+            isCanonical, includeLinkGroups, includeTangleGroups);
+    printFaceStats(numberPerGroup, cardinality, isSimple, isRegular,
+            isCanonical, facesPerFaceAssociatedEnd, includeLinkGroups,
+            includeTangleGroups, fileHandle);
+}
+
+static void reportReferenceStatsFromSnapshotP(CactusSnapshot *snapshot, int64_t cap, stList *adjacencyWeights) {
+    /*
+     * As reportReferenceStatsP.
+     */
+    SnapshotEnd *end = &(snapshot->ends[snapshot->caps[cap].end]);
+    int64_t adjacentEnd = snapshot->caps[snapshot->caps[cap].adjacency].end;
+    int64_t i = 0;
+    for (int64_t j = end->firstCap; j < end->firstCap + end->capNumber; j++) {
+        if (snapshot->caps[j].adjacency != -1
+                && snapshot->caps[snapshot->caps[j].adjacency].end == adjacentEnd) {
+            i++;
+        }
+    }
+    assert(i > 0);
+    stList_append(adjacencyWeights, stIntTuple_construct1(i - 1));
+}
+
+static void reportReferenceStatsForSnapshotThread(CactusSnapshot *snapshot, int64_t startCap, stList *adjacencyWeights) {
+    /*
+     * As reportReferenceStatsForThread, stepping as a cap cursor does. The caps are stored in
+     * positive orientation, which has the same adjacencies, segments and levels.
+     */
+    int64_t cap = startCap;
+    while (1) {
+        //Down to the lowest level 3' cap, then across its adjacency to the 5' cap
+        while (snapshot->caps[cap].nestedCap != -1) {
+            cap = snapshot->caps[cap].nestedCap;
+        }
+        cap = snapshot->caps[cap].adjacency;
+        reportReferenceStatsFromSnapshotP(snapshot, cap, adjacencyWeights);
+        //Up to the highest level 5' cap, a block end or in the top level flower
+        while (snapshot->ends[snapshot->caps[cap].end].block == -1 && snapshot->caps[cap].parentCap != -1) {
+            cap = snapshot->caps[cap].parentCap;
+        }
+        int64_t segment = snapshot->caps[cap].segment;
+        if (segment == -1) {
+            return;
+        }
+        cap = snapshot->segments[segment].cap5 == cap ? snapshot->segments[segment].cap3 : snapshot->segments[segment].cap5;
+    }
+}
+
+static void reportReferenceStatsForSnapshotThreadP(int64_t item, FILE *output, ReferenceThreadStats *referenceThreadStats) {
+    stList *adjacencyWeights = stList_construct3(0, (void(*)(void *)) stIntTuple_destruct);
+    reportReferenceStatsForSnapshotThread(referenceThreadStats->snapshot,
+            stIntTuple_get(stList_get(referenceThreadStats->startCaps, item), 0), adjacencyWeights);
+    writeAdjacencyWeights(adjacencyWeights, output);
+    stList_destruct(adjacencyWeights);
+}
+
+static void reportReferenceStatsFromSnapshot(CactusSnapshot *snapshot, const char *referenceEventString,
+        FILE *fileHandle, int64_t workerNumber) {
+    /*
+     * As reportReferenceStats. The snapshot is mapped shared, so the workers read the same pages.
+     */
+    assert(referenceEventString != NULL);
+    Name referenceEventName = cactusSnapshot_getEventByHeader(snapshot, referenceEventString);
+    if (referenceEventName == NULL_NAME) {
+        st_logDebug("No reference event found for reference string %s, so no reporting reference stats\n", referenceEventString);
+        return;
+    }
+
+    stList *adjacencyWeights = stList_construct3(0,
+            (void(*)(void *)) stIntTuple_destruct);
+
+    stList *startCaps = cactusSnapshot_getThreadStarts(snapshot, referenceEventName);
+    if (workerNumber <= 1) {
+        for (int64_t i = 0; i < stList_length(startCaps); i++) {
+            reportReferenceStatsForSnapshotThread(snapshot, stIntTuple_get(stList_get(startCaps, i), 0), adjacencyWeights);
+        }
+    } else if (stList_length(startCaps) > 0) {
+        ReferenceThreadStats referenceThreadStats = { startCaps, NULL, snapshot, adjacencyWeights };
+        parallelOrderedMap(stList_length(startCaps), workerNumber, &referenceThreadStats,
+                (void (*)(int64_t, FILE *, void *))reportReferenceStatsForSnapshotThreadP,
+                (void (*)(int64_t, FILE *, int64_t, void *))mergeReferenceStatsForThread);
+    }
+    stList_destruct(startCaps);
+
+    printReferenceStats(adjacencyWeights, fileHandle);
+}
+
+void reportSnapshotStats(char *cactusDiskName, CactusSnapshot *snapshot, const char *referenceEventString,
+        FILE *fileHandle, bool perColumnStats, int64_t workerNumber) {
+    double totalSeqSize = snapshot->flowers[0].totalBaseLength;
+    fprintf(
+            fileHandle,
+            "<stats flower_disk=\"%s\" flower_name=\"%s\" total_sequence_length=\"%f\" >",
+            cactusDiskName,
+            cactusMisc_nameToStringStatic(snapshot->flowers[0].name), totalSeqSize);
+
+    printRelativeEntropyStats(totalSeqSize, calculateTreeBitsFromSnapshot(snapshot, 0, 0.0), fileHandle);
+
+    struct IntList *children = constructEmptyIntList(0);
+    struct IntList *tangleChildren = constructEmptyIntList(0);
+    struct IntList *linkChildren = constructEmptyIntList(0);
+    struct IntList *depths = constructEmptyIntList(0);
+    flowerStatsFromSnapshot(snapshot, 0, 0, children, tangleChildren, linkChildren, depths);
+    printFlowerStats(children, tangleChildren, linkChildren, depths, fileHandle);
+
+    reportBlockStatsFromSnapshot(snapshot, fileHandle, 0, perColumnStats);
+    reportBlockStatsFromSnapshot(snapshot, fileHandle, 2, perColumnStats);
+
+    reportChainStatsFromSnapshot(snapshot, 0, fileHandle);
+    reportChainStatsFromSnapshot(snapshot, 2, fileHandle);
+
+    struct IntList *sizes = constructEmptyIntList(0);
+    terminalFlowerSizesFromSnapshot(snapshot, 0, sizes);
+    tabulateAndPrintIntValues(sizes, "terminal_group_sizes", fileHandle);
+    destructIntList(sizes);
+
+    reportNetStatsFromSnapshot(snapshot, fileHandle);
+
+    reportFaceStatsFromSnapshot(snapshot, 1, 1, fileHandle);
+    reportFaceStatsFromSnapshot(snapshot, 0, 1, fileHandle);
+    reportFaceStatsFromSnapshot(snapshot, 1, 0, fileHandle);
+
+    reportReferenceStatsFromSnapshot(snapshot, referenceEventString, fileHandle, workerNumber);
+
+    printClosingTag("stats", fileHandle);
+}
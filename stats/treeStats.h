@@ -19,6 +19,19 @@
  */
 void reportCactusDiskStats(char *cactusDiskName, Flower *flower, const char *referenceEventString,
         FILE *fileHandle, bool perColumnStats);
+
+/*
+ * As reportCactusDiskStats, sharing the reference threads between workerNumber worker processes.
+ */
+void reportCactusDiskStats2(char *cactusDiskName, Flower *flower, const char *referenceEventString,
+        FILE *fileHandle, bool perColumnStats, int64_t workerNumber);
+/*
+ * As reportCactusDiskStats2, for the top level flower of a snapshot, without the database.
+ * The stats are those of the flower the snapshot was written from, if it has no parent.
+ */
+void reportSnapshotStats(char *cactusDiskName, CactusSnapshot *snapshot, const char *referenceEventString,
+        FILE *fileHandle, bool perColumnStats, int64_t workerNumber);
+
 /*
  * Writes stats about blocks, including only those blocks for which include block is true.
  */
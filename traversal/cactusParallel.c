@@ -0,0 +1,159 @@
+/*
+ * cactusParallel.c
+ *
+ *  Created on: 17 Oct 2026
+ */
+
+/*
+ * Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#define _GNU_SOURCE //For fork, waitpid and anonymous shared mappings under -std=c99
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "cactus.h"
+#include "sonLib.h"
+#include "cactusParallel.h"
+
+////////////////////////////////////
+////////////////////////////////////
+//Ordered parallel map over forked workers
+////////////////////////////////////
+////////////////////////////////////
+
+static char *workerDatabaseString = NULL;
+static bool inParallelWorker = 0;
+static CactusDisk *workerCactusDisk = NULL; //Opened by a worker on its first sequence fetch
+
+typedef struct _parallelItem {
+    int64_t worker;
+    int64_t offset; //Of the item's output in the worker's file
+    int64_t length;
+} ParallelItem;
+
+typedef struct _parallelState { //Lives in memory shared with the workers
+    int64_t nextItem;
+    ParallelItem items[];
+} ParallelState;
+
+static void runParallelWorker(ParallelState *state, int64_t itemNumber, int64_t worker, FILE *output,
+        void *extraArg, void (*mapFn)(int64_t item, FILE *output, void *extraArg)) {
+    inParallelWorker = 1;
+    int64_t item;
+    while ((item = __sync_fetch_and_add(&state->nextItem, 1)) < itemNumber) {
+        ParallelItem *parallelItem = &state->items[item];
+        parallelItem->worker = worker;
+        parallelItem->offset = ftell(output);
+        mapFn(item, output, extraArg);
+        parallelItem->length = ftell(output) - parallelItem->offset;
+    }
+    if (fflush(output) != 0) {
+        _exit(EXIT_FAILURE);
+    }
+    _exit(EXIT_SUCCESS); //Skips the exit handlers and stdio buffers inherited from the parent
+}
+
+void parallelOrderedMap(int64_t itemNumber, int64_t workerNumber, void *extraArg,
+        void (*mapFn)(int64_t item, FILE *output, void *extraArg),
+        void (*mergeFn)(int64_t item, FILE *input, int64_t length, void *extraArg)) {
+    if (workerNumber > itemNumber) {
+        workerNumber = itemNumber;
+    }
+    if (workerNumber <= 1) {
+        FILE *output = tmpfile();
+        if (output == NULL) {
+            st_errAbort("Could not create a temporary file for the parallel output\n");
+        }
+        for (int64_t item = 0; item < itemNumber; item++) {
+            rewind(output);
+            mapFn(item, output, extraArg);
+            int64_t length = ftell(output);
+            rewind(output);
+            mergeFn(item, output, length, extraArg);
+        }
+        fclose(output);
+        return;
+    }
+    size_t stateSize = sizeof(ParallelState) + sizeof(ParallelItem) * itemNumber;
+    ParallelState *state = mmap(NULL, stateSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (state == MAP_FAILED) {
+        st_errAbort("Could not map %" PRIi64 " bytes of shared memory for the parallel map\n", (int64_t) stateSize);
+    }
+    state->nextItem = 0;
+    FILE **outputs = st_malloc(sizeof(FILE *) * workerNumber);
+    pid_t *pids = st_malloc(sizeof(pid_t) * workerNumber);
+    fflush(NULL); //Else buffered output would be written by every worker too
+    for (int64_t i = 0; i < workerNumber; i++) {
+        if ((outputs[i] = tmpfile()) == NULL) {
+            st_errAbort("Could not create a temporary file for the parallel output\n");
+        }
+        if ((pids[i] = fork()) < 0) {
+            st_errAbort("Could not fork parallel worker %" PRIi64 "\n", i);
+        }
+        if (pids[i] == 0) {
+            runParallelWorker(state, itemNumber, i, outputs[i], extraArg, mapFn);
+        }
+    }
+    for (int64_t i = 0; i < workerNumber; i++) {
+        int status;
+        if (waitpid(pids[i], &status, 0) != pids[i] || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            st_errAbort("Parallel worker %" PRIi64 " failed\n", i);
+        }
+    }
+    assert(state->nextItem >= itemNumber);
+    for (int64_t item = 0; item < itemNumber; item++) {
+        ParallelItem *parallelItem = &state->items[item];
+        FILE *input = outputs[parallelItem->worker];
+        if (fseek(input, parallelItem->offset, SEEK_SET) != 0) {
+            st_errAbort("Could not read back the output of parallel item %" PRIi64 "\n", item);
+        }
+        mergeFn(item, input, parallelItem->length, extraArg);
+    }
+    for (int64_t i = 0; i < workerNumber; i++) {
+        fclose(outputs[i]);
+    }
+    free(outputs);
+    free(pids);
+    munmap(state, stateSize);
+}
+
+void parallelOrderedMap_setDatabaseString(const char *cactusDiskDatabaseString) {
+    free(workerDatabaseString);
+    workerDatabaseString = cactusDiskDatabaseString != NULL ? stString_copy(cactusDiskDatabaseString) : NULL;
+}
+
+char *parallelSequence_getString(Sequence *sequence, int64_t start, int64_t length, int64_t strand) {
+    if (!inParallelWorker) {
+        return sequence_getString(sequence, start, length, strand);
+    }
+    if (workerCactusDisk == NULL) {
+        if (workerDatabaseString == NULL) {
+            st_errAbort("A parallel worker needs a sequence but no database has been set for the workers\n");
+        }
+        workerCactusDisk = cactusDisk_construct(stKVDatabaseConf_constructFromString(workerDatabaseString), 0);
+    }
+    MetaSequence *metaSequence = cactusDisk_getMetaSequence(workerCactusDisk, sequence_getName(sequence));
+    if (metaSequence == NULL) {
+        st_errAbort("A parallel worker could not find sequence %s in the database\n",
+                cactusMisc_nameToStringStatic(sequence_getName(sequence)));
+    }
+    return metaSequence_getString(metaSequence, start, length, strand);
+}
+
+void copyParallelOutput(FILE *input, int64_t length, FILE *output) {
+    char buffer[65536];
+    while (length > 0) {
+        size_t i = fread(buffer, sizeof(char), length < (int64_t) sizeof(buffer) ? length : sizeof(buffer), input);
+        if (i == 0) {
+            st_errAbort("The output of a parallel item was truncated\n");
+        }
+        fwrite(buffer, sizeof(char), i, output);
+        length -= i;
+    }
+}
@@ -0,0 +1,48 @@
+/*
+ * cactusParallel.h
+ *
+ *  Created on: 17 Oct 2026
+ */
+
+#ifndef CACTUS_PARALLEL_H_
+#define CACTUS_PARALLEL_H_
+
+/*
+ * Runs mapFn for items 0 to itemNumber - 1 in workerNumber forked worker processes,
+ * which take the next unclaimed item as they become free. Each worker buffers the output
+ * mapFn writes for an item to its output stream in a temporary file; once all the workers
+ * are done mergeFn is called for each item in item order, with a stream positioned at the
+ * start of that item's output and its length in bytes.
+ *
+ * Workers are processes rather than threads as the cactus API is not thread safe. They
+ * share everything loaded before the call copy-on-write (see prefetchFlowerSubtree), but
+ * changes they make to memory are lost, so results must go through the output streams.
+ * Nor may they use the database connection they inherit, whose requests and replies would
+ * interleave with those of the other workers, so mapFn must only reach flowers loaded
+ * before the call, which callers ensure by prefetching the subtree mapFn walks, and must
+ * get sequence strings with parallelSequence_getString. This is needed for correctness,
+ * not just speed.
+ * With workerNumber <= 1 the items are run in order in the calling process.
+ */
+void parallelOrderedMap(int64_t itemNumber, int64_t workerNumber, void *extraArg,
+        void (*mapFn)(int64_t item, FILE *output, void *extraArg),
+        void (*mergeFn)(int64_t item, FILE *input, int64_t length, void *extraArg));
+
+/*
+ * Sets the database the workers of parallelOrderedMap fetch sequence strings from, given as
+ * for cactusDisk_construct. Each worker opens its own cactus disk on it on its first fetch.
+ */
+void parallelOrderedMap_setDatabaseString(const char *cactusDiskDatabaseString);
+
+/*
+ * As sequence_getString, but in a worker of parallelOrderedMap fetched through the worker's
+ * own cactus disk rather than the connection inherited from the calling process.
+ */
+char *parallelSequence_getString(Sequence *sequence, int64_t start, int64_t length, int64_t strand);
+
+/*
+ * Copies length bytes from input to output, a mergeFn for output that is simply concatenated.
+ */
+void copyParallelOutput(FILE *input, int64_t length, FILE *output);
+
+#endif /* CACTUS_PARALLEL_H_ */
@@ -15,6 +15,8 @@
 #include <ctype.h>
 #include "cactus.h"
 #include "sonLib.h"
+#include "cactusTraversal.h"
+#include "cactusUtils.h"
 
 ////////////////////////////////////
 ////////////////////////////////////
@@ -22,105 +24,587 @@
 ////////////////////////////////////
 ////////////////////////////////////
 
-static Cap *getCapUp(Cap *cap) {
-    /*
-     * Gets the highest level version of a cap.
-     */
-    while (1) {
-        assert(cap != NULL);
-        cap = cap_getSide(cap) ? cap : cap_getReverse(cap);
-        if (end_isBlockEnd(cap_getEnd(cap))) {
-            return cap;
+/*
+ * The cursor keeps the path of flowers from the top level flower down to the current
+ * position, and the versions of the current cap at each level of that path. Moving
+ * from a 3' position to the adjacent 5' position walks up the path, and the caps seen
+ * on the way up are the 5' levels, so they are not looked up again on the way down.
+ */
+
+#define CAP_CURSOR_START 0
+#define CAP_CURSOR_3PRIME 1
+#define CAP_CURSOR_5PRIME 2
+#define CAP_CURSOR_DONE 3
+
+struct _capCursor {
+    Flower **flowers; //flowers[i] is the flower at depth i of the current path, flowers[0] is the top level flower
+    Cap **caps; //caps[i] is the version of the current cap in flowers[i], for top <= i <= bottom
+    int64_t top;
+    int64_t bottom;
+    int64_t maxDepth;
+    int64_t state;
+    Cap *startCap;
+    CapLevelCache *capLevelCache; //If not NULL, positions only hold their highest and lowest levels
+};
+
+/*
+ * The level cache maps a cap name to the highest and lowest level versions of the cap, in a
+ * fixed size ring of entries, the oldest entry being evicted when the ring is full.
+ */
+
+typedef struct _capLevels {
+    Name name; //The key, first so the entry can be hashed through its address
+    Cap *highestCap;
+    Cap *lowestCap;
+} CapLevels;
+
+struct _capLevelCache {
+    CapLevels *entries;
+    int64_t entryNumber;
+    int64_t maxEntryNumber;
+    int64_t nextEntry; //The next to be overwritten once the ring is full
+    stHash *namesToEntries;
+    int64_t hits;
+    int64_t misses;
+};
+
+static uint64_t capLevels_hashKey(const void *key) {
+    Name name = *((const Name *) key);
+    return (uint64_t) (name ^ (name >> 32));
+}
+
+static int capLevels_equalKey(const void *key1, const void *key2) {
+    return *((const Name *) key1) == *((const Name *) key2);
+}
+
+CapLevelCache *capLevelCache_construct(int64_t maxEntryNumber) {
+    assert(maxEntryNumber > 0);
+    CapLevelCache *capLevelCache = st_malloc(sizeof(CapLevelCache));
+    capLevelCache->entries = st_malloc(sizeof(CapLevels) * maxEntryNumber);
+    capLevelCache->entryNumber = 0;
+    capLevelCache->maxEntryNumber = maxEntryNumber;
+    capLevelCache->nextEntry = 0;
+    capLevelCache->namesToEntries = stHash_construct3(capLevels_hashKey, capLevels_equalKey, NULL, NULL);
+    capLevelCache->hits = 0;
+    capLevelCache->misses = 0;
+    return capLevelCache;
+}
+
+void capLevelCache_destruct(CapLevelCache *capLevelCache) {
+    st_logDebug("Cap level cache: %" PRIi64 " hits, %" PRIi64 " misses\n", capLevelCache->hits, capLevelCache->misses);
+    stHash_destruct(capLevelCache->namesToEntries);
+    free(capLevelCache->entries);
+    free(capLevelCache);
+}
+
+static CapLevels *capLevelCache_get(CapLevelCache *capLevelCache, Cap *cap) {
+    Name name = cap_getName(cap);
+    CapLevels *capLevels = stHash_search(capLevelCache->namesToEntries, &name);
+    if (capLevels != NULL) {
+        capLevelCache->hits++;
+    } else {
+        capLevelCache->misses++;
+    }
+    return capLevels;
+}
+
+static void capLevelCache_add(CapLevelCache *capLevelCache, Cap *highestCap, Cap *lowestCap) {
+    CapLevels *capLevels;
+    if (capLevelCache->entryNumber < capLevelCache->maxEntryNumber) {
+        capLevels = &capLevelCache->entries[capLevelCache->entryNumber++];
+    } else { //Evict the oldest entry
+        capLevels = &capLevelCache->entries[capLevelCache->nextEntry];
+        capLevelCache->nextEntry = (capLevelCache->nextEntry + 1) % capLevelCache->maxEntryNumber;
+        stHash_remove(capLevelCache->namesToEntries, &capLevels->name);
+    }
+    capLevels->name = cap_getName(highestCap);
+    capLevels->highestCap = highestCap;
+    capLevels->lowestCap = lowestCap;
+    stHash_insert(capLevelCache->namesToEntries, &capLevels->name, capLevels);
+}
+
+static void capCursor_setHighestAndLowest(CapCursor *capCursor, Cap *highestCap, Cap *lowestCap, bool side) {
+    capCursor->top = 0;
+    capCursor->caps[0] = cap_getSide(highestCap) == side ? highestCap : cap_getReverse(highestCap);
+    if (end_getFlower(cap_getEnd(highestCap)) == end_getFlower(cap_getEnd(lowestCap))) {
+        capCursor->bottom = 0;
+    } else {
+        capCursor->bottom = 1;
+        capCursor->caps[1] = cap_getSide(lowestCap) == side ? lowestCap : cap_getReverse(lowestCap);
+    }
+}
+
+static void capCursor_descendCached(CapCursor *capCursor, Cap *cap) {
+    CapLevels *capLevels = capLevelCache_get(capCursor->capLevelCache, cap);
+    Cap *lowestCap;
+    if (capLevels != NULL) {
+        lowestCap = capLevels->lowestCap;
+    } else {
+        Flower *nestedFlower;
+        lowestCap = cap;
+        while ((nestedFlower = getNestedFlower(end_getGroup(cap_getEnd(lowestCap)))) != NULL) {
+            lowestCap = flower_getCap(nestedFlower, cap_getName(lowestCap));
+            assert(lowestCap != NULL);
         }
-        Group *parentGroup = flower_getParentGroup(
-                end_getFlower(cap_getEnd(cap)));
-        if (parentGroup == NULL) {
-            return cap;
+        capLevelCache_add(capCursor->capLevelCache, cap, lowestCap);
+    }
+    capCursor_setHighestAndLowest(capCursor, cap, lowestCap, 0);
+}
+
+static void capCursor_ascendCached(CapCursor *capCursor, Cap *cap, bool side) {
+    CapLevels *capLevels = capLevelCache_get(capCursor->capLevelCache, cap);
+    Cap *highestCap;
+    if (capLevels != NULL) {
+        highestCap = capLevels->highestCap;
+    } else {
+        highestCap = cap;
+        Group *parentGroup;
+        while (!end_isBlockEnd(cap_getEnd(highestCap))
+                && (parentGroup = flower_getParentGroup(end_getFlower(cap_getEnd(highestCap)))) != NULL) {
+            highestCap = flower_getCap(group_getFlower(parentGroup), cap_getName(highestCap));
+            assert(highestCap != NULL);
+        }
+        capLevelCache_add(capCursor->capLevelCache, highestCap, cap);
+    }
+    capCursor_setHighestAndLowest(capCursor, highestCap, cap, side);
+}
+
+static void capCursor_ensureDepth(CapCursor *capCursor, int64_t depth) {
+    if (depth >= capCursor->maxDepth) {
+        int64_t maxDepth = capCursor->maxDepth * 2 > depth ? capCursor->maxDepth * 2 : depth + 1;
+        capCursor->flowers = realloc(capCursor->flowers, sizeof(Flower *) * maxDepth);
+        capCursor->caps = realloc(capCursor->caps, sizeof(Cap *) * maxDepth);
+        if (capCursor->flowers == NULL || capCursor->caps == NULL) {
+            st_errAbort("Ran out of memory growing a cap cursor to depth %" PRIi64 "\n", depth);
         }
-        cap = flower_getCap(group_getFlower(parentGroup), cap_getName(cap));
+        capCursor->maxDepth = maxDepth;
     }
 }
 
-static stList *getCapsDown(Cap *cap, bool side) {
+static void capCursor_descend(CapCursor *capCursor, Cap *cap, int64_t depth, bool side) {
     /*
-     * Gets a list of a cap in progressively lower level problems, such that
-     * the first member of the return list will be the given cap, and the last member
-     * will be the lowest level version of the cap.
+     * Sets the levels from depth down to the lowest level version of the cap, each oriented
+     * on the given side.
      */
-    stList *caps = stList_construct();
     assert(end_isAttached(cap_getEnd(cap)) || end_isBlockEnd(cap_getEnd(cap)));
-    if (end_isStubEnd(cap_getEnd(cap))) {
-        assert(flower_getParentGroup(end_getFlower(cap_getEnd(cap))) == NULL);
-    }
+    capCursor->top = depth;
     while (1) {
-        stList_append(caps,
-                cap_getSide(cap) == side ? cap : cap_getReverse(cap));
+        capCursor->caps[depth] = cap_getSide(cap) == side ? cap : cap_getReverse(cap);
         assert(end_getGroup(cap_getEnd(cap)) != NULL);
-        Flower *nestedFlower = group_getNestedFlower(
-                end_getGroup(cap_getEnd(cap)));
-        if (nestedFlower != NULL) {
-            assert(
-                    flower_getEnd(nestedFlower, end_getName(cap_getEnd(cap)))
-                            != NULL);
-            cap = flower_getCap(nestedFlower, cap_getName(cap));
-            assert(cap != NULL);
-        } else {
+        Flower *nestedFlower = getNestedFlower(end_getGroup(cap_getEnd(cap)));
+        if (nestedFlower == NULL) {
             break;
         }
+        assert(flower_getEnd(nestedFlower, end_getName(cap_getEnd(cap))) != NULL);
+        cap = flower_getCap(nestedFlower, cap_getName(cap));
+        assert(cap != NULL);
+        capCursor_ensureDepth(capCursor, ++depth);
+        capCursor->flowers[depth] = nestedFlower;
     }
-    return caps;
+    capCursor->bottom = depth;
 }
 
-void traverseCapsInSequenceOrderFrom3PrimeCap(Cap *cap, void *extraArg,
-        void(*_3PrimeFn)(stList *caps, void *extraArg),
-        void(*_5PrimeFn)(stList *caps, void *extraArg)) {
+static void capCursor_ascend(CapCursor *capCursor, Cap *cap, bool side) {
+    /*
+     * Sets the levels from the lowest level (the current bottom) up to the highest level
+     * version of the cap, which is the first block end or the top level stub end, each
+     * oriented on the given side.
+     */
+    int64_t depth = capCursor->bottom;
+    while (1) {
+        assert(cap != NULL);
+        cap = cap_getSide(cap) == side ? cap : cap_getReverse(cap);
+        capCursor->caps[depth] = cap;
+        if (end_isBlockEnd(cap_getEnd(cap)) || depth == 0) {
+            break;
+        }
+        assert(end_getFlower(cap_getEnd(cap)) == capCursor->flowers[depth]);
+        cap = flower_getCap(capCursor->flowers[--depth], cap_getName(cap));
+    }
+    assert(depth > 0 || flower_getParentGroup(end_getFlower(cap_getEnd(cap))) == NULL);
+    capCursor->top = depth;
+}
+
+CapCursor *capCursor_construct(Cap *cap) {
+    CapCursor *capCursor = st_malloc(sizeof(CapCursor));
+    capCursor->maxDepth = 16;
+    capCursor->flowers = st_malloc(sizeof(Flower *) * capCursor->maxDepth);
+    capCursor->caps = st_malloc(sizeof(Cap *) * capCursor->maxDepth);
+    capCursor->capLevelCache = NULL;
+    capCursor_reset(capCursor, cap);
+    return capCursor;
+}
+
+CapCursor *capCursor_constructAt(Cap *cap) {
+    return capCursor_constructAt2(cap, NULL);
+}
+
+CapCursor *capCursor_constructAt2(Cap *cap, CapLevelCache *capLevelCache) {
+    CapCursor *capCursor = st_malloc(sizeof(CapCursor));
+    capCursor->maxDepth = 16;
+    capCursor->flowers = st_malloc(sizeof(Flower *) * capCursor->maxDepth);
+    capCursor->caps = st_malloc(sizeof(Cap *) * capCursor->maxDepth);
+    capCursor->capLevelCache = capLevelCache;
+    capCursor_resetAt(capCursor, cap);
+    return capCursor;
+}
+
+void capCursor_reset(CapCursor *capCursor, Cap *cap) {
     assert(end_isStubEnd(cap_getEnd(cap)));
     assert(end_isAttached(cap_getEnd(cap)));
     assert(flower_getParentGroup(end_getFlower(cap_getEnd(cap))) == NULL);
-    while (1) {
-        //Call 3' function
-        stList *caps = getCapsDown(cap, 0);
-        if (_3PrimeFn != NULL) {
-            _3PrimeFn(caps, extraArg);
+    assert(!cap_getSide(cap));
+    capCursor->startCap = cap;
+    capCursor->state = CAP_CURSOR_START;
+    capCursor->top = 0;
+    capCursor->bottom = -1;
+}
+
+void capCursor_resetAt(CapCursor *capCursor, Cap *cap) {
+    assert(!cap_getSide(cap));
+    assert(group_isLeaf(end_getGroup(cap_getEnd(cap))));
+    //The path of flowers from the top level flower down to the flower of the cap
+    Flower *flower = end_getFlower(cap_getEnd(cap));
+    int64_t depth = 0;
+    for (Group *group = flower_getParentGroup(flower); group != NULL; group = flower_getParentGroup(group_getFlower(group))) {
+        depth++;
+    }
+    capCursor_ensureDepth(capCursor, depth);
+    for (int64_t i = depth; i >= 0; i--) {
+        capCursor->flowers[i] = flower;
+        if (i > 0) {
+            flower = group_getFlower(flower_getParentGroup(flower));
         }
-        //Get the adjacent 5 prime cap
-        assert(group_isLeaf(end_getGroup(cap_getEnd(stList_peek(caps)))));
-        cap = getCapUp(cap_getAdjacency(stList_peek(caps)));
-        stList_destruct(caps);
-        //Now call 5' function
-        caps = getCapsDown(cap, 1);
-        if (_5PrimeFn != NULL) {
-            _5PrimeFn(caps, extraArg);
+    }
+    capCursor->startCap = NULL;
+    capCursor->bottom = depth;
+    if (capCursor->capLevelCache != NULL) {
+        capCursor_ascendCached(capCursor, cap, 0);
+    } else {
+        capCursor_ascend(capCursor, cap, 0);
+    }
+    capCursor->state = CAP_CURSOR_3PRIME;
+}
+
+void capCursor_setLevelCache(CapCursor *capCursor, CapLevelCache *capLevelCache) {
+    assert(capCursor->state == CAP_CURSOR_START);
+    capCursor->capLevelCache = capLevelCache;
+}
+
+void capCursor_destruct(CapCursor *capCursor) {
+    free(capCursor->flowers);
+    free(capCursor->caps);
+    free(capCursor);
+}
+
+Cap *capCursor_next(CapCursor *capCursor) {
+    switch (capCursor->state) {
+        case CAP_CURSOR_START:
+            capCursor->flowers[0] = end_getFlower(cap_getEnd(capCursor->startCap));
+            if (capCursor->capLevelCache != NULL) {
+                capCursor_descendCached(capCursor, capCursor->startCap);
+            } else {
+                capCursor_descend(capCursor, capCursor->startCap, 0, 0);
+            }
+            capCursor->state = CAP_CURSOR_3PRIME;
+            break;
+        case CAP_CURSOR_3PRIME: //Get the adjacent 5 prime cap
+            assert(group_isLeaf(end_getGroup(cap_getEnd(capCursor->caps[capCursor->bottom]))));
+            if (capCursor->capLevelCache != NULL) {
+                capCursor_ascendCached(capCursor, cap_getAdjacency(capCursor->caps[capCursor->bottom]), 1);
+            } else {
+                capCursor_ascend(capCursor, cap_getAdjacency(capCursor->caps[capCursor->bottom]), 1);
+            }
+            capCursor->state = CAP_CURSOR_5PRIME;
+            break;
+        case CAP_CURSOR_5PRIME: {
+            Cap *cap = capCursor->caps[capCursor->top];
+            if (cap_getSegment(cap) == NULL) {
+                assert(end_isStubEnd(cap_getEnd(cap)));
+                assert(end_isAttached(cap_getEnd(cap)));
+                assert(capCursor->top == 0);
+                capCursor->state = CAP_CURSOR_DONE;
+                return NULL;
+            }
+            //Get the opposite 3 prime cap.
+            if (capCursor->capLevelCache != NULL) {
+                capCursor_descendCached(capCursor, cap_getOtherSegmentCap(cap));
+            } else {
+                capCursor_descend(capCursor, cap_getOtherSegmentCap(cap), capCursor->top, 0);
+            }
+            capCursor->state = CAP_CURSOR_3PRIME;
+            break;
         }
-        stList_destruct(caps);
-        if (cap_getSegment(cap) != NULL) { //Get the opposite 3 prime cap.
-            cap = cap_getOtherSegmentCap(cap);
-            assert(cap != NULL);
+        default:
+            return NULL;
+    }
+    return capCursor->caps[capCursor->top];
+}
+
+bool capCursor_is5Prime(CapCursor *capCursor) {
+    return capCursor->state == CAP_CURSOR_5PRIME;
+}
+
+Cap **capCursor_getLevels(CapCursor *capCursor, int64_t *levelNumber) {
+    assert(capCursor->state == CAP_CURSOR_3PRIME || capCursor->state == CAP_CURSOR_5PRIME);
+    *levelNumber = capCursor->bottom - capCursor->top + 1;
+    return capCursor->caps + capCursor->top;
+}
+
+Cap *capCursor_getLowestCap(CapCursor *capCursor) {
+    assert(capCursor->state == CAP_CURSOR_3PRIME || capCursor->state == CAP_CURSOR_5PRIME);
+    return capCursor->caps[capCursor->bottom];
+}
+
+int64_t capCursor_nextBatch(CapCursor *capCursor, bool side, Cap **highestCaps, Cap **lowestCaps, int64_t maxCaps) {
+    int64_t i = 0;
+    while (i < maxCaps && capCursor_next(capCursor) != NULL) {
+        if (capCursor_is5Prime(capCursor) == side) {
+            if (highestCaps != NULL) {
+                highestCaps[i] = capCursor->caps[capCursor->top];
+            }
+            if (lowestCaps != NULL) {
+                lowestCaps[i] = capCursor->caps[capCursor->bottom];
+            }
+            i++;
+        }
+    }
+    return i;
+}
+
+static void callWithLevels(CapCursor *capCursor, stList *caps, void *extraArg,
+        void(*fn)(stList *caps, void *extraArg)) {
+    while (stList_length(caps) > 0) { //Reuse the list's storage between calls
+        stList_pop(caps);
+    }
+    int64_t levelNumber;
+    Cap **levels = capCursor_getLevels(capCursor, &levelNumber);
+    for (int64_t i = 0; i < levelNumber; i++) {
+        stList_append(caps, levels[i]);
+    }
+    fn(caps, extraArg);
+}
+
+void traverseCapsInSequenceOrderFrom3PrimeCap(Cap *cap, void *extraArg,
+        void(*_3PrimeFn)(stList *caps, void *extraArg),
+        void(*_5PrimeFn)(stList *caps, void *extraArg)) {
+    CapCursor *capCursor = capCursor_construct(cap);
+    stList *caps = stList_construct();
+    while (capCursor_next(capCursor) != NULL) {
+        void(*fn)(stList *caps, void *extraArg) = capCursor_is5Prime(capCursor) ? _5PrimeFn : _3PrimeFn;
+        if (fn != NULL) {
+            callWithLevels(capCursor, caps, extraArg, fn);
+        }
+    }
+    stList_destruct(caps);
+    capCursor_destruct(capCursor);
+}
+
+
+////////////////////////////////////
+////////////////////////////////////
+//Lookup of the caps of an end by event
+////////////////////////////////////
+////////////////////////////////////
+
+typedef struct _eventCap {
+    Name eventName;
+    int64_t instance; //Position in the end's instance order, so ties keep that order
+    Cap *cap;
+} EventCap;
+
+struct _endEventIndex {
+    End *end;
+    EventCap *eventCaps; //Sorted by event name, then instance order
+    Cap **caps; //The caps of eventCaps, in the same order
+    int64_t capNumber;
+};
+
+static int eventCap_cmp(const void *a, const void *b) {
+    const EventCap *eventCap1 = a;
+    const EventCap *eventCap2 = b;
+    if (eventCap1->eventName != eventCap2->eventName) {
+        return eventCap1->eventName < eventCap2->eventName ? -1 : 1;
+    }
+    return eventCap1->instance < eventCap2->instance ? -1 : (eventCap1->instance > eventCap2->instance ? 1 : 0);
+}
+
+EndEventIndex *endEventIndex_construct(End *end) {
+    EndEventIndex *endEventIndex = st_malloc(sizeof(EndEventIndex));
+    endEventIndex->end = end;
+    endEventIndex->eventCaps = st_malloc(sizeof(EventCap) * (end_getInstanceNumber(end) + 1));
+    endEventIndex->caps = st_malloc(sizeof(Cap *) * (end_getInstanceNumber(end) + 1));
+    endEventIndex->capNumber = 0;
+    End_InstanceIterator *it = end_getInstanceIterator(end);
+    Cap *cap;
+    while ((cap = end_getNext(it)) != NULL) {
+        EventCap *eventCap = &endEventIndex->eventCaps[endEventIndex->capNumber];
+        eventCap->eventName = event_getName(cap_getEvent(cap));
+        eventCap->instance = endEventIndex->capNumber++;
+        eventCap->cap = cap;
+    }
+    end_destructInstanceIterator(it);
+    qsort(endEventIndex->eventCaps, endEventIndex->capNumber, sizeof(EventCap), eventCap_cmp);
+    for (int64_t i = 0; i < endEventIndex->capNumber; i++) {
+        endEventIndex->caps[i] = endEventIndex->eventCaps[i].cap;
+    }
+    return endEventIndex;
+}
+
+void endEventIndex_destruct(EndEventIndex *endEventIndex) {
+    free(endEventIndex->eventCaps);
+    free(endEventIndex->caps);
+    free(endEventIndex);
+}
+
+End *endEventIndex_getEnd(EndEventIndex *endEventIndex) {
+    return endEventIndex->end;
+}
+
+Cap **endEventIndex_getCaps(EndEventIndex *endEventIndex, Name eventName, int64_t *capNumber) {
+    int64_t min = 0, max = endEventIndex->capNumber; //Binary search for the first cap of the event
+    while (min < max) {
+        int64_t mid = min + (max - min) / 2;
+        if (endEventIndex->eventCaps[mid].eventName < eventName) {
+            min = mid + 1;
         } else {
-            assert(end_isStubEnd(cap_getEnd(cap)));
-            assert(end_isAttached(cap_getEnd(cap)));
-            assert(
-                    flower_getParentGroup(end_getFlower(cap_getEnd(cap)))
-                            == NULL);
-            break;
+            max = mid;
         }
     }
+    int64_t i = min;
+    while (i < endEventIndex->capNumber && endEventIndex->eventCaps[i].eventName == eventName) {
+        i++;
+    }
+    *capNumber = i - min;
+    return endEventIndex->caps + min;
 }
 
+Cap *endEventIndex_getCap(EndEventIndex *endEventIndex, Name eventName) {
+    int64_t capNumber;
+    Cap **caps = endEventIndex_getCaps(endEventIndex, eventName, &capNumber);
+    return capNumber > 0 ? caps[0] : NULL;
+}
 
 Cap *getCapForReferenceEvent(End *end, Name referenceEventName) {
     /*
-     * Get the cap for a given event.
+     * Get the cap for a given event. A single lookup is a scan, anything more should build an
+     * EndEventIndex.
      */
     End_InstanceIterator *it = end_getInstanceIterator(end);
     Cap *cap;
     while ((cap = end_getNext(it)) != NULL) {
         if (event_getName(cap_getEvent(cap)) == referenceEventName) {
-            end_destructInstanceIterator(it);
-            return cap;
+            break;
         }
     }
     end_destructInstanceIterator(it);
-    assert(0);
-    return NULL;
+    return cap;
+}
+
+
+////////////////////////////////////
+////////////////////////////////////
+//Lookup of the caps of a sequence by coordinate
+////////////////////////////////////
+////////////////////////////////////
+
+/*
+ * For each flower searched, the 3' caps of the event (taking the positive strand of each cap)
+ * sorted by sequence name, then coordinate. The arrays are built as the flowers are first searched.
+ */
+
+typedef struct _flowerCoordinates {
+    Cap **caps;
+    int64_t capNumber;
+} FlowerCoordinates;
+
+struct _capCoordinateIndex {
+    Name eventName;
+    stHash *flowersToCoordinates;
+};
+
+static void flowerCoordinates_destruct(FlowerCoordinates *flowerCoordinates) {
+    free(flowerCoordinates->caps);
+    free(flowerCoordinates);
+}
+
+static int capCoordinate_cmp(const void *a, const void *b) {
+    Cap *cap1 = *((Cap **) a);
+    Cap *cap2 = *((Cap **) b);
+    Name name1 = sequence_getName(cap_getSequence(cap1));
+    Name name2 = sequence_getName(cap_getSequence(cap2));
+    if (name1 != name2) {
+        return name1 < name2 ? -1 : 1;
+    }
+    return cap_getCoordinate(cap1) < cap_getCoordinate(cap2) ? -1 : (cap_getCoordinate(cap1) > cap_getCoordinate(cap2) ? 1 : 0);
+}
+
+static FlowerCoordinates *capCoordinateIndex_getFlowerCoordinates(CapCoordinateIndex *capCoordinateIndex, Flower *flower) {
+    FlowerCoordinates *flowerCoordinates = stHash_search(capCoordinateIndex->flowersToCoordinates, flower);
+    if (flowerCoordinates != NULL) {
+        return flowerCoordinates;
+    }
+    flowerCoordinates = st_malloc(sizeof(FlowerCoordinates));
+    flowerCoordinates->caps = st_malloc(sizeof(Cap *) * (flower_getCapNumber(flower) + 1));
+    flowerCoordinates->capNumber = 0;
+    Flower_CapIterator *capIt = flower_getCapIterator(flower);
+    Cap *cap;
+    while ((cap = flower_getNextCap(capIt)) != NULL) {
+        if (cap_getSequence(cap) != NULL && event_getName(cap_getEvent(cap)) == capCoordinateIndex->eventName) {
+            cap = cap_getStrand(cap) ? cap : cap_getReverse(cap);
+            if (!cap_getSide(cap)) {
+                flowerCoordinates->caps[flowerCoordinates->capNumber++] = cap;
+            }
+        }
+    }
+    flower_destructCapIterator(capIt);
+    qsort(flowerCoordinates->caps, flowerCoordinates->capNumber, sizeof(Cap *), capCoordinate_cmp);
+    stHash_insert(capCoordinateIndex->flowersToCoordinates, flower, flowerCoordinates);
+    return flowerCoordinates;
+}
+
+CapCoordinateIndex *capCoordinateIndex_construct(Name eventName) {
+    CapCoordinateIndex *capCoordinateIndex = st_malloc(sizeof(CapCoordinateIndex));
+    capCoordinateIndex->eventName = eventName;
+    capCoordinateIndex->flowersToCoordinates = stHash_construct2(NULL, (void (*)(void *))flowerCoordinates_destruct);
+    return capCoordinateIndex;
+}
+
+void capCoordinateIndex_destruct(CapCoordinateIndex *capCoordinateIndex) {
+    stHash_destruct(capCoordinateIndex->flowersToCoordinates);
+    free(capCoordinateIndex);
+}
+
+Cap *capCoordinateIndex_getCap(CapCoordinateIndex *capCoordinateIndex, Flower *flower, Sequence *sequence, int64_t coordinate) {
+    /*
+     * At each level the cap is the last 3' cap of the sequence before the coordinate. Its
+     * adjacency spans the coordinate, so if the adjacency is in a nested flower the search
+     * carries on there, from the cap's version in the nested flower.
+     */
+    Name sequenceName = sequence_getName(sequence);
+    Cap *cap = NULL;
+    while (1) {
+        FlowerCoordinates *flowerCoordinates = capCoordinateIndex_getFlowerCoordinates(capCoordinateIndex, flower);
+        int64_t min = 0, max = flowerCoordinates->capNumber; //Binary search for the first cap at or after the coordinate
+        while (min < max) {
+            int64_t mid = min + (max - min) / 2;
+            Cap *midCap = flowerCoordinates->caps[mid];
+            Name midName = sequence_getName(cap_getSequence(midCap));
+            if (midName < sequenceName || (midName == sequenceName && cap_getCoordinate(midCap) < coordinate)) {
+                min = mid + 1;
+            } else {
+                max = mid;
+            }
+        }
+        if (min == 0 || sequence_getName(cap_getSequence(flowerCoordinates->caps[min - 1])) != sequenceName) {
+            assert(cap == NULL); //The version of the cap above is always in the nested flower
+            return NULL;
+        }
+        cap = flowerCoordinates->caps[min - 1];
+        Flower *nestedFlower = getNestedFlower(end_getGroup(cap_getEnd(cap)));
+        if (nestedFlower == NULL) {
+            return cap;
+        }
+        flower = nestedFlower;
+    }
 }
@@ -8,10 +8,145 @@
 #ifndef CACTUS_TRAVERSAL_H_
 #define CACTUS_TRAVERSAL_H_
 
+/*
+ * Cursor over the caps of a thread in sequence order, from its top level 3' stub cap.
+ * Each position is a list of levels, the versions of a cap from the highest level flower
+ * it is a block (or top level stub) end in, down to its lowest level flower. Positions
+ * alternate 3' and 5', as for traverseCapsInSequenceOrderFrom3PrimeCap. The cursor
+ * reuses its level stack, so stepping does not allocate once the stack is deep enough.
+ */
+typedef struct _capCursor CapCursor;
+
+/*
+ * Constructs a cursor before the first position of the thread starting at cap, a top
+ * level attached stub cap on its 3' side.
+ */
+CapCursor *capCursor_construct(Cap *cap);
+
+/*
+ * Restarts the cursor on another thread, keeping its level stack.
+ */
+void capCursor_reset(CapCursor *capCursor, Cap *cap);
+
+void capCursor_destruct(CapCursor *capCursor);
+
+/*
+ * Restarts the cursor part way along a thread, at the 3' position whose lowest level cap is
+ * cap, as returned by capCoordinateIndex_getCap, keeping its level stack. The path of flowers
+ * above the cap is found through the parent groups, not by walking the thread.
+ */
+void capCursor_resetAt(CapCursor *capCursor, Cap *cap);
+
+/*
+ * Constructs a cursor as capCursor_resetAt.
+ */
+CapCursor *capCursor_constructAt(Cap *cap);
+
+/*
+ * Bounded cache of the highest and lowest level versions of caps, keyed by cap name, for
+ * cursors that walk the same threads repeatedly. Once maxEntryNumber caps are cached the
+ * oldest is evicted. The cached caps must stay loaded while the cache is in use.
+ */
+typedef struct _capLevelCache CapLevelCache;
+
+/*
+ * The default maximum number of caps cached, a few tens of megabytes.
+ */
+#define CAP_LEVEL_CACHE_SIZE 1048576
+
+CapLevelCache *capLevelCache_construct(int64_t maxEntryNumber);
+
+void capLevelCache_destruct(CapLevelCache *capLevelCache);
+
+/*
+ * Makes the cursor look the levels of its positions up in (and add them to) the cache, NULL
+ * to stop, before its first move. With a cache a position only holds its highest and lowest
+ * levels, which are all capCursor_nextBatch returns.
+ */
+void capCursor_setLevelCache(CapCursor *capCursor, CapLevelCache *capLevelCache);
+
+/*
+ * As capCursor_constructAt, with the cache (may be NULL) set from the start.
+ */
+CapCursor *capCursor_constructAt2(Cap *cap, CapLevelCache *capLevelCache);
+
+/*
+ * Moves to the next position and returns its highest level cap, or NULL at the end of the thread.
+ */
+Cap *capCursor_next(CapCursor *capCursor);
+
+/*
+ * Returns non-zero if the current position is a 5' one.
+ */
+bool capCursor_is5Prime(CapCursor *capCursor);
+
+/*
+ * Returns the levels of the current position, highest first. The array belongs to the
+ * cursor and is only valid until it is moved.
+ */
+Cap **capCursor_getLevels(CapCursor *capCursor, int64_t *levelNumber);
+
+/*
+ * Returns the lowest level cap of the current position.
+ */
+Cap *capCursor_getLowestCap(CapCursor *capCursor);
+
+/*
+ * Moves on until up to maxCaps positions on the given side (non-zero for 5') are passed,
+ * storing their highest and lowest level caps in highestCaps and lowestCaps, either of which
+ * may be NULL. Returns the number stored, which is less than maxCaps only at the end of the thread.
+ */
+int64_t capCursor_nextBatch(CapCursor *capCursor, bool side, Cap **highestCaps, Cap **lowestCaps, int64_t maxCaps);
+
 void traverseCapsInSequenceOrderFrom3PrimeCap(Cap *cap, void *extraArg,
         void(*_3PrimeFn)(stList *caps, void *extraArg),
         void(*_5PrimeFn)(stList *caps, void *extraArg));
 
+/*
+ * Index of the caps of an end by event, a sorted array that is binary searched, for
+ * looking up more than one event in an end.
+ */
+typedef struct _endEventIndex EndEventIndex;
+
+EndEventIndex *endEventIndex_construct(End *end);
+
+void endEventIndex_destruct(EndEventIndex *endEventIndex);
+
+End *endEventIndex_getEnd(EndEventIndex *endEventIndex);
+
+/*
+ * Returns the caps of the event, in the end's instance order, and sets capNumber to their number
+ * (possibly 0). The array belongs to the index.
+ */
+Cap **endEventIndex_getCaps(EndEventIndex *endEventIndex, Name eventName, int64_t *capNumber);
+
+/*
+ * Returns the first cap of the event, in the end's instance order, or NULL if it has none.
+ */
+Cap *endEventIndex_getCap(EndEventIndex *endEventIndex, Name eventName);
+
+/*
+ * Returns the first cap of the end in the given event, or NULL if there is none.
+ */
 Cap *getCapForReferenceEvent(End *end, Name referenceEventName);
 
+/*
+ * Index of the caps of an event by sequence coordinate. Each flower searched has its 3' caps
+ * of the event sorted by sequence and coordinate, once, so a position is found by a binary
+ * search per level of the cactus tree, loading only the flowers on the way down.
+ */
+typedef struct _capCoordinateIndex CapCoordinateIndex;
+
+CapCoordinateIndex *capCoordinateIndex_construct(Name eventName);
+
+void capCoordinateIndex_destruct(CapCoordinateIndex *capCoordinateIndex);
+
+/*
+ * Returns the lowest level 3' cap of the sequence (on its positive strand) that is the last
+ * before the coordinate, searching down from flower, or NULL if the sequence has no such cap
+ * in flower. The next block on the thread from the cap is the first to contain or follow the
+ * coordinate, so a cursor reset there with capCursor_resetAt reaches it first.
+ */
+Cap *capCoordinateIndex_getCap(CapCoordinateIndex *capCoordinateIndex, Flower *flower, Sequence *sequence, int64_t coordinate);
+
 #endif /* CACTUS_TRAVERSAL_H_ */